@@ -29,6 +29,7 @@
 #include <libavutil/pixfmt.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/common.h>
+#include <libavutil/buffer.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -86,6 +87,11 @@ static inline int obe_clip3( int v, int i_min, int i_max )
     return ( (v < i_min) ? i_min : (v > i_max) ? i_max : v );
 }
 
+/* Statistics counters each have a single writer thread and are read without locking by obe_get_stats() */
+#define OBE_STAT_SET( x, v ) __atomic_store_n( &(x), (v), __ATOMIC_RELAXED )
+#define OBE_STAT_ADD( x, v ) OBE_STAT_SET( x, (x) + (v) )
+#define OBE_STAT_GET( x ) __atomic_load_n( &(x), __ATOMIC_RELAXED )
+
 typedef void *hnd_t;
 
 typedef struct
@@ -227,6 +233,8 @@ typedef struct
     int      num_channels;
     int      num_samples;
     int      sample_fmt;
+    /* If set, audio_data points into this shared buffer instead of owning its own allocation */
+    AVBufferRef *buf;
 } obe_audio_frame_t;
 
 enum user_data_types_e
@@ -313,25 +321,134 @@ typedef struct
     uint8_t drop_frame;
 } obe_timecode_t;
 
+/* Number of slots in each kind of queue, must be powers of two. A producer waits whilst the queue it adds to
+ * is full, so these have to cover the longest a stage can hold on to items while it waits for another one.
+ * The mux waits for video whilst the audio queues up behind it, hence the size of the coded frame queues */
+#define OBE_QUEUE_RAW_FRAMES    128
+#define OBE_QUEUE_CODED_FRAMES  16384
+#define OBE_QUEUE_MUXED_DATA    16384
+
+#define OBE_CACHE_LINE 64
+
+typedef struct
+{
+    /* The position which can be written to the slot next, or one past it once the item is there */
+    uint64_t seq;
+    void     *item;
+} obe_queue_slot_t;
+
+/* Bounded lock-free queue with any number of producers and one consumer. The consumer can look at and remove
+ * any of its items. The mutex and condition variables are only used to sleep when there is nothing to do */
 typedef struct
 {
-    void **queue;
-    int  size;
+    uint8_t  pad0[OBE_CACHE_LINE];
+
+    /* Next position a producer takes. Only written by the producers */
+    uint64_t tail;
+    uint8_t  pad1[OBE_CACHE_LINE - sizeof(uint64_t)];
+
+    /* Position of the first item and the number of items from there which the consumer has found.
+     * Only written by the consumer */
+    uint64_t head;
+    int      size;
+    uint8_t  pad2[OBE_CACHE_LINE - sizeof(uint64_t) - sizeof(int)];
+
+    obe_queue_slot_t *ring;
+    int      mask;
+    int      high_water;
+
+    /* Threads holding the mutex with obe_queue_lock(). Adding or removing only takes the mutex to signal whilst
+     * this is non-zero */
+    int      num_waiters;
+    int      closed;
 
     pthread_mutex_t mutex;
     pthread_cond_t  in_cv;
     pthread_cond_t  out_cv;
 } obe_queue_t;
 
+/* Consumer only, i must be less than the size returned by obe_queue_size() */
+static inline void *obe_queue_item( obe_queue_t *queue, int i )
+{
+    return queue->ring[(queue->head + i) & queue->mask].item;
+}
+
+#define OBE_MAX_SLICE_THREADS 8
+
+typedef void (*obe_slice_func_t)( void *ctx, int slice, int num_slices );
+
+/* Small pool of threads which split a job into slices. The calling thread works on slices too */
+typedef struct
+{
+    int num_threads;
+    pthread_t threads[OBE_MAX_SLICE_THREADS];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  start_cv;
+    pthread_cond_t  done_cv;
+
+    /* Current job */
+    obe_slice_func_t func;
+    void *ctx;
+    int  job;
+    int  num_slices;
+    int  next_slice;
+    int  slices_pending;
+    int  cancel;
+} obe_slice_pool_t;
+
+/* Log-linear latency histogram with 16 sub-buckets per power of two (about 6% precision) */
+#define OBE_LATENCY_SUB_BITS 4
+#define OBE_LATENCY_MAX_BITS 40
+#define OBE_LATENCY_BUCKETS  ((OBE_LATENCY_MAX_BITS - OBE_LATENCY_SUB_BITS + 1) << OBE_LATENCY_SUB_BITS)
+
+typedef struct
+{
+    int64_t max;
+    int64_t buckets[OBE_LATENCY_BUCKETS];
+} obe_latency_hist_t;
+
+/* Number of pooled frames allocated per stream */
+#define OBE_POOL_FRAMES_PER_STREAM 16
+
+/* User-data entries allocated up front for each pooled raw frame */
+#define OBE_POOL_USER_DATA 4
+
+/* Bytes of user-data payload allocated up front for each pooled raw frame */
+#define OBE_POOL_USER_DATA_BUF 1024
+
 typedef struct
+{
+    pthread_mutex_t mutex;
+
+    /* Free objects */
+    void **items;
+    int  num_items;
+    int  max_items;
+
+    /* Statistics */
+    int     num_outstanding;
+    int     high_water;
+    int64_t misses;
+} obe_pool_t;
+
+typedef struct obe_raw_frame_t
 {
     int input_stream_id;
     int64_t pts;
-    void *opaque;
+    obe_pool_t *pool;
 
     void (*release_data)( void* );
     void (*release_frame)( void* );
 
+    /* Holders of this frame's data once obe_ref_raw_frame() has shared it, including the original holder.
+     * Zero for a frame which has never been shared */
+    int num_refs;
+    struct obe_raw_frame_t *ref_parent; /* Frame whose data a frame from obe_ref_raw_frame() shares */
+
+    /* Pool which the video filter's picture goes back to */
+    void *image_pool;
+
     /* Video */
     /* Some devices output visible and VBI/VANC data together. In order
      * to avoid memcpying raw frames, we create two image structures.
@@ -346,9 +463,13 @@ typedef struct
     int timebase_num;
     int timebase_den;
 
-    /* Ancillary / User-data */
+    /* Ancillary / User-data. The array and the buffer holding the payloads are kept while the frame is in the pool */
     int num_user_data;
+    int max_user_data;
     obe_user_data_t *user_data;
+    uint8_t *user_data_buf;
+    int user_data_buf_len;
+    int user_data_buf_size;
 
     /* Audio */
     obe_audio_frame_t audio_frame;
@@ -359,6 +480,9 @@ typedef struct
     obe_timecode_t timecode;
 
     int reset_obe;
+
+    /* Marks the end of the stream after its last frame. Carries no data */
+    int is_eos;
 } obe_raw_frame_t;
 
 typedef struct
@@ -370,6 +494,10 @@ typedef struct
     obe_queue_t queue;
     int cancel_thread;
 
+    /* Statistics */
+    int64_t frames_in;
+    int64_t frames_out;
+    int64_t image_allocs;
 } obe_filter_t;
 
 typedef struct
@@ -384,8 +512,23 @@ typedef struct
 
     hnd_t encoder_params;
 
+    /* Rate control changes from obe_update_stream, applied before the next frame. Protected by the queue mutex */
+    int reconfig;
+    int reconfig_bitrate;
+    int reconfig_vbv_max_bitrate;
+    int reconfig_vbv_buffer_size;
+    int reconfig_keyint_max;
+
     /* HE-AAC and E-AC3 */
     int num_samples;
+
+    /* Statistics */
+    int64_t frames_in;
+    int64_t frames_out;
+    int64_t drops;
+    int64_t last_encode_time;
+    int64_t max_encode_time;
+    int64_t total_encode_time;
 } obe_encoder_t;
 
 typedef struct
@@ -395,8 +538,14 @@ typedef struct
     int cancel_thread;
     obe_output_dest_t output_dest;
 
-    /* Muxed frame queue for transmission */
+    /* Muxed frame queue for transmission. A NULL item marks the end of the stream */
     obe_queue_t queue;
+    /* Set once the end of the stream has been written. Protected by the queue mutex */
+    int is_finished;
+
+    /* Statistics */
+    int64_t packets_sent;
+    int64_t packets_failed;
 } obe_output_t;
 
 typedef struct
@@ -417,6 +566,12 @@ typedef struct
 
     int len;
     uint8_t *data;
+
+    /* Marks the end of the encoder's stream after its last frame. Its timestamps are later than any frame's */
+    int is_eos;
+
+    obe_pool_t *pool;
+    int buf_size;
 } obe_coded_frame_t;
 
 typedef struct
@@ -426,12 +581,23 @@ typedef struct
 
     /* MPEG-TS */
     int64_t *pcr_list;
+
+    /* Capture time of the earliest video frame in data, or 0 if there is none */
+    int64_t arrival_time;
+
+    /* Marks the end of the transport stream. Carries no data */
+    int is_eos;
+
+    /* data and pcr_list share a single buffer */
+    obe_pool_t *pool;
+    int buf_size;
 } obe_muxed_data_t;
 
 struct obe_t
 {
     int is_active;
     int obe_system;
+    int offline;
 
     /* OBE recovered clock */
     pthread_mutex_t obe_clock_mutex;
@@ -448,7 +614,7 @@ struct obe_t
     /* Frame drop flags
      * TODO: make this work for multiple inputs and outputs */
     pthread_mutex_t drop_mutex;
-    int encoder_drop;
+    int encoder_drop; /* Number of input drops. Each video encoder compares it with the count it last saw */
     int mux_drop;
 
     /* Streams */
@@ -487,6 +653,10 @@ struct obe_t
 
     int             enc_smoothing_buffer_complete;
     int64_t         enc_smoothing_last_exit_time;
+    /* Latest DTS the encoders have queued and the DTS of the frame which last left, for speedcontrol. The
+     * encoders write the first atomically, the smoothing thread writes the second with the queue mutex held */
+    int64_t         enc_smoothing_last_dts;
+    int64_t         enc_smoothing_sent_dts;
 
     /* Encoded frame queue for muxing */
     obe_queue_t mux_queue;
@@ -494,8 +664,25 @@ struct obe_t
     /* Muxed frames in smoothing buffer */
     obe_queue_t mux_smoothing_queue;
 
-    /* Statistics and Monitoring */
+    /* Frame pools */
+    obe_pool_t raw_frame_pool;
+    obe_pool_t coded_frame_pool;
+    obe_pool_t muxed_data_pool;
 
+    /* Statistics and Monitoring */
+    int64_t input_frames;
+    int64_t input_drops;
+    int64_t input_allocs;
+    int64_t enc_smoothing_frames;
+    int64_t mux_frames;
+    int64_t mux_bursts;
+    int64_t mux_bytes;
+    int     mux_last_burst_size;
+    int     mux_max_burst_size;
+    int64_t mux_drops;
+
+    /* Video latency histograms. These can have several writers so are updated atomically */
+    obe_latency_hist_t latency[OBE_LATENCY_STAGES];
 
 };
 
@@ -511,27 +698,49 @@ int64_t obe_mdate( void );
 
 obe_device_t *new_device( void );
 void destroy_device( obe_device_t *device );
-obe_raw_frame_t *new_raw_frame( void );
-void destroy_raw_frame( obe_raw_frame_t *raw_frame );
-obe_coded_frame_t *new_coded_frame( int stream_id, int len );
+obe_raw_frame_t *new_raw_frame( obe_t *h );
+obe_user_data_t *obe_add_user_data( obe_t *h, obe_raw_frame_t *raw_frame, int num );
+int obe_alloc_user_data_payload( obe_t *h, obe_raw_frame_t *raw_frame, obe_user_data_t *user_data, int len );
+obe_coded_frame_t *new_coded_frame( obe_t *h, int stream_id, int len );
+obe_raw_frame_t *new_eos_raw_frame( obe_t *h, int input_stream_id );
+obe_coded_frame_t *new_eos_coded_frame( obe_t *h, obe_encoder_t *encoder );
 void destroy_coded_frame( obe_coded_frame_t *coded_frame );
 void obe_release_video_data( void *ptr );
 void obe_release_audio_data( void *ptr );
+void obe_release_audio_buffer( void *ptr );
 void obe_release_frame( void *ptr );
+obe_raw_frame_t *obe_ref_raw_frame( obe_t *h, obe_raw_frame_t *parent );
+void obe_unref_raw_frame( obe_raw_frame_t *raw_frame );
 
-obe_muxed_data_t *new_muxed_data( int len );
+obe_muxed_data_t *new_muxed_data( obe_t *h, int len );
 void destroy_muxed_data( obe_muxed_data_t *muxed_data );
 
 void add_device( obe_t *h, obe_device_t *device );
 
+int obe_init_queue( obe_queue_t *queue, int capacity );
+void obe_destroy_queue( obe_queue_t *queue );
+void obe_close_queue( obe_queue_t *queue );
+void obe_queue_lock( obe_queue_t *queue );
+void obe_queue_unlock( obe_queue_t *queue );
+int obe_queue_size( obe_queue_t *queue );
+int obe_queue_depth( obe_queue_t *queue );
 int add_to_queue( obe_queue_t *queue, void *item );
 int remove_from_queue( obe_queue_t *queue );
 int remove_item_from_queue( obe_queue_t *queue, void *item );
 
+int obe_slice_pool_init( obe_slice_pool_t *pool, int num_threads );
+void obe_slice_pool_run( obe_slice_pool_t *pool, obe_slice_func_t func, void *ctx, int num_slices );
+void obe_slice_pool_destroy( obe_slice_pool_t *pool );
+int obe_slice_threads( int max_threads );
+
 int add_to_filter_queue( obe_t *h, obe_raw_frame_t *raw_frame );
 int add_to_encode_queue( obe_t *h, obe_raw_frame_t *raw_frame, int output_stream_id );
+void update_encoder_stats( obe_encoder_t *encoder, int64_t encode_time );
+void add_latency( obe_t *h, int stage, int64_t arrival_time );
+obe_coded_frame_t *earliest_video_frame( obe_t *h, obe_queue_t *queue );
 int remove_early_frames( obe_t *h, int64_t pts );
 int add_to_output_queue( obe_t *h, obe_muxed_data_t *muxed_data );
+void obe_output_finished( obe_output_t *output );
 int remove_from_output_queue( obe_t *h );
 
 obe_int_input_stream_t *get_input_stream( obe_t *h, int input_stream_id );
@@ -50,7 +50,7 @@ static void *start_encoder( void *ptr )
     obe_output_stream_t *stream = enc_params->stream;
     obe_raw_frame_t *raw_frame;
     obe_coded_frame_t *coded_frame;
-    int64_t cur_pts = -1, pts_increment;
+    int64_t cur_pts = -1, pts_increment, encode_start;
     int i, frame_size, ret, got_pkt, num_frames = 0, total_size = 0;
     AVFifoBuffer *out_fifo = NULL;
     AVAudioResampleContext *avr = NULL;
@@ -175,19 +175,38 @@ static void *start_encoder( void *ptr )
     while( 1 )
     {
         /* TODO: detect bitrate or channel reconfig */
-        pthread_mutex_lock( &encoder->queue.mutex );
+        obe_queue_lock( &encoder->queue );
 
-        while( !encoder->queue.size && !encoder->cancel_thread )
+        while( !obe_queue_size( &encoder->queue ) && !encoder->cancel_thread )
             pthread_cond_wait( &encoder->queue.in_cv, &encoder->queue.mutex );
 
         if( encoder->cancel_thread )
         {
-            pthread_mutex_unlock( &encoder->queue.mutex );
+            obe_queue_unlock( &encoder->queue );
             goto finish;
         }
 
-        raw_frame = encoder->queue.queue[0];
-        pthread_mutex_unlock( &encoder->queue.mutex );
+        obe_queue_unlock( &encoder->queue );
+        raw_frame = obe_queue_item( &encoder->queue, 0 );
+
+        /* Samples which do not fill a whole PES are dropped */
+        if( raw_frame->is_eos )
+        {
+            raw_frame->release_data( raw_frame );
+            raw_frame->release_frame( raw_frame );
+            remove_from_queue( &encoder->queue );
+
+            coded_frame = new_eos_coded_frame( h, encoder );
+            if( !coded_frame )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                goto finish;
+            }
+            add_to_queue( &h->mux_queue, coded_frame );
+            break;
+        }
+
+        encode_start = obe_mdate();
 
         if( cur_pts == -1 )
             cur_pts = raw_frame->pts;
@@ -239,7 +258,7 @@ static void *start_encoder( void *ptr )
 
             if( num_frames == enc_params->frames_per_pes )
             {
-                coded_frame = new_coded_frame( encoder->output_stream_id, total_size );
+                coded_frame = new_coded_frame( h, encoder->output_stream_id, total_size );
                 if( !coded_frame )
                 {
                     syslog( LOG_ERR, "Malloc failed\n" );
@@ -251,12 +270,15 @@ static void *start_encoder( void *ptr )
                 coded_frame->pts = cur_pts;
                 coded_frame->random_access = 1; /* Every frame output is a random access point */
                 add_to_queue( &h->mux_queue, coded_frame );
+                OBE_STAT_ADD( encoder->frames_out, 1 );
 
                 /* We need to generate PTS because frame sizes have changed */
                 cur_pts += pts_increment;
                 total_size = num_frames = 0;
             }
         }
+
+        update_encoder_stats( encoder, obe_mdate() - encode_start );
     }
 
 finish:
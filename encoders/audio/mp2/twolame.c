@@ -41,7 +41,7 @@ static void *start_encoder( void *ptr )
 
     twolame_options *tl_opts = NULL;
     int output_size, frame_size, linesize; /* Linesize in libavresample terminology is the entire buffer size for packed formats */
-    int64_t cur_pts = -1;
+    int64_t cur_pts = -1, encode_start;
     float *audio_buf = NULL;
     uint8_t *output_buf = NULL;
     AVAudioResampleContext *avr = NULL;
@@ -115,19 +115,38 @@ static void *start_encoder( void *ptr )
 
     while( 1 )
     {
-        pthread_mutex_lock( &encoder->queue.mutex );
+        obe_queue_lock( &encoder->queue );
 
-        while( !encoder->queue.size && !encoder->cancel_thread )
+        while( !obe_queue_size( &encoder->queue ) && !encoder->cancel_thread )
             pthread_cond_wait( &encoder->queue.in_cv, &encoder->queue.mutex );
 
         if( encoder->cancel_thread )
         {
-            pthread_mutex_unlock( &encoder->queue.mutex );
+            obe_queue_unlock( &encoder->queue );
             break;
         }
 
-        raw_frame = encoder->queue.queue[0];
-        pthread_mutex_unlock( &encoder->queue.mutex );
+        obe_queue_unlock( &encoder->queue );
+        raw_frame = obe_queue_item( &encoder->queue, 0 );
+
+        /* Samples which do not fill a whole PES are dropped */
+        if( raw_frame->is_eos )
+        {
+            raw_frame->release_data( raw_frame );
+            raw_frame->release_frame( raw_frame );
+            remove_from_queue( &encoder->queue );
+
+            coded_frame = new_eos_coded_frame( h, encoder );
+            if( !coded_frame )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                goto end;
+            }
+            add_to_queue( &h->mux_queue, coded_frame );
+            break;
+        }
+
+        encode_start = obe_mdate();
 
         if( cur_pts == -1 )
             cur_pts = raw_frame->pts;
@@ -174,7 +193,7 @@ static void *start_encoder( void *ptr )
 
         while( av_fifo_size( fifo ) >= frame_size )
         {
-            coded_frame = new_coded_frame( encoder->output_stream_id, frame_size );
+            coded_frame = new_coded_frame( h, encoder->output_stream_id, frame_size );
             if( !coded_frame )
             {
                 syslog( LOG_ERR, "Malloc failed\n" );
@@ -185,9 +204,12 @@ static void *start_encoder( void *ptr )
             coded_frame->random_access = 1; /* Every frame output is a random access point */
 
             add_to_queue( &h->mux_queue, coded_frame );
+            OBE_STAT_ADD( encoder->frames_out, 1 );
             /* We need to generate PTS because frame sizes have changed */
             cur_pts += (double)MP2_NUM_SAMPLES * OBE_CLOCK * enc_params->frames_per_pes / enc_params->sample_rate;
         }
+
+        update_encoder_stats( encoder, obe_mdate() - encode_start );
     }
 
 end:
@@ -26,15 +26,16 @@
 static void *start_smoothing( void *ptr )
 {
     obe_t *h = ptr;
-    int num_enc_smoothing_frames = 0, buffer_frames = 0;
-    int64_t start_dts = -1, start_pts = -1, last_clock = -1;
+    int num_enc_smoothing_frames = 0, buffer_frames = 0, eos_queued = 0;
+    int64_t start_dts = -1, start_pts = -1, last_clock = -1, sent_dts;
     obe_coded_frame_t *coded_frame = NULL;
 
     struct sched_param param = {0};
     param.sched_priority = 99;
     pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
 
-    /* FIXME: when we have soft pulldown this will need changing */
+    /* FIXME: when we have soft pulldown this will need changing
+     * Every video rendition puts its frames in the same queue so buffer each one's worth */
     if( h->obe_system == OBE_SYSTEM_TYPE_GENERIC )
     {
         for( int i = 0; i < h->num_encoders; i++ )
@@ -45,9 +46,8 @@ static void *start_smoothing( void *ptr )
                 while( !h->encoders[i]->is_ready )
                     pthread_cond_wait( &h->encoders[i]->queue.in_cv, &h->encoders[i]->queue.mutex );
                 x264_param_t *params = h->encoders[i]->encoder_params;
-                buffer_frames = params->sc.i_buffer_size;
+                buffer_frames += params->sc.i_buffer_size;
                 pthread_mutex_unlock( &h->encoders[i]->queue.mutex );
-                break;
             }
         }
     }
@@ -56,37 +56,59 @@ static void *start_smoothing( void *ptr )
 
     while( 1 )
     {
-        pthread_mutex_lock( &h->enc_smoothing_queue.mutex );
+        obe_queue_lock( &h->enc_smoothing_queue );
 
-        while( h->enc_smoothing_queue.size == num_enc_smoothing_frames && !h->cancel_enc_smoothing_thread )
+        while( obe_queue_size( &h->enc_smoothing_queue ) == num_enc_smoothing_frames && !h->cancel_enc_smoothing_thread )
             pthread_cond_wait( &h->enc_smoothing_queue.in_cv, &h->enc_smoothing_queue.mutex );
 
         if( h->cancel_enc_smoothing_thread )
         {
-            pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
+            obe_queue_unlock( &h->enc_smoothing_queue );
             break;
         }
 
-        num_enc_smoothing_frames = h->enc_smoothing_queue.size;
+        num_enc_smoothing_frames = obe_queue_size( &h->enc_smoothing_queue );
+
+        /* Once a rendition has finished the input has ended, so there is no clock to wait for or buffer to fill */
+        for( int i = 0; i < num_enc_smoothing_frames && !eos_queued; i++ )
+            eos_queued = ((obe_coded_frame_t*)obe_queue_item( &h->enc_smoothing_queue, i ))->is_eos;
 
         if( !h->enc_smoothing_buffer_complete )
         {
-            if( num_enc_smoothing_frames >= buffer_frames )
+            if( num_enc_smoothing_frames >= buffer_frames || eos_queued )
             {
                 h->enc_smoothing_buffer_complete = 1;
                 start_dts = -1;
             }
             else
             {
-                pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
+                obe_queue_unlock( &h->enc_smoothing_queue );
                 continue;
             }
         }
+        obe_queue_unlock( &h->enc_smoothing_queue );
 
 //        printf("\n smoothed frames %i \n", num_enc_smoothing_frames );
 
-        coded_frame = h->enc_smoothing_queue.queue[0];
-        pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
+        /* The renditions are encoded in parallel so send the earliest frame out of all of them */
+        coded_frame = earliest_video_frame( h, &h->enc_smoothing_queue );
+        if( !coded_frame )
+            continue;
+
+        /* Every rendition has finished so only their end of stream markers are left */
+        if( coded_frame->is_eos )
+        {
+            while( 1 )
+            {
+                coded_frame = obe_queue_size( &h->enc_smoothing_queue ) ? obe_queue_item( &h->enc_smoothing_queue, 0 ) : NULL;
+                if( !coded_frame )
+                    break;
+
+                remove_from_queue( &h->enc_smoothing_queue );
+                add_to_queue( &h->mux_queue, coded_frame );
+            }
+            break;
+        }
 
         /* The terminology can be a cause for confusion:
          *   pts refers to the pts from the input which is monotonic
@@ -99,7 +121,10 @@ static void *start_smoothing( void *ptr )
 
         last_clock = h->obe_clock_last_pts;
 
-        if( start_dts == -1 )
+        /* There is no real time to smooth against offline */
+        if( h->offline || eos_queued )
+            start_dts = coded_frame->real_dts;
+        else if( start_dts == -1 )
         {
             start_dts = coded_frame->real_dts;
             /* Wait until the next clock tick */
@@ -117,14 +142,20 @@ static void *start_smoothing( void *ptr )
 
         pthread_mutex_unlock( &h->obe_clock_mutex );
 
+        add_latency( h, OBE_LATENCY_SMOOTHING, coded_frame->arrival_time );
+        sent_dts = coded_frame->real_dts;
         add_to_queue( &h->mux_queue, coded_frame );
+        OBE_STAT_ADD( h->enc_smoothing_frames, 1 );
 
         //printf("\n send_delta %"PRIi64" \n", get_input_clock_in_mpeg_ticks( h ) - send_delta );
         //send_delta = get_input_clock_in_mpeg_ticks( h );
 
-        remove_from_queue( &h->enc_smoothing_queue );
+        remove_item_from_queue( &h->enc_smoothing_queue, coded_frame );
         pthread_mutex_lock( &h->enc_smoothing_queue.mutex );
         h->enc_smoothing_last_exit_time = get_input_clock_in_mpeg_ticks( h );
+        h->enc_smoothing_sent_dts = sent_dts;
+        /* Speedcontrol waits for the first frame to leave */
+        pthread_cond_broadcast( &h->enc_smoothing_queue.out_cv );
         pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
         num_enc_smoothing_frames = 0;
     }
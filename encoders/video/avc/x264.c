@@ -25,16 +25,35 @@
 #include "encoders/video/video.h"
 #include <libavutil/mathematics.h>
 
+/* Input metadata carried through the encoder's reordering. The SEI payloads are
+ * copied here because x264 holds on to them until the frame has been encoded */
+typedef struct
+{
+    int64_t pts;
+    int64_t arrival_time;
+
+    x264_sei_payload_t *payloads;
+    int max_payloads;
+    uint8_t *sei_buf;
+    int sei_buf_size;
+} frame_info_t;
+
 static void x264_logger( void *p_unused, int i_level, const char *psz_fmt, va_list arg )
 {
     if( i_level <= X264_LOG_INFO )
         vsyslog( i_level == X264_LOG_INFO ? LOG_INFO : i_level == X264_LOG_WARNING ? LOG_WARNING : LOG_ERR, psz_fmt, arg );
 }
 
-static int convert_obe_to_x264_pic( x264_picture_t *pic, obe_raw_frame_t *raw_frame )
+static int is_valid_sei( obe_user_data_t *user_data )
+{
+    return user_data->type == USER_DATA_AVC_REGISTERED_ITU_T35 || user_data->type == USER_DATA_AVC_UNREGISTERED;
+}
+
+static int convert_obe_to_x264_pic( x264_picture_t *pic, obe_raw_frame_t *raw_frame, frame_info_t *info )
 {
     obe_image_t *img = &raw_frame->img;
-    int idx = 0, count = 0;
+    int idx = 0, count = 0, len = 0;
+    uint8_t *buf;
 
     x264_picture_init( pic );
 
@@ -49,49 +68,58 @@ static int convert_obe_to_x264_pic( x264_picture_t *pic, obe_raw_frame_t *raw_fr
     for( int i = 0; i < raw_frame->num_user_data; i++ )
     {
         /* Only give correctly formatted data to the encoder */
-        if( raw_frame->user_data[i].type == USER_DATA_AVC_REGISTERED_ITU_T35 ||
-            raw_frame->user_data[i].type == USER_DATA_AVC_UNREGISTERED )
+        if( is_valid_sei( &raw_frame->user_data[i] ) )
         {
             count++;
+            len += raw_frame->user_data[i].len;
         }
+        else
+            syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
     }
 
     pic->extra_sei.num_payloads = count;
+    /* The payloads belong to the frame info entry so x264 must not free them */
+    pic->extra_sei.sei_free = NULL;
+
+    if( !count )
+        return 0;
 
-    if( pic->extra_sei.num_payloads )
+    /* The entry's buffers only grow when a frame carries more than any before it */
+    if( count > info->max_payloads )
     {
-        pic->extra_sei.sei_free = free;
-        pic->extra_sei.payloads = malloc( pic->extra_sei.num_payloads * sizeof(*pic->extra_sei.payloads) );
+        x264_sei_payload_t *payloads = realloc( info->payloads, count * sizeof(*info->payloads) );
+        if( !payloads )
+            return -1;
+
+        info->payloads = payloads;
+        info->max_payloads = count;
+    }
 
-        if( !pic->extra_sei.payloads )
+    if( len > info->sei_buf_size )
+    {
+        buf = realloc( info->sei_buf, len );
+        if( !buf )
             return -1;
 
-        for( int i = 0; i < raw_frame->num_user_data; i++ )
-        {
-            /* Only give correctly formatted data to the encoder */
-            if( raw_frame->user_data[i].type == USER_DATA_AVC_REGISTERED_ITU_T35 ||
-                raw_frame->user_data[i].type == USER_DATA_AVC_UNREGISTERED )
-            {
-                pic->extra_sei.payloads[idx].payload_type = raw_frame->user_data[i].type;
-                pic->extra_sei.payloads[idx].payload_size = raw_frame->user_data[i].len;
-                pic->extra_sei.payloads[idx].payload = raw_frame->user_data[i].data;
-                idx++;
-            }
-            else
-            {
-                syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
-                free( raw_frame->user_data[i].data );
-            }
-            /* Set the pointer to NULL so only x264 can free the data if necessary */
-            raw_frame->user_data[i].data = NULL;
-        }
+        info->sei_buf = buf;
+        info->sei_buf_size = len;
     }
-    else if( raw_frame->num_user_data )
+
+    pic->extra_sei.payloads = info->payloads;
+    buf = info->sei_buf;
+
+    for( int i = 0; i < raw_frame->num_user_data; i++ )
     {
-        for( int i = 0; i < raw_frame->num_user_data; i++ )
+        obe_user_data_t *user_data = &raw_frame->user_data[i];
+
+        if( is_valid_sei( user_data ) )
         {
-            syslog( LOG_WARNING, "Invalid user data presented to encoder - type %i \n", raw_frame->user_data[i].type );
-            free( raw_frame->user_data[i].data );
+            memcpy( buf, user_data->data, user_data->len );
+            pic->extra_sei.payloads[idx].payload_type = user_data->type;
+            pic->extra_sei.payloads[idx].payload_size = user_data->len;
+            pic->extra_sei.payloads[idx].payload = buf;
+            buf += user_data->len;
+            idx++;
         }
     }
 
@@ -110,6 +138,74 @@ static int convert_obe_to_x264_pic( x264_picture_t *pic, obe_raw_frame_t *raw_fr
     return 0;
 }
 
+static void queue_coded_frame( obe_t *h, obe_coded_frame_t *coded_frame )
+{
+    int64_t last_dts;
+
+    if( h->obe_system == OBE_SYSTEM_TYPE_LOWEST_LATENCY || h->obe_system == OBE_SYSTEM_TYPE_LOW_LATENCY )
+        add_to_queue( &h->mux_queue, coded_frame );
+    else
+    {
+        /* The end of stream marker has no real timestamp */
+        last_dts = __atomic_load_n( &h->enc_smoothing_last_dts, __ATOMIC_RELAXED );
+        while( !coded_frame->is_eos && coded_frame->real_dts > last_dts &&
+               !__atomic_compare_exchange_n( &h->enc_smoothing_last_dts, &last_dts, coded_frame->real_dts, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+            ;
+        add_to_queue( &h->enc_smoothing_queue, coded_frame );
+    }
+}
+
+static int send_coded_frame( obe_t *h, obe_encoder_t *encoder, x264_nal_t *nal, int frame_size, x264_picture_t *pic_out,
+                             frame_info_t *frame_info, int num_frame_info )
+{
+    obe_coded_frame_t *coded_frame;
+    frame_info_t *info;
+
+    coded_frame = new_coded_frame( h, encoder->output_stream_id, frame_size );
+    if( !coded_frame )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return -1;
+    }
+    memcpy( coded_frame->data, nal[0].p_payload, frame_size );
+    coded_frame->is_video = 1;
+    coded_frame->len = frame_size;
+    coded_frame->cpb_initial_arrival_time = pic_out->hrd_timing.cpb_initial_arrival_time;
+    coded_frame->cpb_final_arrival_time = pic_out->hrd_timing.cpb_final_arrival_time;
+    coded_frame->real_dts = pic_out->hrd_timing.cpb_removal_time;
+    coded_frame->real_pts = pic_out->hrd_timing.dpb_output_time;
+    info = &frame_info[pic_out->i_pts % num_frame_info];
+    coded_frame->pts = info->pts;
+    coded_frame->arrival_time = info->arrival_time;
+    coded_frame->random_access = pic_out->b_keyframe;
+    coded_frame->priority = IS_X264_TYPE_I( pic_out->i_type );
+
+    add_latency( h, OBE_LATENCY_ENCODER_OUT, coded_frame->arrival_time );
+
+    queue_coded_frame( h, coded_frame );
+
+    OBE_STAT_ADD( encoder->frames_out, 1 );
+
+    return 0;
+}
+
+/* x264 applies the change from the next frame it is given */
+static void reconfig_encoder( x264_t *s, obe_encoder_t *encoder, x264_param_t *param )
+{
+    if( x264_encoder_reconfig( s, param ) < 0 )
+        syslog( LOG_ERR, "[x264]: encoder reconfiguration failed\n" );
+    else
+        syslog( LOG_INFO, "[x264]: bitrate %i, vbv-maxrate %i, vbv-bufsize %i, keyint %i\n", param->rc.i_bitrate,
+                param->rc.i_vbv_max_bitrate, param->rc.i_vbv_buffer_size, param->i_keyint_max );
+
+    /* Keep what x264 is actually using, which is unchanged if it refused */
+    x264_encoder_parameters( s, param );
+
+    pthread_mutex_lock( &encoder->queue.mutex );
+    memcpy( encoder->encoder_params, param, sizeof(*param) );
+    pthread_mutex_unlock( &encoder->queue.mutex );
+}
+
 static void *start_encoder( void *ptr )
 {
     obe_vid_enc_params_t *enc_params = ptr;
@@ -119,8 +215,10 @@ static void *start_encoder( void *ptr )
     x264_picture_t pic, pic_out;
     x264_nal_t *nal;
     int i_nal, frame_size = 0;
-    int64_t pts = 0, arrival_time = 0, frame_duration, buffer_duration;
-    int64_t *pts2;
+    int64_t pts = 0, frame_duration, buffer_duration, encode_start;
+    frame_info_t *frame_info = NULL, *info;
+    int num_frame_info = 0;
+    int reconfig, drops_seen = 0, eos = 0;
     float buffer_fill;
     obe_raw_frame_t *raw_frame;
     obe_coded_frame_t *coded_frame;
@@ -131,6 +229,9 @@ static void *start_encoder( void *ptr )
     pthread_mutex_lock( &encoder->queue.mutex );
 
     enc_params->avc_param.pf_log = x264_logger;
+    /* Speedcontrol trades quality to keep up with real time which is meaningless offline */
+    if( h->offline )
+        enc_params->avc_param.sc.f_speed = 0;
     s = x264_encoder_open( &enc_params->avc_param );
     if( !s )
     {
@@ -150,6 +251,19 @@ static void *start_encoder( void *ptr )
     }
     memcpy( encoder->encoder_params, &enc_params->avc_param, sizeof(enc_params->avc_param) );
 
+    /* Indexed by the x264 pts. Frames come out in coding order, in which a B-frame can follow up to i_bframe
+     * frames that are later in display order, so the frame given in call p comes back at the latest in call
+     * p + maximum delay + i_bframe. Its entry (SEI included, which x264 reads until then) is reused in call
+     * p + num_frame_info */
+    num_frame_info = x264_encoder_maximum_delayed_frames( s ) + enc_params->avc_param.i_bframe + 1;
+    frame_info = calloc( num_frame_info, sizeof(*frame_info) );
+    if( !frame_info )
+    {
+        pthread_mutex_unlock( &encoder->queue.mutex );
+        syslog( LOG_ERR, "Malloc failed\n" );
+        goto end;
+    }
+
     encoder->is_ready = 1;
     /* XXX: This will need fixing for soft pulldown streams */
     frame_duration = av_rescale_q( 1, (AVRational){enc_params->avc_param.i_fps_den, enc_params->avc_param.i_fps_num}, (AVRational){1, OBE_CLOCK} );
@@ -161,50 +275,72 @@ static void *start_encoder( void *ptr )
 
     while( 1 )
     {
-        pthread_mutex_lock( &encoder->queue.mutex );
+        obe_queue_lock( &encoder->queue );
 
-        while( !encoder->queue.size && !encoder->cancel_thread )
+        while( !obe_queue_size( &encoder->queue ) && !encoder->cancel_thread )
             pthread_cond_wait( &encoder->queue.in_cv, &encoder->queue.mutex );
 
         if( encoder->cancel_thread )
         {
-            pthread_mutex_unlock( &encoder->queue.mutex );
+            obe_queue_unlock( &encoder->queue );
             break;
         }
 
         /* Reset the speedcontrol buffer if the source has dropped frames. Otherwise speedcontrol
          * stays in an underflow state and is locked to the fastest preset */
         pthread_mutex_lock( &h->drop_mutex );
-        if( h->encoder_drop )
+        if( h->encoder_drop != drops_seen )
         {
             pthread_mutex_lock( &h->enc_smoothing_queue.mutex );
             h->enc_smoothing_buffer_complete = 0;
             pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
             syslog( LOG_INFO, "Speedcontrol reset\n" );
             x264_speedcontrol_sync( s, enc_params->avc_param.sc.i_buffer_size, enc_params->avc_param.sc.f_buffer_init, 0 );
-            h->encoder_drop = 0;
+            drops_seen = h->encoder_drop;
+            OBE_STAT_ADD( encoder->drops, 1 );
         }
         pthread_mutex_unlock( &h->drop_mutex );
 
-        raw_frame = encoder->queue.queue[0];
-        pthread_mutex_unlock( &encoder->queue.mutex );
+        raw_frame = obe_queue_item( &encoder->queue, 0 );
 
-        if( convert_obe_to_x264_pic( &pic, raw_frame ) < 0 )
+        if( raw_frame->is_eos )
         {
-            syslog( LOG_ERR, "Malloc failed\n" );
+            obe_queue_unlock( &encoder->queue );
+            raw_frame->release_data( raw_frame );
+            raw_frame->release_frame( raw_frame );
+            remove_from_queue( &encoder->queue );
+            eos = 1;
             break;
         }
 
-        /* FIXME: if frames are dropped this might not be true */
-        pic.i_pts = pts++;
-        pts2 = malloc( sizeof(int64_t) );
-        if( !pts2 )
+        reconfig = encoder->reconfig;
+        if( reconfig )
+        {
+            enc_params->avc_param.rc.i_bitrate = encoder->reconfig_bitrate;
+            enc_params->avc_param.rc.i_vbv_max_bitrate = encoder->reconfig_vbv_max_bitrate;
+            enc_params->avc_param.rc.i_vbv_buffer_size = encoder->reconfig_vbv_buffer_size;
+            enc_params->avc_param.i_keyint_max = encoder->reconfig_keyint_max;
+            encoder->reconfig = 0;
+        }
+        obe_queue_unlock( &encoder->queue );
+
+        if( reconfig )
+            reconfig_encoder( s, encoder, &enc_params->avc_param );
+
+        add_latency( h, OBE_LATENCY_ENCODER_IN, raw_frame->arrival_time );
+
+        /* Carry the pts, capture time and SEI through the encoder's reordering */
+        info = &frame_info[pts % num_frame_info];
+        if( convert_obe_to_x264_pic( &pic, raw_frame, info ) < 0 )
         {
             syslog( LOG_ERR, "Malloc failed\n" );
             break;
         }
-        pts2[0] = raw_frame->pts;
-        pic.opaque = pts2;
+
+        /* FIXME: if frames are dropped this might not be true */
+        pic.i_pts = pts++;
+        info->pts = raw_frame->pts;
+        info->arrival_time = raw_frame->arrival_time;
         pic.param = NULL;
 
         /* If the AFD has changed, then change the SAR. x264 will write the SAR at the next keyframe
@@ -219,7 +355,7 @@ static void *start_encoder( void *ptr )
         }
 
         /* Update speedcontrol based on the system state */
-        if( h->obe_system == OBE_SYSTEM_TYPE_GENERIC )
+        if( h->obe_system == OBE_SYSTEM_TYPE_GENERIC && !h->offline )
         {
             pthread_mutex_lock( &h->enc_smoothing_queue.mutex );
             if( h->enc_smoothing_buffer_complete )
@@ -231,16 +367,10 @@ static void *start_encoder( void *ptr )
                 /* time elapsed since last frame was removed */
                 int64_t last_frame_delta = get_input_clock_in_mpeg_ticks( h ) - h->enc_smoothing_last_exit_time;
 
-                if( h->enc_smoothing_queue.size )
-                {
-                    obe_coded_frame_t *first_frame, *last_frame;
-                    first_frame = h->enc_smoothing_queue.queue[0];
-                    last_frame = h->enc_smoothing_queue.queue[h->enc_smoothing_queue.size-1];
-                    int64_t frame_durations = last_frame->real_dts - first_frame->real_dts + frame_duration;
-                    buffer_fill = (float)(frame_durations - last_frame_delta)/buffer_duration;
-                }
-                else
-                    buffer_fill = (float)(-1 * last_frame_delta)/buffer_duration;
+                /* The queue belongs to the smoothing thread so what is buffered is worked out from the DTS either side of it.
+                 * This is the same as the DTS range of the queued frames plus a frame, or nothing once it is empty */
+                int64_t frame_durations = __atomic_load_n( &h->enc_smoothing_last_dts, __ATOMIC_RELAXED ) - h->enc_smoothing_sent_dts;
+                buffer_fill = (float)(frame_durations - last_frame_delta)/buffer_duration;
 
                 x264_speedcontrol_sync( s, buffer_fill, enc_params->avc_param.sc.i_buffer_size, 1 );
             }
@@ -248,9 +378,10 @@ static void *start_encoder( void *ptr )
             pthread_mutex_unlock( &h->enc_smoothing_queue.mutex );
         }
 
+        encode_start = obe_mdate();
         frame_size = x264_encoder_encode( s, &nal, &i_nal, &pic, &pic_out );
+        update_encoder_stats( encoder, obe_mdate() - encode_start );
 
-        arrival_time = raw_frame->arrival_time;
         raw_frame->release_data( raw_frame );
         raw_frame->release_frame( raw_frame );
         remove_from_queue( &encoder->queue );
@@ -261,41 +392,48 @@ static void *start_encoder( void *ptr )
             break;
         }
 
-        if( frame_size )
+        if( frame_size && send_coded_frame( h, encoder, nal, frame_size, &pic_out, frame_info, num_frame_info ) < 0 )
+            break;
+     }
+
+    /* Encode the frames x264 is still holding and then mark the end of the stream */
+    if( eos )
+    {
+        while( x264_encoder_delayed_frames( s ) )
         {
-            coded_frame = new_coded_frame( encoder->output_stream_id, frame_size );
-            if( !coded_frame )
+            encode_start = obe_mdate();
+            frame_size = x264_encoder_encode( s, &nal, &i_nal, NULL, &pic_out );
+            update_encoder_stats( encoder, obe_mdate() - encode_start );
+
+            if( frame_size < 0 )
             {
-                syslog( LOG_ERR, "Malloc failed\n" );
+                syslog( LOG_ERR, "x264_encoder_encode failed\n" );
                 break;
             }
-            memcpy( coded_frame->data, nal[0].p_payload, frame_size );
-            coded_frame->is_video = 1;
-            coded_frame->len = frame_size;
-            coded_frame->cpb_initial_arrival_time = pic_out.hrd_timing.cpb_initial_arrival_time;
-            coded_frame->cpb_final_arrival_time = pic_out.hrd_timing.cpb_final_arrival_time;
-            coded_frame->real_dts = pic_out.hrd_timing.cpb_removal_time;
-            coded_frame->real_pts = pic_out.hrd_timing.dpb_output_time;
-            pts2 = pic_out.opaque;
-            coded_frame->pts = pts2[0];
-            coded_frame->random_access = pic_out.b_keyframe;
-            coded_frame->priority = IS_X264_TYPE_I( pic_out.i_type );
-            free( pic_out.opaque );
-
-            if( h->obe_system == OBE_SYSTEM_TYPE_LOWEST_LATENCY || h->obe_system == OBE_SYSTEM_TYPE_LOW_LATENCY )
-            {
-                coded_frame->arrival_time = arrival_time;
-                add_to_queue( &h->mux_queue, coded_frame );
-                //printf("\n Encode Latency %"PRIi64" \n", obe_mdate() - coded_frame->arrival_time );
-            }
-            else
-                add_to_queue( &h->enc_smoothing_queue, coded_frame );
+
+            if( frame_size && send_coded_frame( h, encoder, nal, frame_size, &pic_out, frame_info, num_frame_info ) < 0 )
+                break;
         }
-     }
+
+        coded_frame = new_eos_coded_frame( h, encoder );
+        if( coded_frame )
+            queue_coded_frame( h, coded_frame );
+        else
+            syslog( LOG_ERR, "Malloc failed\n" );
+    }
 
 end:
     if( s )
         x264_encoder_close( s );
+    if( frame_info )
+    {
+        for( int i = 0; i < num_frame_info; i++ )
+        {
+            free( frame_info[i].payloads );
+            free( frame_info[i].sei_buf );
+        }
+    }
+    free( frame_info );
     free( enc_params );
 
     return NULL;
@@ -23,6 +23,21 @@
 #include "common/common.h"
 #include "audio.h"
 
+/* Move ownership of the captured samples into a refcounted buffer which the split frames can share */
+static int share_audio_frame( obe_raw_frame_t *raw_frame )
+{
+    obe_audio_frame_t *audio_frame = &raw_frame->audio_frame;
+    int size = av_samples_get_buffer_size( NULL, audio_frame->num_channels, audio_frame->num_samples, audio_frame->sample_fmt, 0 );
+
+    audio_frame->buf = av_buffer_create( audio_frame->audio_data[0], size, av_buffer_default_free, NULL, 0 );
+    if( !audio_frame->buf )
+        return -1;
+
+    raw_frame->release_data = obe_release_audio_buffer;
+
+    return 0;
+}
+
 static void *start_filter( void *ptr )
 {
     obe_raw_frame_t *raw_frame, *split_raw_frame;
@@ -30,58 +45,128 @@ static void *start_filter( void *ptr )
     obe_t *h = filter_params->h;
     obe_filter_t *filter = filter_params->filter;
     obe_output_stream_t *output_stream;
-    int num_channels;
+    int num_channels, first_channel, planar, sample_size;
 
     while( 1 )
     {
-        pthread_mutex_lock( &filter->queue.mutex );
+        obe_queue_lock( &filter->queue );
 
-        while( !filter->queue.size && !filter->cancel_thread )
+        while( !obe_queue_size( &filter->queue ) && !filter->cancel_thread )
             pthread_cond_wait( &filter->queue.in_cv, &filter->queue.mutex );
 
         if( filter->cancel_thread )
         {
-            pthread_mutex_unlock( &filter->queue.mutex );
+            obe_queue_unlock( &filter->queue );
+            break;
+        }
+
+        obe_queue_unlock( &filter->queue );
+        raw_frame = obe_queue_item( &filter->queue, 0 );
+
+        /* Pass the end of the stream on to every audio encoder and finish */
+        if( raw_frame->is_eos )
+        {
+            for( int i = 0; i < h->num_encoders; i++ )
+            {
+                if( h->encoders[i]->is_video )
+                    continue;
+
+                split_raw_frame = new_eos_raw_frame( h, raw_frame->input_stream_id );
+                if( !split_raw_frame )
+                {
+                    syslog( LOG_ERR, "Malloc failed\n" );
+                    break;
+                }
+                add_to_encode_queue( h, split_raw_frame, h->encoders[i]->output_stream_id );
+            }
+
+            remove_from_queue( &filter->queue );
+            raw_frame->release_data( raw_frame );
+            raw_frame->release_frame( raw_frame );
             break;
         }
 
-        raw_frame = filter->queue.queue[0];
-        pthread_mutex_unlock( &filter->queue.mutex );
+        /* Planar samples can be handed to each encoder as a view of its channels */
+        planar = av_sample_fmt_is_planar( raw_frame->audio_frame.sample_fmt );
+        if( planar && !raw_frame->audio_frame.buf && share_audio_frame( raw_frame ) < 0 )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            return NULL;
+        }
 
-        /* ignore the video track */
-        for( int i = 1; i < h->num_encoders; i++ )
+        for( int i = 0; i < h->num_encoders; i++ )
         {
+            /* Any of the encoders can be a video rendition */
+            if( h->encoders[i]->is_video )
+                continue;
+
             output_stream = get_output_stream( h, h->encoders[i]->output_stream_id );
             num_channels = av_get_channel_layout_nb_channels( output_stream->channel_layout );
+            first_channel = ((output_stream->sdi_audio_pair-1)<<1)+output_stream->mono_channel;
 
-            split_raw_frame = new_raw_frame();
+            split_raw_frame = new_raw_frame( h );
             if( !split_raw_frame )
             {
                 syslog( LOG_ERR, "Malloc failed\n" );
                 return NULL;
             }
+            /* Keep the split frame's own user-data array and payload buffer */
+            obe_user_data_t *user_data = split_raw_frame->user_data;
+            int max_user_data = split_raw_frame->max_user_data;
+            uint8_t *user_data_buf = split_raw_frame->user_data_buf;
+            int user_data_buf_size = split_raw_frame->user_data_buf_size;
             memcpy( split_raw_frame, raw_frame, sizeof(*split_raw_frame) );
+            split_raw_frame->user_data = user_data;
+            split_raw_frame->max_user_data = max_user_data;
+            split_raw_frame->num_user_data = 0;
+            split_raw_frame->user_data_buf = user_data_buf;
+            split_raw_frame->user_data_buf_size = user_data_buf_size;
+            split_raw_frame->user_data_buf_len = 0;
             memset( split_raw_frame->audio_frame.audio_data, 0, sizeof(split_raw_frame->audio_frame.audio_data) );
-            split_raw_frame->audio_frame.linesize = split_raw_frame->audio_frame.num_channels = 0;
+            split_raw_frame->audio_frame.num_channels = 0;
             split_raw_frame->audio_frame.channel_layout = output_stream->channel_layout;
 
-            if( av_samples_alloc( split_raw_frame->audio_frame.audio_data, &split_raw_frame->audio_frame.linesize, num_channels,
-                                  split_raw_frame->audio_frame.num_samples, split_raw_frame->audio_frame.sample_fmt, 0 ) < 0 )
+            if( planar )
             {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                return NULL;
+                split_raw_frame->audio_frame.buf = av_buffer_ref( raw_frame->audio_frame.buf );
+                if( !split_raw_frame->audio_frame.buf )
+                {
+                    syslog( LOG_ERR, "Malloc failed\n" );
+                    return NULL;
+                }
+
+                for( int j = 0; j < num_channels; j++ )
+                    split_raw_frame->audio_frame.audio_data[j] = raw_frame->audio_frame.audio_data[first_channel+j];
+            }
+            else
+            {
+                /* Packed samples need their own buffer with just the selected channels */
+                split_raw_frame->audio_frame.buf = NULL;
+                split_raw_frame->audio_frame.linesize = 0;
+                split_raw_frame->release_data = obe_release_audio_data;
+
+                if( av_samples_alloc( split_raw_frame->audio_frame.audio_data, &split_raw_frame->audio_frame.linesize, num_channels,
+                                      split_raw_frame->audio_frame.num_samples, split_raw_frame->audio_frame.sample_fmt, 0 ) < 0 )
+                {
+                    syslog( LOG_ERR, "Malloc failed\n" );
+                    return NULL;
+                }
+
+                sample_size = av_get_bytes_per_sample( split_raw_frame->audio_frame.sample_fmt );
+                for( int j = 0; j < split_raw_frame->audio_frame.num_samples; j++ )
+                {
+                    memcpy( &split_raw_frame->audio_frame.audio_data[0][j*num_channels*sample_size],
+                            &raw_frame->audio_frame.audio_data[0][(j*raw_frame->audio_frame.num_channels+first_channel)*sample_size],
+                            num_channels*sample_size );
+                }
             }
-
-            /* TODO: offset the channel pointers by the user's request */
-            av_samples_copy( split_raw_frame->audio_frame.audio_data,
-                             &raw_frame->audio_frame.audio_data[((output_stream->sdi_audio_pair-1)<<1)+output_stream->mono_channel], 0, 0,
-                             split_raw_frame->audio_frame.num_samples, num_channels, split_raw_frame->audio_frame.sample_fmt );
 
             split_raw_frame->pts += (int64_t)output_stream->audio_offset * OBE_CLOCK/1000;
 
             add_to_encode_queue( h, split_raw_frame, h->encoders[i]->output_stream_id );
         }
 
+        OBE_STAT_ADD( filter->frames_out, 1 );
         remove_from_queue( &filter->queue );
         raw_frame->release_data( raw_frame );
         raw_frame->release_frame( raw_frame );
@@ -88,7 +88,7 @@ static void write_itu_t_codes( bs_t *s )
 }
 
 /* TODO: factor shared code out from 608 and 708 */
-int write_608_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
+int write_608_cc( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     bs_t q, r;
     uint8_t temp[1000];
@@ -166,12 +166,7 @@ int write_608_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
     bs_flush( &r );
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &r ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    if( obe_alloc_user_data_payload( h, raw_frame, user_data, bs_pos( &r ) >> 3 ) < 0 )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
         return -1;
@@ -182,7 +177,7 @@ int write_608_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
     return 0;
 }
 
-static int write_708_cc( obe_user_data_t *user_data, uint8_t *start, int cc_count )
+static int write_708_cc( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame, uint8_t *start, int cc_count )
 {
     bs_t s;
     uint8_t temp[1000];
@@ -216,12 +211,7 @@ static int write_708_cc( obe_user_data_t *user_data, uint8_t *start, int cc_coun
     bs_flush( &s );
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &s ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    if( obe_alloc_user_data_payload( h, raw_frame, user_data, bs_pos( &s ) >> 3 ) < 0 )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
         return -1;
@@ -232,7 +222,7 @@ static int write_708_cc( obe_user_data_t *user_data, uint8_t *start, int cc_coun
     return 0;
 }
 
-int read_cdp( obe_user_data_t *user_data )
+int read_cdp( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     uint8_t *start = NULL, calc_cs = 0;
     int cc_count = 0;
@@ -343,7 +333,7 @@ int read_cdp( obe_user_data_t *user_data )
     if( !cc_count )
         return 1;
 
-    if( write_708_cc( user_data, start, cc_count ) < 0 )
+    if( write_708_cc( h, user_data, raw_frame, start, cc_count ) < 0 )
         return -1;
 
     return 0;
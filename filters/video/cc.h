@@ -24,7 +24,7 @@
 #ifndef OBE_FILTERS_VIDEO_CC_H
 #define OBE_FILTERS_VIDEO_CC_H
 
-int write_608_cc( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame );
-int read_cdp( obe_user_data_t *user_data );
+int write_608_cc( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame );
+int read_cdp( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame );
 
 #endif
@@ -0,0 +1,154 @@
+/*****************************************************************************
+ * scale.c: horizontal polyphase scaler
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+/* Only resizes horizontally, which is all the SD and 1440/1280 wide HD outputs need,
+ * so the vertical and colourspace work of swscale is avoided */
+
+#include <math.h>
+#include <libavutil/cpu.h>
+#include "common/common.h"
+#include "scale.h"
+#include "x86/vfilter.h"
+
+#define LANCZOS_TAPS 3
+
+static double lanczos( double x )
+{
+    if( x == 0.0 )
+        return 1.0;
+    if( fabs( x ) >= LANCZOS_TAPS )
+        return 0.0;
+
+    return LANCZOS_TAPS * sin( M_PI * x ) * sin( M_PI * x / LANCZOS_TAPS ) / (M_PI * M_PI * x * x);
+}
+
+void obe_hscale_row_c( const uint16_t *src, uint16_t *dst, int dst_width, const int32_t *pos,
+                       const int16_t *coefs, int filter_size )
+{
+    for( int i = 0; i < dst_width; i++ )
+    {
+        const uint16_t *s = src + pos[i];
+        int sum = 1 << (OBE_HSCALE_COEF_BITS - 1);
+
+        for( int k = 0; k < filter_size; k++ )
+            sum += s[k] * OBE_HSCALE_COEF( coefs, filter_size, i, k );
+
+        dst[i] = av_clip( sum >> OBE_HSCALE_COEF_BITS, 0, 1023 );
+    }
+}
+
+int obe_hscale_init( obe_hscale_t *s, int src_width, int dst_width, int chroma, int cpu_flags )
+{
+    double scale = (double)src_width / dst_width;
+    /* Widen the filter when downscaling so it also removes what the output can't represent */
+    double filter_scale = FFMAX( scale, 1.0 );
+    double radius = LANCZOS_TAPS * filter_scale;
+    int padded_width = FFALIGN( dst_width, 4 );
+    double *weights;
+
+    memset( s, 0, sizeof(*s) );
+    s->src_width = src_width;
+    s->dst_width = dst_width;
+    /* Enough taps either side of the centre for the whole kernel wherever the centre falls */
+    s->filter_size = FFALIGN( (int)ceil( 2 * radius ) + 4, 8 );
+
+    if( src_width < s->filter_size )
+    {
+        syslog( LOG_ERR, "Scaler input is too narrow\n" );
+        return -1;
+    }
+
+    s->pos = av_malloc( padded_width * sizeof(*s->pos) );
+    s->coefs = av_malloc( padded_width * s->filter_size * sizeof(*s->coefs) );
+    weights = malloc( s->filter_size * sizeof(*weights) );
+    if( !s->pos || !s->coefs || !weights )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        free( weights );
+        obe_hscale_close( s );
+        return -1;
+    }
+
+    for( int i = 0; i < padded_width; i++ )
+    {
+        /* The padding repeats the last output */
+        int x = FFMIN( i, dst_width - 1 );
+        double centre, sum = 0.0;
+        int start, clipped_start, total = 0, max_k = 0;
+
+        /* Position of the output sample in source samples. Chroma is co-sited with even luma samples */
+        if( chroma )
+            centre = ((2 * x + 0.5) * scale - 0.5) / 2;
+        else
+            centre = (x + 0.5) * scale - 0.5;
+
+        start = (int)floor( centre ) - s->filter_size / 2 + 1;
+
+        for( int k = 0; k < s->filter_size; k++ )
+        {
+            weights[k] = lanczos( (start + k - centre) / filter_scale );
+            sum += weights[k];
+        }
+
+        /* Taps past either edge of the line use the edge sample, so fold them onto it
+         * and move the filter so it only reads inside the line */
+        clipped_start = av_clip( start, 0, src_width - s->filter_size );
+        for( int k = 0; k < s->filter_size; k++ )
+            OBE_HSCALE_COEF( s->coefs, s->filter_size, i, k ) = 0;
+
+        for( int k = 0; k < s->filter_size; k++ )
+        {
+            int tap = av_clip( start + k, 0, src_width - 1 ) - clipped_start;
+            int coef = lrint( weights[k] / sum * (1 << OBE_HSCALE_COEF_BITS) );
+            OBE_HSCALE_COEF( s->coefs, s->filter_size, i, tap ) += coef;
+        }
+
+        /* Make the coefficients sum to exactly one so flat areas stay flat */
+        for( int k = 0; k < s->filter_size; k++ )
+        {
+            int16_t coef = OBE_HSCALE_COEF( s->coefs, s->filter_size, i, k );
+            total += coef;
+            if( coef > OBE_HSCALE_COEF( s->coefs, s->filter_size, i, max_k ) )
+                max_k = k;
+        }
+        OBE_HSCALE_COEF( s->coefs, s->filter_size, i, max_k ) += (1 << OBE_HSCALE_COEF_BITS) - total;
+
+        s->pos[i] = clipped_start;
+    }
+
+    free( weights );
+
+    s->scale_row = obe_hscale_row_c;
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+        s->scale_row = obe_hscale_row_avx2;
+#endif
+
+    return 0;
+}
+
+void obe_hscale_close( obe_hscale_t *s )
+{
+    av_freep( &s->pos );
+    av_freep( &s->coefs );
+}
@@ -0,0 +1,60 @@
+/*****************************************************************************
+ * scale.h : OBE horizontal scaler
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+#ifndef OBE_FILTERS_VIDEO_SCALE_H
+#define OBE_FILTERS_VIDEO_SCALE_H
+
+/* Coefficients have 14 fractional bits */
+#define OBE_HSCALE_COEF_BITS 14
+
+/* Coefficients are stored in groups of four output samples. For each block of eight taps
+ * the group holds the eight coefficients of each of its four outputs in turn */
+#define OBE_HSCALE_COEF( coefs, filter_size, i, k ) \
+    (coefs)[((i) & ~3) * (filter_size) + ((k) & ~7) * 4 + ((i) & 3) * 8 + ((k) & 7)]
+
+typedef void (*obe_hscale_row_t)( const uint16_t *src, uint16_t *dst, int dst_width, const int32_t *pos,
+                                  const int16_t *coefs, int filter_size );
+
+/* Lanczos3 polyphase scaler for one plane of 10-bit samples. Output sample i is the sum of filter_size
+ * source samples from pos[i]. The tables are padded to a multiple of four outputs, which is also how
+ * much the scale_row functions write */
+typedef struct
+{
+    int src_width;
+    int dst_width;
+    int filter_size; /* Multiple of eight */
+
+    int32_t *pos;
+    int16_t *coefs;
+
+    obe_hscale_row_t scale_row;
+} obe_hscale_t;
+
+/* Chroma is co-sited with the even luma samples. The source must be at least filter_size samples wide */
+int obe_hscale_init( obe_hscale_t *s, int src_width, int dst_width, int chroma, int cpu_flags );
+void obe_hscale_close( obe_hscale_t *s );
+
+void obe_hscale_row_c( const uint16_t *src, uint16_t *dst, int dst_width, const int32_t *pos,
+                       const int16_t *coefs, int filter_size );
+
+#endif
@@ -28,36 +28,91 @@
 #include "video.h"
 #include "cc.h"
 #include "dither.h"
+#include "scale.h"
 #include "x86/vfilter.h"
 #include "input/sdi/sdi.h"
 
 
+/* Default maximum number of helper threads for the row operations */
+#define VIDEO_FILTER_THREADS 3
+
 #if X264_BIT_DEPTH > 8
 typedef uint16_t pixel;
 #else
 typedef uint8_t pixel;
 #endif
 
+/* Number of image sizes the pool keeps at once. Each rendition can have a scaled and a downconverted size */
+#define IMAGE_POOL_FORMATS 12
+
 typedef struct
 {
-    /* cpu flags */
-    uint32_t avutil_cpu;
+    int csp;
+    int width;
+    int height;
 
-    /* upscaling */
-    void (*scale_plane)( uint16_t *src, int stride, int width, int height, int lshift, int rshift );
+    int num_images;
+    obe_image_t images[OBE_POOL_FRAMES_PER_STREAM];
+} obe_image_bucket_t;
+
+/* Output images of the filter are recycled here when the encoder releases them.
+ * Frames can still be queued for the encoder after the filter has exited,
+ * so the pool is freed by whichever of the filter and the last frame finishes last */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    int closed;
+    int num_outstanding;
+
+    int num_buckets;
+    obe_image_bucket_t buckets[IMAGE_POOL_FORMATS];
+} obe_image_pool_t;
+
+/* A distinct picture made by the filter and the encoders which take it */
+typedef struct
+{
+    int width;
+    int height;
+    int target_csp;
+    int is_wide;
 
     /* resize */
+    int scaler;
     struct SwsContext *sws_ctx;
     int sws_ctx_flags;
     enum PixelFormat dst_pix_fmt;
+    obe_hscale_t hscale[2]; /* luma, chroma */
 
-    /* downsample */
-    void (*downsample_chroma_row_top)( uint16_t *src, uint16_t *dst, int width, int stride );
-    void (*downsample_chroma_row_bottom)( uint16_t *src, uint16_t *dst, int width, int stride );
+    int num_output_stream_ids;
+    int output_stream_ids[MAX_STREAMS];
+} obe_vid_filter_output_t;
 
-    /* dither */
-    void (*dither_row_10_to_8)( uint16_t *src, uint8_t *dst, const uint16_t *dithers, int width, int stride );
+typedef struct
+{
+    /* cpu flags */
+    uint32_t avutil_cpu;
+
+    /* outputs */
+    int num_outputs;
+    obe_vid_filter_output_t outputs[MAX_STREAMS];
+
+    /* downsample and dither */
+    obe_vid_filter_dsp_t dsp;
     int16_t *error_buf;
+
+    /* image pool */
+    obe_filter_t *filter;
+    obe_image_pool_t *image_pool;
+
+    /* slice threads */
+    int has_slice_pool;
+    obe_slice_pool_t slice_pool;
+    int num_slices;
+    obe_image_t *slice_src;
+    obe_image_t *slice_dst;
+    obe_hscale_t *slice_hscale;
+    uint16_t *scratch[OBE_MAX_SLICE_THREADS+1];
+    int scratch_stride;
 } obe_vid_filter_ctx_t;
 
 typedef struct
@@ -204,45 +259,135 @@ static void downsample_chroma_row_bottom_c( uint16_t *src, uint16_t *dst, int wi
         dst[i] = (src[i] + 3*srcf[i] + 2) >> 2;
 }
 
-static void init_filter( obe_vid_filter_ctx_t *vfilt )
+/* Progressive. Note: srcf is the next line */
+static void downsample_chroma_row_avg_c( uint16_t *src, uint16_t *dst, int width, int stride )
 {
-    vfilt->avutil_cpu = av_get_cpu_flags();
-
-#if 0
-    vfilt->scale_plane = scale_plane_c;
-
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_MMX2 )
-        vfilt->scale_plane = obe_scale_plane_mmxext;
+    uint16_t *srcf = src + stride;
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_SSE2 )
-        vfilt->scale_plane = obe_scale_plane_sse2;
+    for( int i = 0; i < width/2; i++ )
+        dst[i] = (src[i] + srcf[i] + 1) >> 1;
+}
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_AVX )
-        vfilt->scale_plane = obe_scale_plane_avx;
-#endif
+static void scale_row_8_to_10_c( const uint8_t *src, const uint8_t *srcn, uint16_t *dst, int width, int weight )
+{
+    for( int i = 0; i < width; i++ )
+    {
+        int v = (weight * src[i] + (8 - weight) * srcn[i] + 1) >> 1;
+        dst[i] = v + (v >> 8);
+    }
+}
 
+void obe_init_vid_filter_dsp( obe_vid_filter_dsp_t *dsp, int cpu_flags )
+{
     /* downsampling */
-    vfilt->downsample_chroma_row_top = downsample_chroma_row_top_c;
-    vfilt->downsample_chroma_row_bottom = downsample_chroma_row_bottom_c;
+    dsp->downsample_chroma_row_top = downsample_chroma_row_top_c;
+    dsp->downsample_chroma_row_bottom = downsample_chroma_row_bottom_c;
+    dsp->downsample_chroma_row_avg = downsample_chroma_row_avg_c;
 
     /* dither */
-    vfilt->dither_row_10_to_8 = dither_row_10_to_8_c;
+    dsp->dither_row_10_to_8 = dither_row_10_to_8_c;
+
+    /* upconvert */
+    dsp->scale_row_8_to_10 = scale_row_8_to_10_c;
+
+    if( cpu_flags & AV_CPU_FLAG_SSE2 )
+    {
+        dsp->downsample_chroma_row_top = obe_downsample_chroma_row_top_sse2;
+        dsp->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_sse2;
+        dsp->downsample_chroma_row_avg = obe_downsample_chroma_row_avg_sse2;
+        dsp->scale_row_8_to_10 = obe_scale_row_8_to_10_sse2;
+    }
+
+    if( cpu_flags & AV_CPU_FLAG_SSE4 )
+        dsp->dither_row_10_to_8 = obe_dither_row_10_to_8_sse4;
+
+    if( cpu_flags & AV_CPU_FLAG_AVX )
+    {
+        dsp->downsample_chroma_row_top = obe_downsample_chroma_row_top_avx;
+        dsp->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_avx;
+        dsp->downsample_chroma_row_avg = obe_downsample_chroma_row_avg_avx;
+        dsp->dither_row_10_to_8 = obe_dither_row_10_to_8_avx;
+    }
+
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+    {
+        dsp->downsample_chroma_row_top = obe_downsample_chroma_row_top_avx2;
+        dsp->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_avx2;
+        dsp->downsample_chroma_row_avg = obe_downsample_chroma_row_avg_avx2;
+        dsp->dither_row_10_to_8 = obe_dither_row_10_to_8_avx2;
+        dsp->scale_row_8_to_10 = obe_scale_row_8_to_10_avx2;
+    }
+#endif
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_SSE2 )
+#if HAVE_AVX512
+    /* cpu_flags of zero still means C only */
+    if( (cpu_flags & AV_CPU_FLAG_AVX) && obe_cpu_has_avx512bw() )
     {
-        vfilt->downsample_chroma_row_top = obe_downsample_chroma_row_top_sse2;
-        vfilt->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_sse2;
+        dsp->downsample_chroma_row_top = obe_downsample_chroma_row_top_avx512bw;
+        dsp->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_avx512bw;
+        dsp->downsample_chroma_row_avg = obe_downsample_chroma_row_avg_avx512bw;
+        dsp->dither_row_10_to_8 = obe_dither_row_10_to_8_avx512bw;
     }
+#endif
+}
+
+static int init_filter( obe_vid_filter_ctx_t *vfilt, obe_filter_t *filter, obe_vid_filter_params_t *filter_params )
+{
+    int filter_threads = filter_params->filter_threads;
+    int num_threads = filter_threads > 0 ? FFMIN( filter_threads - 1, OBE_MAX_SLICE_THREADS ) :
+                                           obe_slice_threads( VIDEO_FILTER_THREADS );
+
+    vfilt->avutil_cpu = av_get_cpu_flags();
+
+    obe_init_vid_filter_dsp( &vfilt->dsp, vfilt->avutil_cpu );
+
+    /* Streams which only differ in how they are encoded share a picture */
+    for( int i = 0; i < filter_params->num_output_streams; i++ )
+    {
+        obe_output_stream_t *output_stream = filter_params->output_streams[i];
+        int csp = output_stream->avc_param.i_csp & X264_CSP_MASK;
+        obe_vid_filter_output_t *output = NULL;
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_SSE4 )
-        vfilt->dither_row_10_to_8 = obe_dither_row_10_to_8_sse4;
+        for( int j = 0; j < vfilt->num_outputs; j++ )
+        {
+            if( vfilt->outputs[j].width == output_stream->avc_param.i_width &&
+                vfilt->outputs[j].height == output_stream->avc_param.i_height && vfilt->outputs[j].target_csp == csp &&
+                vfilt->outputs[j].is_wide == output_stream->is_wide && vfilt->outputs[j].scaler == output_stream->scaler )
+            {
+                output = &vfilt->outputs[j];
+                break;
+            }
+        }
+
+        if( !output )
+        {
+            output = &vfilt->outputs[vfilt->num_outputs++];
+            output->width = output_stream->avc_param.i_width;
+            output->height = output_stream->avc_param.i_height;
+            output->target_csp = csp;
+            output->is_wide = output_stream->is_wide;
+            output->scaler = output_stream->scaler;
+        }
+
+        output->output_stream_ids[output->num_output_stream_ids++] = output_stream->output_stream_id;
+    }
 
-    if( vfilt->avutil_cpu & AV_CPU_FLAG_AVX )
+    vfilt->filter = filter;
+    vfilt->image_pool = calloc( 1, sizeof(*vfilt->image_pool) );
+    if( !vfilt->image_pool )
     {
-        vfilt->downsample_chroma_row_top = obe_downsample_chroma_row_top_avx;
-        vfilt->downsample_chroma_row_bottom = obe_downsample_chroma_row_bottom_avx;
-        vfilt->dither_row_10_to_8 = obe_dither_row_10_to_8_avx;
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return -1;
     }
+    pthread_mutex_init( &vfilt->image_pool->mutex, NULL );
+
+    if( obe_slice_pool_init( &vfilt->slice_pool, num_threads ) < 0 )
+        return -1;
+    vfilt->has_slice_pool = 1;
+    vfilt->num_slices = vfilt->slice_pool.num_threads + 1;
+
+    return 0;
 }
 
 static void blank_line( uint16_t *y, uint16_t *u, uint16_t *v, int width )
@@ -270,48 +415,338 @@ static void blank_lines( obe_raw_frame_t *raw_frame )
     blank_line( y, u, v, raw_frame->img.width / 2 );
 }
 
-static int resize_frame( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame, int width )
+/** Image pool **/
+/* Caller must hold pool->mutex */
+static obe_image_bucket_t *find_bucket( obe_image_pool_t *pool, const obe_image_t *img )
+{
+    for( int i = 0; i < pool->num_buckets; i++ )
+    {
+        obe_image_bucket_t *bucket = &pool->buckets[i];
+        if( bucket->csp == img->csp && bucket->width == img->width && bucket->height == img->height )
+            return bucket;
+    }
+
+    return NULL;
+}
+
+/* Caller must hold pool->mutex */
+static void empty_bucket( obe_image_bucket_t *bucket )
+{
+    for( int i = 0; i < bucket->num_images; i++ )
+        av_free( bucket->images[i].plane[0] );
+    bucket->num_images = 0;
+}
+
+static void free_image_pool( obe_image_pool_t *pool )
+{
+    pthread_mutex_destroy( &pool->mutex );
+    free( pool );
+}
+
+/* Fills in the planes and strides of img. The csp, width and height must be set */
+static int get_pooled_image( obe_vid_filter_ctx_t *vfilt, obe_image_t *img )
+{
+    obe_image_pool_t *pool = vfilt->image_pool;
+    obe_image_bucket_t *bucket;
+    int found = 0;
+
+    pthread_mutex_lock( &pool->mutex );
+    bucket = find_bucket( pool, img );
+    if( !bucket )
+    {
+        /* Reuse the last bucket if there are too many sizes in use, e.g. after a format change */
+        if( pool->num_buckets < IMAGE_POOL_FORMATS )
+            bucket = &pool->buckets[pool->num_buckets++];
+        else
+        {
+            bucket = &pool->buckets[IMAGE_POOL_FORMATS-1];
+            empty_bucket( bucket );
+        }
+
+        bucket->csp = img->csp;
+        bucket->width = img->width;
+        bucket->height = img->height;
+    }
+
+    if( bucket->num_images )
+    {
+        obe_image_t *pooled = &bucket->images[--bucket->num_images];
+        memcpy( img->plane, pooled->plane, sizeof(img->plane) );
+        memcpy( img->stride, pooled->stride, sizeof(img->stride) );
+        found = 1;
+    }
+    pool->num_outstanding++;
+    pthread_mutex_unlock( &pool->mutex );
+
+    if( found )
+        return 0;
+
+    /* 32-byte aligned strides leave room for the AVX2 kernels to write a whole register past the width */
+    if( av_image_alloc( img->plane, img->stride, img->width, img->height+1, img->csp, 32 ) < 0 )
+    {
+        pthread_mutex_lock( &pool->mutex );
+        pool->num_outstanding--;
+        pthread_mutex_unlock( &pool->mutex );
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return -1;
+    }
+    OBE_STAT_ADD( vfilt->filter->image_allocs, 1 );
+
+    return 0;
+}
+
+static void release_pooled_image( void *ptr )
+{
+    obe_raw_frame_t *raw_frame = ptr;
+    obe_image_pool_t *pool = raw_frame->image_pool;
+    obe_image_t *img = &raw_frame->alloc_img;
+    obe_image_bucket_t *bucket;
+    int destroy;
+
+    pthread_mutex_lock( &pool->mutex );
+    bucket = pool->closed ? NULL : find_bucket( pool, img );
+    if( bucket && bucket->num_images < OBE_POOL_FRAMES_PER_STREAM )
+    {
+        memcpy( &bucket->images[bucket->num_images++], img, sizeof(*img) );
+        img->plane[0] = NULL;
+    }
+    pool->num_outstanding--;
+    destroy = pool->closed && !pool->num_outstanding;
+    pthread_mutex_unlock( &pool->mutex );
+
+    av_freep( &img->plane[0] );
+
+    if( destroy )
+        free_image_pool( pool );
+}
+
+static void close_image_pool( obe_image_pool_t *pool )
+{
+    int destroy;
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->closed = 1;
+    for( int i = 0; i < pool->num_buckets; i++ )
+        empty_bucket( &pool->buckets[i] );
+    pool->num_buckets = 0;
+    destroy = !pool->num_outstanding;
+    pthread_mutex_unlock( &pool->mutex );
+
+    if( destroy )
+        free_image_pool( pool );
+}
+
+/* Replaces the picture of the frame with a pooled image */
+static void set_pooled_image( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame, obe_image_t *img )
+{
+    raw_frame->release_data( raw_frame );
+    memcpy( &raw_frame->alloc_img, img, sizeof(obe_image_t) );
+    memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
+    raw_frame->release_data = release_pooled_image;
+    raw_frame->ref_parent = NULL;
+    raw_frame->image_pool = vfilt->image_pool;
+}
+
+static int resize_frame( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_output_t *output, obe_raw_frame_t *raw_frame )
 {
     obe_image_t tmp_image = {0};
 
-    if( !vfilt->sws_ctx || raw_frame->reset_obe )
+    if( !output->sws_ctx || raw_frame->reset_obe )
     {
         if( IS_INTERLACED( raw_frame->img.format ) )
-            vfilt->dst_pix_fmt = raw_frame->img.csp;
+            output->dst_pix_fmt = raw_frame->img.csp;
         else
-            vfilt->dst_pix_fmt = raw_frame->img.csp == PIX_FMT_YUV422P10 ? PIX_FMT_YUV420P10 : PIX_FMT_YUV420P;
+            output->dst_pix_fmt = raw_frame->img.csp == PIX_FMT_YUV422P10 ? PIX_FMT_YUV420P10 : PIX_FMT_YUV420P;
 
-        vfilt->sws_ctx_flags |= SWS_FULL_CHR_H_INP | SWS_ACCURATE_RND | SWS_LANCZOS;
+        output->sws_ctx_flags |= SWS_FULL_CHR_H_INP | SWS_ACCURATE_RND | SWS_LANCZOS;
 
-        vfilt->sws_ctx = sws_getContext( raw_frame->img.width, raw_frame->img.height, raw_frame->img.csp,
-                                         width, raw_frame->img.height, vfilt->dst_pix_fmt,
-                                         vfilt->sws_ctx_flags, NULL, NULL, NULL );
-        if( !vfilt->sws_ctx )
+        /* Only progressive renditions may differ in height, as the fields would need deinterlacing */
+        output->sws_ctx = sws_getContext( raw_frame->img.width, raw_frame->img.height, raw_frame->img.csp,
+                                          output->width, output->height, output->dst_pix_fmt,
+                                          output->sws_ctx_flags, NULL, NULL, NULL );
+        if( !output->sws_ctx )
         {
             fprintf( stderr, "Video scaling failed\n" );
             return -1;
         }
     }
 
-    tmp_image.width = width;
-    tmp_image.height = raw_frame->img.height;
-    tmp_image.planes = av_pix_fmt_descriptors[vfilt->dst_pix_fmt].nb_components;
-    tmp_image.csp = vfilt->dst_pix_fmt;
+    tmp_image.width = output->width;
+    tmp_image.height = output->height;
+    tmp_image.planes = av_pix_fmt_descriptors[output->dst_pix_fmt].nb_components;
+    tmp_image.csp = output->dst_pix_fmt;
     tmp_image.format = raw_frame->img.format;
 
-    if( av_image_alloc( tmp_image.plane, tmp_image.stride, tmp_image.width, tmp_image.height+1,
-                        tmp_image.csp, 16 ) < 0 )
+    if( get_pooled_image( vfilt, &tmp_image ) < 0 )
+        return -1;
+
+    sws_scale( output->sws_ctx, (const uint8_t* const*)raw_frame->img.plane, raw_frame->img.stride,
+               0, tmp_image.height, tmp_image.plane, tmp_image.stride );
+
+    set_pooled_image( vfilt, raw_frame, &tmp_image );
+
+    return 0;
+}
+
+static void hscale_slice( void *ptr, int slice, int num_slices )
+{
+    obe_vid_filter_ctx_t *vfilt = ptr;
+    obe_image_t *img = vfilt->slice_src;
+    obe_image_t *out = vfilt->slice_dst;
+
+    for( int i = 0; i < img->planes; i++ )
     {
-        syslog( LOG_ERR, "Malloc failed\n" );
+        obe_hscale_t *s = &vfilt->slice_hscale[!!i];
+        int height = obe_cli_csps[img->csp].height[i] * img->height;
+        int start = (height * slice) / num_slices;
+        int end = (height * (slice + 1)) / num_slices;
+
+        for( int j = start; j < end; j++ )
+            s->scale_row( (uint16_t*)(img->plane[i] + j * img->stride[i]), (uint16_t*)(out->plane[i] + j * out->stride[i]),
+                          s->dst_width, s->pos, s->coefs, s->filter_size );
+    }
+}
+
+/* Horizontal resize of 10-bit planar 4:2:2 or 4:2:0 with the polyphase scaler. The format is unchanged */
+static int hscale_frame( obe_vid_filter_ctx_t *vfilt, obe_vid_filter_output_t *output, obe_raw_frame_t *raw_frame )
+{
+    obe_image_t tmp_image = {0};
+
+    if( output->hscale[0].src_width != raw_frame->img.width || output->hscale[0].dst_width != output->width )
+    {
+        obe_hscale_close( &output->hscale[0] );
+        obe_hscale_close( &output->hscale[1] );
+
+        if( obe_hscale_init( &output->hscale[0], raw_frame->img.width, output->width, 0, vfilt->avutil_cpu ) < 0 ||
+            obe_hscale_init( &output->hscale[1], raw_frame->img.width / 2, output->width / 2, 1, vfilt->avutil_cpu ) < 0 )
+            return -1;
+    }
+
+    tmp_image.width = output->width;
+    tmp_image.height = raw_frame->img.height;
+    tmp_image.planes = raw_frame->img.planes;
+    tmp_image.csp = raw_frame->img.csp;
+    tmp_image.format = raw_frame->img.format;
+
+    if( get_pooled_image( vfilt, &tmp_image ) < 0 )
         return -1;
+
+    vfilt->slice_src = &raw_frame->img;
+    vfilt->slice_dst = &tmp_image;
+    vfilt->slice_hscale = output->hscale;
+    obe_slice_pool_run( &vfilt->slice_pool, hscale_slice, vfilt, vfilt->num_slices );
+
+    set_pooled_image( vfilt, raw_frame, &tmp_image );
+
+    return 0;
+}
+
+/* The SIMD versions only convert whole blocks of 16 pixels as the 8-bit picture may come from a decoder
+ * which does not pad its lines. The rest of the line is converted in C */
+static void scale_row_8_to_10( obe_vid_filter_dsp_t *dsp, const uint8_t *src, const uint8_t *srcn, uint16_t *dst,
+                               int width, int weight )
+{
+    int w = width & ~15;
+
+    if( w )
+        dsp->scale_row_8_to_10( src, srcn, dst, w, weight );
+
+    scale_row_8_to_10_c( src + w, srcn + w, dst + w, width - w, weight );
+}
+
+/* Each output line is computed from at most two input lines so bands can start anywhere.
+ * 4:2:0 chroma is interpolated linearly between the two nearest chroma lines, within the field if interlaced.
+ * Progressive chroma is midway between two luma lines. Interlaced chroma is a quarter of the way down
+ * from the first luma line of its pair in the top field and three quarters in the bottom field */
+static void upconvert_slice( void *ptr, int slice, int num_slices )
+{
+    obe_vid_filter_ctx_t *vfilt = ptr;
+    obe_image_t *img = vfilt->slice_src;
+    obe_image_t *out = vfilt->slice_dst;
+    int interlaced = IS_INTERLACED( img->format );
+    int upsample = img->csp == PIX_FMT_YUV420P;
+    int start = (img->height * slice) / num_slices;
+    int end = (img->height * (slice + 1)) / num_slices;
+
+    for( int i = 0; i < img->planes; i++ )
+    {
+        int width = i ? img->width / 2 : img->width;
+        int chroma_height = (img->height + 1) / 2;
+
+        for( int j = start; j < end; j++ )
+        {
+            uint16_t *dst = (uint16_t*)(out->plane[i] + j * out->stride[i]);
+            const uint8_t *src, *srcn;
+            int line = j, next = j, weight = 8;
+
+            if( i && upsample && interlaced )
+            {
+                /* Line k of the field's chroma is line 2*k + field of the plane */
+                int field = j & 1;
+                int field_line = j >> 1;
+                int k = field_line >> 1;
+                int lower = field_line & 1;
+                int nk = av_clip( lower ? k + 1 : k - 1, 0, chroma_height / 2 - 1 );
+
+                line = 2 * k + field;
+                next = 2 * nk + field;
+                weight = (lower ^ field) ? 5 : 7;
+            }
+            else if( i && upsample )
+            {
+                line = j >> 1;
+                next = av_clip( j & 1 ? line + 1 : line - 1, 0, chroma_height - 1 );
+                weight = 6;
+            }
+
+            src = img->plane[i] + line * img->stride[i];
+            srcn = img->plane[i] + next * img->stride[i];
+            scale_row_8_to_10( &vfilt->dsp, src, srcn, dst, width, weight );
+        }
     }
+}
 
-    sws_scale( vfilt->sws_ctx, (const uint8_t* const*)raw_frame->img.plane, raw_frame->img.stride,
-               0, tmp_image.height, tmp_image.plane, tmp_image.stride );
+/* Brings 8-bit 4:2:0 and 4:2:2 up to the 10-bit 4:2:2 the rest of the filter works in, in one pass */
+static int upconvert_image( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+{
+    obe_image_t tmp_image = {0};
 
-    raw_frame->release_data( raw_frame );
-    memcpy( &raw_frame->alloc_img, &tmp_image, sizeof(obe_image_t) );
-    memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
+    tmp_image.csp = PIX_FMT_YUV422P10;
+    tmp_image.width = raw_frame->img.width;
+    tmp_image.height = raw_frame->img.height;
+    tmp_image.planes = av_pix_fmt_descriptors[tmp_image.csp].nb_components;
+    tmp_image.format = raw_frame->img.format;
+
+    if( get_pooled_image( vfilt, &tmp_image ) < 0 )
+        return -1;
+
+    vfilt->slice_src = &raw_frame->img;
+    vfilt->slice_dst = &tmp_image;
+    obe_slice_pool_run( &vfilt->slice_pool, upconvert_slice, vfilt, vfilt->num_slices );
+
+    set_pooled_image( vfilt, raw_frame, &tmp_image );
+
+    return 0;
+}
+
+/* 8-bit frames which are already what every encoder takes, such as those from the direct v210 conversion,
+ * are passed through. Any other 8-bit frame is upconverted */
+static int needs_upconvert( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+{
+    int csp = raw_frame->img.csp;
+
+    if( csp != PIX_FMT_YUV420P && csp != PIX_FMT_YUV422P )
+        return 0;
+
+    if( X264_BIT_DEPTH != 8 )
+        return 1;
+
+    for( int i = 0; i < vfilt->num_outputs; i++ )
+    {
+        if( raw_frame->img.width != vfilt->outputs[i].width || raw_frame->img.height != vfilt->outputs[i].height ||
+            (csp == PIX_FMT_YUV420P ? X264_CSP_I420 : X264_CSP_I422) != vfilt->outputs[i].target_csp )
+            return 1;
+    }
 
     return 0;
 }
@@ -398,55 +833,138 @@ static int dither_image( obe_raw_frame_t *raw_frame, int16_t *error_buf )
 
 #endif
 
-static int downconvert_image_interlaced( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
+/* Each band is a whole number of line groups, four lines if interlaced so both fields of the chroma
+ * are downsampled together, otherwise two. If the output is 8-bit each group of chroma lines is dithered
+ * from scratch lines whilst still in cache, giving the same result as dither_image() on a 10-bit image */
+static void downconvert_slice( void *ptr, int slice, int num_slices )
+{
+    obe_vid_filter_ctx_t *vfilt = ptr;
+    obe_image_t *img = vfilt->slice_src;
+    obe_image_t *out = vfilt->slice_dst;
+    int interlaced = IS_INTERLACED( img->format );
+    int out_lines = interlaced ? 2 : 1;
+    int dither = out->csp == PIX_FMT_YUV420P;
+    int start = (img->height * slice) / num_slices;
+    int end = (img->height * (slice + 1)) / num_slices;
+
+    if( dither )
+    {
+        for( int j = start; j < end; j++ )
+            vfilt->dsp.dither_row_10_to_8( (uint16_t*)(img->plane[0] + j * img->stride[0]), out->plane[0] + j * out->stride[0],
+                                           obe_dithers[j&7], img->width, 0 );
+    }
+    else
+        av_image_copy_plane( out->plane[0] + start * out->stride[0], out->stride[0],
+                             img->plane[0] + start * img->stride[0], img->stride[0],
+                             img->width * 2, end - start );
+
+    for( int i = 1; i < out->planes; i++ )
+    {
+        int num_interleaved = csp_num_interleaved( img->csp, i );
+        int height = obe_cli_csps[out->csp].height[i] * img->height;
+        int width = obe_cli_csps[out->csp].width[i] * img->width / num_interleaved;
+        int num_groups = (height + out_lines - 1) / out_lines;
+        int first = (num_groups * slice) / num_slices;
+        int last = (num_groups * (slice + 1)) / num_slices;
+
+        for( int j = first; j < last; j++ )
+        {
+            int row = j * out_lines;
+            uint16_t *src = (uint16_t*)(img->plane[i] + 2 * row * img->stride[i]);
+            uint16_t *dst[2];
+
+            for( int k = 0; k < out_lines; k++ )
+                dst[k] = dither ? vfilt->scratch[slice] + k * vfilt->scratch_stride :
+                                  (uint16_t*)(out->plane[i] + (row + k) * out->stride[i]);
+
+            if( interlaced )
+            {
+                uint16_t *srcp = src + img->stride[i] / 2;
+                vfilt->dsp.downsample_chroma_row_top( src, dst[0], width*2, img->stride[i] );
+                vfilt->dsp.downsample_chroma_row_bottom( srcp, dst[1], width*2, img->stride[i] );
+            }
+            else
+                vfilt->dsp.downsample_chroma_row_avg( src, dst[0], width*2, img->stride[i] / 2 );
+
+            if( dither )
+            {
+                for( int k = 0; k < out_lines; k++ )
+                    vfilt->dsp.dither_row_10_to_8( dst[k], out->plane[i] + (row + k) * out->stride[i],
+                                                   obe_dithers[(row + k)&7], width, 0 );
+            }
+        }
+    }
+}
+
+/* Downconverts 4:2:2 to 4:2:0, dithering to 8-bit in the same pass if dither is set */
+static int downconvert_image( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame, int dither )
 {
     obe_image_t *img = &raw_frame->img;
     obe_image_t tmp_image = {0};
     obe_image_t *out = &tmp_image;
 
-    /* FIXME: support 8-bit. Note hardcoded width*2 below. */
-    tmp_image.csp = PIX_FMT_YUV420P10;
+    tmp_image.csp = dither ? PIX_FMT_YUV420P : PIX_FMT_YUV420P10;
     tmp_image.width = raw_frame->img.width;
     tmp_image.height = raw_frame->img.height;
     tmp_image.planes = av_pix_fmt_descriptors[tmp_image.csp].nb_components;
     tmp_image.format = raw_frame->img.format;
 
-    if( av_image_alloc( tmp_image.plane, tmp_image.stride, tmp_image.width, tmp_image.height+1,
-                        tmp_image.csp, 16 ) < 0 )
+    /* Two lines of downsampled chroma per slice. The SIMD versions write past the end of the line */
+    if( dither && vfilt->scratch_stride < FFALIGN( img->width / 2, 32 ) + 32 )
     {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
+        vfilt->scratch_stride = FFALIGN( img->width / 2, 32 ) + 32;
+        for( int i = 0; i < vfilt->num_slices; i++ )
+        {
+            av_free( vfilt->scratch[i] );
+            vfilt->scratch[i] = av_malloc( 2 * vfilt->scratch_stride * sizeof(uint16_t) );
+            if( !vfilt->scratch[i] )
+            {
+                vfilt->scratch_stride = 0;
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return -1;
+            }
+        }
     }
 
-    av_image_copy_plane( (uint8_t*)tmp_image.plane[0], tmp_image.stride[0],
-                         (const uint8_t *)raw_frame->img.plane[0], raw_frame->img.stride[0],
-                          raw_frame->img.width * 2, raw_frame->img.height );
+    if( get_pooled_image( vfilt, &tmp_image ) < 0 )
+        return -1;
+
+    vfilt->slice_src = img;
+    vfilt->slice_dst = out;
+    obe_slice_pool_run( &vfilt->slice_pool, downconvert_slice, vfilt, vfilt->num_slices );
+
+    set_pooled_image( vfilt, raw_frame, out );
+
+    return 0;
+}
+
+/* The dither pattern depends on the line number in the plane so bands give the same output as the whole image */
+static void dither_slice( void *ptr, int slice, int num_slices )
+{
+    obe_vid_filter_ctx_t *vfilt = ptr;
+    obe_image_t *img = vfilt->slice_src;
+    obe_image_t *out = vfilt->slice_dst;
 
-    for( int i = 1; i < tmp_image.planes; i++ )
+    for( int i = 0; i < img->planes; i++ )
     {
         int num_interleaved = csp_num_interleaved( img->csp, i );
-        int height = obe_cli_csps[out->csp].height[i] * img->height;
-        int width = obe_cli_csps[out->csp].width[i] * img->width / num_interleaved;
-        uint16_t *src = (uint16_t*)img->plane[i];
-        uint16_t *dst = (uint16_t*)out->plane[i];
+        int height = obe_cli_csps[img->csp].height[i] * img->height;
+        int width = obe_cli_csps[img->csp].width[i] * img->width / num_interleaved;
+        int start = (height * slice) / num_slices;
+        int end = (height * (slice + 1)) / num_slices;
+        uint16_t *src = (uint16_t*)(img->plane[i] + start * img->stride[i]);
+        uint8_t *dst = out->plane[i] + start * out->stride[i];
 
-        for( int j = 0; j < height; j += 2 )
+        for( int j = start; j < end; j++ )
         {
-            uint16_t *srcp = (uint16_t*)src + img->stride[i] / 2;
-            uint16_t *dstp = (uint16_t*)dst + out->stride[i] / 2;
-            vfilt->downsample_chroma_row_top( src, dst, width*2, img->stride[i] );
-            vfilt->downsample_chroma_row_bottom( srcp, dstp, width*2, img->stride[i] );
+            const uint16_t *dither = obe_dithers[j&7];
 
-            src += img->stride[i] * 2;
+            vfilt->dsp.dither_row_10_to_8( src, dst, dither, width, img->stride[i] );
+
+            src += img->stride[i] / 2;
             dst += out->stride[i];
         }
     }
-
-    raw_frame->release_data( raw_frame );
-    memcpy( &raw_frame->alloc_img, out, sizeof(obe_image_t) );
-    memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
-
-    return 0;
 }
 
 static int dither_image( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame )
@@ -461,47 +979,179 @@ static int dither_image( obe_vid_filter_ctx_t *vfilt, obe_raw_frame_t *raw_frame
     tmp_image.planes = av_pix_fmt_descriptors[tmp_image.csp].nb_components;
     tmp_image.format = raw_frame->img.format;
 
-    if( av_image_alloc( tmp_image.plane, tmp_image.stride, tmp_image.width, tmp_image.height+1,
-                        tmp_image.csp, 16 ) < 0 )
-    {
-        syslog( LOG_ERR, "Malloc failed\n" );
+    if( get_pooled_image( vfilt, &tmp_image ) < 0 )
         return -1;
+
+    vfilt->slice_src = img;
+    vfilt->slice_dst = out;
+    obe_slice_pool_run( &vfilt->slice_pool, dither_slice, vfilt, vfilt->num_slices );
+
+    set_pooled_image( vfilt, raw_frame, &tmp_image );
+
+    return 0;
+}
+
+/** Direct conversion from v210 **/
+/* Returns the format of the frames which the filter would pass straight to the encoder, or PIX_FMT_NONE
+ * if the input must send 4:2:2. Only HD is supported as SD needs the 4:2:2 lines for VBI and blanking.
+ * Renditions are made from the 4:2:2 picture so there must be a single video stream encoded from the device.
+ * Interlaced chroma is downsampled exactly as downconvert_image() would. Progressive chroma is only averaged
+ * over line pairs, not Lanczos filtered as swscale does, so this is only used if the stream asks for the
+ * polyphase scaler, which downsamples progressive chroma the same way */
+int obe_video_filter_direct_csp( obe_t *h, obe_device_t *device, int video_format, int width, int height )
+{
+    obe_output_stream_t *output_stream = NULL;
+    int input_stream_id = -1, num_video_streams = 0;
+
+    for( int i = 0; i < device->num_input_streams; i++ )
+    {
+        if( device->streams[i]->stream_format == VIDEO_UNCOMPRESSED )
+            input_stream_id = device->streams[i]->input_stream_id;
     }
 
-    for( int i = 0; i < img->planes; i++ )
+    for( int i = 0; i < h->num_output_streams; i++ )
     {
-        //const int src_depth = av_pix_fmt_descriptors[img->csp].comp[i].depth_minus1+1;
-        //const int dst_depth = av_pix_fmt_descriptors[out->csp].comp[i].depth_minus1+1;
+        if( h->output_streams[i].stream_action == STREAM_ENCODE && h->output_streams[i].stream_format == VIDEO_AVC &&
+            h->output_streams[i].input_stream_id == input_stream_id )
+        {
+            output_stream = &h->output_streams[i];
+            num_video_streams++;
+        }
+    }
 
-        //uint16_t scale = obe_dither_scale[dst_depth-1][src_depth-1];
-        //int shift = src_depth-dst_depth + obe_dither_scale[src_depth-2][dst_depth-1];
+    if( num_video_streams != 1 || IS_SD( video_format ) || output_stream->avc_param.i_width != width ||
+        output_stream->avc_param.i_height != height ||
+        (output_stream->avc_param.i_csp & X264_CSP_MASK) != X264_CSP_I420 ||
+        (!IS_INTERLACED( video_format ) && output_stream->scaler != OBE_SCALER_POLYPHASE) )
+        return PIX_FMT_NONE;
 
-        int num_interleaved = csp_num_interleaved( img->csp, i );
-        int height = obe_cli_csps[img->csp].height[i] * img->height;
-        int width = obe_cli_csps[img->csp].width[i] * img->width / num_interleaved;
-        uint16_t *src = (uint16_t*)img->plane[i];
-        uint8_t *dst = out->plane[i];
+    return X264_BIT_DEPTH == 8 ? PIX_FMT_YUV420P : PIX_FMT_YUV420P10;
+}
+
+int obe_v210_convert_init( obe_v210_convert_t *conv, int width, int csp, int interlaced, int num_slices )
+{
+    memset( conv, 0, sizeof(*conv) );
+
+    conv->width = width;
+    conv->csp = csp;
+    conv->interlaced = interlaced;
+    conv->unpack = obe_get_v210_planar_unpack();
+    obe_init_vid_filter_dsp( &conv->dsp, av_get_cpu_flags() );
+
+    /* Four luma lines, four lines of each chroma plane and two downsampled lines of each chroma plane.
+     * The unpack functions write past the end of the line so pad each line */
+    conv->scratch_stride = FFALIGN( width, 32 ) + 64;
+    conv->scratch = calloc( num_slices, sizeof(*conv->scratch) );
+    if( !conv->scratch )
+        goto fail;
+    conv->num_slices = num_slices;
+
+    for( int i = 0; i < num_slices; i++ )
+    {
+        conv->scratch[i] = av_malloc( 10 * conv->scratch_stride * sizeof(uint16_t) );
+        if( !conv->scratch[i] )
+            goto fail;
+    }
 
-        for( int j = 0; j < height; j++ )
+    return 0;
+
+fail:
+    syslog( LOG_ERR, "Malloc failed\n" );
+    obe_v210_convert_close( conv );
+    return -1;
+}
+
+int obe_v210_convert_alloc_image( obe_v210_convert_t *conv, obe_image_t *img, int height )
+{
+    img->csp = conv->csp;
+    img->planes = av_pix_fmt_descriptors[img->csp].nb_components;
+    img->width = conv->width;
+    img->height = height;
+
+    /* Luma is unpacked straight into the picture in 10-bit so pad the lines */
+    if( av_image_alloc( img->plane, img->stride, FFALIGN( conv->width, 32 ) + 32, height + 1, img->csp, 32 ) < 0 )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Converts lines [start, end) of the picture. Line i is read from src[i&1] + (i>>1)*src_stride so fields
+ * can be stored separately. start and end must be a multiple of four lines if interlaced, otherwise two.
+ * Each line group is unpacked into the slice's scratch lines, which stay in L1, and then downsampled and
+ * dithered from there. This is not fused into one kernel because the unpack has a version per instruction
+ * set and the downsample and dither are shared with downconvert_image(); the extra pass is over cached
+ * lines so fusing would save little */
+void obe_v210_convert_lines( obe_v210_convert_t *conv, const uint8_t *src[2], int src_stride, obe_image_t *out,
+                             int start, int end, int slice )
+{
+    obe_vid_filter_dsp_t *dsp = &conv->dsp;
+    int group = conv->interlaced ? 4 : 2;
+    int luma_stride = conv->scratch_stride, chroma_stride = conv->scratch_stride / 2;
+    int chroma_width = conv->width / 2;
+    int high_bit_depth = conv->csp == PIX_FMT_YUV420P10;
+    uint16_t *y_tmp = conv->scratch[slice];
+    uint16_t *c_tmp[2] = { y_tmp + 4 * luma_stride, y_tmp + 4 * luma_stride + 4 * chroma_stride };
+    uint16_t *c_out[2] = { c_tmp[1] + 4 * chroma_stride, c_tmp[1] + 6 * chroma_stride };
+
+    for( int i = start; i < end; i += group )
+    {
+        for( int j = 0; j < group; j++ )
         {
-            const uint16_t *dither = obe_dithers[j&7];
+            int line = i + j;
+            const uint32_t *line_src = (const uint32_t*)(src[line & 1] + (line >> 1) * src_stride);
+            uint16_t *y = high_bit_depth ? (uint16_t*)(out->plane[0] + line * out->stride[0]) : y_tmp + j * luma_stride;
 
-            vfilt->dither_row_10_to_8( src, dst, dither, width, img->stride[i] );
+            obe_v210_decode_line( conv->unpack, line_src, y, c_tmp[0] + j * chroma_stride, c_tmp[1] + j * chroma_stride,
+                                  conv->width );
 
-            src += img->stride[i] / 2;
-            dst += out->stride[i];
+            if( !high_bit_depth )
+                dsp->dither_row_10_to_8( y, out->plane[0] + line * out->stride[0], obe_dithers[line&7], conv->width, 0 );
         }
-    }
 
-    raw_frame->release_data( raw_frame );
-    memcpy( &raw_frame->alloc_img, &tmp_image, sizeof(obe_image_t) );
-    memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(obe_image_t) );
+        for( int k = 1; k < 3; k++ )
+        {
+            int row = i / 2;
+            uint16_t *src_c = c_tmp[k-1];
+            uint16_t *dst[2];
+
+            for( int j = 0; j < group / 2; j++ )
+                dst[j] = high_bit_depth ? (uint16_t*)(out->plane[k] + (row + j) * out->stride[k]) : c_out[k-1] + j * chroma_stride;
+
+            /* Interlaced chroma is downsampled within each field */
+            if( conv->interlaced )
+            {
+                dsp->downsample_chroma_row_top( src_c, dst[0], chroma_width*2, 2 * chroma_stride );
+                dsp->downsample_chroma_row_bottom( src_c + chroma_stride, dst[1], chroma_width*2, 2 * chroma_stride );
+            }
+            else
+                dsp->downsample_chroma_row_avg( src_c, dst[0], chroma_width*2, chroma_stride );
+
+            if( !high_bit_depth )
+            {
+                for( int j = 0; j < group / 2; j++ )
+                    dsp->dither_row_10_to_8( dst[j], out->plane[k] + (row + j) * out->stride[k], obe_dithers[(row + j)&7],
+                                             chroma_width, 0 );
+            }
+        }
+    }
+}
 
-    return 0;
+void obe_v210_convert_close( obe_v210_convert_t *conv )
+{
+    if( conv->scratch )
+    {
+        for( int i = 0; i < conv->num_slices; i++ )
+            av_free( conv->scratch[i] );
+        free( conv->scratch );
+        conv->scratch = NULL;
+    }
 }
 
 /** User-data encapsulation **/
-static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
+static int write_afd( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     bs_t r;
     uint8_t temp[100];
@@ -540,12 +1190,7 @@ static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
         set_sar( raw_frame, is_wide ); // TODO check return
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &r ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    if( obe_alloc_user_data_payload( h, raw_frame, user_data, bs_pos( &r ) >> 3 ) < 0 )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
         return -1;
@@ -556,7 +1201,7 @@ static int write_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
     return 0;
 }
 
-static int write_bar_data( obe_user_data_t *user_data )
+static int write_bar_data( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     bs_t r;
     uint8_t temp[100];
@@ -608,12 +1253,7 @@ static int write_bar_data( obe_user_data_t *user_data )
     bs_flush( &r );
 
     user_data->type = USER_DATA_AVC_REGISTERED_ITU_T35;
-    user_data->len = bs_pos( &r ) >> 3;
-
-    free( user_data->data );
-
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
+    if( obe_alloc_user_data_payload( h, raw_frame, user_data, bs_pos( &r ) >> 3 ) < 0 )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
         return -1;
@@ -624,29 +1264,29 @@ static int write_bar_data( obe_user_data_t *user_data )
     return 0;
 }
 
-static int convert_wss_to_afd( obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
+static int convert_wss_to_afd( obe_t *h, obe_user_data_t *user_data, obe_raw_frame_t *raw_frame )
 {
     user_data->data[0] = (wss_to_afd[user_data->data[0]].afd_code << 3) | (wss_to_afd[user_data->data[0]].is_wide << 2);
 
-    return write_afd( user_data, raw_frame );
+    return write_afd( h, user_data, raw_frame );
 }
 
-static int encapsulate_user_data( obe_raw_frame_t *raw_frame, obe_int_input_stream_t *input_stream )
+static int encapsulate_user_data( obe_t *h, obe_raw_frame_t *raw_frame, obe_int_input_stream_t *input_stream )
 {
     int ret = 0;
 
     for( int i = 0; i < raw_frame->num_user_data; i++ )
     {
         if( raw_frame->user_data[i].type == USER_DATA_CEA_608 )
-            ret = write_608_cc( &raw_frame->user_data[i], raw_frame );
+            ret = write_608_cc( h, &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_CEA_708_CDP )
-            ret = read_cdp( &raw_frame->user_data[i] );
+            ret = read_cdp( h, &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_AFD )
-            ret = write_afd( &raw_frame->user_data[i], raw_frame );
+            ret = write_afd( h, &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_BAR_DATA )
-            ret = write_bar_data( &raw_frame->user_data[i] );
+            ret = write_bar_data( h, &raw_frame->user_data[i], raw_frame );
         else if( raw_frame->user_data[i].type == USER_DATA_WSS )
-            ret = convert_wss_to_afd( &raw_frame->user_data[i], raw_frame );
+            ret = convert_wss_to_afd( h, &raw_frame->user_data[i], raw_frame );
 
         /* FIXME: use standard return codes */
         if( ret < 0 )
@@ -654,21 +1294,123 @@ static int encapsulate_user_data( obe_raw_frame_t *raw_frame, obe_int_input_stre
 
         if( ret == 1 )
         {
-            free( raw_frame->user_data[i].data );
             memmove( &raw_frame->user_data[i], &raw_frame->user_data[i+1],
-                     sizeof(raw_frame->user_data) * (raw_frame->num_user_data-i-1) );
+                     sizeof(*raw_frame->user_data) * (raw_frame->num_user_data-i-1) );
             raw_frame->num_user_data--;
             i--;
         }
     }
 
-    if( !raw_frame->num_user_data )
+    return ret;
+}
+
+/* Makes the picture of one output from the blanked 4:2:2 or already converted input */
+static int filter_frame( obe_t *h, obe_vid_filter_ctx_t *vfilt, obe_vid_filter_output_t *output, obe_raw_frame_t *raw_frame,
+                         obe_int_input_stream_t *input_stream )
+{
+    int h_shift, v_shift, dither;
+    const AVPixFmtDescriptor *pfd;
+
+    if( av_pix_fmt_get_chroma_sub_sample( raw_frame->img.csp, &h_shift, &v_shift ) < 0 )
+        return -1;
+
+    /* Resize if necessary. The polyphase scaler only resizes horizontally, the chroma is downconverted below */
+    if( output->scaler == OBE_SCALER_POLYPHASE && raw_frame->img.height == output->height &&
+        (raw_frame->img.csp == PIX_FMT_YUV422P10 || raw_frame->img.csp == PIX_FMT_YUV420P10) )
     {
-        free( raw_frame->user_data );
-        raw_frame->user_data = NULL;
+        if( raw_frame->img.width != output->width && hscale_frame( vfilt, output, raw_frame ) < 0 )
+            return -1;
     }
+    /* swscale does the colourspace conversion too if progressive.
+     * Inputs which convert straight to 4:2:0 have already done this */
+    else if( raw_frame->img.width != output->width || raw_frame->img.height != output->height ||
+             (!IS_INTERLACED( raw_frame->img.format ) && output->target_csp == X264_CSP_I420 && !v_shift) )
+    {
+        if( resize_frame( vfilt, output, raw_frame ) < 0 )
+            return -1;
 
-    return ret;
+        if( av_pix_fmt_get_chroma_sub_sample( raw_frame->img.csp, &h_shift, &v_shift ) < 0 )
+            return -1;
+    }
+
+    pfd = av_pix_fmt_desc_get( raw_frame->img.csp );
+    dither = pfd->comp[0].depth_minus1+1 == 10 && X264_BIT_DEPTH == 8;
+
+    /* Downconvert if input is 4:2:2 and target is 4:2:0. Interlaced chroma is downsampled within each field.
+     * For an 8-bit encoder this dithers as well so the 10-bit 4:2:0 picture is never written out */
+    if( h_shift == 1 && v_shift == 0 && output->target_csp == X264_CSP_I420 )
+    {
+        if( downconvert_image( vfilt, raw_frame, dither ) < 0 )
+            return -1;
+    }
+    else if( dither )
+    {
+        if( dither_image( vfilt, raw_frame ) < 0 )
+            return -1;
+    }
+
+    if( encapsulate_user_data( h, raw_frame, input_stream ) < 0 )
+        return -1;
+
+    /* If SAR, on an SD stream, has not been updated by AFD or WSS, set to default 4:3
+     * TODO: make this user-choosable. OBE will prioritise any SAR information from AFD or WSS over any user settings */
+    if( raw_frame->sar_width == 1 && raw_frame->sar_height == 1 )
+    {
+        set_sar( raw_frame, IS_SD( raw_frame->img.format ) ? output->is_wide : 1 );
+        raw_frame->sar_guess = 1;
+    }
+
+    return 0;
+}
+
+/* The encoder releases frames itself so one which goes to several encoders is shared by a frame for each */
+static int send_to_encoders( obe_t *h, obe_vid_filter_output_t *output, obe_raw_frame_t *raw_frame )
+{
+    obe_raw_frame_t *ref;
+
+    if( output->num_output_stream_ids == 1 )
+    {
+        add_to_encode_queue( h, raw_frame, output->output_stream_ids[0] );
+        return 0;
+    }
+
+    for( int i = 0; i < output->num_output_stream_ids; i++ )
+    {
+        ref = obe_ref_raw_frame( h, raw_frame );
+        if( !ref )
+        {
+            obe_unref_raw_frame( raw_frame );
+            return -1;
+        }
+
+        add_to_encode_queue( h, ref, output->output_stream_ids[i] );
+    }
+
+    obe_unref_raw_frame( raw_frame );
+
+    return 0;
+}
+
+static int send_eos_to_encoders( obe_t *h, obe_vid_filter_ctx_t *vfilt, int input_stream_id )
+{
+    obe_raw_frame_t *raw_frame;
+
+    for( int i = 0; i < vfilt->num_outputs; i++ )
+    {
+        for( int j = 0; j < vfilt->outputs[i].num_output_stream_ids; j++ )
+        {
+            raw_frame = new_eos_raw_frame( h, input_stream_id );
+            if( !raw_frame )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return -1;
+            }
+
+            add_to_encode_queue( h, raw_frame, vfilt->outputs[i].output_stream_ids[j] );
+        }
+    }
+
+    return 0;
 }
 
 static void *start_filter( void *ptr )
@@ -677,10 +1419,8 @@ static void *start_filter( void *ptr )
     obe_t *h = filter_params->h;
     obe_filter_t *filter = filter_params->filter;
     obe_int_input_stream_t *input_stream = filter_params->input_stream;
-    obe_raw_frame_t *raw_frame;
-    obe_output_stream_t *output_stream = get_output_stream( h, 0 ); /* FIXME when output_stream_id for video is not zero */
-    int h_shift, v_shift;
-    const AVPixFmtDescriptor *pfd;
+    obe_raw_frame_t *raw_frame = NULL, *out_frame;
+    int64_t arrival_time;
 
     obe_vid_filter_ctx_t *vfilt = calloc( 1, sizeof(*vfilt) );
     if( !vfilt )
@@ -689,78 +1429,107 @@ static void *start_filter( void *ptr )
         goto end;
     }
 
-    init_filter( vfilt );
+    if( init_filter( vfilt, filter, filter_params ) < 0 )
+        goto end;
 
     while( 1 )
     {
         /* TODO: support resolution changes */
         /* TODO: support changes in pixel format */
 
-        pthread_mutex_lock( &filter->queue.mutex );
+        obe_queue_lock( &filter->queue );
 
-        while( !filter->queue.size && !filter->cancel_thread )
+        while( !obe_queue_size( &filter->queue ) && !filter->cancel_thread )
             pthread_cond_wait( &filter->queue.in_cv, &filter->queue.mutex );
 
         if( filter->cancel_thread )
         {
-            pthread_mutex_unlock( &filter->queue.mutex );
+            obe_queue_unlock( &filter->queue );
             goto end;
         }
 
-        raw_frame = filter->queue.queue[0];
-        pthread_mutex_unlock( &filter->queue.mutex );
-
-        /* TODO: scale 8-bit to 10-bit
-         * TODO: convert from 4:2:0 to 4:2:2 */
+        obe_queue_unlock( &filter->queue );
+        raw_frame = obe_queue_item( &filter->queue, 0 );
 
-        if( raw_frame->img.format == INPUT_VIDEO_FORMAT_PAL )
-            blank_lines( raw_frame );
-
-        /* Resize if necessary. Together with colourspace conversion if progressive */
-        if( raw_frame->img.width != output_stream->avc_param.i_width || (!IS_INTERLACED( raw_frame->img.format ) &&
-                                                                          filter_params->target_csp == X264_CSP_I420 ) )
+        /* Nothing follows so the thread can finish */
+        if( raw_frame->is_eos )
         {
-            if( resize_frame( vfilt, raw_frame, output_stream->avc_param.i_width ) < 0 )
-                goto end;
-        }
-
-        if( av_pix_fmt_get_chroma_sub_sample( raw_frame->img.csp, &h_shift, &v_shift ) < 0 )
+            remove_from_queue( &filter->queue );
+            send_eos_to_encoders( h, vfilt, raw_frame->input_stream_id );
+            raw_frame->release_data( raw_frame );
+            raw_frame->release_frame( raw_frame );
             goto end;
-
-        /* Downconvert using interlaced scaling if input is 4:2:2 and target is 4:2:0 */
-        if( h_shift == 1 && v_shift == 0 && filter_params->target_csp == X264_CSP_I420 )
-        {
-            if( downconvert_image_interlaced( vfilt, raw_frame ) < 0 )
-                goto end;
         }
 
-        pfd = av_pix_fmt_desc_get( raw_frame->img.csp );
-        if( pfd->comp[0].depth_minus1+1 == 10 && X264_BIT_DEPTH == 8 )
-        {
-            if( dither_image( vfilt, raw_frame ) < 0 )
-                goto end;
-        }
+        arrival_time = raw_frame->arrival_time;
 
-        if( encapsulate_user_data( raw_frame, input_stream ) < 0 )
+        if( needs_upconvert( vfilt, raw_frame ) && upconvert_image( vfilt, raw_frame ) < 0 )
             goto end;
 
-        /* If SAR, on an SD stream, has not been updated by AFD or WSS, set to default 4:3
-         * TODO: make this user-choosable. OBE will prioritise any SAR information from AFD or WSS over any user settings */
-        if( raw_frame->sar_width == 1 && raw_frame->sar_height == 1 )
+        if( raw_frame->img.format == INPUT_VIDEO_FORMAT_PAL && raw_frame->img.csp == PIX_FMT_YUV422P10 )
+            blank_lines( raw_frame );
+
+        /* With several outputs each is made from a frame sharing the input picture. The share is
+         * dropped as soon as an output has a picture of its own */
+        if( vfilt->num_outputs > 1 )
+            remove_from_queue( &filter->queue );
+
+        for( int i = 0; i < vfilt->num_outputs; i++ )
         {
-            set_sar( raw_frame, IS_SD( raw_frame->img.format ) ? output_stream->is_wide : 1 );
-            raw_frame->sar_guess = 1;
+            out_frame = raw_frame;
+            if( vfilt->num_outputs > 1 )
+            {
+                out_frame = obe_ref_raw_frame( h, raw_frame );
+                if( !out_frame )
+                    goto fail;
+            }
+
+            if( filter_frame( h, vfilt, &vfilt->outputs[i], out_frame, input_stream ) < 0 )
+            {
+                if( out_frame != raw_frame )
+                    obe_unref_raw_frame( out_frame );
+                goto fail;
+            }
+
+            if( vfilt->num_outputs == 1 )
+                remove_from_queue( &filter->queue );
+
+            if( send_to_encoders( h, &vfilt->outputs[i], out_frame ) < 0 )
+                goto fail;
         }
 
-        remove_from_queue( &filter->queue );
-        add_to_encode_queue( h, raw_frame, 0 );
+        if( vfilt->num_outputs > 1 )
+            obe_unref_raw_frame( raw_frame );
+
+        OBE_STAT_ADD( filter->frames_out, 1 );
+        add_latency( h, OBE_LATENCY_FILTER, arrival_time );
     }
 
+fail:
+    /* A single output's frame is still queued or has gone to the encoders */
+    if( vfilt->num_outputs > 1 )
+        obe_unref_raw_frame( raw_frame );
+
 end:
     if( vfilt )
     {
-        if( vfilt->sws_ctx )
-            sws_freeContext( vfilt->sws_ctx );
+        for( int i = 0; i < vfilt->num_outputs; i++ )
+        {
+            if( vfilt->outputs[i].sws_ctx )
+                sws_freeContext( vfilt->outputs[i].sws_ctx );
+
+            obe_hscale_close( &vfilt->outputs[i].hscale[0] );
+            obe_hscale_close( &vfilt->outputs[i].hscale[1] );
+        }
+
+        if( vfilt->has_slice_pool )
+            obe_slice_pool_destroy( &vfilt->slice_pool );
+
+        if( vfilt->image_pool )
+            close_image_pool( vfilt->image_pool );
+
+        for( int i = 0; i < vfilt->num_slices; i++ )
+            av_free( vfilt->scratch[i] );
 
         free( vfilt );
     }
@@ -34,9 +34,55 @@ typedef struct
     obe_t *h;
     obe_filter_t *filter;
     obe_int_input_stream_t *input_stream;
-    int target_csp;
+    int filter_threads;
+
+    /* The video streams encoded from the input. The filter makes each distinct picture once */
+    int num_output_streams;
+    obe_output_stream_t *output_streams[MAX_STREAMS];
 } obe_vid_filter_params_t;
 
 extern const obe_vid_filter_func_t video_filter;
 
+typedef struct
+{
+    /* downsample */
+    void (*downsample_chroma_row_top)( uint16_t *src, uint16_t *dst, int width, int stride );
+    void (*downsample_chroma_row_bottom)( uint16_t *src, uint16_t *dst, int width, int stride );
+    void (*downsample_chroma_row_avg)( uint16_t *src, uint16_t *dst, int width, int stride );
+
+    /* dither */
+    void (*dither_row_10_to_8)( uint16_t *src, uint8_t *dst, const uint16_t *dithers, int width, int stride );
+
+    /* 8-bit to 10-bit. Interpolates weight/8 of src and the rest of srcn so chroma can be upsampled
+     * vertically at the same time. Lines which need no interpolation pass src as srcn with a weight of 8.
+     * width must be a multiple of 16 */
+    void (*scale_row_8_to_10)( const uint8_t *src, const uint8_t *srcn, uint16_t *dst, int width, int weight );
+} obe_vid_filter_dsp_t;
+
+void obe_init_vid_filter_dsp( obe_vid_filter_dsp_t *dsp, int cpu_flags );
+
+/* Converts v210 lines straight to the encoder's 4:2:0 format, which the video filter then passes through.
+ * This saves unpacking to 4:2:2, downsampling and dithering as separate passes over the frame */
+typedef struct
+{
+    int width;
+    int csp;
+    int interlaced;
+
+    void (*unpack)( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+    obe_vid_filter_dsp_t dsp;
+
+    /* One set of lines per slice */
+    int num_slices;
+    uint16_t **scratch;
+    int scratch_stride;
+} obe_v210_convert_t;
+
+int obe_video_filter_direct_csp( obe_t *h, obe_device_t *device, int video_format, int width, int height );
+int obe_v210_convert_init( obe_v210_convert_t *conv, int width, int csp, int interlaced, int num_slices );
+int obe_v210_convert_alloc_image( obe_v210_convert_t *conv, obe_image_t *img, int height );
+void obe_v210_convert_lines( obe_v210_convert_t *conv, const uint8_t *src[2], int src_stride, obe_image_t *out,
+                             int start, int end, int slice );
+void obe_v210_convert_close( obe_v210_convert_t *conv );
+
 #endif
@@ -7,8 +7,14 @@ scale: times 4 dd 511
 shift: dd 11
 
 align 32
-two: times 8 dw 2
-three: times 8 dw 3
+; (x * 511) >> 11 == (x * (511 << 5)) >> 16 for the dithered range
+scale_hi: times 16 dw 511 << 5
+two: times 16 dw 2
+three: times 16 dw 3
+one: times 16 dw 1
+
+hscale_round: times 4 dd 1 << 13
+pixel_max_10: times 8 dw 1023
 
 SECTION .text
 
@@ -59,6 +65,35 @@ DITHER_row
 INIT_XMM avx
 DITHER_row
 
+; The sum of a 10-bit sample and the dither fits in 11 bits so the product
+; with 511 is the high word of a 16-bit multiply. packuswb works within each
+; lane so the quadwords are put back in order before the store
+%macro DITHER_row_mulhi 0
+cglobal dither_row_10_to_8, 5, 5, 4
+    movsxdifnidn r3, r3d
+    vbroadcasti128 m2, [r2]
+    mova      m3, [scale_hi]
+    lea       r0, [r0+2*r3]
+    add       r1, r3
+    neg       r3
+
+.loop
+    paddw     m0, m2, [r0+2*r3]
+    paddw     m1, m2, [r0+2*r3+mmsize]
+    pmulhuw   m0, m3
+    pmulhuw   m1, m3
+    packuswb  m0, m1
+    vpermq    m0, m0, 0xd8
+    movu      [r1+r3], m0
+
+    add       r3, mmsize
+    jl        .loop
+    RET
+%endmacro
+
+INIT_YMM avx2
+DITHER_row_mulhi
+
 ;
 ; obe_downsample_chroma_row_field( uint16_t *src, uint16_t *dst, int width, int stride )
 ;
@@ -88,7 +123,11 @@ cglobal downsample_chroma_row_%1, 4, 5, 4
     DOWNSAMPLE_chroma_row_inner r4, r0
 %endif
 
+%if mmsize == 32
+    movu      [r1+r2], m2
+%else
     mova      [r1+r2], m2
+%endif
 
     add       r2, mmsize
     jl        .loop
@@ -102,3 +141,163 @@ DOWNSAMPLE_chroma_row bottom
 INIT_XMM avx
 DOWNSAMPLE_chroma_row top
 DOWNSAMPLE_chroma_row bottom
+
+INIT_YMM avx2
+DOWNSAMPLE_chroma_row top
+DOWNSAMPLE_chroma_row bottom
+
+;
+; obe_downsample_chroma_row_avg( uint16_t *src, uint16_t *dst, int width, int stride )
+;
+
+; Progressive 4:2:2 to 4:2:0, (src + srcf + 1) >> 1
+%macro DOWNSAMPLE_chroma_row_avg 0
+cglobal downsample_chroma_row_avg, 4, 5, 1
+    add       r0, r2
+    add       r1, r2
+    lea       r4, [r0+2*r3]
+    neg       r2
+.loop
+%if mmsize == 32
+    movu      m0, [r0+r2]
+    pavgw     m0, [r4+r2]
+    movu      [r1+r2], m0
+%else
+    mova      m0, [r0+r2]
+    pavgw     m0, [r4+r2]
+    mova      [r1+r2], m0
+%endif
+
+    add       r2, mmsize
+    jl        .loop
+    REP_RET
+%endmacro
+
+INIT_XMM sse2
+DOWNSAMPLE_chroma_row_avg
+INIT_XMM avx
+DOWNSAMPLE_chroma_row_avg
+INIT_YMM avx2
+DOWNSAMPLE_chroma_row_avg
+;
+; obe_scale_row_8_to_10( const uint8_t *src, const uint8_t *srcn, uint16_t *dst, int width, int weight )
+;
+
+; v = (weight * src + (8 - weight) * srcn + 1) >> 1 is four times the interpolated
+; sample and v + (v >> 8) fills the bottom bits so 255 becomes 1023.
+; width must be a non-zero multiple of 16 so neither version reads or writes past the
+; end of the line. The caller converts any remaining pixels in C
+%macro SCALE_row_8_to_10 0
+cglobal scale_row_8_to_10, 5, 5, 6
+    movsxdifnidn r3, r3d
+    movd      xmm4, r4d
+    neg       r4d
+    add       r4d, 8
+    movd      xmm5, r4d
+%if mmsize == 32
+    vpbroadcastw m4, xmm4
+    vpbroadcastw m5, xmm5
+%else
+    pshuflw   m4, m4, 0
+    pshuflw   m5, m5, 0
+    punpcklqdq m4, m4
+    punpcklqdq m5, m5
+    pxor      m2, m2
+%endif
+    mova      m3, [one]
+    add       r0, r3
+    add       r1, r3
+    lea       r2, [r2+2*r3]
+    neg       r3
+
+.loop
+%if mmsize == 32
+    vpmovzxbw m0, [r0+r3]
+    vpmovzxbw m1, [r1+r3]
+%else
+    movq      m0, [r0+r3]
+    movq      m1, [r1+r3]
+    punpcklbw m0, m2
+    punpcklbw m1, m2
+%endif
+    pmullw    m0, m4
+    pmullw    m1, m5
+    paddw     m0, m1
+    paddw     m0, m3
+    psrlw     m0, 1
+    psrlw     m1, m0, 8
+    paddw     m0, m1
+    movu      [r2+2*r3], m0
+
+    add       r3, mmsize/2
+    jl        .loop
+    RET
+%endmacro
+
+INIT_XMM sse2
+SCALE_row_8_to_10
+INIT_YMM avx2
+SCALE_row_8_to_10
+
+;
+; obe_hscale_row( const uint16_t *src, uint16_t *dst, int dst_width, const int32_t *pos,
+;                 const int16_t *coefs, int filter_size )
+;
+
+; Four outputs at a time, two per ymm register. Each 128-bit lane accumulates
+; the dot product of eight taps of one output then the lanes are summed horizontally.
+; Writes a multiple of four outputs
+%macro HSCALE_row 0
+cglobal hscale_row, 6, 11, 6
+    movsxdifnidn r2, r2d
+    movsxdifnidn r5, r5d
+    add       r5, r5
+    pxor      xmm4, xmm4
+    mova      xmm5, [pixel_max_10]
+.loop_x
+    movsxd    r6, [r3]
+    movsxd    r7, [r3+4]
+    movsxd    r8, [r3+8]
+    movsxd    r9, [r3+12]
+    lea       r6, [r0+2*r6]
+    lea       r7, [r0+2*r7]
+    lea       r8, [r0+2*r8]
+    lea       r9, [r0+2*r9]
+    pxor      m0, m0
+    pxor      m1, m1
+    xor       r10, r10
+.loop_k
+    movu      xmm2, [r6+r10]
+    vinserti128 m2, m2, [r7+r10], 1
+    movu      xmm3, [r8+r10]
+    vinserti128 m3, m3, [r9+r10], 1
+    pmaddwd   m2, [r4]
+    pmaddwd   m3, [r4+32]
+    paddd     m0, m2
+    paddd     m1, m3
+    add       r4, 64
+    add       r10, 16
+    cmp       r10, r5
+    jl        .loop_k
+
+    ; lane 0 is [x, x+2, x, x+2] and lane 1 is [x+1, x+3, x+1, x+3]
+    phaddd    m0, m1
+    phaddd    m0, m0
+    vextracti128 xmm1, m0, 1
+    punpckldq xmm0, xmm1
+    paddd     xmm0, [hscale_round]
+    psrad     xmm0, 14
+    packssdw  xmm0, xmm0
+    pmaxsw    xmm0, xmm4
+    pminsw    xmm0, xmm5
+    movq      [r1], xmm0
+
+    add       r1, 8
+    add       r3, 16
+    sub       r2, 4
+    jg        .loop_x
+    RET
+%endmacro
+
+INIT_YMM avx2
+HSCALE_row
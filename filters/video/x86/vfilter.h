@@ -24,16 +24,33 @@
 #ifndef OBE_X86_VFILTER
 #define OBE_X86_VFILTER
 
-void obe_scale_plane_mmxext( uint16_t *src, int stride, int width, int height, int lshift, int rshift );
-void obe_scale_plane_sse2( uint16_t *src, int stride, int width, int height, int lshift, int rshift );
-void obe_scale_plane_avx( uint16_t *src, int stride, int width, int height, int lshift, int rshift );
+void obe_scale_row_8_to_10_sse2( const uint8_t *src, const uint8_t *srcn, uint16_t *dst, int width, int weight );
+void obe_scale_row_8_to_10_avx2( const uint8_t *src, const uint8_t *srcn, uint16_t *dst, int width, int weight );
 
 void obe_downsample_chroma_row_top_sse2( uint16_t *src, uint16_t *dst, int width, int stride );
 void obe_downsample_chroma_row_bottom_sse2( uint16_t *src, uint16_t *dst, int width, int stride );
 void obe_downsample_chroma_row_top_avx( uint16_t *src, uint16_t *dst, int width, int stride );
 void obe_downsample_chroma_row_bottom_avx( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_avg_sse2( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_avg_avx( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_top_avx2( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_bottom_avx2( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_avg_avx2( uint16_t *src, uint16_t *dst, int width, int stride );
 
 void obe_dither_row_10_to_8_sse4( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
 void obe_dither_row_10_to_8_avx( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
+void obe_dither_row_10_to_8_avx2( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
+
+void obe_hscale_row_avx2( const uint16_t *src, uint16_t *dst, int dst_width, const int32_t *pos,
+                          const int16_t *coefs, int filter_size );
+
+#if HAVE_AVX512
+/* Handle any alignment and do not write past the end of the row */
+void obe_downsample_chroma_row_top_avx512bw( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_bottom_avx512bw( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_downsample_chroma_row_avg_avx512bw( uint16_t *src, uint16_t *dst, int width, int stride );
+void obe_dither_row_10_to_8_avx512bw( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride );
+int obe_cpu_has_avx512bw( void );
+#endif
 
 #endif
@@ -0,0 +1,107 @@
+/*****************************************************************************
+ * vfilter_avx512.c: AVX-512 video filter functions
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+/* yasm cannot assemble AVX-512 so these are written with intrinsics.
+ * The last block of each row is masked so nothing past the width is read or written */
+
+#include "common/common.h"
+#include "filters/video/x86/vfilter.h"
+
+#if HAVE_AVX512
+#include <immintrin.h>
+
+#define AVX512BW_TARGET __attribute__((target("avx512f,avx512bw")))
+
+static inline __mmask32 tail_mask( int left )
+{
+    return left >= 32 ? 0xffffffff : (1u << left) - 1;
+}
+
+/* (3 * a + b + 2) >> 2 */
+static inline AVX512BW_TARGET __m512i downsample_field( __m512i a, __m512i b, __m512i two )
+{
+    __m512i sum = _mm512_add_epi16( _mm512_add_epi16( a, a ), _mm512_add_epi16( a, b ) );
+    return _mm512_srli_epi16( _mm512_add_epi16( sum, two ), 2 );
+}
+
+AVX512BW_TARGET void obe_downsample_chroma_row_top_avx512bw( uint16_t *src, uint16_t *dst, int width, int stride )
+{
+    uint16_t *srcf = src + stride;
+    __m512i two = _mm512_set1_epi16( 2 );
+
+    for( int i = 0; i < width/2; i += 32 )
+    {
+        __mmask32 mask = tail_mask( width/2 - i );
+        __m512i a = _mm512_maskz_loadu_epi16( mask, src + i );
+        __m512i b = _mm512_maskz_loadu_epi16( mask, srcf + i );
+        _mm512_mask_storeu_epi16( dst + i, mask, downsample_field( a, b, two ) );
+    }
+}
+
+AVX512BW_TARGET void obe_downsample_chroma_row_bottom_avx512bw( uint16_t *src, uint16_t *dst, int width, int stride )
+{
+    uint16_t *srcf = src + stride;
+    __m512i two = _mm512_set1_epi16( 2 );
+
+    for( int i = 0; i < width/2; i += 32 )
+    {
+        __mmask32 mask = tail_mask( width/2 - i );
+        __m512i a = _mm512_maskz_loadu_epi16( mask, src + i );
+        __m512i b = _mm512_maskz_loadu_epi16( mask, srcf + i );
+        _mm512_mask_storeu_epi16( dst + i, mask, downsample_field( b, a, two ) );
+    }
+}
+
+AVX512BW_TARGET void obe_downsample_chroma_row_avg_avx512bw( uint16_t *src, uint16_t *dst, int width, int stride )
+{
+    uint16_t *srcf = src + stride;
+
+    for( int i = 0; i < width/2; i += 32 )
+    {
+        __mmask32 mask = tail_mask( width/2 - i );
+        __m512i a = _mm512_maskz_loadu_epi16( mask, src + i );
+        __m512i b = _mm512_maskz_loadu_epi16( mask, srcf + i );
+        _mm512_mask_storeu_epi16( dst + i, mask, _mm512_avg_epu16( a, b ) );
+    }
+}
+
+/* The dithered sample fits in 11 bits so (x * 511) >> 11 is the high word of x * (511 << 5) */
+AVX512BW_TARGET void obe_dither_row_10_to_8_avx512bw( uint16_t *src, uint8_t *dst, const uint16_t *dither, int width, int stride )
+{
+    __m512i dithers = _mm512_broadcast_i32x4( _mm_loadu_si128( (const __m128i*)dither ) );
+    __m512i scale = _mm512_set1_epi16( 511 << 5 );
+
+    for( int i = 0; i < width; i += 32 )
+    {
+        __mmask32 mask = tail_mask( width - i );
+        __m512i x = _mm512_add_epi16( _mm512_maskz_loadu_epi16( mask, src + i ), dithers );
+        _mm512_mask_cvtepi16_storeu_epi8( dst + i, mask, _mm512_mulhi_epu16( x, scale ) );
+    }
+}
+
+int obe_cpu_has_avx512bw( void )
+{
+    /* libavutil has no AVX-512 flags. This also checks the OS saves the ZMM state */
+    return __builtin_cpu_supports( "avx512bw" );
+}
+#endif
@@ -21,13 +21,84 @@
  *
  *****************************************************************************/
 
+#include <libavutil/cpu.h>
 #include "common/common.h"
 #include "ancillary.h"
 #include "sdi.h"
 #include "vbi.h"
+#include "x86/sdi.h"
 
 #define READ_8(x) ((x) & 0xff)
 
+#define IS_ADF(x) ((x)[0] <= 0x03 && ((x)[1] & 0x3fc) == 0x3fc && ((x)[2] & 0x3fc) == 0x3fc)
+
+/* Each v210 word holds three samples. It can start an ADF if any of them is 0x000-0x003 */
+#define V210_HAS_LOW_SAMPLE(x) (!((x) & 0x3fc) || !((x) & 0xff000) || !((x) & 0x3fc00000))
+
+static obe_vanc_dsp_t vanc_dsp;
+static pthread_once_t vanc_dsp_once = PTHREAD_ONCE_INIT;
+
+static int vanc_find_adf_c( const uint16_t *line, int i, int end )
+{
+    while( i < end && !IS_ADF( &line[i] ) )
+        i++;
+
+    return i;
+}
+
+static int vanc_checksum_c( const uint16_t *src, int len )
+{
+    int sum = 0;
+
+    for( int i = 0; i < len; i++ )
+        sum += src[i] & 0x1ff;
+
+    return sum & 0x1ff;
+}
+
+void obe_init_vanc_dsp( obe_vanc_dsp_t *dsp, int cpu_flags )
+{
+    dsp->find_adf = vanc_find_adf_c;
+    dsp->checksum = vanc_checksum_c;
+    dsp->block_size = 1;
+
+    if( cpu_flags & AV_CPU_FLAG_SSE2 )
+    {
+        dsp->find_adf = obe_vanc_find_adf_sse2;
+        dsp->checksum = obe_vanc_checksum_sse2;
+        dsp->block_size = 8;
+    }
+
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+    {
+        dsp->find_adf = obe_vanc_find_adf_avx2;
+        dsp->checksum = obe_vanc_checksum_avx2;
+        dsp->block_size = 16;
+    }
+#endif
+}
+
+/* Finish the search one word at a time after the last whole block */
+int obe_vanc_find_adf( const obe_vanc_dsp_t *dsp, const uint16_t *line, int i, int end )
+{
+    i = dsp->find_adf( line, i, end );
+
+    return vanc_find_adf_c( line, i, end );
+}
+
+int obe_vanc_checksum( const obe_vanc_dsp_t *dsp, const uint16_t *src, int len )
+{
+    int tail = len & (dsp->block_size - 1);
+
+    return (dsp->checksum( src, len ) + vanc_checksum_c( src + len - tail, tail )) & 0x1ff;
+}
+
+static void init_vanc_dsp( void )
+{
+    obe_init_vanc_dsp( &vanc_dsp, av_get_cpu_flags() );
+}
+
 static int get_vanc_type( uint8_t did, uint8_t sdid )
 {
     for( int i = 0; vanc_identifiers[i].did != 0; i++ )
@@ -39,6 +110,101 @@ static int get_vanc_type( uint8_t did, uint8_t sdid )
     return -1;
 }
 
+static void setup_vanc_filter( obe_t *h, obe_sdi_non_display_data_t *non_display_data )
+{
+    const int dvb_vbi_types[] = { MISC_TELETEXT, MISC_TELETEXT_INVERTED, MISC_VPS, MISC_WSS };
+    int wanted;
+
+    non_display_data->num_vanc_filter = 0;
+
+    /* Only the packets which a parser will do something with */
+    for( int i = 0; vanc_identifiers[i].did != 0; i++ )
+    {
+        switch( vanc_identifiers[i].type )
+        {
+            case MISC_AFD:
+            case CAPTIONS_CEA_708:
+                wanted = check_user_selected_non_display_data( h, vanc_identifiers[i].type, USER_DATA_LOCATION_FRAME );
+                break;
+            case VANC_DVB_SCTE_VBI:
+                wanted = 0;
+                for( int j = 0; j < sizeof(dvb_vbi_types) / sizeof(*dvb_vbi_types); j++ )
+                    wanted |= check_user_selected_non_display_data( h, dvb_vbi_types[j], USER_DATA_LOCATION_DVB_STREAM );
+                break;
+            default:
+                wanted = 0;
+                break;
+        }
+
+        if( wanted && non_display_data->num_vanc_filter < sizeof(non_display_data->vanc_filter) / sizeof(*non_display_data->vanc_filter) )
+        {
+            non_display_data->vanc_filter[non_display_data->num_vanc_filter++] = (vanc_identifiers[i].did << 8) |
+                                                                                 vanc_identifiers[i].sdid;
+        }
+    }
+
+    non_display_data->has_vanc_filter = 1;
+}
+
+/* Probing looks at every packet */
+static int check_vanc_filter( obe_t *h, obe_sdi_non_display_data_t *non_display_data, uint8_t did, uint8_t sdid )
+{
+    if( non_display_data->probe )
+        return 1;
+
+    if( !non_display_data->has_vanc_filter )
+        setup_vanc_filter( h, non_display_data );
+
+    for( int i = 0; i < non_display_data->num_vanc_filter; i++ )
+    {
+        if( non_display_data->vanc_filter[i] == ((did << 8) | sdid) )
+            return 1;
+    }
+
+    return 0;
+}
+
+static inline int v210_sample( const uint32_t *src, int k )
+{
+    return (src[k / 3] >> (10 * (k % 3))) & 0x3ff;
+}
+
+/* Looks for wanted packets in a line before it is unpacked. Samples are numbered in Cb Y Cr Y order.
+ * HD has separate luma and chroma ANC streams so consecutive packet words are two samples apart */
+int obe_v210_line_has_vanc( obe_t *h, obe_sdi_non_display_data_t *non_display_data, const uint32_t *src, int width, int sd )
+{
+    int step = sd ? 1 : 2;
+    int num_samples = width * 2;
+
+    if( non_display_data->probe )
+        return 1;
+
+    if( !non_display_data->has_vanc_filter )
+        setup_vanc_filter( h, non_display_data );
+
+    if( !non_display_data->num_vanc_filter )
+        return 0;
+
+    for( int i = 0; i < num_samples / 3; i++ )
+    {
+        if( !V210_HAS_LOW_SAMPLE( src[i] ) )
+            continue;
+
+        for( int k = 3*i; k < 3*i + 3 && k + 4*step < num_samples; k++ )
+        {
+            if( v210_sample( src, k ) > 0x03 || (v210_sample( src, k + step ) & 0x3fc) != 0x3fc ||
+                (v210_sample( src, k + 2*step ) & 0x3fc) != 0x3fc )
+                continue;
+
+            if( check_vanc_filter( h, non_display_data, READ_8( v210_sample( src, k + 3*step ) ),
+                                   READ_8( v210_sample( src, k + 4*step ) ) ) )
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
 /* TODO/FIXME: check parity, ideally using x86's PF
  *             is it possible to check parity but follow 8-bit backwards compatibility? */
 
@@ -46,7 +212,7 @@ static int parse_afd( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
                       uint16_t *line, int line_number, int len )
 {
     obe_int_frame_data_t *tmp, *frame_data;
-    obe_user_data_t *tmp2, *user_data;
+    obe_user_data_t *user_data;
 
     if( READ_8( line[0] ) != 8 )
     {
@@ -101,21 +267,15 @@ static int parse_afd( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
     if( check_active_non_display_data( raw_frame, USER_DATA_AFD ) )
         return 0;
 
-    tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+2) * sizeof(*raw_frame->user_data) );
-    if( !tmp2 )
+    user_data = obe_add_user_data( h, raw_frame, 2 );
+    if( !user_data )
         goto fail;
 
-    raw_frame->user_data = tmp2;
-    user_data = &raw_frame->user_data[raw_frame->num_user_data];
-    raw_frame->num_user_data += 2;
-
     /* Read AFD */
-    user_data->len = 1;
+    if( obe_alloc_user_data_payload( h, raw_frame, user_data, 1 ) < 0 )
+        goto fail;
     user_data->type = USER_DATA_AFD;
     user_data->source = VANC_GENERIC;
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
-        goto fail;
 
     user_data->data[0] = READ_8( line[0] );
 
@@ -124,12 +284,10 @@ static int parse_afd( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
     user_data++;
 
     /* Read Bar Data */
-    user_data->len = 5;
+    if( obe_alloc_user_data_payload( h, raw_frame, user_data, 5 ) < 0 )
+        goto fail;
     user_data->type = USER_DATA_BAR_DATA;
     user_data->source = VANC_GENERIC;
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
-        goto fail;
 
     for( int i = 0; i < user_data->len; i++)
         user_data->data[i] = READ_8( line[i] );
@@ -219,7 +377,7 @@ static int parse_cdp( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
                       uint16_t *line, int line_number, int len )
 {
     obe_int_frame_data_t *tmp, *frame_data;
-    obe_user_data_t *tmp2, *user_data;
+    obe_user_data_t *user_data;
 
     /* Skip DC word */
     line++;
@@ -253,18 +411,13 @@ static int parse_cdp( obe_t *h, obe_sdi_non_display_data_t *non_display_data, ob
     if( check_active_non_display_data( raw_frame, USER_DATA_CEA_708_CDP ) )
         return 0;
 
-    tmp2 = realloc( raw_frame->user_data, (raw_frame->num_user_data+1) * sizeof(*raw_frame->user_data) );
-    if( !tmp2 )
+    user_data = obe_add_user_data( h, raw_frame, 1 );
+    if( !user_data )
+        goto fail;
+    if( obe_alloc_user_data_payload( h, raw_frame, user_data, len ) < 0 )
         goto fail;
-
-    raw_frame->user_data = tmp2;
-    user_data = &raw_frame->user_data[raw_frame->num_user_data++];
-    user_data->len = len;
     user_data->type = USER_DATA_CEA_708_CDP;
     user_data->source = VANC_GENERIC;
-    user_data->data = malloc( user_data->len );
-    if( !user_data->data )
-        goto fail;
 
     for( int i = 0; i < user_data->len; i++ )
         user_data->data[i] = READ_8( line[i] );
@@ -286,64 +439,65 @@ static int parse_cea_608( uint16_t *line )
 int parse_vanc_line( obe_t *h, obe_sdi_non_display_data_t *non_display_data, obe_raw_frame_t *raw_frame,
                      uint16_t *line, int width, int line_number )
 {
-    int i = 0, j;
+    int i = 0;
     uint16_t vanc_checksum, *pkt_start;
 
+    pthread_once( &vanc_dsp_once, init_vanc_dsp );
+
     /* VANC can be in luma or chroma */
     width <<= 1;
 
-    /* The smallest VANC data length is 7 words long (ADF + SDID + DID + DC + CS)
-     * TODO: optimise this */
-    while( i < width - 7 )
+    /* The smallest VANC data length is 7 words long (ADF + SDID + DID + DC + CS) */
+    while( 1 )
     {
-        if( line[i] <= 0x03 && (line[i+1] & 0x3fc) == 0x3fc && (line[i+2] & 0x3fc) == 0x3fc )
-        {
-            i += 3;
-            pkt_start = &line[i];
-            int len = READ_8( pkt_start[2] );
-            vanc_checksum = 0;
+        i = obe_vanc_find_adf( &vanc_dsp, line, i, width - 7 );
+        if( i >= width - 7 )
+            break;
 
-            if( (len+2) > (width - i - 1) )
-            {
-                syslog( LOG_ERR, "VANC packet length too large on line %i \n", line_number );
-                break;
-            }
+        i += 3;
+        pkt_start = &line[i];
+        int len = READ_8( pkt_start[2] );
 
-            /* Checksum includes DC, DID and SDID/DBN */
-            for( j = 0; j < len+3; j++ )
-            {
-                vanc_checksum += pkt_start[j] & 0x1ff;
-                vanc_checksum &= 0x1ff;
-            }
+        if( (len+2) > (width - i - 1) )
+        {
+            syslog( LOG_ERR, "VANC packet length too large on line %i \n", line_number );
+            break;
+        }
 
-            vanc_checksum |= (~vanc_checksum & 0x100) << 1;
+        /* Don't checksum packets nothing will parse */
+        if( !check_vanc_filter( h, non_display_data, READ_8( pkt_start[0] ), READ_8( pkt_start[1] ) ) )
+        {
+            i += 2 + len + 1;
+            continue;
+        }
+
+        /* Checksum includes DC, DID and SDID/DBN */
+        vanc_checksum = obe_vanc_checksum( &vanc_dsp, pkt_start, len+3 );
+        vanc_checksum |= (~vanc_checksum & 0x100) << 1;
 
-            if( pkt_start[j] == vanc_checksum )
+        if( pkt_start[len+3] == vanc_checksum )
+        {
+            /* Pass the DC word to the parsing function because some parsers may want to sanity check the length */
+            switch ( get_vanc_type( READ_8( pkt_start[0] ), READ_8( pkt_start[1] ) ) )
             {
-                /* Pass the DC word to the parsing function because some parsers may want to sanity check the length */
-                switch ( get_vanc_type( READ_8( pkt_start[0] ), READ_8( pkt_start[1] ) ) )
-                {
-                    case MISC_AFD:
-                        parse_afd( h, non_display_data, raw_frame, &pkt_start[2], line_number, len );
-                        break;
-                    case VANC_DVB_SCTE_VBI:
-                        parse_dvb_scte_vbi( h, non_display_data, raw_frame, &pkt_start[2], line_number, len );
-                        break;
-                    case CAPTIONS_CEA_708:
-                        parse_cdp( h, non_display_data, raw_frame, &pkt_start[2], line_number, len );
-                        break;
-                    default:
-                        break;
-                }
+                case MISC_AFD:
+                    parse_afd( h, non_display_data, raw_frame, &pkt_start[2], line_number, len );
+                    break;
+                case VANC_DVB_SCTE_VBI:
+                    parse_dvb_scte_vbi( h, non_display_data, raw_frame, &pkt_start[2], line_number, len );
+                    break;
+                case CAPTIONS_CEA_708:
+                    parse_cdp( h, non_display_data, raw_frame, &pkt_start[2], line_number, len );
+                    break;
+                default:
+                    break;
             }
-            else
-                syslog( LOG_ERR, "Invalid VANC checksum on line %i \n", line_number );
-
-            /* skip DID, DBN/SDID, user data words and checksum */
-            i += 2 + len + 1;
         }
         else
-            i++;
+            syslog( LOG_ERR, "Invalid VANC checksum on line %i \n", line_number );
+
+        /* skip DID, DBN/SDID, user data words and checksum */
+        i += 2 + len + 1;
     }
 
     /* FIXME: should we probe more frames? */
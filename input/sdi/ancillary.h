@@ -68,7 +68,20 @@ const static obe_anc_identifier_t vanc_identifiers[] =
     { 0, 0, 0 },
 };
 
+typedef struct
+{
+    /* Returns the index of the first ADF in [i, end) or, for the SIMD versions, where the search stopped */
+    int (*find_adf)( const uint16_t *line, int i, int end );
+    /* Returns the sum of the low 9 bits of the words, modulo 512. The SIMD versions only sum whole blocks */
+    int (*checksum)( const uint16_t *src, int len );
+    int block_size;
+} obe_vanc_dsp_t;
+
+void obe_init_vanc_dsp( obe_vanc_dsp_t *dsp, int cpu_flags );
+int obe_vanc_find_adf( const obe_vanc_dsp_t *dsp, const uint16_t *line, int i, int end );
+int obe_vanc_checksum( const obe_vanc_dsp_t *dsp, const uint16_t *src, int len );
 
+int obe_v210_line_has_vanc( obe_t *h, obe_sdi_non_display_data_t *non_display_data, const uint32_t *src, int width, int sd );
 int parse_vanc_line( obe_t *h, obe_sdi_non_display_data_t *non_display_data, obe_raw_frame_t *raw_frame,
                      uint16_t *line, int width, int line_number );
 #endif
@@ -84,7 +84,7 @@ const static struct obe_to_decklink_video video_format_tab[] =
     { INPUT_VIDEO_FORMAT_720P_60,         bmdModeHD720p60,      1,    60 },
     { INPUT_VIDEO_FORMAT_1080I_50,        bmdModeHD1080i50,     1,    25 },
     { INPUT_VIDEO_FORMAT_1080I_5994,      bmdModeHD1080i5994,   1001, 30000 },
-    { INPUT_VIDEO_FORMAT_1080I_60,        bmdModeHD1080i6000,   1,    60 },
+    { INPUT_VIDEO_FORMAT_1080I_60,        bmdModeHD1080i6000,   1,    30 },
     { INPUT_VIDEO_FORMAT_1080P_2398,      bmdModeHD1080p2398,   1001, 24000 },
     { INPUT_VIDEO_FORMAT_1080P_24,        bmdModeHD1080p24,     1,    24 },
     { INPUT_VIDEO_FORMAT_1080P_25,        bmdModeHD1080p25,     1,    25 },
@@ -130,6 +130,9 @@ typedef struct
     void (*downscale_line) ( uint16_t *src, uint8_t *dst, int lines );
     void (*blank_line) ( uint16_t *dst, int width );
     obe_sdi_non_display_data_t non_display_parser;
+    uint16_t *anc_buf;
+    uint8_t  *vbi_buf;
+    int      anc_buf_width;
 
     obe_device_t *device;
     obe_t *h;
@@ -325,6 +328,7 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
     uint16_t *anc_buf, *anc_buf_pos;
     uint8_t *vbi_buf;
     int anc_lines[DECKLINK_VANC_LINES];
+    int anc_has_packets[DECKLINK_VANC_LINES];
     IDeckLinkVideoFrameAncillary *ancillary;
     BMDTimeValue stream_time, frame_duration;
 
@@ -357,8 +361,10 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
                 syslog( LOG_WARNING, "Decklink card index %i: No frame received for %"PRIi64" ms", decklink_opts_->card_idx,
                        (cur_frame_time - decklink_ctx->last_frame_time) / 1000 );
                 pthread_mutex_lock( &h->drop_mutex );
-                h->encoder_drop = h->mux_drop = 1;
+                h->encoder_drop++;
+                h->mux_drop = 1;
                 pthread_mutex_unlock( &h->drop_mutex );
+                OBE_STAT_ADD( h->input_drops, 1 );
             }
 
             decklink_ctx->last_frame_time = cur_frame_time;
@@ -384,22 +390,35 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
         line = decklink_opts_->video_format == INPUT_VIDEO_FORMAT_NTSC ? 4 : 1;
         anc_line_stride = FFALIGN( (width * 2 * sizeof(uint16_t)), 16 );
 
-        /* Overallocate slightly for VANC buffer
-         * Some VBI services stray into the active picture so allocate some extra space */
-        anc_buf = anc_buf_pos = (uint16_t*)av_malloc( DECKLINK_VANC_LINES * anc_line_stride );
-        if( !anc_buf )
+        /* The buffers are sized when the card is opened and only change if a wider format is detected */
+        if( width > decklink_ctx->anc_buf_width )
         {
-            syslog( LOG_ERR, "Malloc failed\n" );
-            goto end;
+            if( obe_alloc_anc_buffers( &decklink_ctx->anc_buf, &decklink_ctx->vbi_buf, width, DECKLINK_VANC_LINES ) < 0 )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                decklink_ctx->anc_buf_width = 0;
+                goto end;
+            }
+            decklink_ctx->anc_buf_width = width;
+            OBE_STAT_ADD( h->input_allocs, 1 );
         }
+        anc_buf = anc_buf_pos = decklink_ctx->anc_buf;
+        vbi_buf = decklink_ctx->vbi_buf;
 
         while( 1 )
         {
             /* Some cards have restrictions on what lines can be accessed so try them all
              * Some buggy decklink cards will randomly refuse access to a particular line so
              * work around this issue by blanking the line */
+            anc_has_packets[num_anc_lines] = 0;
             if( ancillary->GetBufferForVerticalBlankingLine( line, &anc_line ) == S_OK )
-                decklink_ctx->unpack_line( (uint32_t*)anc_line, anc_buf_pos, width );
+            {
+                /* Most lines are empty so check the packed line first. SD still needs every line for VBI */
+                anc_has_packets[num_anc_lines] = obe_v210_line_has_vanc( h, &decklink_ctx->non_display_parser, (uint32_t*)anc_line,
+                                                                         width, IS_SD( decklink_opts_->video_format ) );
+                if( anc_has_packets[num_anc_lines] || IS_SD( decklink_opts_->video_format ) )
+                    decklink_ctx->unpack_line( (uint32_t*)anc_line, anc_buf_pos, width );
+            }
             else
                 decklink_ctx->blank_line( anc_buf_pos, width );
 
@@ -421,7 +440,7 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
 
         if( !decklink_opts_->probe )
         {
-            raw_frame = new_raw_frame();
+            raw_frame = new_raw_frame( h );
             if( !raw_frame )
             {
                 syslog( LOG_ERR, "Malloc failed\n" );
@@ -432,7 +451,8 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
         anc_buf_pos = anc_buf;
         for( int i = 0; i < num_anc_lines; i++ )
         {
-            parse_vanc_line( h, &decklink_ctx->non_display_parser, raw_frame, anc_buf_pos, width, anc_lines[i] );
+            if( anc_has_packets[i] )
+                parse_vanc_line( h, &decklink_ctx->non_display_parser, raw_frame, anc_buf_pos, width, anc_lines[i] );
             anc_buf_pos += anc_line_stride / 2;
         }
 
@@ -452,13 +472,6 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
             }
             num_anc_lines += num_vbi_lines;
 
-            vbi_buf = (uint8_t*)av_malloc( width * 2 * num_anc_lines );
-            if( !vbi_buf )
-            {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                goto end;
-            }
-
             /* Scale the lines from 10-bit to 8-bit */
             decklink_ctx->downscale_line( anc_buf, vbi_buf, num_anc_lines );
             anc_buf_pos = anc_buf;
@@ -493,12 +506,8 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
 
             if( decode_vbi( h, &decklink_ctx->non_display_parser, vbi_buf, raw_frame ) < 0 )
                 goto fail;
-
-            av_free( vbi_buf );
         }
 
-        av_free( anc_buf );
-
         if( !decklink_opts_->probe )
         {
             frame = avcodec_alloc_frame();
@@ -522,6 +531,7 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
 
             raw_frame->release_data = obe_release_video_data;
             raw_frame->release_frame = obe_release_frame;
+            raw_frame->arrival_time = decklink_ctx->last_frame_time;
 
             memcpy( raw_frame->alloc_img.stride, frame->linesize, sizeof(raw_frame->alloc_img.stride) );
             memcpy( raw_frame->alloc_img.plane, frame->data, sizeof(raw_frame->alloc_img.plane) );
@@ -591,7 +601,7 @@ HRESULT DeckLinkCaptureDelegate::VideoInputFrameArrived( IDeckLinkVideoInputFram
     if( audioframe && !decklink_opts_->probe )
     {
         audioframe->GetBytes( &frame_bytes );
-        raw_frame = new_raw_frame();
+        raw_frame = new_raw_frame( h );
         if( !raw_frame )
         {
             syslog( LOG_ERR, "Malloc failed\n" );
@@ -681,6 +691,9 @@ static void close_card( decklink_opts_t *decklink_opts )
     if( decklink_ctx->avr )
         avresample_free( &decklink_ctx->avr );
 
+    av_freep( &decklink_ctx->anc_buf );
+    av_freep( &decklink_ctx->vbi_buf );
+    decklink_ctx->anc_buf_width = 0;
 }
 
 static int open_card( decklink_opts_t *decklink_opts )
@@ -889,6 +902,16 @@ static int open_card( decklink_opts_t *decklink_opts )
         goto finish;
     }
 
+    /* Overallocate slightly for VANC buffer
+     * Some VBI services stray into the active picture so allocate some extra space */
+    if( obe_alloc_anc_buffers( &decklink_ctx->anc_buf, &decklink_ctx->vbi_buf, decklink_opts->width, DECKLINK_VANC_LINES ) < 0 )
+    {
+        fprintf( stderr, "[decklink] Malloc failed\n" );
+        ret = -1;
+        goto finish;
+    }
+    decklink_ctx->anc_buf_width = decklink_opts->width;
+
     /* Setup audio connection */
     for( i = 0; audio_conn_tab[i].obe_name != -1; i++ )
     {
@@ -0,0 +1,896 @@
+/*****************************************************************************
+ * file.c: raw SDI capture file input
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+/* Plays back a raw capture so the pipeline can be run without an SDI card.
+ *
+ * The video file is a sequence of v210 frames with rows padded to 48 pixels (128 bytes per 48 pixels).
+ * If VANC is enabled each frame starts with the vertical blanking lines in SMPTE line order
+ * (i.e. the order sdi_next_line() walks them), followed by the active picture in frame order.
+ *
+ * The audio file is 8 channels of interleaved signed 32-bit little-endian PCM at 48kHz.
+ * If no audio file is given, silence is sent. */
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "common/common.h"
+#include "common/lavc.h"
+#include "input/input.h"
+#include "input/sdi/sdi.h"
+#include "input/sdi/ancillary.h"
+#include "input/sdi/vbi.h"
+#include "input/sdi/x86/sdi.h"
+#include "filters/video/video.h"
+
+#include <libavutil/mathematics.h>
+#include <libavutil/bswap.h>
+#include <libavresample/avresample.h>
+#include <libavutil/opt.h>
+
+#define FILE_NUM_CHANNELS       8
+#define FILE_SAMPLE_RATE        48000
+#define FILE_VANC_LINES         100
+/* When not pacing, the number of frames allowed in each queue before the input waits */
+#define FILE_MAX_QUEUED_FRAMES  8
+
+typedef struct
+{
+    /* video file */
+    int          vfd;
+    uint8_t      *vmap;
+    size_t       vmap_size;
+    int64_t      num_frames;
+    int64_t      cur_frame;
+    int          stride;
+    int          width;
+    int          num_vanc_lines;
+    int          frame_size;
+    int64_t      v_counter;
+    AVRational   v_timebase;
+
+    void (*unpack_line) ( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+
+    /* HD pictures can be converted straight to the encoder's format */
+    int          direct;
+    obe_v210_convert_t convert;
+
+    /* audio file */
+    int          afd;
+    uint8_t      *amap;
+    size_t       amap_size;
+    int64_t      num_samples;
+    int64_t      cur_sample;
+    int64_t      a_counter;
+    AVRational   a_timebase;
+    AVAudioResampleContext *avr;
+
+    int64_t      start_time;
+
+    /* VBI */
+    int has_setup_vbi;
+
+    /* Ancillary */
+    void (*vanc_unpack_line) ( uint32_t *src, uint16_t *dst, int width );
+    void (*downscale_line) ( uint16_t *src, uint8_t *dst, int lines );
+    uint16_t *anc_buf;
+    uint8_t  *vbi_buf;
+    obe_sdi_non_display_data_t non_display_parser;
+
+    obe_device_t *device;
+    obe_t *h;
+} file_ctx_t;
+
+typedef struct
+{
+    file_ctx_t file_ctx;
+
+    /* Input */
+    char *video_location;
+    char *audio_location;
+    int vanc;
+    int pacing;
+    int loop;
+    int probe;
+
+    /* Output */
+    int video_format;
+    int width;
+    int height;
+
+    int timebase_num;
+    int timebase_den;
+
+    int interlaced;
+    int tff;
+} file_opts_t;
+
+struct file_status
+{
+    obe_input_params_t *input;
+    file_opts_t *file_opts;
+};
+
+static void close_files( file_opts_t *file_opts )
+{
+    file_ctx_t *file_ctx = &file_opts->file_ctx;
+
+    if( file_ctx->vmap )
+        munmap( file_ctx->vmap, file_ctx->vmap_size );
+    if( file_ctx->vfd > 0 )
+        close( file_ctx->vfd );
+
+    if( file_ctx->amap )
+        munmap( file_ctx->amap, file_ctx->amap_size );
+    if( file_ctx->afd > 0 )
+        close( file_ctx->afd );
+
+    if( file_ctx->avr )
+        avresample_free( &file_ctx->avr );
+
+    av_freep( &file_ctx->anc_buf );
+    av_freep( &file_ctx->vbi_buf );
+
+    obe_v210_convert_close( &file_ctx->convert );
+}
+
+static int map_file( const char *location, int *fd, uint8_t **map, size_t *size )
+{
+    struct stat st;
+
+    if( (*fd = open( location, O_RDONLY )) < 0 )
+    {
+        fprintf( stderr, "[file] couldn't open %s: %s \n", location, strerror( errno ) );
+        return -1;
+    }
+
+    if( fstat( *fd, &st ) < 0 || !st.st_size )
+    {
+        fprintf( stderr, "[file] %s is empty or not a regular file \n", location );
+        return -1;
+    }
+
+    *size = st.st_size;
+    *map = mmap( NULL, *size, PROT_READ, MAP_SHARED, *fd, 0 );
+    if( *map == MAP_FAILED )
+    {
+        *map = NULL;
+        fprintf( stderr, "[file] couldn't mmap %s: %s \n", location, strerror( errno ) );
+        return -1;
+    }
+
+    madvise( *map, *size, MADV_SEQUENTIAL );
+
+    return 0;
+}
+
+static int open_files( file_opts_t *file_opts )
+{
+    file_ctx_t *file_ctx = &file_opts->file_ctx;
+    const obe_sdi_video_format_t *format = obe_sdi_get_video_format( file_opts->video_format );
+    int j, line, aligned_width, cpu_flags;
+
+    if( !format )
+    {
+        fprintf( stderr, "[file] Unsupported video format\n" );
+        return -1;
+    }
+
+    file_opts->width = file_ctx->width = format->width;
+    file_opts->height = format->height;
+    file_opts->timebase_num = format->timebase_num;
+    file_opts->timebase_den = format->timebase_den;
+    file_opts->interlaced = IS_INTERLACED( file_opts->video_format );
+    if( file_opts->interlaced )
+        file_opts->tff = format->tff;
+
+    file_ctx->v_timebase.num = file_opts->timebase_num;
+    file_ctx->v_timebase.den = file_opts->timebase_den;
+    file_ctx->a_timebase.num = 1;
+    file_ctx->a_timebase.den = FILE_SAMPLE_RATE;
+
+    aligned_width = ((file_opts->width + 47) / 48) * 48;
+    file_ctx->stride = aligned_width * 8 / 3;
+
+    if( file_opts->vanc )
+    {
+        for( j = 0; first_active_line[j].format != -1; j++ )
+        {
+            if( file_opts->video_format == first_active_line[j].format )
+                break;
+        }
+
+        /* NTSC starts on line 4 */
+        line = file_opts->video_format == INPUT_VIDEO_FORMAT_NTSC ? 4 : 1;
+        while( line != first_active_line[j].line )
+        {
+            file_ctx->num_vanc_lines++;
+            line = sdi_next_line( file_opts->video_format, line );
+        }
+    }
+
+    file_ctx->frame_size = (file_ctx->num_vanc_lines + file_opts->height) * file_ctx->stride;
+
+    if( map_file( file_opts->video_location, &file_ctx->vfd, &file_ctx->vmap, &file_ctx->vmap_size ) < 0 )
+        return -1;
+
+    file_ctx->num_frames = file_ctx->vmap_size / file_ctx->frame_size;
+    if( !file_ctx->num_frames )
+    {
+        fprintf( stderr, "[file] %s is smaller than one frame \n", file_opts->video_location );
+        return -1;
+    }
+
+    if( file_opts->audio_location )
+    {
+        if( map_file( file_opts->audio_location, &file_ctx->afd, &file_ctx->amap, &file_ctx->amap_size ) < 0 )
+            return -1;
+
+        file_ctx->num_samples = file_ctx->amap_size / (FILE_NUM_CHANNELS * sizeof(int32_t));
+        if( !file_ctx->num_samples )
+        {
+            fprintf( stderr, "[file] %s is smaller than one sample \n", file_opts->audio_location );
+            return -1;
+        }
+
+        if( !file_opts->probe )
+        {
+            file_ctx->avr = avresample_alloc_context();
+            if( !file_ctx->avr )
+            {
+                fprintf( stderr, "[file] couldn't setup sample format conversion \n" );
+                return -1;
+            }
+
+            /* Give libavresample a made up channel map */
+            av_opt_set_int( file_ctx->avr, "in_channel_layout",   (1 << FILE_NUM_CHANNELS) - 1, 0 );
+            av_opt_set_int( file_ctx->avr, "in_sample_fmt",       AV_SAMPLE_FMT_S32, 0 );
+            av_opt_set_int( file_ctx->avr, "in_sample_rate",      FILE_SAMPLE_RATE, 0 );
+            av_opt_set_int( file_ctx->avr, "out_channel_layout",  (1 << FILE_NUM_CHANNELS) - 1, 0 );
+            av_opt_set_int( file_ctx->avr, "out_sample_fmt",      AV_SAMPLE_FMT_S32P, 0 );
+
+            if( avresample_open( file_ctx->avr ) < 0 )
+            {
+                fprintf( stderr, "Could not open AVResample\n" );
+                return -1;
+            }
+        }
+    }
+
+    cpu_flags = av_get_cpu_flags();
+
+    /* Setup unpack functions */
+    file_ctx->unpack_line = obe_get_v210_planar_unpack();
+
+    /* Setup VBI and VANC unpack functions */
+    if( IS_SD( file_opts->video_format ) )
+    {
+        file_ctx->vanc_unpack_line = obe_v210_line_to_uyvy_c;
+        file_ctx->downscale_line = obe_downscale_line_c;
+
+        if( cpu_flags & AV_CPU_FLAG_MMX )
+            file_ctx->downscale_line = obe_downscale_line_mmx;
+
+        if( cpu_flags & AV_CPU_FLAG_SSE2 )
+            file_ctx->downscale_line = obe_downscale_line_sse2;
+    }
+    else
+        file_ctx->vanc_unpack_line = obe_v210_line_to_nv20_c;
+
+    if( file_ctx->num_vanc_lines )
+    {
+        /* Overallocate slightly for VANC buffer
+         * Some VBI services stray into the active picture so allocate some extra space */
+        if( obe_alloc_anc_buffers( &file_ctx->anc_buf, &file_ctx->vbi_buf, file_ctx->width, FILE_VANC_LINES ) < 0 )
+        {
+            fprintf( stderr, "malloc failed \n" );
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int handle_non_display_data( file_opts_t *file_opts, uint8_t *data, obe_raw_frame_t *raw_frame )
+{
+    file_ctx_t *file_ctx = &file_opts->file_ctx;
+    obe_t *h = file_ctx->h;
+    int anc_line_stride, num_anc_lines = 0, first_line, last_line, line, num_vbi_lines, vii_line, tmp_line;
+    uint16_t *anc_buf_pos;
+    uint8_t *active = data + file_ctx->num_vanc_lines * file_ctx->stride;
+
+    anc_line_stride = FFALIGN( (file_ctx->width * 2 * sizeof(uint16_t)), 16 );
+    anc_buf_pos = file_ctx->anc_buf;
+
+    first_line = last_line = line = file_opts->video_format == INPUT_VIDEO_FORMAT_NTSC ? 4 : 1;
+    for( int i = 0; i < file_ctx->num_vanc_lines; i++ )
+    {
+        /* Most lines are empty so check the packed line first. SD still needs every line for VBI */
+        int has_packets = obe_v210_line_has_vanc( h, &file_ctx->non_display_parser, (uint32_t*)data, file_ctx->width,
+                                                  IS_SD( file_opts->video_format ) );
+        if( has_packets || IS_SD( file_opts->video_format ) )
+            file_ctx->vanc_unpack_line( (uint32_t*)data, anc_buf_pos, file_ctx->width );
+        if( has_packets )
+            parse_vanc_line( h, &file_ctx->non_display_parser, raw_frame, anc_buf_pos, file_ctx->width, line );
+
+        data += file_ctx->stride;
+        anc_buf_pos += anc_line_stride / 2;
+        last_line = line;
+        line = sdi_next_line( file_opts->video_format, line );
+        num_anc_lines++;
+    }
+
+    if( IS_SD( file_opts->video_format ) && first_line != last_line )
+    {
+        /* NTSC starts from line 283 so add an extra line */
+        num_vbi_lines = NUM_ACTIVE_VBI_LINES + ( file_opts->video_format == INPUT_VIDEO_FORMAT_NTSC );
+        for( int i = 0; i < num_vbi_lines; i++ )
+        {
+            file_ctx->vanc_unpack_line( (uint32_t*)active, anc_buf_pos, file_ctx->width );
+            anc_buf_pos += anc_line_stride / 2;
+            active += file_ctx->stride;
+            last_line = sdi_next_line( file_opts->video_format, last_line );
+        }
+        num_anc_lines += num_vbi_lines;
+
+        /* Scale the lines from 10-bit to 8-bit */
+        file_ctx->downscale_line( file_ctx->anc_buf, file_ctx->vbi_buf, num_anc_lines );
+        anc_buf_pos = file_ctx->anc_buf;
+
+        /* Handle Video Index information */
+        tmp_line = first_line;
+        vii_line = file_opts->video_format == INPUT_VIDEO_FORMAT_NTSC ? NTSC_VIDEO_INDEX_LINE : PAL_VIDEO_INDEX_LINE;
+        while( tmp_line < vii_line )
+        {
+            anc_buf_pos += anc_line_stride / 2;
+            tmp_line++;
+        }
+
+        if( decode_video_index_information( h, &file_ctx->non_display_parser, anc_buf_pos, raw_frame, vii_line ) < 0 )
+            return -1;
+
+        if( !file_ctx->has_setup_vbi )
+        {
+            vbi_raw_decoder_init( &file_ctx->non_display_parser.vbi_decoder );
+
+            file_ctx->non_display_parser.ntsc = file_opts->video_format == INPUT_VIDEO_FORMAT_NTSC;
+            file_ctx->non_display_parser.vbi_decoder.start[0] = first_line;
+            file_ctx->non_display_parser.vbi_decoder.start[1] = sdi_next_line( file_opts->video_format, first_line );
+            file_ctx->non_display_parser.vbi_decoder.count[0] = last_line - file_ctx->non_display_parser.vbi_decoder.start[1] + 1;
+            file_ctx->non_display_parser.vbi_decoder.count[1] = file_ctx->non_display_parser.vbi_decoder.count[0];
+
+            if( setup_vbi_parser( &file_ctx->non_display_parser ) < 0 )
+                return -1;
+
+            file_ctx->has_setup_vbi = 1;
+        }
+
+        if( decode_vbi( h, &file_ctx->non_display_parser, file_ctx->vbi_buf, raw_frame ) < 0 )
+            return -1;
+    }
+
+    return 0;
+}
+
+static int handle_video_frame( file_opts_t *file_opts, uint8_t *data )
+{
+    file_ctx_t *file_ctx = &file_opts->file_ctx;
+    obe_t *h = file_ctx->h;
+    obe_raw_frame_t *raw_frame = NULL;
+    obe_image_t *output;
+    uint16_t *y_dst, *u_dst, *v_dst;
+    uint8_t *src;
+    int j;
+
+    if( file_opts->probe )
+        return file_ctx->num_vanc_lines ? handle_non_display_data( file_opts, data, NULL ) : 0;
+
+    raw_frame = new_raw_frame( h );
+    if( !raw_frame )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return -1;
+    }
+    output = &raw_frame->alloc_img;
+
+    raw_frame->release_data = obe_release_video_data;
+    raw_frame->release_frame = obe_release_frame;
+    raw_frame->arrival_time = obe_mdate();
+
+    if( file_ctx->num_vanc_lines && handle_non_display_data( file_opts, data, raw_frame ) < 0 )
+        goto fail;
+
+    src = data + file_ctx->num_vanc_lines * file_ctx->stride;
+
+    if( file_ctx->direct )
+    {
+        const uint8_t *src_lines[2] = { src, src + file_ctx->stride };
+
+        if( obe_v210_convert_alloc_image( &file_ctx->convert, output, file_opts->height ) < 0 )
+            goto fail;
+
+        obe_v210_convert_lines( &file_ctx->convert, src_lines, 2 * file_ctx->stride, output, 0, output->height, 0 );
+    }
+    else
+    {
+        output->csp = PIX_FMT_YUV422P10;
+        output->planes = av_pix_fmt_descriptors[output->csp].nb_components;
+        output->width = file_opts->width;
+        output->height = file_opts->height;
+
+        if( av_image_alloc( output->plane, output->stride, output->width, output->height + 1, output->csp, 16 ) < 0 )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            goto fail;
+        }
+
+        y_dst = (uint16_t*)output->plane[0];
+        u_dst = (uint16_t*)output->plane[1];
+        v_dst = (uint16_t*)output->plane[2];
+
+        for( int i = 0; i < output->height; i++ )
+        {
+            obe_v210_decode_line( file_ctx->unpack_line, (const uint32_t*)src, y_dst, u_dst, v_dst, file_ctx->width );
+
+            src += file_ctx->stride;
+            y_dst += output->stride[0] / 2;
+            u_dst += output->stride[1] / 2;
+            v_dst += output->stride[2] / 2;
+        }
+    }
+
+    output->format = file_opts->video_format;
+    memcpy( &raw_frame->img, output, sizeof(raw_frame->img) );
+
+    if( IS_SD( file_opts->video_format ) )
+    {
+        for( j = 0; first_active_line[j].format != -1; j++ )
+        {
+            if( file_opts->video_format == first_active_line[j].format )
+                break;
+        }
+
+        raw_frame->img.first_line = first_active_line[j].line;
+        if( file_opts->video_format == INPUT_VIDEO_FORMAT_NTSC )
+        {
+            raw_frame->img.height = 480;
+            while( raw_frame->img.first_line != NTSC_FIRST_CODED_LINE )
+            {
+                for( int i = 0; i < raw_frame->img.planes; i++ )
+                    raw_frame->img.plane[i] += raw_frame->img.stride[i];
+
+                raw_frame->img.first_line = sdi_next_line( INPUT_VIDEO_FORMAT_NTSC, raw_frame->img.first_line );
+            }
+        }
+    }
+
+    raw_frame->timebase_num = file_opts->timebase_num;
+    raw_frame->timebase_den = file_opts->timebase_den;
+
+    /* If AFD is present and the stream is SD this will be changed in the video filter */
+    raw_frame->sar_width = raw_frame->sar_height = 1;
+    raw_frame->pts = av_rescale_q( file_ctx->v_counter, file_ctx->v_timebase, (AVRational){1, OBE_CLOCK} );
+
+    for( int i = 0; i < file_ctx->device->num_input_streams; i++ )
+    {
+        if( file_ctx->device->streams[i]->stream_format == VIDEO_UNCOMPRESSED )
+            raw_frame->input_stream_id = file_ctx->device->streams[i]->input_stream_id;
+    }
+
+    if( add_to_filter_queue( h, raw_frame ) < 0 )
+        goto fail;
+
+    if( send_vbi_and_ttx( h, &file_ctx->non_display_parser, raw_frame->pts ) < 0 )
+        return -1;
+
+    file_ctx->non_display_parser.num_vbi = 0;
+    file_ctx->non_display_parser.num_anc_vbi = 0;
+
+    return 0;
+
+fail:
+    raw_frame->release_data( raw_frame );
+    raw_frame->release_frame( raw_frame );
+
+    return -1;
+}
+
+static int handle_audio_frame( file_opts_t *file_opts, int num_samples )
+{
+    file_ctx_t *file_ctx = &file_opts->file_ctx;
+    obe_raw_frame_t *raw_frame;
+    uint8_t *out[FILE_NUM_CHANNELS], *in;
+    int done = 0, len;
+
+    raw_frame = new_raw_frame( file_ctx->h );
+    if( !raw_frame )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return -1;
+    }
+
+    raw_frame->audio_frame.num_samples = num_samples;
+    raw_frame->audio_frame.num_channels = FILE_NUM_CHANNELS;
+    raw_frame->audio_frame.sample_fmt = AV_SAMPLE_FMT_S32P;
+    raw_frame->release_data = obe_release_audio_data;
+    raw_frame->release_frame = obe_release_frame;
+
+    if( av_samples_alloc( raw_frame->audio_frame.audio_data, &raw_frame->audio_frame.linesize, FILE_NUM_CHANNELS,
+                          num_samples, raw_frame->audio_frame.sample_fmt, 0 ) < 0 )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        raw_frame->release_frame( raw_frame );
+        return -1;
+    }
+
+    if( !file_ctx->amap )
+        av_samples_set_silence( raw_frame->audio_frame.audio_data, 0, num_samples, FILE_NUM_CHANNELS, raw_frame->audio_frame.sample_fmt );
+
+    /* The audio file is looped independently of the video file */
+    while( file_ctx->amap && done < num_samples )
+    {
+        if( file_ctx->cur_sample == file_ctx->num_samples )
+            file_ctx->cur_sample = 0;
+
+        len = FFMIN( num_samples - done, file_ctx->num_samples - file_ctx->cur_sample );
+        in = &file_ctx->amap[file_ctx->cur_sample * FILE_NUM_CHANNELS * sizeof(int32_t)];
+        for( int i = 0; i < FILE_NUM_CHANNELS; i++ )
+            out[i] = &raw_frame->audio_frame.audio_data[i][done * sizeof(int32_t)];
+
+        if( avresample_convert( file_ctx->avr, out, raw_frame->audio_frame.linesize, len, &in,
+                                len * FILE_NUM_CHANNELS * sizeof(int32_t), len ) < 0 )
+        {
+            syslog( LOG_ERR, "[file] Sample format conversion failed\n" );
+            goto fail;
+        }
+
+        file_ctx->cur_sample += len;
+        done += len;
+    }
+
+    raw_frame->pts = av_rescale_q( file_ctx->a_counter, file_ctx->a_timebase, (AVRational){1, OBE_CLOCK} );
+    file_ctx->a_counter += num_samples;
+
+    for( int i = 0; i < file_ctx->device->num_input_streams; i++ )
+    {
+        if( file_ctx->device->streams[i]->stream_format == AUDIO_PCM )
+            raw_frame->input_stream_id = file_ctx->device->streams[i]->input_stream_id;
+    }
+
+    if( add_to_filter_queue( file_ctx->h, raw_frame ) < 0 )
+        goto fail;
+
+    return 0;
+
+fail:
+    raw_frame->release_data( raw_frame );
+    raw_frame->release_frame( raw_frame );
+    return -1;
+}
+
+static void unlock_queue( void *ptr )
+{
+    obe_queue_unlock( ptr );
+}
+
+static void wait_for_queue( obe_queue_t *queue )
+{
+    obe_queue_lock( queue );
+    pthread_cleanup_push( unlock_queue, queue );
+    while( obe_queue_depth( queue ) >= FILE_MAX_QUEUED_FRAMES )
+        pthread_cond_wait( &queue->out_cv, &queue->mutex );
+    pthread_cleanup_pop( 1 );
+}
+
+/* Without pacing there is nothing to stop the file being read into memory faster than it can be encoded */
+static void wait_for_pipeline( obe_t *h )
+{
+    for( int i = 0; i < h->num_filters; i++ )
+        wait_for_queue( &h->filters[i]->queue );
+
+    for( int i = 0; i < h->num_encoders; i++ )
+        wait_for_queue( &h->encoders[i]->queue );
+}
+
+/* Returns 1 at the end of a file which is not looped */
+static int read_frame( file_opts_t *file_opts )
+{
+    file_ctx_t *file_ctx = &file_opts->file_ctx;
+    obe_t *h = file_ctx->h;
+    int64_t pts;
+    int num_samples;
+
+    if( file_ctx->cur_frame == file_ctx->num_frames )
+    {
+        if( !file_opts->loop )
+            return 1;
+
+        file_ctx->cur_frame = 0;
+    }
+
+    pts = av_rescale_q( file_ctx->v_counter, file_ctx->v_timebase, (AVRational){1, OBE_CLOCK} );
+
+    if( file_opts->pacing == INPUT_PACING_REALTIME )
+    {
+        if( file_ctx->start_time == -1 )
+            file_ctx->start_time = get_wallclock_in_mpeg_ticks();
+        else
+            sleep_mpeg_ticks( file_ctx->start_time + pts );
+    }
+    else
+        wait_for_pipeline( h );
+
+    /* use file timestamps as clock source */
+    obe_clock_tick( h, pts );
+
+    if( handle_video_frame( file_opts, &file_ctx->vmap[file_ctx->cur_frame * file_ctx->frame_size] ) < 0 )
+        return -1;
+
+    /* Spread the samples so that the audio stays locked to the video */
+    num_samples = av_rescale( file_ctx->v_counter + 1, (int64_t)FILE_SAMPLE_RATE * file_opts->timebase_num, file_opts->timebase_den ) -
+                  av_rescale( file_ctx->v_counter, (int64_t)FILE_SAMPLE_RATE * file_opts->timebase_num, file_opts->timebase_den );
+
+    if( handle_audio_frame( file_opts, num_samples ) < 0 )
+        return -1;
+
+    file_ctx->cur_frame++;
+    file_ctx->v_counter++;
+
+    return 0;
+}
+
+/* Tells the filters, and through them the encoders, that nothing follows the last frame */
+static int send_eos( file_ctx_t *file_ctx )
+{
+    obe_raw_frame_t *raw_frame;
+    int format;
+
+    for( int i = 0; i < file_ctx->device->num_input_streams; i++ )
+    {
+        format = file_ctx->device->streams[i]->stream_format;
+        if( format != VIDEO_UNCOMPRESSED && format != AUDIO_PCM )
+            continue;
+
+        raw_frame = new_eos_raw_frame( file_ctx->h, file_ctx->device->streams[i]->input_stream_id );
+        if( !raw_frame )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            return -1;
+        }
+
+        /* The stream may not be encoded */
+        if( add_to_filter_queue( file_ctx->h, raw_frame ) < 0 )
+            raw_frame->release_frame( raw_frame );
+    }
+
+    return 0;
+}
+
+static int copy_location( char **dst, const char *src )
+{
+    if( !src )
+        return 0;
+
+    *dst = malloc( strlen( src ) + 1 );
+    if( !*dst )
+        return -1;
+    strcpy( *dst, src );
+
+    return 0;
+}
+
+static void close_thread( void *handle )
+{
+    struct file_status *status = handle;
+
+    if( status->file_opts )
+    {
+        close_files( status->file_opts );
+        free( status->file_opts->video_location );
+        free( status->file_opts->audio_location );
+        free( status->file_opts );
+    }
+
+    free( status->input );
+}
+
+static void *probe_stream( void *ptr )
+{
+    obe_input_probe_t *probe_ctx = ptr;
+    obe_t *h = probe_ctx->h;
+    obe_input_t *user_opts = &probe_ctx->user_opts;
+    obe_device_t *device;
+    obe_int_input_stream_t *streams[MAX_STREAMS];
+    int num_streams = 0, vbi_stream_services = 0, num_probe_frames;
+    obe_sdi_non_display_data_t *non_display_parser;
+
+    file_opts_t file_opts;
+    memset( &file_opts, 0, sizeof(file_opts_t) );
+    non_display_parser = &file_opts.file_ctx.non_display_parser;
+    file_opts.file_ctx.h = h;
+    file_opts.probe = non_display_parser->probe = 1;
+
+    file_opts.video_location = user_opts->location;
+    file_opts.audio_location = user_opts->audio_location;
+    file_opts.video_format = user_opts->video_format;
+    file_opts.vanc = user_opts->vanc;
+
+    if( !file_opts.video_location )
+    {
+        fprintf( stderr, "[file] No video file specified \n" );
+        goto finish;
+    }
+
+    if( open_files( &file_opts ) < 0 )
+    {
+        close_files( &file_opts );
+        goto finish;
+    }
+
+    /* Look for ancillary data in the first second */
+    num_probe_frames = FFMIN( file_opts.file_ctx.num_frames, file_opts.timebase_den / file_opts.timebase_num + 1 );
+    for( int i = 0; i < num_probe_frames; i++ )
+        handle_video_frame( &file_opts, &file_opts.file_ctx.vmap[i * file_opts.file_ctx.frame_size] );
+
+    close_files( &file_opts );
+
+    for( int i = 0; i < non_display_parser->num_frame_data; i++ )
+    {
+        if( non_display_parser->frame_data[i].location == USER_DATA_LOCATION_DVB_STREAM )
+            vbi_stream_services++;
+    }
+
+    num_streams = 2+!!vbi_stream_services;
+    for( int i = 0; i < num_streams; i++ )
+    {
+        streams[i] = calloc( 1, sizeof(*streams[i]) );
+        if( !streams[i] )
+            goto finish;
+
+        pthread_mutex_lock( &h->device_list_mutex );
+        streams[i]->input_stream_id = h->cur_input_stream_id++;
+        pthread_mutex_unlock( &h->device_list_mutex );
+
+        if( i == 0 )
+        {
+            streams[i]->stream_type = STREAM_TYPE_VIDEO;
+            streams[i]->stream_format = VIDEO_UNCOMPRESSED;
+            streams[i]->width  = file_opts.width;
+            streams[i]->height = file_opts.video_format == INPUT_VIDEO_FORMAT_NTSC ? 480 : file_opts.height;
+            streams[i]->timebase_num = file_opts.timebase_num;
+            streams[i]->timebase_den = file_opts.timebase_den;
+            streams[i]->csp    = PIX_FMT_YUV422P10;
+            streams[i]->interlaced = file_opts.interlaced;
+            streams[i]->tff = file_opts.tff;
+            streams[i]->sar_num = streams[i]->sar_den = 1; /* The user can choose this when encoding */
+
+            if( add_non_display_services( non_display_parser, streams[i], USER_DATA_LOCATION_FRAME ) < 0 )
+                goto finish;
+        }
+        else if( i == 1 )
+        {
+            streams[i]->stream_type = STREAM_TYPE_AUDIO;
+            streams[i]->stream_format = AUDIO_PCM;
+            streams[i]->num_channels = FILE_NUM_CHANNELS;
+            streams[i]->sample_format = AV_SAMPLE_FMT_S32P;
+            streams[i]->sample_rate = FILE_SAMPLE_RATE;
+        }
+        else /* VBI stream */
+        {
+            streams[i]->stream_type = STREAM_TYPE_MISC;
+            streams[i]->stream_format = VBI_RAW;
+            if( add_non_display_services( non_display_parser, streams[i], USER_DATA_LOCATION_DVB_STREAM ) < 0 )
+                goto finish;
+        }
+    }
+
+    if( non_display_parser->num_frame_data )
+        free( non_display_parser->frame_data );
+
+    device = new_device();
+
+    if( !device )
+        goto finish;
+
+    device->num_input_streams = num_streams;
+    memcpy( device->streams, streams, num_streams * sizeof(obe_int_input_stream_t**) );
+    device->device_type = INPUT_DEVICE_FILE;
+    memcpy( &device->user_opts, user_opts, sizeof(*user_opts) );
+
+    /* add device */
+    add_device( h, device );
+
+finish:
+    free( probe_ctx );
+
+    return NULL;
+}
+
+static void *open_input( void *ptr )
+{
+    obe_input_params_t *input = ptr;
+    obe_t *h = input->h;
+    obe_device_t *device = input->device;
+    obe_input_t *user_opts = &device->user_opts;
+    file_opts_t *file_opts;
+    file_ctx_t *file_ctx;
+    struct file_status status;
+    int csp, ret;
+
+    file_opts = calloc( 1, sizeof(*file_opts) );
+    if( !file_opts )
+    {
+        fprintf( stderr, "malloc failed \n" );
+        return NULL;
+    }
+
+    status.input = input;
+    status.file_opts = file_opts;
+    pthread_cleanup_push( close_thread, (void*)&status );
+
+    file_opts->video_format = user_opts->video_format;
+    file_opts->vanc = user_opts->vanc;
+    /* Offline mode has no real time to pace against */
+    file_opts->pacing = h->offline ? INPUT_PACING_NONE : user_opts->pacing;
+    file_opts->loop = user_opts->loop;
+
+    file_ctx = &file_opts->file_ctx;
+
+    file_ctx->device = device;
+    file_ctx->h = h;
+    file_ctx->start_time = -1;
+    file_ctx->non_display_parser.device = device;
+
+    if( copy_location( &file_opts->video_location, user_opts->location ) < 0 ||
+        copy_location( &file_opts->audio_location, user_opts->audio_location ) < 0 )
+    {
+        fprintf( stderr, "malloc failed \n" );
+        return NULL;
+    }
+
+    if( open_files( file_opts ) < 0 )
+        return NULL;
+
+    csp = obe_video_filter_direct_csp( h, file_ctx->device, file_opts->video_format, file_opts->width,
+                                       file_opts->height );
+    if( csp != PIX_FMT_NONE )
+    {
+        if( obe_v210_convert_init( &file_ctx->convert, file_opts->width, csp, file_opts->interlaced, 1 ) < 0 )
+            return NULL;
+        file_ctx->direct = 1;
+    }
+
+    while( !( ret = read_frame( file_opts ) ) )
+        ;
+
+    if( ret > 0 )
+        send_eos( file_ctx );
+
+    pthread_cleanup_pop( 1 );
+
+    return NULL;
+}
+
+const obe_input_func_t file_input = { probe_stream, open_input };
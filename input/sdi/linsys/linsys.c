@@ -43,6 +43,7 @@
 #include "input/sdi/ancillary.h"
 #include "input/sdi/vbi.h"
 #include "input/sdi/x86/sdi.h"
+#include "filters/video/video.h"
 
 #include <libavutil/mathematics.h>
 #include <libavutil/bswap.h>
@@ -64,35 +65,31 @@
 #define NB_ABUFFERS             2
 #define LINSYS_VANC_LINES       100
 #define LINSYS_NTSC_TOP_LINES   6
+#define LINSYS_UNPACK_THREADS   3
 
 struct obe_to_linsys_video
 {
     int obe_name;
     int linsys_name;
-    int timebase_num;
-    int timebase_den;
-    int width;
-    int height;
-    int total_height;
-    int tff;
 };
 
+/* Sizes and frame rates are in the shared SDI format table */
 const static struct obe_to_linsys_video video_format_tab[] =
 {
-    { INPUT_VIDEO_FORMAT_PAL,        SDIVIDEO_CTL_BT_601_576I_50HZ,         1,    25,    720,  576,  625,  1 },
-    { INPUT_VIDEO_FORMAT_NTSC,       SDIVIDEO_CTL_SMPTE_125M_486I_59_94HZ,  1001, 30000, 720,  486,  525,  0 },
-    { INPUT_VIDEO_FORMAT_720P_50,    SDIVIDEO_CTL_SMPTE_296M_720P_50HZ,     1,    50,    1280, 720,  750,  0 },
-    { INPUT_VIDEO_FORMAT_720P_5994,  SDIVIDEO_CTL_SMPTE_296M_720P_59_94HZ,  1001, 60000, 1280, 720,  750,  0 },
-    { INPUT_VIDEO_FORMAT_720P_60,    SDIVIDEO_CTL_SMPTE_296M_720P_60HZ,     1,    60,    1280, 720,  750,  0 },
-    { INPUT_VIDEO_FORMAT_1080I_50,   SDIVIDEO_CTL_SMPTE_274M_1080I_50HZ,    1,    25,    1920, 1080, 1125, 1 },
-    { INPUT_VIDEO_FORMAT_1080I_5994, SDIVIDEO_CTL_SMPTE_274M_1080I_59_94HZ, 1001, 30000, 1920, 1080, 1125, 1 },
-    { INPUT_VIDEO_FORMAT_1080I_60,   SDIVIDEO_CTL_SMPTE_274M_1080I_60HZ,    1,    60,    1920, 1080, 1125, 1 },
-    { INPUT_VIDEO_FORMAT_1080P_2398, SDIVIDEO_CTL_SMPTE_274M_1080P_23_98HZ, 1001, 24000, 1920, 1080, 1125, 0 },
-    { INPUT_VIDEO_FORMAT_1080P_24,   SDIVIDEO_CTL_SMPTE_274M_1080P_24HZ,    1,    24,    1920, 1080, 1125, 0 },
-    { INPUT_VIDEO_FORMAT_1080P_25,   SDIVIDEO_CTL_SMPTE_274M_1080P_25HZ,    1,    25,    1920, 1080, 1125, 0 },
-    { INPUT_VIDEO_FORMAT_1080P_2997, SDIVIDEO_CTL_SMPTE_274M_1080P_29_97HZ, 1001, 30000, 1920, 1080, 1125, 0 },
-    { INPUT_VIDEO_FORMAT_1080P_30,   SDIVIDEO_CTL_SMPTE_274M_1080P_30HZ,    1,    30,    1920, 1080, 1125, 0 },
-    { -1, -1, -1, -1, -1, -1 },
+    { INPUT_VIDEO_FORMAT_PAL,        SDIVIDEO_CTL_BT_601_576I_50HZ },
+    { INPUT_VIDEO_FORMAT_NTSC,       SDIVIDEO_CTL_SMPTE_125M_486I_59_94HZ },
+    { INPUT_VIDEO_FORMAT_720P_50,    SDIVIDEO_CTL_SMPTE_296M_720P_50HZ },
+    { INPUT_VIDEO_FORMAT_720P_5994,  SDIVIDEO_CTL_SMPTE_296M_720P_59_94HZ },
+    { INPUT_VIDEO_FORMAT_720P_60,    SDIVIDEO_CTL_SMPTE_296M_720P_60HZ },
+    { INPUT_VIDEO_FORMAT_1080I_50,   SDIVIDEO_CTL_SMPTE_274M_1080I_50HZ },
+    { INPUT_VIDEO_FORMAT_1080I_5994, SDIVIDEO_CTL_SMPTE_274M_1080I_59_94HZ },
+    { INPUT_VIDEO_FORMAT_1080I_60,   SDIVIDEO_CTL_SMPTE_274M_1080I_60HZ },
+    { INPUT_VIDEO_FORMAT_1080P_2398, SDIVIDEO_CTL_SMPTE_274M_1080P_23_98HZ },
+    { INPUT_VIDEO_FORMAT_1080P_24,   SDIVIDEO_CTL_SMPTE_274M_1080P_24HZ },
+    { INPUT_VIDEO_FORMAT_1080P_25,   SDIVIDEO_CTL_SMPTE_274M_1080P_25HZ },
+    { INPUT_VIDEO_FORMAT_1080P_2997, SDIVIDEO_CTL_SMPTE_274M_1080P_29_97HZ },
+    { INPUT_VIDEO_FORMAT_1080P_30,   SDIVIDEO_CTL_SMPTE_274M_1080P_30HZ },
+    { -1, -1 },
 };
 
 struct linsys_audio_channels
@@ -140,6 +137,21 @@ typedef struct
     obe_raw_frame_t *raw_frame;
     void (*unpack_line) ( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
 
+    /* Bands of lines are unpacked in parallel so the buffer can be returned to the driver sooner */
+    obe_slice_pool_t unpack_pool;
+    int              has_unpack_pool;
+    const uint8_t    *unpack_src[2];
+    obe_image_t      *unpack_dst;
+
+    /* HD pictures can be converted straight to the encoder's format.
+     * Only the VANC lines before the active picture are then unpacked to 4:2:2 */
+    int                direct;
+    obe_v210_convert_t convert;
+    obe_image_t        vanc_img;
+    int                num_vanc_lines;
+    const uint8_t      *direct_src[2];
+    int                direct_src_stride;
+
     /* audio device reader */
     int          afd;
     int          max_channel;
@@ -165,6 +177,8 @@ typedef struct
     void (*pack_line) ( uint16_t *y, uint16_t *u, uint16_t *v, uint16_t *dst, int width );
     void (*downscale_line) ( uint16_t *src, uint8_t *dst, int lines );
     obe_sdi_non_display_data_t non_display_parser;
+    uint16_t *anc_buf;
+    uint8_t  *vbi_buf;
 
     obe_device_t *device;
     obe_t *h;
@@ -202,46 +216,6 @@ struct linsys_status
 
 #define MAXLEN 256
 
-#define READ_PIXELS(a, b, c)         \
-    do {                             \
-        val  = av_le2ne32(*src++);   \
-        *a++ =  val & 0x3FF;         \
-        *b++ = (val >> 10) & 0x3FF;  \
-        *c++ = (val >> 20) & 0x3FF;  \
-    } while (0)
-
-static inline void obe_decode_line( linsys_ctx_t *linsys_ctx, const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v )
-{
-    uint32_t val = 0;
-    int w;
-
-    w = (linsys_ctx->width / 6) * 6;
-    linsys_ctx->unpack_line( src, y, u, v, w );
-
-    y += w;
-    u += w >> 1;
-    v += w >> 1;
-    src += (w << 1) / 3;
-
-   if( w < linsys_ctx->width - 1 )
-   {
-       READ_PIXELS(u, y, v);
-
-       val  = av_le2ne32(*src++);
-       *y++ =  val & 0x3FF;
-   }
-
-   if( w < linsys_ctx->width - 3 )
-   {
-       *u++ = (val >> 10) & 0x3FF;
-       *y++ = (val >> 20) & 0x3FF;
-
-       val  = av_le2ne32(*src++);
-       *v++ =  val & 0x3FF;
-       *y++ = (val >> 10) & 0x3FF;
-   }
-}
-
 static ssize_t write_ul_sysfs( const char *fmt, unsigned int card_idx, unsigned int buf )
 {
     char filename[MAXLEN], data[MAXLEN];
@@ -285,6 +259,106 @@ static void close_card( linsys_opts_t *linsys_opts )
 
     if( linsys_ctx->avr )
         avresample_free( &linsys_ctx->avr );
+
+    if( linsys_ctx->has_unpack_pool )
+    {
+        obe_slice_pool_destroy( &linsys_ctx->unpack_pool );
+        linsys_ctx->has_unpack_pool = 0;
+    }
+
+    obe_v210_convert_close( &linsys_ctx->convert );
+    av_freep( &linsys_ctx->vanc_img.plane[0] );
+    av_freep( &linsys_ctx->anc_buf );
+    av_freep( &linsys_ctx->vbi_buf );
+    linsys_ctx->direct = 0;
+}
+
+/* Even lines come from the first field and odd lines from the second */
+static const uint8_t *coded_line( linsys_ctx_t *linsys_ctx, int i )
+{
+    if( linsys_ctx->unpack_src[0] != linsys_ctx->unpack_src[1] )
+        return linsys_ctx->unpack_src[i & 1] + (i >> 1) * linsys_ctx->stride;
+
+    return linsys_ctx->unpack_src[0] + i * linsys_ctx->stride;
+}
+
+static void unpack_slice( void *ptr, int slice, int num_slices )
+{
+    linsys_ctx_t *linsys_ctx = ptr;
+    obe_image_t *output = linsys_ctx->unpack_dst;
+    int start = (linsys_ctx->coded_height * slice) / num_slices;
+    int end = (linsys_ctx->coded_height * (slice + 1)) / num_slices;
+
+    for( int i = start; i < end; i++ )
+    {
+        const uint8_t *src = coded_line( linsys_ctx, i );
+        uint16_t *y_dst = (uint16_t*)(output->plane[0] + i * output->stride[0]);
+        uint16_t *u_dst = (uint16_t*)(output->plane[1] + i * output->stride[1]);
+        uint16_t *v_dst = (uint16_t*)(output->plane[2] + i * output->stride[2]);
+
+        /* The SIMD versions can write into the start of the next line, which belongs to another slice */
+        if( i == end - 1 && slice != num_slices - 1 )
+            obe_v210_decode_line( obe_v210_planar_unpack_c, (const uint32_t*)src, y_dst, u_dst, v_dst, linsys_ctx->width );
+        else
+            obe_v210_decode_line( linsys_ctx->unpack_line, (const uint32_t*)src, y_dst, u_dst, v_dst, linsys_ctx->width );
+    }
+}
+
+static void convert_slice( void *ptr, int slice, int num_slices )
+{
+    linsys_ctx_t *linsys_ctx = ptr;
+    obe_image_t *output = linsys_ctx->unpack_dst;
+    /* Bands are made of whole groups of lines so the chroma can be downsampled */
+    int group = linsys_ctx->convert.interlaced ? 4 : 2;
+    int num_groups = output->height / group;
+    int start = (num_groups * slice) / num_slices * group;
+    int end = (num_groups * (slice + 1)) / num_slices * group;
+
+    obe_v210_convert_lines( &linsys_ctx->convert, linsys_ctx->direct_src, linsys_ctx->direct_src_stride,
+                            output, start, end, slice );
+}
+
+static int setup_direct_conversion( linsys_opts_t *linsys_opts )
+{
+    linsys_ctx_t *linsys_ctx = &linsys_opts->linsys_ctx;
+    int csp = obe_video_filter_direct_csp( linsys_ctx->h, linsys_ctx->device, linsys_opts->video_format, linsys_opts->width,
+                                           linsys_opts->height );
+    int j;
+
+    if( csp == PIX_FMT_NONE )
+        return 0;
+
+    if( obe_v210_convert_init( &linsys_ctx->convert, linsys_ctx->width, csp, linsys_opts->interlaced,
+                               linsys_ctx->unpack_pool.num_threads + 1 ) < 0 )
+        return -1;
+
+    if( linsys_ctx->has_vanc )
+    {
+        for( j = 0; first_active_line[j].format != -1; j++ )
+        {
+            if( linsys_opts->video_format == first_active_line[j].format )
+                break;
+        }
+
+        for( int line = 1; line != first_active_line[j].line; line = sdi_next_line( linsys_opts->video_format, line ) )
+            linsys_ctx->num_vanc_lines++;
+
+        linsys_ctx->vanc_img.csp = PIX_FMT_YUV422P10;
+        linsys_ctx->vanc_img.planes = av_pix_fmt_descriptors[linsys_ctx->vanc_img.csp].nb_components;
+        linsys_ctx->vanc_img.width = linsys_ctx->width;
+        linsys_ctx->vanc_img.height = linsys_ctx->num_vanc_lines;
+
+        if( av_image_alloc( linsys_ctx->vanc_img.plane, linsys_ctx->vanc_img.stride, linsys_ctx->width,
+                            linsys_ctx->num_vanc_lines + 1, PIX_FMT_YUV422P10, 16 ) < 0 )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            return -1;
+        }
+    }
+
+    linsys_ctx->direct = 1;
+
+    return 0;
 }
 
 static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
@@ -293,9 +367,10 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
     obe_t *h = linsys_ctx->h;
     obe_raw_frame_t *raw_frame = NULL;
     int num_anc_lines = 0, anc_line_stride, first_line = 0, last_line = 0, cur_line, num_vbi_lines, vii_line, tmp_line;
-    uint16_t *anc_buf = NULL, *anc_buf_pos = NULL;
+    int row, has_packets;
+    uint16_t *anc_buf = linsys_ctx->anc_buf, *anc_buf_pos = linsys_ctx->anc_buf;
     uint16_t *y_src, *u_src, *v_src;
-    uint8_t *vbi_buf;
+    uint8_t *vbi_buf = linsys_ctx->vbi_buf;
     int64_t pts, sdi_clock;
 
     obe_image_t *output;
@@ -317,8 +392,10 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
             syslog( LOG_WARNING, "Linsys card index %i: No frame received for %"PRIi64" ms", linsys_opts->card_idx,
                    (cur_frame_time - linsys_ctx->last_frame_time) / 1000 );
             pthread_mutex_lock( &h->drop_mutex );
-            h->encoder_drop = h->mux_drop = 1;
+            h->encoder_drop++;
+            h->mux_drop = 1;
             pthread_mutex_unlock( &h->drop_mutex );
+            OBE_STAT_ADD( h->input_drops, 1 );
         }
 
         linsys_ctx->last_frame_time = cur_frame_time;
@@ -332,7 +409,7 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
     }
 
     /* Create raw frame */
-    raw_frame = new_raw_frame();
+    raw_frame = new_raw_frame( h );
     if( !raw_frame )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
@@ -349,15 +426,21 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
     output->width = linsys_ctx->width;
     output->height = linsys_opts->height;
 
-    if( av_image_fill_linesizes( output->stride, output->csp, output->width ) < 0 )
-        goto fail;
+    if( linsys_ctx->direct )
+    {
+        if( obe_v210_convert_alloc_image( &linsys_ctx->convert, output, linsys_opts->height ) < 0 )
+            goto fail;
 
-    if( av_image_alloc( output->plane, output->stride, linsys_ctx->width, linsys_ctx->coded_height + 1, PIX_FMT_YUV422P10, 16 ) < 0 )
-        goto fail;
+        output = &linsys_ctx->vanc_img;
+    }
+    else
+    {
+        if( av_image_fill_linesizes( output->stride, output->csp, output->width ) < 0 )
+            goto fail;
 
-    uint16_t *y_dst = (uint16_t*)output->plane[0];
-    uint16_t *u_dst = (uint16_t*)output->plane[1];
-    uint16_t *v_dst = (uint16_t*)output->plane[2];
+        if( av_image_alloc( output->plane, output->stride, linsys_ctx->width, linsys_ctx->coded_height + 1, PIX_FMT_YUV422P10, 16 ) < 0 )
+            goto fail;
+    }
 
     /* Interleave fields */
     if( linsys_opts->interlaced )
@@ -382,35 +465,28 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
             /* All non-VANC resolutions have an even height */
             v210_src_f2 += (linsys_ctx->coded_height / 2) * linsys_ctx->stride;
 
-        for( int i = 0; i < linsys_ctx->coded_height; i++ )
-        {
-            if( !(i & 1) )
-            {
-                obe_decode_line( linsys_ctx, (const uint32_t*)v210_src_f1, y_dst, u_dst, v_dst );
-                v210_src_f1 += linsys_ctx->stride;
-            }
-            else
-            {
-                obe_decode_line( linsys_ctx, (const uint32_t*)v210_src_f2, y_dst, u_dst, v_dst );
-                v210_src_f2 += linsys_ctx->stride;
-            }
+        linsys_ctx->unpack_src[0] = v210_src_f1;
+        linsys_ctx->unpack_src[1] = v210_src_f2;
+    }
+    else
+        linsys_ctx->unpack_src[0] = linsys_ctx->unpack_src[1] = data;
 
-            y_dst += output->stride[0] / 2;
-            u_dst += output->stride[1] / 2;
-            v_dst += output->stride[2] / 2;
-        }
+    if( linsys_ctx->direct )
+    {
+        /* The VANC lines are split evenly between the fields so the active picture starts on the first field.
+         * They are only unpacked below if they carry packets */
+        linsys_ctx->direct_src[0] = coded_line( linsys_ctx, linsys_ctx->num_vanc_lines );
+        linsys_ctx->direct_src[1] = coded_line( linsys_ctx, linsys_ctx->num_vanc_lines + 1 );
+        linsys_ctx->direct_src_stride = linsys_opts->interlaced ? linsys_ctx->stride : 2 * linsys_ctx->stride;
+
+        linsys_ctx->unpack_dst = &raw_frame->alloc_img;
+        obe_slice_pool_run( &linsys_ctx->unpack_pool, convert_slice, linsys_ctx, linsys_ctx->unpack_pool.num_threads + 1 );
     }
     else
     {
-        for( int i = 0; i < linsys_ctx->coded_height; i++ )
-        {
-            obe_decode_line( linsys_ctx, (const uint32_t*)data, y_dst, u_dst, v_dst );
-
-            data += linsys_ctx->stride;
-            y_dst += output->stride[0] / 2;
-            u_dst += output->stride[1] / 2;
-            v_dst += output->stride[2] / 2;
-        }
+        /* Returns once every band has been unpacked */
+        linsys_ctx->unpack_dst = output;
+        obe_slice_pool_run( &linsys_ctx->unpack_pool, unpack_slice, linsys_ctx, linsys_ctx->unpack_pool.num_threads + 1 );
     }
 
     anc_line_stride = FFALIGN( (linsys_ctx->width * 2 * sizeof(uint16_t)), 16 );
@@ -431,21 +507,25 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
         }
 
         first_line = cur_line = linsys_opts->video_format == INPUT_VIDEO_FORMAT_NTSC ? 4 : 1;
-
-        /* Overallocate slightly for VANC buffer
-         * Some VBI services stray into the active picture so allocate some extra space */
-        anc_buf = anc_buf_pos = av_malloc( LINSYS_VANC_LINES * anc_line_stride );
-        if( !anc_buf )
-        {
-            syslog( LOG_ERR, "Malloc failed\n" );
-            goto fail;
-        }
+        row = linsys_opts->video_format == INPUT_VIDEO_FORMAT_NTSC ? LINSYS_NTSC_TOP_LINES : 0;
 
         while( cur_line != first_active_line[j].line )
         {
-            linsys_ctx->pack_line( y_src, u_src, v_src, anc_buf_pos, linsys_ctx->width );
-            parse_vanc_line( h, &linsys_ctx->non_display_parser, raw_frame, anc_buf_pos, linsys_ctx->width, cur_line );
+            /* Most lines are empty so check the packed line first. SD still needs every line for VBI */
+            has_packets = obe_v210_line_has_vanc( h, &linsys_ctx->non_display_parser, (const uint32_t*)coded_line( linsys_ctx, row ),
+                                                  linsys_ctx->width, IS_SD( linsys_opts->video_format ) );
+            if( has_packets || IS_SD( linsys_opts->video_format ) )
+            {
+                if( linsys_ctx->direct )
+                    obe_v210_decode_line( linsys_ctx->unpack_line, (const uint32_t*)coded_line( linsys_ctx, row ), y_src, u_src, v_src,
+                                          linsys_ctx->width );
+
+                linsys_ctx->pack_line( y_src, u_src, v_src, anc_buf_pos, linsys_ctx->width );
+                if( has_packets )
+                    parse_vanc_line( h, &linsys_ctx->non_display_parser, raw_frame, anc_buf_pos, linsys_ctx->width, cur_line );
+            }
             anc_buf_pos += anc_line_stride / 2;
+            row++;
 
             y_src += output->stride[0] / 2;
             u_src += output->stride[1] / 2;
@@ -476,12 +556,7 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
             }
 
             /* Only the first two lines can be probed for VBI data */
-            anc_buf = anc_buf_pos = av_malloc( NUM_ACTIVE_VBI_LINES * anc_line_stride );
-            if( !anc_buf )
-            {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                goto fail;
-            }
+            anc_buf_pos = anc_buf;
         }
         else
             num_vbi_lines += linsys_opts->video_format == INPUT_VIDEO_FORMAT_NTSC;
@@ -501,13 +576,6 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
             last_line = sdi_next_line( linsys_opts->video_format, last_line );
         }
 
-        vbi_buf = av_malloc( linsys_ctx->width * 2 * num_anc_lines );
-        if( !vbi_buf )
-        {
-            syslog( LOG_ERR, "Malloc failed\n" );
-            goto fail;
-        }
-
         /* Scale the lines from 10-bit to 8-bit */
         linsys_ctx->downscale_line( anc_buf, vbi_buf, num_anc_lines );
         anc_buf_pos = anc_buf;
@@ -545,12 +613,8 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
 
         if( decode_vbi( h, &linsys_ctx->non_display_parser, vbi_buf, raw_frame ) < 0 )
             goto fail;
-
-        av_free( vbi_buf );
     }
 
-    av_free( anc_buf );
-
     if( linsys_opts->probe )
     {
         raw_frame->release_data( raw_frame );
@@ -559,7 +623,9 @@ static int handle_video_frame( linsys_opts_t *linsys_opts, uint8_t *data )
     else
     {
         raw_frame->alloc_img.format = linsys_opts->video_format;
-        if( linsys_ctx->has_vanc )
+        if( linsys_ctx->direct )
+            memcpy( &raw_frame->img, &raw_frame->alloc_img, sizeof(raw_frame->img) );
+        else if( linsys_ctx->has_vanc )
         {
             /* Just present the coded picture to the encoder */
             y_src = (uint16_t*)output->plane[0];
@@ -641,7 +707,7 @@ static int handle_audio_frame( linsys_opts_t *linsys_opts, uint8_t *data )
 {
     linsys_ctx_t *linsys_ctx = &linsys_opts->linsys_ctx;
 
-    obe_raw_frame_t *raw_frame = new_raw_frame();
+    obe_raw_frame_t *raw_frame = new_raw_frame( linsys_ctx->h );
     if( !raw_frame )
     {
         syslog( LOG_ERR, "Malloc failed\n" );
@@ -798,6 +864,7 @@ static int capture_data( linsys_opts_t *linsys_opts )
 static int open_card( linsys_opts_t *linsys_opts )
 {
     linsys_ctx_t *linsys_ctx = &linsys_opts->linsys_ctx;
+    const obe_sdi_video_format_t *format;
     int          ret = 0, i, aligned_width, cpu_flags;
     const int    page_size = getpagesize();
     unsigned int bufmemsize, sample_rate;
@@ -874,18 +941,19 @@ static int open_card( linsys_opts_t *linsys_opts )
         goto finish;
     }
 
-    linsys_opts->video_format = video_format_tab[i].obe_name;
-    linsys_opts->width = linsys_ctx->width = video_format_tab[i].width;
-    linsys_opts->height = linsys_ctx->coded_height = video_format_tab[i].height;
+    format = obe_sdi_get_video_format( video_format_tab[i].obe_name );
+    linsys_opts->video_format = format->obe_name;
+    linsys_opts->width = linsys_ctx->width = format->width;
+    linsys_opts->height = linsys_ctx->coded_height = format->height;
     /* Ignore any 6 junk lines */
     if( linsys_opts->video_format == INPUT_VIDEO_FORMAT_NTSC )
         linsys_opts->height = 480;
 
-    linsys_opts->timebase_num = video_format_tab[i].timebase_num;
-    linsys_opts->timebase_den = video_format_tab[i].timebase_den;
+    linsys_opts->timebase_num = format->timebase_num;
+    linsys_opts->timebase_den = format->timebase_den;
     linsys_opts->interlaced = IS_INTERLACED( linsys_opts->video_format );
     if( linsys_opts->interlaced )
-        linsys_opts->tff = video_format_tab[i].tff;
+        linsys_opts->tff = format->tff;
 
     linsys_ctx->v_timebase.num = linsys_opts->timebase_num;
     linsys_ctx->v_timebase.den = linsys_opts->timebase_den;
@@ -897,13 +965,14 @@ static int open_card( linsys_opts_t *linsys_opts )
     cpu_flags = av_get_cpu_flags();
 
     /* Setup unpack functions */
-    linsys_ctx->unpack_line = obe_v210_planar_unpack_c;
-
-    if( cpu_flags & AV_CPU_FLAG_SSSE3 )
-        linsys_ctx->unpack_line = obe_v210_planar_unpack_aligned_ssse3;
+    linsys_ctx->unpack_line = obe_get_v210_planar_unpack();
 
-    if( cpu_flags & AV_CPU_FLAG_AVX )
-        linsys_ctx->unpack_line = obe_v210_planar_unpack_aligned_avx;
+    if( obe_slice_pool_init( &linsys_ctx->unpack_pool, obe_slice_threads( LINSYS_UNPACK_THREADS ) ) < 0 )
+    {
+        ret = -1;
+        goto finish;
+    }
+    linsys_ctx->has_unpack_pool = 1;
 
     /* Setup VBI and VANC pack functions */
     if( IS_SD( linsys_opts->video_format ) )
@@ -920,6 +989,15 @@ static int open_card( linsys_opts_t *linsys_opts )
     else
         linsys_ctx->pack_line = obe_yuv422p10_line_to_nv20_c;
 
+    /* Overallocate slightly for VANC buffer
+     * Some VBI services stray into the active picture so allocate some extra space */
+    if( obe_alloc_anc_buffers( &linsys_ctx->anc_buf, &linsys_ctx->vbi_buf, linsys_ctx->width, LINSYS_VANC_LINES ) < 0 )
+    {
+        fprintf( stderr, "[linsys] malloc failed \n" );
+        ret = -1;
+        goto finish;
+    }
+
     close( linsys_ctx->vfd );
 
     /* First open the audio for synchronization reasons */
@@ -1062,8 +1140,8 @@ static int open_card( linsys_opts_t *linsys_opts )
     /* Increase the buffer size if VANC is being included and make the v210 decoder act on the full frame */
     if( linsys_ctx->has_vanc )
     {
-        linsys_ctx->vbuffer_size += (video_format_tab[i].total_height - video_format_tab[i].height) * linsys_ctx->stride;
-        linsys_ctx->coded_height = video_format_tab[i].total_height;
+        linsys_ctx->vbuffer_size += (format->total_height - format->height) * linsys_ctx->stride;
+        linsys_ctx->coded_height = format->total_height;
     }
 
     linsys_ctx->num_vbuffers = NB_VBUFFERS;
@@ -1280,6 +1358,9 @@ static void *open_input( void *ptr )
     if( open_card( linsys_opts ) < 0 )
         return NULL;
 
+    if( setup_direct_conversion( linsys_opts ) < 0 )
+        return NULL;
+
     while( 1 )
     {
         if( capture_data( linsys_opts ) < 0 )
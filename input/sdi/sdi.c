@@ -23,7 +23,9 @@
  *****************************************************************************/
 
 #include "sdi.h"
+#include "x86/sdi.h"
 #include <libavutil/bswap.h>
+#include <libavutil/cpu.h>
 
 #define READ_PIXELS(a, b, c)         \
     do {                             \
@@ -33,6 +35,39 @@
         *c++ = (val >> 20) & 0x3ff;  \
     } while (0)
 
+/* The timebase is the frame rate, so interlaced formats use half the field rate */
+static const obe_sdi_video_format_t video_format_tab[] =
+{
+    { INPUT_VIDEO_FORMAT_PAL,        1,    25,    720,  576,  625,  1 },
+    { INPUT_VIDEO_FORMAT_NTSC,       1001, 30000, 720,  486,  525,  0 },
+    { INPUT_VIDEO_FORMAT_720P_50,    1,    50,    1280, 720,  750,  0 },
+    { INPUT_VIDEO_FORMAT_720P_5994,  1001, 60000, 1280, 720,  750,  0 },
+    { INPUT_VIDEO_FORMAT_720P_60,    1,    60,    1280, 720,  750,  0 },
+    { INPUT_VIDEO_FORMAT_1080I_50,   1,    25,    1920, 1080, 1125, 1 },
+    { INPUT_VIDEO_FORMAT_1080I_5994, 1001, 30000, 1920, 1080, 1125, 1 },
+    { INPUT_VIDEO_FORMAT_1080I_60,   1,    30,    1920, 1080, 1125, 1 },
+    { INPUT_VIDEO_FORMAT_1080P_2398, 1001, 24000, 1920, 1080, 1125, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_24,   1,    24,    1920, 1080, 1125, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_25,   1,    25,    1920, 1080, 1125, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_2997, 1001, 30000, 1920, 1080, 1125, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_30,   1,    30,    1920, 1080, 1125, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_50,   1,    50,    1920, 1080, 1125, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_5994, 1001, 60000, 1920, 1080, 1125, 0 },
+    { INPUT_VIDEO_FORMAT_1080P_60,   1,    60,    1920, 1080, 1125, 0 },
+    { -1, -1, -1, -1, -1, -1, -1 },
+};
+
+const obe_sdi_video_format_t *obe_sdi_get_video_format( int obe_name )
+{
+    for( int i = 0; video_format_tab[i].obe_name != -1; i++ )
+    {
+        if( video_format_tab[i].obe_name == obe_name )
+            return &video_format_tab[i];
+    }
+
+    return NULL;
+}
+
 void obe_v210_planar_unpack_c( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width )
 {
     uint32_t val;
@@ -46,6 +81,64 @@ void obe_v210_planar_unpack_c( const uint32_t *src, uint16_t *y, uint16_t *u, ui
     }
 }
 
+/* The source must be aligned to the vector width. The SIMD versions work in blocks so may read
+ * the rest of the padded v210 line and write a few pixels past the end of each plane's line */
+obe_v210_planar_unpack_t obe_get_v210_planar_unpack( void )
+{
+    obe_v210_planar_unpack_t unpack = obe_v210_planar_unpack_c;
+    int cpu_flags = av_get_cpu_flags();
+
+    if( cpu_flags & AV_CPU_FLAG_SSSE3 )
+        unpack = obe_v210_planar_unpack_aligned_ssse3;
+
+    if( cpu_flags & AV_CPU_FLAG_AVX )
+        unpack = obe_v210_planar_unpack_aligned_avx;
+
+#ifdef AV_CPU_FLAG_AVX2
+    if( cpu_flags & AV_CPU_FLAG_AVX2 )
+        unpack = obe_v210_planar_unpack_aligned_avx2;
+#endif
+
+#if HAVE_AVX512
+    if( obe_cpu_has_avx512vbmi() )
+        unpack = obe_v210_planar_unpack_avx512vbmi;
+#endif
+
+    return unpack;
+}
+
+/* Unpacks a whole line, including the pixels after the last complete group of six */
+void obe_v210_decode_line( obe_v210_planar_unpack_t unpack, const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width )
+{
+    uint32_t val = 0;
+    int w = (width / 6) * 6;
+
+    unpack( src, y, u, v, w );
+
+    y += w;
+    u += w >> 1;
+    v += w >> 1;
+    src += (w << 1) / 3;
+
+    if( w < width - 1 )
+    {
+        READ_PIXELS( u, y, v );
+
+        val  = av_le2ne32( *src++ );
+        *y++ =  val & 0x3ff;
+    }
+
+    if( w < width - 3 )
+    {
+        *u++ = (val >> 10) & 0x3ff;
+        *y++ = (val >> 20) & 0x3ff;
+
+        val  = av_le2ne32( *src++ );
+        *v++ =  val & 0x3ff;
+        *y++ = (val >> 10) & 0x3ff;
+    }
+}
+
 /* Convert v210 to the native HD-SDI pixel format. */
 void obe_v210_line_to_nv20_c( uint32_t *src, uint16_t *dst, int width )
 {
@@ -146,6 +239,27 @@ void obe_blank_line_uyvy_c( uint16_t *dst, int width )
     }
 }
 
+/* Buffers for a frame's ancillary lines in the native SDI format and downscaled for libzvbi.
+ * They are written here so the capture thread doesn't fault the pages in later */
+int obe_alloc_anc_buffers( uint16_t **anc_buf, uint8_t **vbi_buf, int width, int num_lines )
+{
+    int anc_buf_size = num_lines * FFALIGN( (width * 2 * sizeof(uint16_t)), 16 );
+    int vbi_buf_size = num_lines * width * 2;
+
+    av_freep( anc_buf );
+    av_freep( vbi_buf );
+
+    *anc_buf = av_malloc( anc_buf_size );
+    *vbi_buf = av_malloc( vbi_buf_size );
+    if( !*anc_buf || !*vbi_buf )
+        return -1;
+
+    memset( *anc_buf, 0, anc_buf_size );
+    memset( *vbi_buf, 0, vbi_buf_size );
+
+    return 0;
+}
+
 int add_non_display_services( obe_sdi_non_display_data_t *non_display_data, obe_int_input_stream_t *stream, int location )
 {
     int idx = 0, count = 0;
@@ -66,6 +66,11 @@ typedef struct
     int num_anc_vbi;
     obe_anc_vbi_t anc_vbi[100];
 
+    /* VANC packets the parsers will act on, as (DID << 8) | SDID. Built on first use */
+    int has_vanc_filter;
+    int num_vanc_filter;
+    uint16_t vanc_filter[8];
+
     /* Video Index Information */
     AVCRC crc[257];
     AVCRC crc_broken[257];
@@ -113,6 +118,22 @@ const static obe_line_number_t field_start_lines[] =
     { -1, -1 },
 };
 
+typedef struct
+{
+    int obe_name;
+    int timebase_num;
+    int timebase_den;
+    int width;
+    int height;
+    int total_height;
+    int tff;
+} obe_sdi_video_format_t;
+
+typedef void (*obe_v210_planar_unpack_t)( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+
+const obe_sdi_video_format_t *obe_sdi_get_video_format( int obe_name );
+obe_v210_planar_unpack_t obe_get_v210_planar_unpack( void );
+void obe_v210_decode_line( obe_v210_planar_unpack_t unpack, const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
 void obe_v210_line_to_nv20_c( uint32_t *src, uint16_t *dst, int width );
 void obe_v210_line_to_uyvy_c( uint32_t *src, uint16_t *dst, int width );
 void obe_yuv422p10_line_to_nv20_c( uint16_t *y, uint16_t *u, uint16_t *v, uint16_t *dst, int width );
@@ -120,6 +141,7 @@ void obe_yuv422p10_line_to_uyvy_c( uint16_t *y, uint16_t *u, uint16_t *v, uint16
 void obe_downscale_line_c( uint16_t *src, uint8_t *dst, int lines );
 void obe_blank_line_nv20_c( uint16_t *dst, int width );
 void obe_blank_line_uyvy_c( uint16_t *dst, int width );
+int obe_alloc_anc_buffers( uint16_t **anc_buf, uint8_t **vbi_buf, int width, int num_lines );
 int add_non_display_services( obe_sdi_non_display_data_t *non_display_data, obe_int_input_stream_t *stream, int location );
 int check_probed_non_display_data( obe_sdi_non_display_data_t *non_display_data, int type );
 int check_active_non_display_data( obe_raw_frame_t *raw_frame, int type );
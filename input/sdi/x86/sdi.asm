@@ -7,6 +7,10 @@ v210_mult: dw 64,4,64,4,64,4,64,4
 v210_luma_shuf: db 8,9,0,1,2,3,12,13,4,5,6,7,-1,-1,-1,-1
 v210_chroma_shuf: db 0,1,8,9,6,7,-1,-1,2,3,4,5,12,13,-1,-1
 
+adf_zero_mask: times 16 dw 0xfffc
+adf_ones_mask: times 16 dw 0x3fc
+vanc_cs_mask:  times 16 dw 0x1ff
+
 SECTION .text
 
 ; downscale_line( uint16_t *src, uint8_t *dst, int lines );
@@ -45,10 +49,17 @@ cglobal v210_planar_unpack_%1, 5, 5, 7
     add    r3, r4
     neg    r4
 
+%if mmsize == 32
+    vbroadcasti128 m3, [v210_mult]
+    vbroadcasti128 m4, [v210_mask]
+    vbroadcasti128 m5, [v210_luma_shuf]
+    vbroadcasti128 m6, [v210_chroma_shuf]
+%else
     mova   m3, [v210_mult]
     mova   m4, [v210_mask]
     mova   m5, [v210_luma_shuf]
     mova   m6, [v210_chroma_shuf]
+%endif
 .loop
 %ifidn %1, unaligned
     movu   m0, [r0]
@@ -63,15 +74,29 @@ cglobal v210_planar_unpack_%1, 5, 5, 7
 
     shufps m2, m1, m0, 0x8d ; y1 y2 y4 y5 y0 __ y3 __
     pshufb m2, m5 ; y0 y1 y2 y3 y4 y5 __ __
+%if mmsize == 32
+    ; each lane holds 6 pixels
+    vmovdqu [r1+2*r4], xmm2
+    vextracti128 [r1+2*r4+12], m2, 1
+%else
     movu   [r1+2*r4], m2
+%endif
 
     shufps m1, m0, 0xd8 ; u0 v0 v1 u2 u1 __ v2 __
     pshufb m1, m6 ; u0 u1 u2 __ v0 v1 v2 __
+%if mmsize == 32
+    vextracti128 xmm0, m1, 1
+    vmovq  [r2+r4], xmm1
+    vmovhps [r3+r4], xmm1
+    vmovq  [r2+r4+6], xmm0
+    vmovhps [r3+r4+6], xmm0
+%else
     movq   [r2+r4], m1
     movhps [r3+r4], m1
+%endif
 
     add r0, mmsize
-    add r4, 6
+    add r4, 6*mmsize/16
     jl  .loop
 
     REP_RET
@@ -81,8 +106,99 @@ INIT_XMM ssse3
 v210_planar_unpack unaligned
 INIT_XMM avx
 v210_planar_unpack unaligned
+INIT_YMM avx2
+v210_planar_unpack unaligned
 
 INIT_XMM ssse3
 v210_planar_unpack aligned
 INIT_XMM avx
 v210_planar_unpack aligned
+INIT_YMM avx2
+v210_planar_unpack aligned
+
+; vanc_find_adf( const uint16_t *line, int i, int end )
+; Searches whole blocks of words starting before end. Returns the index of the first ADF found
+; or the index where the search stopped, which the caller continues from
+%macro VANC_find_adf 0
+cglobal vanc_find_adf, 3, 4, 6
+    movsxdifnidn r1, r1d
+    movsxdifnidn r2, r2d
+    movu      m3, [adf_zero_mask]
+    movu      m4, [adf_ones_mask]
+    pxor      m5, m5
+    sub       r2, mmsize/2
+.loop
+    cmp       r1, r2
+    jg        .end
+
+    ; line[i] <= 0x03 && (line[i+1] & 0x3fc) == 0x3fc && (line[i+2] & 0x3fc) == 0x3fc
+    movu      m0, [r0+2*r1]
+    movu      m1, [r0+2*r1+2]
+    movu      m2, [r0+2*r1+4]
+    pand      m0, m3
+    pand      m1, m4
+    pand      m2, m4
+    pcmpeqw   m0, m5
+    pcmpeqw   m1, m4
+    pcmpeqw   m2, m4
+    pand      m0, m1
+    pand      m0, m2
+    pmovmskb  r3d, m0
+    test      r3d, r3d
+    jnz       .found
+
+    add       r1, mmsize/2
+    jmp       .loop
+
+.found
+    tzcnt     r3d, r3d
+    shr       r3d, 1
+    add       r1, r3
+.end
+    mov       eax, r1d
+    RET
+%endmacro
+
+INIT_XMM sse2
+VANC_find_adf
+INIT_YMM avx2
+VANC_find_adf
+
+; vanc_checksum( const uint16_t *src, int len )
+; Sums the low 9 bits of whole blocks of words. The caller adds the remaining words
+; 16-bit sums can wrap as only the low 9 bits are needed
+%macro VANC_checksum 0
+cglobal vanc_checksum, 2, 2, 3
+    movsxdifnidn r1, r1d
+    movu      m2, [vanc_cs_mask]
+    pxor      m0, m0
+    and       r1, ~(mmsize/2-1)
+    lea       r0, [r0+2*r1]
+    neg       r1
+    jz        .end
+.loop
+    movu      m1, [r0+2*r1]
+    pand      m1, m2
+    paddw     m0, m1
+    add       r1, mmsize/2
+    jl        .loop
+.end
+%if mmsize == 32
+    vextracti128 xmm1, m0, 1
+    paddw     xmm0, xmm1
+%endif
+    pshufd    xmm1, xmm0, 0xee
+    paddw     xmm0, xmm1
+    pshuflw   xmm1, xmm0, 0xee
+    paddw     xmm0, xmm1
+    pshuflw   xmm1, xmm0, 0x55
+    paddw     xmm0, xmm1
+    movd      eax, xmm0
+    and       eax, 0x1ff
+    RET
+%endmacro
+
+INIT_XMM sse2
+VANC_checksum
+INIT_YMM avx2
+VANC_checksum
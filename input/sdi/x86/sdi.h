@@ -35,4 +35,18 @@ void obe_v210_planar_unpack_unaligned_avx( const uint32_t *src, uint16_t *y, uin
 void obe_v210_planar_unpack_aligned_ssse3( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
 void obe_v210_planar_unpack_aligned_avx( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
 
+void obe_v210_planar_unpack_unaligned_avx2( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+void obe_v210_planar_unpack_aligned_avx2( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+
+int obe_vanc_find_adf_sse2( const uint16_t *line, int i, int end );
+int obe_vanc_find_adf_avx2( const uint16_t *line, int i, int end );
+int obe_vanc_checksum_sse2( const uint16_t *src, int len );
+int obe_vanc_checksum_avx2( const uint16_t *src, int len );
+
+#if HAVE_AVX512
+/* Handles any alignment and does not write past the end of the line */
+void obe_v210_planar_unpack_avx512vbmi( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width );
+int obe_cpu_has_avx512vbmi( void );
+#endif
+
 #endif
@@ -0,0 +1,112 @@
+/*****************************************************************************
+ * sdi_avx512.c: AVX-512 SDI functions
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+/* yasm cannot assemble AVX-512 so these are written with intrinsics */
+
+#include "common/common.h"
+#include "input/sdi/x86/sdi.h"
+
+#if HAVE_AVX512
+#include <immintrin.h>
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,avx512vl,avx512vbmi")))
+
+/* Each block of 64 bytes is 4 groups of 6 pixels. Every output sample is gathered with vpermb
+ * into a word holding the two source bytes it straddles, then shifted down by its bit position */
+static const uint8_t v210_luma_perm[64] =
+{
+     1,  2,  4,  5,  6,  7,  9, 10, 12, 13, 14, 15, 17, 18, 20, 21,
+    22, 23, 25, 26, 28, 29, 30, 31, 33, 34, 36, 37, 38, 39, 41, 42,
+    44, 45, 46, 47, 49, 50, 52, 53, 54, 55, 57, 58, 60, 61, 62, 63,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
+};
+
+static const uint16_t v210_luma_shift[32] =
+{
+     2,  0,  4,  2,  0,  4,  2,  0,  4,  2,  0,  4,  2,  0,  4,  2,
+     0,  4,  2,  0,  4,  2,  0,  4,  0,  0,  0,  0,  0,  0,  0,  0
+};
+
+/* Cb in the low half, Cr in the high half */
+static const uint8_t v210_chroma_perm[64] =
+{
+     0,  1,  5,  6, 10, 11, 16, 17, 21, 22, 26, 27, 32, 33, 37, 38,
+    42, 43, 48, 49, 53, 54, 58, 59,  0,  0,  0,  0,  0,  0,  0,  0,
+     2,  3,  8,  9, 13, 14, 18, 19, 24, 25, 29, 30, 34, 35, 40, 41,
+    45, 46, 50, 51, 56, 57, 61, 62,  0,  0,  0,  0,  0,  0,  0,  0
+};
+
+static const uint16_t v210_chroma_shift[32] =
+{
+     0,  2,  4,  0,  2,  4,  0,  2,  4,  0,  2,  4,  0,  0,  0,  0,
+     4,  0,  2,  4,  0,  2,  4,  0,  2,  4,  0,  2,  0,  0,  0,  0
+};
+
+static inline AVX512_TARGET void v210_planar_unpack_block( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int groups,
+                                                          __m512i luma_perm, __m512i luma_shift, __m512i chroma_perm,
+                                                          __m512i chroma_shift, __m512i mask )
+{
+    __m512i in, luma, chroma;
+
+    /* Partial blocks only touch the groups which exist */
+    in = _mm512_maskz_loadu_epi32( (1 << (4*groups)) - 1, src );
+
+    luma = _mm512_permutexvar_epi8( luma_perm, in );
+    luma = _mm512_and_si512( _mm512_srlv_epi16( luma, luma_shift ), mask );
+    _mm512_mask_storeu_epi16( y, (1 << (6*groups)) - 1, luma );
+
+    chroma = _mm512_permutexvar_epi8( chroma_perm, in );
+    chroma = _mm512_and_si512( _mm512_srlv_epi16( chroma, chroma_shift ), mask );
+    _mm256_mask_storeu_epi16( u, (1 << (3*groups)) - 1, _mm512_castsi512_si256( chroma ) );
+    _mm256_mask_storeu_epi16( v, (1 << (3*groups)) - 1, _mm512_extracti64x4_epi64( chroma, 1 ) );
+}
+
+AVX512_TARGET void obe_v210_planar_unpack_avx512vbmi( const uint32_t *src, uint16_t *y, uint16_t *u, uint16_t *v, int width )
+{
+    __m512i luma_perm    = _mm512_loadu_si512( v210_luma_perm );
+    __m512i luma_shift   = _mm512_loadu_si512( v210_luma_shift );
+    __m512i chroma_perm  = _mm512_loadu_si512( v210_chroma_perm );
+    __m512i chroma_shift = _mm512_loadu_si512( v210_chroma_shift );
+    __m512i mask         = _mm512_set1_epi16( 0x3ff );
+    int groups = width / 6;
+
+    for( ; groups >= 4; groups -= 4 )
+    {
+        v210_planar_unpack_block( src, y, u, v, 4, luma_perm, luma_shift, chroma_perm, chroma_shift, mask );
+        src += 16;
+        y += 24;
+        u += 12;
+        v += 12;
+    }
+
+    if( groups )
+        v210_planar_unpack_block( src, y, u, v, groups, luma_perm, luma_shift, chroma_perm, chroma_shift, mask );
+}
+
+int obe_cpu_has_avx512vbmi( void )
+{
+    /* libavutil has no flag for VBMI. This also checks the OS saves the ZMM state */
+    return __builtin_cpu_supports( "avx512bw" ) && __builtin_cpu_supports( "avx512vl" ) &&
+           __builtin_cpu_supports( "avx512vbmi" );
+}
+#endif
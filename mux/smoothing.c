@@ -27,14 +27,27 @@
 #include <libavutil/buffer.h>
 #include "common/common.h"
 
+/* Time taken to send the initial VBV fill at the maximum rate */
+static int64_t get_temporal_vbv_size( x264_param_t *params )
+{
+    return av_rescale_q_rnd( (int64_t)params->rc.i_vbv_buffer_size * params->rc.f_vbv_buffer_init,
+                             (AVRational){1, params->rc.i_vbv_max_bitrate }, (AVRational){ 1, OBE_CLOCK }, AV_ROUND_UP );
+}
+
+/* Pads the end of the stream out to a whole output packet */
+static const uint8_t null_packet[188] = { 0x47, 0x1f, 0xff, 0x10 };
+
 static void *start_smoothing( void *ptr )
 {
     obe_t *h = ptr;
-    int num_muxed_data = 0, buffer_complete = 0;
-    int64_t start_clock = -1, start_pcr, end_pcr, temporal_vbv_size = 0, cur_pcr;
-    obe_muxed_data_t **muxed_data = NULL, *start_data, *end_data;
-    AVFifoBuffer *fifo_data = NULL, *fifo_pcr = NULL;
+    int num_muxed_data = 0, muxed_data_size = 0, buffer_complete = 0, eos = 0;
+    int64_t start_clock = -1, start_pcr, end_pcr, temporal_vbv_size = 0, cur_pcr, last_pcr = 0;
+    /* Byte positions in the data fifo, used to find the first packet of each video frame */
+    int64_t bytes_in = 0, bytes_out = 0, latency[2] = { -1, 0 };
+    obe_muxed_data_t **muxed_data = NULL, **tmp, *start_data, *end_data;
+    AVFifoBuffer *fifo_data = NULL, *fifo_pcr = NULL, *fifo_latency = NULL;
     AVBufferRef **output_buffers = NULL;
+    AVBufferPool *packet_pool = NULL;
 
     struct sched_param param = {0};
     param.sched_priority = 99;
@@ -55,6 +68,14 @@ static void *start_smoothing( void *ptr )
         return NULL;
     }
 
+    /* Pairs of position in the data fifo and capture time */
+    fifo_latency = av_fifo_alloc( 2 * sizeof(int64_t) );
+    if( !fifo_latency )
+    {
+        fprintf( stderr, "[mux-smoothing] Could not allocate latency fifo" );
+        return NULL;
+    }
+
     output_buffers = malloc( h->num_outputs * sizeof(*output_buffers) );
     if( !output_buffers )
     {
@@ -62,6 +83,14 @@ static void *start_smoothing( void *ptr )
         return NULL;
     }
 
+    /* Each output packet is 7 PCRs followed by the transport stream packets */
+    packet_pool = av_buffer_pool_init( TS_PACKETS_SIZE + 7 * sizeof(int64_t), NULL );
+    if( !packet_pool )
+    {
+        fprintf( stderr, "[mux-smoothing] Could not allocate packet pool" );
+        return NULL;
+    }
+
     if( h->obe_system != OBE_SYSTEM_TYPE_LOWEST_LATENCY )
     {
         for( int i = 0; i < h->num_encoders; i++ )
@@ -71,10 +100,8 @@ static void *start_smoothing( void *ptr )
                 pthread_mutex_lock( &h->encoders[i]->queue.mutex );
                 while( !h->encoders[i]->is_ready )
                     pthread_cond_wait( &h->encoders[i]->queue.in_cv, &h->encoders[i]->queue.mutex );
-                x264_param_t *params = h->encoders[i]->encoder_params;
-                temporal_vbv_size = av_rescale_q_rnd(
-                (int64_t)params->rc.i_vbv_buffer_size * params->rc.f_vbv_buffer_init,
-                (AVRational){1, params->rc.i_vbv_max_bitrate }, (AVRational){ 1, OBE_CLOCK }, AV_ROUND_UP );
+                /* obe_update_stream does not allow the VBV buffer duration to change so this holds while running */
+                temporal_vbv_size = get_temporal_vbv_size( h->encoders[i]->encoder_params );
                 pthread_mutex_unlock( &h->encoders[i]->queue.mutex );
                 break;
             }
@@ -83,18 +110,19 @@ static void *start_smoothing( void *ptr )
 
     while( 1 )
     {
-        pthread_mutex_lock( &h->mux_smoothing_queue.mutex );
+        obe_queue_lock( &h->mux_smoothing_queue );
 
-        while( h->mux_smoothing_queue.size == num_muxed_data && !h->cancel_mux_smoothing_thread )
+        while( obe_queue_size( &h->mux_smoothing_queue ) == num_muxed_data && !h->cancel_mux_smoothing_thread )
             pthread_cond_wait( &h->mux_smoothing_queue.in_cv, &h->mux_smoothing_queue.mutex );
 
         if( h->cancel_mux_smoothing_thread )
         {
-            pthread_mutex_unlock( &h->mux_smoothing_queue.mutex );
+            obe_queue_unlock( &h->mux_smoothing_queue );
             break;
         }
+        obe_queue_unlock( &h->mux_smoothing_queue );
 
-        num_muxed_data = h->mux_smoothing_queue.size;
+        num_muxed_data = obe_queue_size( &h->mux_smoothing_queue );
 
         /* Refill the buffer after a drop */
         pthread_mutex_lock( &h->drop_mutex );
@@ -102,8 +130,12 @@ static void *start_smoothing( void *ptr )
         {
             syslog( LOG_INFO, "Mux smoothing buffer reset\n" );
             h->mux_drop = 0;
+            OBE_STAT_ADD( h->mux_drops, 1 );
             av_fifo_reset( fifo_data );
             av_fifo_reset( fifo_pcr );
+            av_fifo_reset( fifo_latency );
+            bytes_in = bytes_out = 0;
+            latency[0] = -1;
             buffer_complete = 0;
             start_clock = -1;
         }
@@ -111,37 +143,52 @@ static void *start_smoothing( void *ptr )
 
         if( !buffer_complete )
         {
-            start_data = h->mux_smoothing_queue.queue[0];
-            end_data = h->mux_smoothing_queue.queue[num_muxed_data-1];
+            start_data = obe_queue_item( &h->mux_smoothing_queue, 0 );
+            end_data = obe_queue_item( &h->mux_smoothing_queue, num_muxed_data-1 );
+
+            /* Whatever is buffered is sent once the stream has ended */
+            if( !end_data->is_eos )
+            {
+                start_pcr = start_data->pcr_list[0];
+                end_pcr = end_data->pcr_list[(end_data->len / 188)-1];
+            }
 
-            start_pcr = start_data->pcr_list[0];
-            end_pcr = end_data->pcr_list[(end_data->len / 188)-1];
-            if( end_pcr - start_pcr >= temporal_vbv_size )
+            if( end_data->is_eos || end_pcr - start_pcr >= temporal_vbv_size )
             {
                 buffer_complete = 1;
                 start_clock = -1;
             }
             else
-            {
-                pthread_mutex_unlock( &h->mux_smoothing_queue.mutex );
                 continue;
-            }
         }
 
         //printf("\n mux smoothed frames %i \n", num_muxed_data );
 
-        muxed_data = malloc( num_muxed_data * sizeof(*muxed_data) );
-        if( !muxed_data )
+        if( num_muxed_data > muxed_data_size )
         {
-            pthread_mutex_unlock( &h->mux_smoothing_queue.mutex );
-            syslog( LOG_ERR, "Malloc failed\n" );
-            return NULL;
+            tmp = realloc( muxed_data, num_muxed_data * sizeof(*muxed_data) );
+            if( !tmp )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return NULL;
+            }
+            muxed_data = tmp;
+            muxed_data_size = num_muxed_data;
         }
-        memcpy( muxed_data, h->mux_smoothing_queue.queue, num_muxed_data * sizeof(*muxed_data) );
-        pthread_mutex_unlock( &h->mux_smoothing_queue.mutex );
+
+        for( int i = 0; i < num_muxed_data; i++ )
+            muxed_data[i] = obe_queue_item( &h->mux_smoothing_queue, i );
 
         for( int i = 0; i < num_muxed_data; i++ )
         {
+            if( muxed_data[i]->is_eos )
+            {
+                eos = 1;
+                remove_from_queue( &h->mux_smoothing_queue );
+                destroy_muxed_data( muxed_data[i] );
+                continue;
+            }
+
             if( av_fifo_realloc2( fifo_data, av_fifo_size( fifo_data ) + muxed_data[i]->len ) < 0 )
             {
                 syslog( LOG_ERR, "Malloc failed\n" );
@@ -150,6 +197,18 @@ static void *start_smoothing( void *ptr )
 
             av_fifo_generic_write( fifo_data, muxed_data[i]->data, muxed_data[i]->len, NULL );
 
+            if( muxed_data[i]->arrival_time )
+            {
+                int64_t entry[2] = { bytes_in, muxed_data[i]->arrival_time };
+                if( av_fifo_realloc2( fifo_latency, av_fifo_size( fifo_latency ) + sizeof(entry) ) < 0 )
+                {
+                    syslog( LOG_ERR, "Malloc failed\n" );
+                    return NULL;
+                }
+                av_fifo_generic_write( fifo_latency, entry, sizeof(entry), NULL );
+            }
+            bytes_in += muxed_data[i]->len;
+
             if( av_fifo_realloc2( fifo_pcr, av_fifo_size( fifo_pcr ) + ((muxed_data[i]->len * sizeof(int64_t)) / 188) ) < 0 )
             {
                 syslog( LOG_ERR, "Malloc failed\n" );
@@ -157,18 +216,36 @@ static void *start_smoothing( void *ptr )
             }
 
             av_fifo_generic_write( fifo_pcr, muxed_data[i]->pcr_list, (muxed_data[i]->len * sizeof(int64_t)) / 188, NULL );
+            if( muxed_data[i]->len )
+                last_pcr = muxed_data[i]->pcr_list[(muxed_data[i]->len / 188)-1];
 
             remove_from_queue( &h->mux_smoothing_queue );
             destroy_muxed_data( muxed_data[i] );
         }
 
-        free( muxed_data );
-        muxed_data = NULL;
         num_muxed_data = 0;
 
+        while( eos && av_fifo_size( fifo_data ) % TS_PACKETS_SIZE )
+        {
+            if( av_fifo_realloc2( fifo_data, av_fifo_size( fifo_data ) + sizeof(null_packet) ) < 0 ||
+                av_fifo_realloc2( fifo_pcr, av_fifo_size( fifo_pcr ) + sizeof(last_pcr) ) < 0 )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return NULL;
+            }
+
+            av_fifo_generic_write( fifo_data, (void*)null_packet, sizeof(null_packet), NULL );
+            av_fifo_generic_write( fifo_pcr, &last_pcr, sizeof(last_pcr), NULL );
+        }
+
         while( av_fifo_size( fifo_data ) >= TS_PACKETS_SIZE )
         {
-            output_buffers[0] = av_buffer_alloc( TS_PACKETS_SIZE + 7 * sizeof(int64_t) );
+            output_buffers[0] = av_buffer_pool_get( packet_pool );
+            if( !output_buffers[0] )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return NULL;
+            }
             av_fifo_generic_read( fifo_pcr, output_buffers[0]->data, 7 * sizeof(int64_t), NULL );
             av_fifo_generic_read( fifo_data, &output_buffers[0]->data[7 * sizeof(int64_t)], TS_PACKETS_SIZE, NULL );
 
@@ -201,12 +278,42 @@ static void *start_smoothing( void *ptr )
                     return NULL;
                 output_buffers[i] = NULL;
             }
+
+            /* Record the latency of frames whose first byte was in this packet */
+            bytes_out += TS_PACKETS_SIZE;
+            while( 1 )
+            {
+                if( latency[0] == -1 )
+                {
+                    if( av_fifo_size( fifo_latency ) < sizeof(latency) )
+                        break;
+                    av_fifo_generic_read( fifo_latency, latency, sizeof(latency), NULL );
+                }
+
+                if( latency[0] >= bytes_out )
+                    break;
+
+                add_latency( h, OBE_LATENCY_OUTPUT, latency[1] );
+                latency[0] = -1;
+            }
+        }
+
+        /* A NULL buffer tells the outputs that the stream has ended */
+        if( eos )
+        {
+            for( int i = 0; i < h->num_outputs; i++ )
+                add_to_queue( &h->outputs[i]->queue, NULL );
+            break;
         }
     }
 
     av_fifo_free( fifo_data );
     av_fifo_free( fifo_pcr );
+    av_fifo_free( fifo_latency );
     free( output_buffers );
+    free( muxed_data );
+    /* Buffers still queued for output keep the pool alive until they are unreferenced */
+    av_buffer_pool_uninit( &packet_pool );
 
     return NULL;
 }
@@ -73,6 +73,16 @@ static obe_output_stream_t *get_output_mux_stream( obe_mux_params_t *mux_params,
     return NULL;
 }
 
+static int num_eos_frames( obe_queue_t *queue )
+{
+    int num_eos = 0;
+
+    for( int i = 0; i < obe_queue_size( queue ); i++ )
+        num_eos += ((obe_coded_frame_t*)obe_queue_item( queue, i ))->is_eos;
+
+    return num_eos;
+}
+
 static void encoder_wait( obe_t *h, int output_stream_id )
 {
     /* Wait for encoder to be ready */
@@ -89,10 +99,10 @@ void *open_muxer( void *ptr )
     obe_t *h = mux_params->h;
     obe_mux_opts_t *mux_opts = &h->mux_opts;
     int cur_pid = MIN_PID;
-    int stream_format, video_pid = 0, video_found = 0, width = 0,
+    int stream_format, video_pid = 0, video_found = 0, eos = 0, width = 0,
     height = 0, has_dds = 0, len = 0, num_frames = 0;
     uint8_t *output;
-    int64_t first_video_pts = -1, video_dts, first_video_real_pts = -1;
+    int64_t first_video_pts = -1, video_dts, first_video_real_pts = -1, arrival_time;
     int64_t *pcr_list;
     ts_writer_t *w;
     ts_main_t params = {0};
@@ -100,7 +110,8 @@ void *open_muxer( void *ptr )
     ts_stream_t *stream;
     ts_dvb_sub_t subtitles;
     ts_dvb_vbi_t *vbi_services;
-    ts_frame_t *frames;
+    ts_frame_t *frames = NULL, *tmp_frames;
+    int frames_size = 0, num_queued;
     obe_int_input_stream_t *input_stream;
     obe_output_stream_t *output_stream;
     obe_encoder_t *encoder;
@@ -211,9 +222,11 @@ void *open_muxer( void *ptr )
         {
             encoder_wait( h, output_stream->output_stream_id );
 
-            width = output_stream->avc_param.i_width;
-            height = output_stream->avc_param.i_height;
-            video_pid = stream->pid;
+            /* The program is described by its largest rendition and the PCR goes on the first one */
+            width = MAX( width, output_stream->avc_param.i_width );
+            height = MAX( height, output_stream->avc_param.i_height );
+            if( !video_pid )
+                video_pid = stream->pid;
         }
         else if( stream_format == AUDIO_MP2 )
             stream->audio_frame_size = (double)MP2_NUM_SAMPLES * 90000LL * output_stream->ts_opts.frames_per_pes / input_stream->sample_rate;
@@ -388,32 +401,34 @@ void *open_muxer( void *ptr )
         video_found = 0;
         video_dts = 0;
 
-        pthread_mutex_lock( &h->mux_queue.mutex );
+        obe_queue_lock( &h->mux_queue );
 
         if( h->cancel_mux_thread )
         {
-            pthread_mutex_unlock( &h->mux_queue.mutex );
+            obe_queue_unlock( &h->mux_queue );
             goto end;
         }
 
         while( !video_found )
         {
-            for( int i = 0; i < h->mux_queue.size; i++ )
+            /* Mux up to the earliest frame of all the video renditions */
+            coded_frame = earliest_video_frame( h, &h->mux_queue );
+            /* Once the video has finished everything left is muxed, so the other encoders must have finished too */
+            if( coded_frame && coded_frame->is_eos && num_eos_frames( &h->mux_queue ) < h->num_encoders )
+                coded_frame = NULL;
+
+            if( coded_frame )
             {
-                coded_frame = h->mux_queue.queue[i];
-                if( coded_frame->is_video )
+                video_found = 1;
+                video_dts = coded_frame->real_dts;
+                eos = coded_frame->is_eos;
+                /* FIXME: handle case where first_video_pts < coded_frame->real_pts */
+                if( first_video_pts == -1 && !eos )
                 {
-                    video_found = 1;
-                    video_dts = coded_frame->real_dts;
-                    /* FIXME: handle case where first_video_pts < coded_frame->real_pts */
-                    if( first_video_pts == -1 )
-                    {
-                        /* Get rid of frames which are too early */
-                        first_video_pts = coded_frame->pts;
-                        first_video_real_pts = coded_frame->real_pts;
-                        remove_early_frames( h, first_video_pts );
-                    }
-                    break;
+                    /* Get rid of frames which are too early */
+                    first_video_pts = coded_frame->pts;
+                    first_video_real_pts = coded_frame->real_pts;
+                    remove_early_frames( h, first_video_pts );
                 }
             }
 
@@ -422,25 +437,38 @@ void *open_muxer( void *ptr )
 
             if( h->cancel_mux_thread )
             {
-                pthread_mutex_unlock( &h->mux_queue.mutex );
+                obe_queue_unlock( &h->mux_queue );
                 goto end;
             }
         }
+        obe_queue_unlock( &h->mux_queue );
+
+        num_queued = obe_queue_size( &h->mux_queue );
 
-        frames = calloc( h->mux_queue.size, sizeof(*frames) );
-        if( !frames )
+        /* Only grows so the steady state does not allocate */
+        if( num_queued > frames_size )
         {
-            syslog( LOG_ERR, "Malloc failed\n" );
-            pthread_mutex_unlock( &h->mux_queue.mutex );
-            goto end;
+            tmp_frames = realloc( frames, num_queued * sizeof(*frames) );
+            if( !tmp_frames )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                goto end;
+            }
+            frames = tmp_frames;
+            frames_size = num_queued;
         }
 
-        //printf("\n START - queuelen %i \n", h->mux_queue.size);
+        //printf("\n START - queuelen %i \n", num_queued);
 
         num_frames = 0;
-        for( int i = 0; i < h->mux_queue.size; i++ )
+        arrival_time = 0;
+        for( int i = 0; i < num_queued; i++ )
         {
-            coded_frame = h->mux_queue.queue[i];
+            coded_frame = obe_queue_item( &h->mux_queue, i );
+            /* Without any video there is nothing to time the other streams against */
+            if( coded_frame->is_eos || first_video_pts == -1 )
+                continue;
+
             output_stream = get_output_mux_stream( mux_params, coded_frame->output_stream_id );
             // FIXME name
             int64_t rescaled_dts = coded_frame->pts - first_video_pts + first_video_real_pts;
@@ -451,12 +479,17 @@ void *open_muxer( void *ptr )
 
             if( rescaled_dts <= video_dts )
             {
-                frames[num_frames].opaque = h->mux_queue.queue[i];
+                memset( &frames[num_frames], 0, sizeof(*frames) );
+                frames[num_frames].opaque = obe_queue_item( &h->mux_queue, i );
                 frames[num_frames].size = coded_frame->len;
                 frames[num_frames].data = coded_frame->data;
                 frames[num_frames].pid = output_stream->ts_opts.pid;
                 if( coded_frame->is_video )
                 {
+                    add_latency( h, OBE_LATENCY_MUX, coded_frame->arrival_time );
+                    if( coded_frame->arrival_time && ( !arrival_time || coded_frame->arrival_time < arrival_time ) )
+                        arrival_time = coded_frame->arrival_time;
+
                     frames[num_frames].cpb_initial_arrival_time = coded_frame->cpb_initial_arrival_time;
                     frames[num_frames].cpb_final_arrival_time = coded_frame->cpb_final_arrival_time;
                     frames[num_frames].dts = coded_frame->real_dts;
@@ -478,14 +511,12 @@ void *open_muxer( void *ptr )
             }
         }
 
-        pthread_mutex_unlock( &h->mux_queue.mutex );
-
         // TODO figure out last frame
         ts_write_frames( w, frames, num_frames, &output, &len, &pcr_list );
 
         if( len )
         {
-            muxed_data = new_muxed_data( len );
+            muxed_data = new_muxed_data( h, len );
             if( !muxed_data )
             {
                 syslog( LOG_ERR, "Malloc failed\n" );
@@ -493,29 +524,47 @@ void *open_muxer( void *ptr )
             }
 
             memcpy( muxed_data->data, output, len );
-            muxed_data->pcr_list = malloc( (len / 188) * sizeof(int64_t) );
-            if( !muxed_data->pcr_list )
-            {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                destroy_muxed_data( muxed_data );
-                goto end;
-            }
             memcpy( muxed_data->pcr_list, pcr_list, (len / 188) * sizeof(int64_t) );
+            muxed_data->arrival_time = arrival_time;
             add_to_queue( &h->mux_smoothing_queue, muxed_data );
+
+            OBE_STAT_ADD( h->mux_bursts, 1 );
+            OBE_STAT_ADD( h->mux_bytes, len );
+            OBE_STAT_SET( h->mux_last_burst_size, len );
+            if( len > h->mux_max_burst_size )
+                OBE_STAT_SET( h->mux_max_burst_size, len );
         }
 
+        OBE_STAT_ADD( h->mux_frames, num_frames );
+
         for( int i = 0; i < num_frames; i++ )
         {
             remove_item_from_queue( &h->mux_queue, frames[i].opaque );
             destroy_coded_frame( frames[i].opaque );
         }
 
-        free( frames );
+        /* The end of stream markers are destroyed with the queue */
+        if( eos )
+        {
+            muxed_data = new_muxed_data( h, 0 );
+            if( !muxed_data )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                goto end;
+            }
+
+            muxed_data->is_eos = 1;
+            add_to_queue( &h->mux_smoothing_queue, muxed_data );
+            goto end;
+        }
     }
 
 end:
     ts_close_writer( w );
 
+    if( frames )
+        free( frames );
+
     /* TODO: clean more */
 
     free( program.streams );
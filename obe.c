@@ -21,6 +21,8 @@
  *
  *****************************************************************************/
 
+#define _GNU_SOURCE
+
 #include "common/common.h"
 #include "common/lavc.h"
 #include "input/input.h"
@@ -65,46 +67,298 @@ void destroy_device( obe_device_t *device )
     free( device );
 }
 
+/** Frame pools **/
+static void init_pool( obe_pool_t *pool )
+{
+    pthread_mutex_init( &pool->mutex, NULL );
+}
+
+/* Returns a recycled object or NULL if the caller must allocate a new one */
+static void *get_from_pool( obe_pool_t *pool )
+{
+    void *item = NULL;
+
+    pthread_mutex_lock( &pool->mutex );
+    if( pool->num_items )
+        item = pool->items[--pool->num_items];
+    else
+        pool->misses++;
+
+    pool->num_outstanding++;
+    pool->high_water = MAX( pool->high_water, pool->num_outstanding );
+    pthread_mutex_unlock( &pool->mutex );
+
+    return item;
+}
+
+/* Returns -1 if the pool is full and the caller must free the object.
+ * A NULL item marks an object from get_from_pool() which could not be allocated */
+static int return_to_pool( obe_pool_t *pool, void *item )
+{
+    int ret = -1;
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->num_outstanding--;
+    if( item && pool->num_items < pool->max_items )
+    {
+        pool->items[pool->num_items++] = item;
+        ret = 0;
+    }
+    pthread_mutex_unlock( &pool->mutex );
+
+    return ret;
+}
+
+static int fill_pool( obe_pool_t *pool, int max_items, int item_size )
+{
+    if( !max_items )
+        return 0;
+
+    pool->items = malloc( max_items * sizeof(*pool->items) );
+    if( !pool->items )
+        return -1;
+
+    pool->max_items = max_items;
+    for( ; pool->num_items < max_items; pool->num_items++ )
+    {
+        /* Payload buffers are allocated on first use when the size is known */
+        pool->items[pool->num_items] = calloc( 1, item_size );
+        if( !pool->items[pool->num_items] )
+            return -1;
+    }
+
+    return 0;
+}
+
+static void destroy_pool( obe_pool_t *pool, void (*free_item)( void* ) )
+{
+    for( int i = 0; i < pool->num_items; i++ )
+        free_item( pool->items[i] );
+
+    free( pool->items );
+    pthread_mutex_destroy( &pool->mutex );
+}
+
+static int setup_frame_pools( obe_t *h )
+{
+    int num_raw_frames = 0, num_coded_frames = 0, num_muxed_data = OBE_POOL_FRAMES_PER_STREAM;
+
+    for( int i = 0; i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *output_stream = &h->output_streams[i];
+        num_coded_frames += OBE_POOL_FRAMES_PER_STREAM;
+
+        if( output_stream->stream_action != STREAM_ENCODE )
+            continue;
+
+        /* Filter and encoder queues */
+        num_raw_frames += 2 * OBE_POOL_FRAMES_PER_STREAM;
+
+        if( output_stream->stream_format == VIDEO_AVC )
+        {
+            x264_param_t *x264_param = &output_stream->avc_param;
+
+            /* Enough frames to fill the encoder and mux smoothing buffers */
+            if( x264_param->rc.i_vbv_max_bitrate > 0 && x264_param->i_fps_den > 0 )
+            {
+                int vbv_frames = (int64_t)x264_param->rc.i_vbv_buffer_size * x264_param->i_fps_num /
+                                 ((int64_t)x264_param->rc.i_vbv_max_bitrate * x264_param->i_fps_den);
+                num_coded_frames += vbv_frames;
+                num_muxed_data += vbv_frames;
+            }
+        }
+    }
+
+    if( fill_pool( &h->raw_frame_pool, num_raw_frames, sizeof(obe_raw_frame_t) ) < 0 ||
+        fill_pool( &h->coded_frame_pool, num_coded_frames, sizeof(obe_coded_frame_t) ) < 0 ||
+        fill_pool( &h->muxed_data_pool, num_muxed_data, sizeof(obe_muxed_data_t) ) < 0 )
+    {
+        fprintf( stderr, "Malloc failed\n" );
+        return -1;
+    }
+
+    /* Give each raw frame room for the usual amount of ancillary data so capture doesn't allocate */
+    for( int i = 0; i < h->raw_frame_pool.num_items; i++ )
+    {
+        obe_raw_frame_t *raw_frame = h->raw_frame_pool.items[i];
+        raw_frame->user_data = calloc( OBE_POOL_USER_DATA, sizeof(*raw_frame->user_data) );
+        raw_frame->user_data_buf = malloc( OBE_POOL_USER_DATA_BUF );
+        if( !raw_frame->user_data || !raw_frame->user_data_buf )
+        {
+            fprintf( stderr, "Malloc failed\n" );
+            return -1;
+        }
+        raw_frame->max_user_data = OBE_POOL_USER_DATA;
+        raw_frame->user_data_buf_size = OBE_POOL_USER_DATA_BUF;
+    }
+
+    return 0;
+}
+
 /* Raw frame */
-obe_raw_frame_t *new_raw_frame( void )
+obe_raw_frame_t *new_raw_frame( obe_t *h )
 {
-    obe_raw_frame_t *raw_frame = calloc( 1, sizeof(*raw_frame) );
+    obe_raw_frame_t *raw_frame = get_from_pool( &h->raw_frame_pool );
 
-    if( !raw_frame )
+    if( raw_frame )
     {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return NULL;
+        obe_user_data_t *user_data = raw_frame->user_data;
+        int max_user_data = raw_frame->max_user_data;
+        uint8_t *user_data_buf = raw_frame->user_data_buf;
+        int user_data_buf_size = raw_frame->user_data_buf_size;
+
+        memset( raw_frame, 0, sizeof(*raw_frame) );
+        raw_frame->user_data = user_data;
+        raw_frame->max_user_data = max_user_data;
+        raw_frame->user_data_buf = user_data_buf;
+        raw_frame->user_data_buf_size = user_data_buf_size;
+    }
+    else
+    {
+        raw_frame = calloc( 1, sizeof(*raw_frame) );
+        if( !raw_frame )
+        {
+            return_to_pool( &h->raw_frame_pool, NULL );
+            syslog( LOG_ERR, "Malloc failed\n" );
+            return NULL;
+        }
     }
 
+    raw_frame->pool = &h->raw_frame_pool;
+
     return raw_frame;
 }
 
+/* Appends num zeroed entries. The array only grows when a frame carries more than it has held before */
+obe_user_data_t *obe_add_user_data( obe_t *h, obe_raw_frame_t *raw_frame, int num )
+{
+    obe_user_data_t *user_data;
+
+    if( raw_frame->num_user_data + num > raw_frame->max_user_data )
+    {
+        int max_user_data = MAX( raw_frame->num_user_data + num, 2 * raw_frame->max_user_data );
+
+        user_data = realloc( raw_frame->user_data, max_user_data * sizeof(*raw_frame->user_data) );
+        if( !user_data )
+            return NULL;
+
+        raw_frame->user_data = user_data;
+        raw_frame->max_user_data = max_user_data;
+        OBE_STAT_ADD( h->input_allocs, 1 );
+    }
+
+    user_data = &raw_frame->user_data[raw_frame->num_user_data];
+    memset( user_data, 0, num * sizeof(*user_data) );
+    raw_frame->num_user_data += num;
+
+    return user_data;
+}
+
+/* Points user_data->data at len bytes of the frame's payload buffer.
+ * If the buffer has to grow, the payloads already in it move and the entries are updated */
+int obe_alloc_user_data_payload( obe_t *h, obe_raw_frame_t *raw_frame, obe_user_data_t *user_data, int len )
+{
+    if( raw_frame->user_data_buf_len + len > raw_frame->user_data_buf_size )
+    {
+        int size = MAX( raw_frame->user_data_buf_len + len, 2 * raw_frame->user_data_buf_size );
+        uint8_t *buf = malloc( size );
+        if( !buf )
+            return -1;
+
+        if( raw_frame->user_data_buf_len )
+            memcpy( buf, raw_frame->user_data_buf, raw_frame->user_data_buf_len );
+        for( int i = 0; i < raw_frame->num_user_data; i++ )
+        {
+            if( raw_frame->user_data[i].data )
+                raw_frame->user_data[i].data = buf + (raw_frame->user_data[i].data - raw_frame->user_data_buf);
+        }
+
+        free( raw_frame->user_data_buf );
+        raw_frame->user_data_buf = buf;
+        raw_frame->user_data_buf_size = size;
+        OBE_STAT_ADD( h->input_allocs, 1 );
+    }
+
+    user_data->data = raw_frame->user_data_buf + raw_frame->user_data_buf_len;
+    user_data->len = len;
+    raw_frame->user_data_buf_len += len;
+
+    return 0;
+}
+
 /* Coded frame */
-obe_coded_frame_t *new_coded_frame( int output_stream_id, int len )
+obe_coded_frame_t *new_coded_frame( obe_t *h, int output_stream_id, int len )
 {
-    obe_coded_frame_t *coded_frame = calloc( 1, sizeof(*coded_frame) );
+    uint8_t *data;
+    int buf_size;
+    obe_coded_frame_t *coded_frame = get_from_pool( &h->coded_frame_pool );
+
     if( !coded_frame )
-        return NULL;
+    {
+        coded_frame = calloc( 1, sizeof(*coded_frame) );
+        if( !coded_frame )
+        {
+            return_to_pool( &h->coded_frame_pool, NULL );
+            return NULL;
+        }
+    }
 
-    coded_frame->output_stream_id = output_stream_id;
-    coded_frame->len = len;
-    coded_frame->data = malloc( len );
-    if( !coded_frame->data )
+    /* Keep the payload buffer of a recycled frame unless it is too small. Grow with some headroom
+     * so frames which get steadily larger, such as a run of intra frames, don't reallocate every time */
+    data = coded_frame->data;
+    buf_size = coded_frame->buf_size;
+    if( buf_size < len )
     {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        free( coded_frame );
-        return NULL;
+        free( data );
+        buf_size = len + len / 4;
+        data = malloc( buf_size );
+        if( !data )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            free( coded_frame );
+            return_to_pool( &h->coded_frame_pool, NULL );
+            return NULL;
+        }
     }
 
+    memset( coded_frame, 0, sizeof(*coded_frame) );
+    coded_frame->output_stream_id = output_stream_id;
+    coded_frame->len = len;
+    coded_frame->data = data;
+    coded_frame->buf_size = buf_size;
+    coded_frame->pool = &h->coded_frame_pool;
+
     return coded_frame;
 }
 
-void destroy_coded_frame( obe_coded_frame_t *coded_frame )
+static void free_coded_frame( void *ptr )
 {
+    obe_coded_frame_t *coded_frame = ptr;
     free( coded_frame->data );
     free( coded_frame );
 }
 
+void destroy_coded_frame( obe_coded_frame_t *coded_frame )
+{
+    if( return_to_pool( coded_frame->pool, coded_frame ) < 0 )
+        free_coded_frame( coded_frame );
+}
+
+/* Sorts after every frame of the stream so the smoothing and mux threads see it last */
+obe_coded_frame_t *new_eos_coded_frame( obe_t *h, obe_encoder_t *encoder )
+{
+    obe_coded_frame_t *coded_frame = new_coded_frame( h, encoder->output_stream_id, 0 );
+
+    if( coded_frame )
+    {
+        coded_frame->is_video = encoder->is_video;
+        coded_frame->is_eos = 1;
+        coded_frame->pts = coded_frame->real_pts = coded_frame->real_dts = INT64_MAX;
+    }
+
+    return coded_frame;
+}
+
 void obe_release_video_data( void *ptr )
 {
      obe_raw_frame_t *raw_frame = ptr;
@@ -117,43 +371,187 @@ void obe_release_audio_data( void *ptr )
      av_freep( &raw_frame->audio_frame.audio_data[0] );
 }
 
-void obe_release_frame( void *ptr )
+void obe_release_audio_buffer( void *ptr )
+{
+     obe_raw_frame_t *raw_frame = ptr;
+     av_buffer_unref( &raw_frame->audio_frame.buf );
+}
+
+static void free_raw_frame( void *ptr )
 {
      obe_raw_frame_t *raw_frame = ptr;
-     for( int i = 0; i < raw_frame->num_user_data; i++ )
-         free( raw_frame->user_data[i].data );
      free( raw_frame->user_data );
+     free( raw_frame->user_data_buf );
      free( raw_frame );
 }
 
+void obe_release_frame( void *ptr )
+{
+     obe_raw_frame_t *raw_frame = ptr;
+     raw_frame->num_user_data = 0;
+     raw_frame->user_data_buf_len = 0;
+     if( return_to_pool( raw_frame->pool, raw_frame ) < 0 )
+         free_raw_frame( raw_frame );
+}
+
+static void release_eos_data( void *ptr )
+{
+}
+
+obe_raw_frame_t *new_eos_raw_frame( obe_t *h, int input_stream_id )
+{
+    obe_raw_frame_t *raw_frame = new_raw_frame( h );
+
+    if( raw_frame )
+    {
+        raw_frame->input_stream_id = input_stream_id;
+        raw_frame->is_eos = 1;
+        raw_frame->release_data = release_eos_data;
+        raw_frame->release_frame = obe_release_frame;
+    }
+
+    return raw_frame;
+}
+
+static void release_frame_ref( void *ptr )
+{
+    obe_raw_frame_t *raw_frame = ptr;
+    obe_unref_raw_frame( raw_frame->ref_parent );
+}
+
+/* Makes a frame which shares the picture of parent, so one filtered picture can go to several encoders.
+ * The user data is copied as each encoder writes it into its own SEI. The new frame drops its reference
+ * when its data is released, including when the filter replaces the picture with one of its own.
+ * The caller keeps its own reference to parent and drops it with obe_unref_raw_frame() */
+obe_raw_frame_t *obe_ref_raw_frame( obe_t *h, obe_raw_frame_t *parent )
+{
+    obe_raw_frame_t *raw_frame = new_raw_frame( h );
+    obe_user_data_t *user_data;
+    uint8_t *user_data_buf;
+    int max_user_data, user_data_buf_size;
+
+    if( !raw_frame )
+        return NULL;
+
+    /* The new frame keeps its own user data storage */
+    user_data = raw_frame->user_data;
+    max_user_data = raw_frame->max_user_data;
+    user_data_buf = raw_frame->user_data_buf;
+    user_data_buf_size = raw_frame->user_data_buf_size;
+
+    memcpy( raw_frame, parent, sizeof(*raw_frame) );
+    raw_frame->pool = &h->raw_frame_pool;
+    raw_frame->num_refs = 0;
+    raw_frame->image_pool = NULL;
+    raw_frame->user_data = user_data;
+    raw_frame->max_user_data = max_user_data;
+    raw_frame->num_user_data = 0;
+    raw_frame->user_data_buf = user_data_buf;
+    raw_frame->user_data_buf_size = user_data_buf_size;
+    raw_frame->user_data_buf_len = 0;
+
+    for( int i = 0; i < parent->num_user_data; i++ )
+    {
+        user_data = obe_add_user_data( h, raw_frame, 1 );
+        if( !user_data )
+            goto fail;
+
+        *user_data = parent->user_data[i];
+        user_data->data = NULL;
+        if( parent->user_data[i].data )
+        {
+            if( obe_alloc_user_data_payload( h, raw_frame, user_data, parent->user_data[i].len ) < 0 )
+                goto fail;
+            memcpy( user_data->data, parent->user_data[i].data, user_data->len );
+        }
+    }
+
+    /* A frame which has not been shared before has one holder, the caller */
+    if( !__atomic_load_n( &parent->num_refs, __ATOMIC_RELAXED ) )
+        __atomic_store_n( &parent->num_refs, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &parent->num_refs, 1, __ATOMIC_RELAXED );
+
+    raw_frame->ref_parent = parent;
+    raw_frame->release_data = release_frame_ref;
+    raw_frame->release_frame = obe_release_frame;
+
+    return raw_frame;
+
+fail:
+    syslog( LOG_ERR, "Malloc failed\n" );
+    obe_release_frame( raw_frame );
+    return NULL;
+}
+
+/* Drops a reference to the frame and releases it when it was the last */
+void obe_unref_raw_frame( obe_raw_frame_t *raw_frame )
+{
+    if( __atomic_load_n( &raw_frame->num_refs, __ATOMIC_ACQUIRE ) && __atomic_sub_fetch( &raw_frame->num_refs, 1, __ATOMIC_ACQ_REL ) )
+        return;
+
+    raw_frame->release_data( raw_frame );
+    raw_frame->release_frame( raw_frame );
+}
+
 /* Muxed data */
-obe_muxed_data_t *new_muxed_data( int len )
+obe_muxed_data_t *new_muxed_data( obe_t *h, int len )
 {
-    obe_muxed_data_t *muxed_data = calloc( 1, sizeof(*muxed_data) );
+    uint8_t *buf;
+    int buf_size;
+    int pcr_size = (len / 188) * sizeof(int64_t);
+    obe_muxed_data_t *muxed_data = get_from_pool( &h->muxed_data_pool );
+
     if( !muxed_data )
-        return NULL;
+    {
+        muxed_data = calloc( 1, sizeof(*muxed_data) );
+        if( !muxed_data )
+        {
+            return_to_pool( &h->muxed_data_pool, NULL );
+            return NULL;
+        }
+    }
 
-    muxed_data->len = len;
-    muxed_data->data = malloc( len );
-    if( !muxed_data->data )
+    /* The PCR list goes first to keep it aligned */
+    buf = (uint8_t*)muxed_data->pcr_list;
+    buf_size = muxed_data->buf_size;
+    if( buf_size < pcr_size + len )
     {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        free( muxed_data );
-        return NULL;
+        free( buf );
+        buf_size = pcr_size + len;
+        buf = malloc( buf_size );
+        if( !buf )
+        {
+            syslog( LOG_ERR, "Malloc failed\n" );
+            free( muxed_data );
+            return_to_pool( &h->muxed_data_pool, NULL );
+            return NULL;
+        }
     }
 
+    muxed_data->len = len;
+    muxed_data->arrival_time = 0;
+    muxed_data->is_eos = 0;
+    muxed_data->pcr_list = (int64_t*)buf;
+    muxed_data->data = buf + pcr_size;
+    muxed_data->buf_size = buf_size;
+    muxed_data->pool = &h->muxed_data_pool;
+
     return muxed_data;
 }
 
-void destroy_muxed_data( obe_muxed_data_t *muxed_data )
+static void free_muxed_data( void *ptr )
 {
-    if( muxed_data->pcr_list )
-        free( muxed_data->pcr_list );
-
-    free( muxed_data->data );
+    obe_muxed_data_t *muxed_data = ptr;
+    free( muxed_data->pcr_list );
     free( muxed_data );
 }
 
+void destroy_muxed_data( obe_muxed_data_t *muxed_data )
+{
+    if( return_to_pool( muxed_data->pool, muxed_data ) < 0 )
+        free_muxed_data( muxed_data );
+}
+
 /** Add/Remove misc **/
 void add_device( obe_t *h, obe_device_t *device )
 {
@@ -163,16 +561,35 @@ void add_device( obe_t *h, obe_device_t *device )
 }
 
 /** Add/Remove from queues */
-void obe_init_queue( obe_queue_t *queue )
+int obe_init_queue( obe_queue_t *queue, int capacity )
 {
+    /* The ring is allocated up front so the steady state never touches the allocator */
+    queue->ring = av_malloc( capacity * sizeof(*queue->ring) );
+    if( !queue->ring )
+    {
+        syslog( LOG_ERR, "Malloc failed\n" );
+        return -1;
+    }
+
+    for( int i = 0; i < capacity; i++ )
+        queue->ring[i].seq = i;
+    queue->mask = capacity - 1;
+    queue->head = queue->tail = 0;
+    queue->size = 0;
+    queue->high_water = 0;
+    queue->num_waiters = 0;
+    queue->closed = 0;
+
     pthread_mutex_init( &queue->mutex, NULL );
     pthread_cond_init( &queue->in_cv, NULL );
     pthread_cond_init( &queue->out_cv, NULL );
+
+    return 0;
 }
 
 void obe_destroy_queue( obe_queue_t *queue )
 {
-    free( queue->queue );
+    av_freep( &queue->ring );
 
     pthread_mutex_unlock( &queue->mutex );
     pthread_mutex_destroy( &queue->mutex );
@@ -180,74 +597,277 @@ void obe_destroy_queue( obe_queue_t *queue )
     pthread_cond_destroy( &queue->out_cv );
 }
 
-int add_to_queue( obe_queue_t *queue, void *item )
+/* Producers waiting for space give up, so that a stage which has stopped consuming cannot block shutdown */
+void obe_close_queue( obe_queue_t *queue )
 {
-    void **tmp;
+    pthread_mutex_lock( &queue->mutex );
+    queue->closed = 1;
+    pthread_cond_broadcast( &queue->out_cv );
+    pthread_mutex_unlock( &queue->mutex );
+}
 
+/* Take the mutex this way to wait on in_cv or out_cv. The fence pairs with the one in wake_waiters() so either
+ * the waiter sees the change or the thread making it sees the waiter and signals */
+void obe_queue_lock( obe_queue_t *queue )
+{
     pthread_mutex_lock( &queue->mutex );
-    tmp = realloc( queue->queue, sizeof(*queue->queue) * (queue->size+1) );
-    if( !tmp )
+    __atomic_add_fetch( &queue->num_waiters, 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+}
+
+void obe_queue_unlock( obe_queue_t *queue )
+{
+    __atomic_sub_fetch( &queue->num_waiters, 1, __ATOMIC_RELAXED );
+    pthread_mutex_unlock( &queue->mutex );
+}
+
+static void wake_waiters( obe_queue_t *queue, pthread_cond_t *cv )
+{
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if( __atomic_load_n( &queue->num_waiters, __ATOMIC_RELAXED ) )
     {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
+        pthread_mutex_lock( &queue->mutex );
+        pthread_cond_broadcast( cv );
+        pthread_mutex_unlock( &queue->mutex );
     }
-    queue->queue = tmp;
-    queue->queue[queue->size++] = item;
+}
 
-    pthread_cond_signal( &queue->in_cv );
-    pthread_mutex_unlock( &queue->mutex );
+/* Consumer only. Items become visible in order, once the producers have finished writing them */
+int obe_queue_size( obe_queue_t *queue )
+{
+    uint64_t pos = queue->head + queue->size;
 
-    return 0;
+    /* Shutdown can follow a failed start, where some queues were never initialised */
+    if( !queue->ring )
+        return 0;
+
+    while( queue->size <= queue->mask &&
+           __atomic_load_n( &queue->ring[pos & queue->mask].seq, __ATOMIC_ACQUIRE ) == pos + 1 )
+    {
+        queue->size++;
+        pos++;
+    }
+
+    return queue->size;
 }
 
-int remove_from_queue( obe_queue_t *queue )
+/* Any thread, but only approximate whilst items are being added or removed */
+int obe_queue_depth( obe_queue_t *queue )
 {
-    void **tmp;
+    uint64_t head = __atomic_load_n( &queue->head, __ATOMIC_RELAXED );
 
-    pthread_mutex_lock( &queue->mutex );
-    if( queue->size > 1 )
-        memmove( &queue->queue[0], &queue->queue[1], sizeof(*queue->queue) * (queue->size-1) );
-    tmp = realloc( queue->queue, sizeof(*queue->queue) * (queue->size-1) );
-    queue->size--;
-    if( !tmp && queue->size )
+    return __atomic_load_n( &queue->tail, __ATOMIC_RELAXED ) - head;
+}
+
+static int queue_full( obe_queue_t *queue )
+{
+    uint64_t pos = __atomic_load_n( &queue->tail, __ATOMIC_RELAXED );
+
+    return (int64_t)(__atomic_load_n( &queue->ring[pos & queue->mask].seq, __ATOMIC_ACQUIRE ) - pos) < 0;
+}
+
+static int wait_for_space( obe_queue_t *queue )
+{
+    int closed;
+
+    obe_queue_lock( queue );
+    /* Input threads are cancelled and may be waiting here */
+    pthread_cleanup_push( (void (*)( void* ))obe_queue_unlock, queue );
+    while( queue_full( queue ) && !queue->closed )
+        pthread_cond_wait( &queue->out_cv, &queue->mutex );
+    closed = queue->closed;
+    pthread_cleanup_pop( 1 );
+
+    return closed ? -1 : 0;
+}
+
+int add_to_queue( obe_queue_t *queue, void *item )
+{
+    obe_queue_slot_t *slot;
+    uint64_t pos = __atomic_load_n( &queue->tail, __ATOMIC_RELAXED );
+    int64_t diff;
+    int depth;
+
+    /* A slot is free when its sequence number is the position being claimed */
+    while( 1 )
     {
-        syslog( LOG_ERR, "Malloc failed\n" );
-        return -1;
+        slot = &queue->ring[pos & queue->mask];
+        diff = __atomic_load_n( &slot->seq, __ATOMIC_ACQUIRE ) - pos;
+        if( !diff )
+        {
+            if( __atomic_compare_exchange_n( &queue->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+                break;
+        }
+        else if( diff < 0 )
+        {
+            if( wait_for_space( queue ) < 0 )
+                return -1;
+            pos = __atomic_load_n( &queue->tail, __ATOMIC_RELAXED );
+        }
+        else
+            pos = __atomic_load_n( &queue->tail, __ATOMIC_RELAXED );
     }
-    queue->queue = tmp;
 
-    pthread_cond_signal( &queue->out_cv );
-    pthread_mutex_unlock( &queue->mutex );
+    slot->item = item;
+    __atomic_store_n( &slot->seq, pos + 1, __ATOMIC_RELEASE );
+    wake_waiters( queue, &queue->in_cv );
+
+    depth = FFMIN( pos + 1 - __atomic_load_n( &queue->head, __ATOMIC_RELAXED ), queue->mask + 1 );
+    if( depth > OBE_STAT_GET( queue->high_water ) )
+        OBE_STAT_SET( queue->high_water, depth );
+
+    return 0;
+}
+
+/* Consumer only. Hands the first num slots back to the producers */
+static void release_items( obe_queue_t *queue, int num )
+{
+    for( int i = 0; i < num; i++ )
+        __atomic_store_n( &queue->ring[(queue->head + i) & queue->mask].seq, queue->head + i + queue->mask + 1, __ATOMIC_RELEASE );
+
+    __atomic_store_n( &queue->head, queue->head + num, __ATOMIC_RELAXED );
+    queue->size -= num;
+}
+
+int remove_from_queue( obe_queue_t *queue )
+{
+    if( !obe_queue_size( queue ) )
+        return 0;
+
+    release_items( queue, 1 );
+    wake_waiters( queue, &queue->out_cv );
 
     return 0;
 }
 
+/* Consumer only. The producers own everything past the last item, so the gap is closed from the head */
 int remove_item_from_queue( obe_queue_t *queue, void *item )
 {
-    void **tmp;
+    int size = obe_queue_size( queue );
 
-    pthread_mutex_lock( &queue->mutex );
-    for( int i = 0; i < queue->size; i++ )
+    for( int i = 0; i < size; i++ )
     {
-        if( queue->queue[i] == item )
+        if( obe_queue_item( queue, i ) == item )
         {
-            memmove( &queue->queue[i], &queue->queue[i+1], sizeof(*queue->queue) * (queue->size-1-i) );
-            tmp = realloc( queue->queue, sizeof(*queue->queue) * (queue->size-1) );
-            queue->size--;
-            if( !tmp && queue->size )
-            {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                return -1;
-            }
-            queue->queue = tmp;
+            for( int j = i; j > 0; j-- )
+                queue->ring[(queue->head + j) & queue->mask].item = obe_queue_item( queue, j-1 );
+
+            release_items( queue, 1 );
+            wake_waiters( queue, &queue->out_cv );
             break;
         }
     }
 
-    pthread_cond_signal( &queue->out_cv );
-    pthread_mutex_unlock( &queue->mutex );
+    return 0;
+}
+
+/* Slice threads */
+/* Caller must hold pool->mutex */
+static void run_slices( obe_slice_pool_t *pool )
+{
+    while( pool->next_slice < pool->num_slices )
+    {
+        int slice = pool->next_slice++;
+        pthread_mutex_unlock( &pool->mutex );
+        pool->func( pool->ctx, slice, pool->num_slices );
+        pthread_mutex_lock( &pool->mutex );
+
+        if( !--pool->slices_pending )
+            pthread_cond_signal( &pool->done_cv );
+    }
+}
+
+static void *slice_thread( void *ptr )
+{
+    obe_slice_pool_t *pool = ptr;
+    int job = 0;
+
+    pthread_mutex_lock( &pool->mutex );
+    while( 1 )
+    {
+        while( pool->job == job && !pool->cancel )
+            pthread_cond_wait( &pool->start_cv, &pool->mutex );
+
+        if( pool->cancel )
+            break;
+
+        job = pool->job;
+        run_slices( pool );
+    }
+    pthread_mutex_unlock( &pool->mutex );
+
+    return NULL;
+}
+
+int obe_slice_pool_init( obe_slice_pool_t *pool, int num_threads )
+{
+    memset( pool, 0, sizeof(*pool) );
+    pthread_mutex_init( &pool->mutex, NULL );
+    pthread_cond_init( &pool->start_cv, NULL );
+    pthread_cond_init( &pool->done_cv, NULL );
+
+    num_threads = FFMIN( num_threads, OBE_MAX_SLICE_THREADS );
+    for( ; pool->num_threads < num_threads; pool->num_threads++ )
+    {
+        if( pthread_create( &pool->threads[pool->num_threads], NULL, slice_thread, pool ) < 0 )
+        {
+            syslog( LOG_ERR, "Couldn't create slice thread\n" );
+            obe_slice_pool_destroy( pool );
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Returns once every slice has finished */
+void obe_slice_pool_run( obe_slice_pool_t *pool, obe_slice_func_t func, void *ctx, int num_slices )
+{
+    if( !pool->num_threads || num_slices <= 1 )
+    {
+        for( int i = 0; i < num_slices; i++ )
+            func( ctx, i, num_slices );
+        return;
+    }
+
+    pthread_mutex_lock( &pool->mutex );
+    pool->func = func;
+    pool->ctx = ctx;
+    pool->num_slices = pool->slices_pending = num_slices;
+    pool->next_slice = 0;
+    pool->job++;
+    pthread_cond_broadcast( &pool->start_cv );
+
+    /* The calling thread may be cancelled whilst waiting */
+    pthread_cleanup_push( (void (*)( void* ))pthread_mutex_unlock, &pool->mutex );
+    run_slices( pool );
+    while( pool->slices_pending )
+        pthread_cond_wait( &pool->done_cv, &pool->mutex );
+    pthread_cleanup_pop( 1 );
+}
+
+void obe_slice_pool_destroy( obe_slice_pool_t *pool )
+{
+    pthread_mutex_lock( &pool->mutex );
+    pool->cancel = 1;
+    pthread_cond_broadcast( &pool->start_cv );
+    pthread_mutex_unlock( &pool->mutex );
+
+    for( int i = 0; i < pool->num_threads; i++ )
+        pthread_join( pool->threads[i], NULL );
+    pool->num_threads = 0;
+
+    pthread_mutex_destroy( &pool->mutex );
+    pthread_cond_destroy( &pool->start_cv );
+    pthread_cond_destroy( &pool->done_cv );
+}
+
+/* Number of helper threads to use, leaving one core for the calling thread */
+int obe_slice_threads( int max_threads )
+{
+    long cpus = sysconf( _SC_NPROCESSORS_ONLN );
 
-    return 0;
+    return av_clip( cpus - 1, 0, FFMIN( max_threads, OBE_MAX_SLICE_THREADS ) );
 }
 
 /* Filter queue */
@@ -270,6 +890,9 @@ int add_to_filter_queue( obe_t *h, obe_raw_frame_t *raw_frame )
     if( !filter )
         return -1;
 
+    OBE_STAT_ADD( h->input_frames, 1 );
+    OBE_STAT_ADD( filter->frames_in, 1 );
+
     return add_to_queue( &filter->queue, raw_frame );
 }
 
@@ -277,9 +900,9 @@ static void destroy_filter( obe_filter_t *filter )
 {
     obe_raw_frame_t *raw_frame;
     pthread_mutex_lock( &filter->queue.mutex );
-    for( int i = 0; i < filter->queue.size; i++ )
+    for( int i = 0; i < obe_queue_size( &filter->queue ); i++ )
     {
-        raw_frame = filter->queue.queue[i];
+        raw_frame = obe_queue_item( &filter->queue, i );
         raw_frame->release_data( raw_frame );
         raw_frame->release_frame( raw_frame );
     }
@@ -307,16 +930,27 @@ int add_to_encode_queue( obe_t *h, obe_raw_frame_t *raw_frame, int output_stream
     if( !encoder )
         return -1;
 
+    OBE_STAT_ADD( encoder->frames_in, 1 );
+
     return add_to_queue( &encoder->queue, raw_frame );
 }
 
+/* Called by the encoder thread after each call to the encoder */
+void update_encoder_stats( obe_encoder_t *encoder, int64_t encode_time )
+{
+    OBE_STAT_SET( encoder->last_encode_time, encode_time );
+    OBE_STAT_ADD( encoder->total_encode_time, encode_time );
+    if( encode_time > encoder->max_encode_time )
+        OBE_STAT_SET( encoder->max_encode_time, encode_time );
+}
+
 static void destroy_encoder( obe_encoder_t *encoder )
 {
     obe_raw_frame_t *raw_frame;
     pthread_mutex_lock( &encoder->queue.mutex );
-    for( int i = 0; i < encoder->queue.size; i++ )
+    for( int i = 0; i < obe_queue_size( &encoder->queue ); i++ )
     {
-        raw_frame = encoder->queue.queue[i];
+        raw_frame = obe_queue_item( &encoder->queue, i );
         raw_frame->release_data( raw_frame );
         raw_frame->release_frame( raw_frame );
     }
@@ -333,9 +967,9 @@ static void destroy_enc_smoothing( obe_queue_t *queue )
 {
     obe_coded_frame_t *coded_frame;
     pthread_mutex_lock( &queue->mutex );
-    for( int i = 0; i < queue->size; i++ )
+    for( int i = 0; i < obe_queue_size( queue ); i++ )
     {
-        coded_frame = queue->queue[i];
+        coded_frame = obe_queue_item( queue, i );
         destroy_coded_frame( coded_frame );
     }
 
@@ -345,8 +979,8 @@ static void destroy_enc_smoothing( obe_queue_t *queue )
 static void destroy_mux( obe_t *h )
 {
     pthread_mutex_lock( &h->mux_queue.mutex );
-    for( int i = 0; i < h->mux_queue.size; i++ )
-        destroy_coded_frame( h->mux_queue.queue[i] );
+    for( int i = 0; i < obe_queue_size( &h->mux_queue ); i++ )
+        destroy_coded_frame( obe_queue_item( &h->mux_queue, i ) );
 
     obe_destroy_queue( &h->mux_queue );
 
@@ -360,46 +994,92 @@ static void destroy_mux_smoothing( obe_queue_t *queue )
 {
     obe_muxed_data_t *muxed_data;
     pthread_mutex_lock( &queue->mutex );
-    for( int i = 0; i < queue->size; i++ )
+    for( int i = 0; i < obe_queue_size( queue ); i++ )
     {
-        muxed_data = queue->queue[i];
+        muxed_data = obe_queue_item( queue, i );
         destroy_muxed_data( muxed_data );
     }
 
     obe_destroy_queue( queue );
 }
 
-int remove_early_frames( obe_t *h, int64_t pts )
+/* Consumer only. Every video rendition needs a frame queued as one which has none could still send a frame
+ * with an earlier DTS */
+obe_coded_frame_t *earliest_video_frame( obe_t *h, obe_queue_t *queue )
 {
-    void **tmp;
-    for( int i = 0; i < h->mux_queue.size; i++ )
+    obe_coded_frame_t *coded_frame, *head, *earliest = NULL;
+    int size = obe_queue_size( queue );
+
+    for( int j = 0; j < h->num_encoders; j++ )
     {
-        obe_coded_frame_t *frame = h->mux_queue.queue[i];
-        if( !frame->is_video && frame->pts < pts )
+        if( !h->encoders[j]->is_video )
+            continue;
+
+        head = NULL;
+        for( int i = 0; i < size; i++ )
         {
-            destroy_coded_frame( frame );
-            memmove( &h->mux_queue.queue[i], &h->mux_queue.queue[i+1], sizeof(*h->mux_queue.queue) * (h->mux_queue.size-1-i) );
-            tmp = realloc( h->mux_queue.queue, sizeof(*h->mux_queue.queue) * (h->mux_queue.size-1) );
-            h->mux_queue.size--;
-            i--;
-            if( !tmp && h->mux_queue.size )
+            coded_frame = obe_queue_item( queue, i );
+            if( coded_frame->output_stream_id == h->encoders[j]->output_stream_id )
             {
-                syslog( LOG_ERR, "Malloc failed\n" );
-                return -1;
+                head = coded_frame;
+                break;
             }
-            h->mux_queue.queue = tmp;
         }
+
+        if( !head )
+            return NULL;
+
+        if( !earliest || head->real_dts < earliest->real_dts )
+            earliest = head;
+    }
+
+    return earliest;
+}
+
+/* Caller must hold the mux queue with obe_queue_lock() */
+int remove_early_frames( obe_t *h, int64_t pts )
+{
+    obe_queue_t *queue = &h->mux_queue;
+    int size = obe_queue_size( queue );
+    int j = size;
+
+    /* Compact the ring towards the tail, keeping the frames which are not early, and free the slots at the head */
+    for( int i = size - 1; i >= 0; i-- )
+    {
+        obe_coded_frame_t *frame = obe_queue_item( queue, i );
+        if( !frame->is_video && frame->pts < pts )
+            destroy_coded_frame( frame );
+        else
+            queue->ring[(queue->head + --j) & queue->mask].item = frame;
+    }
+
+    if( j )
+    {
+        release_items( queue, j );
+        pthread_cond_broadcast( &queue->out_cv );
     }
 
     return 0;
 }
 
 /* Output queue */
+/* Called by an output thread once it has written the end of the stream */
+void obe_output_finished( obe_output_t *output )
+{
+    pthread_mutex_lock( &output->queue.mutex );
+    output->is_finished = 1;
+    pthread_cond_broadcast( &output->queue.out_cv );
+    pthread_mutex_unlock( &output->queue.mutex );
+}
+
 static void destroy_output( obe_output_t *output )
 {
     pthread_mutex_lock( &output->queue.mutex );
-    for( int i = 0; i < output->queue.size; i++ )
-        av_buffer_unref( output->queue.queue[i] );
+    for( int i = 0; i < obe_queue_size( &output->queue ); i++ )
+    {
+        AVBufferRef *buf = obe_queue_item( &output->queue, i );
+        av_buffer_unref( &buf );
+    }
 
     obe_destroy_queue( &output->queue );
     free( output );
@@ -467,6 +1147,9 @@ obe_t *obe_setup( void )
     }
 
     pthread_mutex_init( &h->device_list_mutex, NULL );
+    init_pool( &h->raw_frame_pool );
+    init_pool( &h->coded_frame_pool );
+    init_pool( &h->muxed_data_pool );
 
     if( av_lockmgr_register( obe_lavc_lockmgr ) < 0 )
     {
@@ -491,6 +1174,19 @@ int obe_set_config( obe_t *h, int system_type )
     return 0;
 }
 
+int obe_set_offline( obe_t *h, int offline )
+{
+    if( h->is_active )
+    {
+        fprintf( stderr, "Offline mode cannot be changed while encoding\n" );
+        return -1;
+    }
+
+    h->offline = !!offline;
+
+    return 0;
+}
+
 /* TODO handle error conditions */
 int64_t get_wallclock_in_mpeg_ticks( void )
 {
@@ -523,7 +1219,11 @@ int64_t get_input_clock_in_mpeg_ticks( obe_t *h )
 {
     int64_t value;
     pthread_mutex_lock( &h->obe_clock_mutex );
-    value = h->obe_clock_last_pts + ( get_wallclock_in_mpeg_ticks() - h->obe_clock_last_wallclock );
+    /* The virtual clock only moves when the input ticks it */
+    if( h->offline )
+        value = h->obe_clock_last_pts;
+    else
+        value = h->obe_clock_last_pts + ( get_wallclock_in_mpeg_ticks() - h->obe_clock_last_wallclock );
     pthread_mutex_unlock( &h->obe_clock_mutex );
 
     return value;
@@ -532,6 +1232,10 @@ int64_t get_input_clock_in_mpeg_ticks( obe_t *h )
 void sleep_input_clock( obe_t *h, int64_t i_time )
 {
     int64_t wallclock_time;
+
+    if( h->offline )
+        return;
+
     pthread_mutex_lock( &h->obe_clock_mutex );
     wallclock_time = ( i_time - h->obe_clock_last_pts ) + h->obe_clock_last_wallclock;
     pthread_mutex_unlock( &h->obe_clock_mutex );
@@ -614,13 +1318,15 @@ int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *
 #endif
     else if( input_device->input_type == INPUT_DEVICE_LINSYS_SDI )
         input = linsys_sdi_input;
+    else if( input_device->input_type == INPUT_DEVICE_FILE )
+        input = file_input;
     else
     {
         fprintf( stderr, "Invalid input device \n" );
         return -1;
     }
 
-    if( input_device->input_type == INPUT_URL && !input_device->location )
+    if( ( input_device->input_type == INPUT_URL || input_device->input_type == INPUT_DEVICE_FILE ) && !input_device->location )
     {
         fprintf( stderr, "Invalid input location\n" );
         return -1;
@@ -647,6 +1353,18 @@ int obe_probe_device( obe_t *h, obe_input_t *input_device, obe_input_program_t *
         strcpy( args->user_opts.location, input_device->location );
     }
 
+    if( input_device->audio_location )
+    {
+        args->user_opts.audio_location = malloc( strlen( input_device->audio_location ) + 1 );
+        if( !args->user_opts.audio_location )
+        {
+            fprintf( stderr, "Malloc failed \n" );
+            goto fail;
+        }
+
+        strcpy( args->user_opts.audio_location, input_device->audio_location );
+    }
+
     if( obe_validate_input_params( input_device ) < 0 )
         goto fail;
 
@@ -734,6 +1452,8 @@ fail:
     {
         if( args->user_opts.location )
             free( args->user_opts.location );
+        if( args->user_opts.audio_location )
+            free( args->user_opts.audio_location );
         free( args );
     }
 
@@ -946,6 +1666,134 @@ int obe_setup_output( obe_t *h, obe_output_opts_t *output_opts )
     return 0;
 }
 
+/* Sum of the video maxrates and audio bitrates in bits per second. Passthrough streams are not
+ * counted as their bitrate is not known */
+static int64_t encoded_bitrate( obe_t *h )
+{
+    int64_t total_bitrate = 0;
+
+    for( int i = 0; i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *output_stream = &h->output_streams[i];
+        int format = output_stream->stream_format;
+
+        if( output_stream->stream_action != STREAM_ENCODE )
+            continue;
+
+        if( format == VIDEO_AVC )
+            total_bitrate += (int64_t)output_stream->avc_param.rc.i_vbv_max_bitrate * 1000;
+        else if( format == AUDIO_MP2 || format == AUDIO_AC_3 || format == AUDIO_E_AC_3 || format == AUDIO_AAC )
+            total_bitrate += (int64_t)output_stream->bitrate * 1000;
+    }
+
+    return total_bitrate;
+}
+
+/* The video filter can only scale progressive input vertically, as interlaced input would need deinterlacing.
+ * The renditions are smoothed and muxed on the timeline of the first so their VBV buffers must last as long */
+static int check_video_renditions( obe_t *h )
+{
+    x264_param_t *first = NULL;
+    obe_int_input_stream_t *input_stream;
+    int64_t total_bitrate;
+
+    for( int i = 0; i < h->num_output_streams; i++ )
+    {
+        obe_output_stream_t *output_stream = &h->output_streams[i];
+        x264_param_t *param = &output_stream->avc_param;
+
+        if( output_stream->stream_action != STREAM_ENCODE || output_stream->stream_format != VIDEO_AVC )
+            continue;
+
+        input_stream = get_input_stream( h, output_stream->input_stream_id );
+        if( !input_stream || input_stream->stream_type != STREAM_TYPE_VIDEO )
+        {
+            fprintf( stderr, "Video output stream %i is not encoded from a video input stream \n", output_stream->output_stream_id );
+            return -1;
+        }
+
+        if( param->i_width <= 0 || param->i_width & 1 || param->i_height <= 0 || param->i_height & 1 )
+        {
+            fprintf( stderr, "Video output stream %i: %ix%i is not a valid size \n",
+                     output_stream->output_stream_id, param->i_width, param->i_height );
+            return -1;
+        }
+
+        if( param->i_height != input_stream->height && input_stream->interlaced )
+        {
+            fprintf( stderr, "Video output stream %i: %ix%i cannot be made from the %ix%i interlaced input. "
+                     "Deinterlacing is not supported so the height must be %i \n",
+                     output_stream->output_stream_id, param->i_width, param->i_height,
+                     input_stream->width, input_stream->height, input_stream->height );
+            return -1;
+        }
+
+        if( !first )
+        {
+            first = param;
+            continue;
+        }
+
+        /* Lowest latency mode sets the buffer to one frame for every rendition */
+        if( h->obe_system != OBE_SYSTEM_TYPE_LOWEST_LATENCY &&
+            (int64_t)param->rc.i_vbv_buffer_size * first->rc.i_vbv_max_bitrate !=
+            (int64_t)first->rc.i_vbv_buffer_size * param->rc.i_vbv_max_bitrate )
+        {
+            fprintf( stderr, "Video output stream %i must have the same vbv-bufsize to vbv-maxrate ratio as the first video stream \n",
+                     output_stream->output_stream_id );
+            return -1;
+        }
+
+        if( param->rc.f_vbv_buffer_init != first->rc.f_vbv_buffer_init )
+        {
+            fprintf( stderr, "Video output stream %i must have the same initial VBV occupancy as the first video stream \n",
+                     output_stream->output_stream_id );
+            return -1;
+        }
+    }
+
+    /* Every rendition can send at its maxrate at once */
+    total_bitrate = encoded_bitrate( h );
+    if( h->mux_opts.ts_muxrate && total_bitrate > h->mux_opts.ts_muxrate )
+    {
+        fprintf( stderr, "The mux rate %i is lower than the sum of the video maxrates and audio bitrates %"PRIi64" \n",
+                 h->mux_opts.ts_muxrate, total_bitrate );
+        return -1;
+    }
+
+    return 0;
+}
+
+/* x264 makes its threads from the encoder thread so they inherit its cores */
+static int init_encoder_affinity( pthread_attr_t *attr, obe_output_stream_t *output_stream )
+{
+    long online = sysconf( _SC_NPROCESSORS_ONLN );
+    cpu_set_t cpus;
+
+    if( output_stream->first_cpu < 0 || output_stream->first_cpu + output_stream->num_cpus > MIN( online, CPU_SETSIZE ) )
+    {
+        fprintf( stderr, "Output stream %i: cpus %i-%i are not online \n", output_stream->output_stream_id,
+                 output_stream->first_cpu, output_stream->first_cpu + output_stream->num_cpus - 1 );
+        return -1;
+    }
+
+    CPU_ZERO( &cpus );
+    for( int i = 0; i < output_stream->num_cpus; i++ )
+        CPU_SET( output_stream->first_cpu + i, &cpus );
+
+    if( pthread_attr_init( attr ) )
+        return -1;
+
+    if( pthread_attr_setaffinity_np( attr, sizeof(cpus), &cpus ) )
+    {
+        pthread_attr_destroy( attr );
+        fprintf( stderr, "Couldn't set the cpus of output stream %i \n", output_stream->output_stream_id );
+        return -1;
+    }
+
+    return 0;
+}
+
 int obe_start( obe_t *h )
 {
     obe_int_input_stream_t  *input_stream;
@@ -966,9 +1814,13 @@ int obe_start( obe_t *h )
     /* Setup mutexes and cond vars */
     pthread_mutex_init( &h->devices[0]->device_mutex, NULL );
     pthread_mutex_init( &h->drop_mutex, NULL );
-    obe_init_queue( &h->enc_smoothing_queue );
-    obe_init_queue( &h->mux_queue );
-    obe_init_queue( &h->mux_smoothing_queue );
+    if( obe_init_queue( &h->enc_smoothing_queue, OBE_QUEUE_CODED_FRAMES ) < 0 ||
+        obe_init_queue( &h->mux_queue, OBE_QUEUE_CODED_FRAMES ) < 0 ||
+        obe_init_queue( &h->mux_smoothing_queue, OBE_QUEUE_MUXED_DATA ) < 0 )
+        goto fail;
+
+    if( setup_frame_pools( h ) < 0 )
+        goto fail;
     pthread_mutex_init( &h->obe_clock_mutex, NULL );
     pthread_cond_init( &h->obe_clock_cv, NULL );
 
@@ -984,17 +1836,32 @@ int obe_start( obe_t *h )
 #endif
     else if( h->devices[0]->device_type == INPUT_DEVICE_LINSYS_SDI )
         input = linsys_sdi_input;
+    else if( h->devices[0]->device_type == INPUT_DEVICE_FILE )
+        input = file_input;
     else
     {
         fprintf( stderr, "Invalid input device \n" );
         goto fail;
     }
 
+    if( h->offline && h->devices[0]->device_type != INPUT_DEVICE_FILE )
+    {
+        fprintf( stderr, "Offline mode requires a file input \n" );
+        goto fail;
+    }
+
+    if( check_video_renditions( h ) < 0 )
+        goto fail;
+
     /* Open Output Threads */
     for( int i = 0; i < h->num_outputs; i++ )
     {
-        obe_init_queue( &h->outputs[i]->queue );
-        output = ip_output;
+        if( obe_init_queue( &h->outputs[i]->queue, OBE_QUEUE_MUXED_DATA ) < 0 )
+            goto fail;
+        if( h->outputs[i]->output_dest.type == OUTPUT_FILE )
+            output = file_output;
+        else
+            output = ip_output;
 
         if( pthread_create( &h->outputs[i]->output_thread, NULL, output.open_output, (void*)h->outputs[i] ) < 0 )
         {
@@ -1014,7 +1881,8 @@ int obe_start( obe_t *h )
                 fprintf( stderr, "Malloc failed \n" );
                 goto fail;
             }
-            obe_init_queue( &h->encoders[h->num_encoders]->queue );
+            if( obe_init_queue( &h->encoders[h->num_encoders]->queue, OBE_QUEUE_RAW_FRAMES ) < 0 )
+                goto fail;
             h->encoders[h->num_encoders]->output_stream_id = h->output_streams[i].output_stream_id;
 
             if( h->output_streams[i].stream_format == VIDEO_AVC )
@@ -1037,7 +1905,27 @@ int obe_start( obe_t *h )
                 h->encoders[h->num_encoders]->is_video = 1;
 
                 memcpy( &vid_enc_params->avc_param, &h->output_streams[i].avc_param, sizeof(x264_param_t) );
-                if( pthread_create( &h->encoders[h->num_encoders]->encoder_thread, NULL, x264_encoder.start_encoder, (void*)vid_enc_params ) < 0 )
+
+                if( h->output_streams[i].num_cpus )
+                {
+                    pthread_attr_t attr;
+                    int ret;
+
+                    if( init_encoder_affinity( &attr, &h->output_streams[i] ) < 0 )
+                    {
+                        free( vid_enc_params );
+                        goto fail;
+                    }
+
+                    ret = pthread_create( &h->encoders[h->num_encoders]->encoder_thread, &attr, x264_encoder.start_encoder, (void*)vid_enc_params );
+                    pthread_attr_destroy( &attr );
+                    if( ret )
+                    {
+                        fprintf( stderr, "Couldn't create encode thread \n" );
+                        goto fail;
+                    }
+                }
+                else if( pthread_create( &h->encoders[h->num_encoders]->encoder_thread, NULL, x264_encoder.start_encoder, (void*)vid_enc_params ) < 0 )
                 {
                     fprintf( stderr, "Couldn't create encode thread \n" );
                     goto fail;
@@ -1143,7 +2031,8 @@ int obe_start( obe_t *h )
             if( !h->filters[h->num_filters] )
                 goto fail;
 
-            obe_init_queue( &h->filters[h->num_filters]->queue );
+            if( obe_init_queue( &h->filters[h->num_filters]->queue, OBE_QUEUE_RAW_FRAMES ) < 0 )
+                goto fail;
 
             h->filters[h->num_filters]->num_stream_ids = 1;
             h->filters[h->num_filters]->stream_id_list = malloc( sizeof(*h->filters[h->num_filters]->stream_id_list) );
@@ -1167,7 +2056,23 @@ int obe_start( obe_t *h )
                 vid_filter_params->h = h;
                 vid_filter_params->filter = h->filters[h->num_filters];
                 vid_filter_params->input_stream = input_stream;
-                vid_filter_params->target_csp = h->output_streams[i].avc_param.i_csp & X264_CSP_MASK;
+                vid_filter_params->filter_threads = h->devices[0]->user_opts.filter_threads;
+
+                /* Every video rendition of this input is made by the one filter */
+                for( int j = 0; j < h->num_output_streams; j++ )
+                {
+                    if( h->output_streams[j].stream_action == STREAM_ENCODE && h->output_streams[j].stream_format == VIDEO_AVC &&
+                        h->output_streams[j].input_stream_id == input_stream->input_stream_id &&
+                        vid_filter_params->num_output_streams < MAX_STREAMS )
+                        vid_filter_params->output_streams[vid_filter_params->num_output_streams++] = &h->output_streams[j];
+                }
+
+                if( !vid_filter_params->num_output_streams )
+                {
+                    free( vid_filter_params );
+                    fprintf( stderr, "No video output stream for input stream %i\n", input_stream->input_stream_id );
+                    goto fail;
+                }
 
                 if( pthread_create( &h->filters[h->num_filters]->filter_thread, NULL, video_filter.start_filter, vid_filter_params ) < 0 )
                 {
@@ -1230,12 +2135,266 @@ fail:
     return -1;
 };
 
+/** Latency **/
+static int latency_bucket( int64_t value )
+{
+    int msb;
+
+    if( value < (1 << OBE_LATENCY_SUB_BITS) )
+        return value;
+
+    value = MIN( value, (1LL << OBE_LATENCY_MAX_BITS) - 1 );
+    msb = 63 - __builtin_clzll( value );
+
+    return ((msb - OBE_LATENCY_SUB_BITS + 1) << OBE_LATENCY_SUB_BITS) +
+           ((value >> (msb - OBE_LATENCY_SUB_BITS)) & ((1 << OBE_LATENCY_SUB_BITS) - 1));
+}
+
+/* Largest value which falls in a bucket */
+static int64_t latency_bucket_value( int bucket )
+{
+    int shift;
+
+    if( bucket < (1 << OBE_LATENCY_SUB_BITS) )
+        return bucket;
+
+    shift = (bucket >> OBE_LATENCY_SUB_BITS) - 1;
+
+    return ((int64_t)((1 << OBE_LATENCY_SUB_BITS) + (bucket & ((1 << OBE_LATENCY_SUB_BITS) - 1))) << shift) + (1LL << shift) - 1;
+}
+
+/* Records the time since capture of a video frame leaving a stage */
+void add_latency( obe_t *h, int stage, int64_t arrival_time )
+{
+    obe_latency_hist_t *hist = &h->latency[stage];
+    int64_t value, max;
+
+    if( !arrival_time )
+        return;
+
+    value = MAX( obe_mdate() - arrival_time, 0 );
+
+    __atomic_fetch_add( &hist->buckets[latency_bucket( value )], 1, __ATOMIC_RELAXED );
+
+    max = __atomic_load_n( &hist->max, __ATOMIC_RELAXED );
+    while( value > max && !__atomic_compare_exchange_n( &hist->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+}
+
+int obe_wait_finished( obe_t *h )
+{
+    if( !h->is_active )
+    {
+        fprintf( stderr, "Encoder is not running\n" );
+        return -1;
+    }
+
+    for( int i = 0; i < h->num_outputs; i++ )
+    {
+        pthread_mutex_lock( &h->outputs[i]->queue.mutex );
+        while( !h->outputs[i]->is_finished )
+            pthread_cond_wait( &h->outputs[i]->queue.out_cv, &h->outputs[i]->queue.mutex );
+        pthread_mutex_unlock( &h->outputs[i]->queue.mutex );
+    }
+
+    return 0;
+}
+
+int obe_update_stream( obe_t *h, obe_output_stream_t *output_stream )
+{
+    x264_param_t *avc_param = &output_stream->avc_param;
+    x264_param_t *cur_param;
+    obe_output_stream_t *cur_stream;
+    obe_encoder_t *encoder;
+    int vbv_buffer_size;
+
+    if( !h->is_active )
+    {
+        fprintf( stderr, "Encoder is not running\n" );
+        return -1;
+    }
+
+    encoder = get_encoder( h, output_stream->output_stream_id );
+    cur_stream = get_output_stream( h, output_stream->output_stream_id );
+    if( !encoder || !encoder->is_video || !cur_stream )
+    {
+        fprintf( stderr, "Stream %i is not an encoded video stream\n", output_stream->output_stream_id );
+        return -1;
+    }
+
+    if( avc_param->rc.i_bitrate < 0 || avc_param->rc.i_vbv_max_bitrate <= 0 || avc_param->i_keyint_max <= 0 ||
+        ( h->obe_system != OBE_SYSTEM_TYPE_LOWEST_LATENCY && avc_param->rc.i_vbv_buffer_size <= 0 ) )
+    {
+        fprintf( stderr, "Invalid rate control settings\n" );
+        return -1;
+    }
+
+    /* All the other streams keep their rates */
+    if( h->mux_opts.ts_muxrate && encoded_bitrate( h ) + ( (int64_t)avc_param->rc.i_vbv_max_bitrate -
+        cur_stream->avc_param.rc.i_vbv_max_bitrate ) * 1000 > h->mux_opts.ts_muxrate )
+    {
+        fprintf( stderr, "The sum of the video maxrates and audio bitrates would be higher than the mux rate\n" );
+        return -1;
+    }
+
+    pthread_mutex_lock( &encoder->queue.mutex );
+    if( !encoder->is_ready )
+    {
+        pthread_mutex_unlock( &encoder->queue.mutex );
+        fprintf( stderr, "Encoder is not ready\n" );
+        return -1;
+    }
+
+    cur_param = encoder->encoder_params;
+    vbv_buffer_size = avc_param->rc.i_vbv_buffer_size;
+    /* As in obe_start, x264 calculates the exact single-frame size */
+    if( h->obe_system == OBE_SYSTEM_TYPE_LOWEST_LATENCY )
+        vbv_buffer_size = (double)avc_param->rc.i_vbv_max_bitrate * cur_param->i_fps_den / cur_param->i_fps_num;
+
+    /* The mux smoothing buffer and the other renditions were set up for this VBV buffer duration.
+     * Lowest latency mode always has a single-frame buffer. Allow for the buffer size being rounded down to a kbit */
+    if( h->obe_system != OBE_SYSTEM_TYPE_LOWEST_LATENCY &&
+        llabs( (int64_t)vbv_buffer_size * cur_param->rc.i_vbv_max_bitrate -
+               (int64_t)cur_param->rc.i_vbv_buffer_size * avc_param->rc.i_vbv_max_bitrate ) >= cur_param->rc.i_vbv_max_bitrate )
+    {
+        pthread_mutex_unlock( &encoder->queue.mutex );
+        fprintf( stderr, "The VBV buffer duration (vbv-bufsize / vbv-maxrate) cannot change while running\n" );
+        return -1;
+    }
+
+    encoder->reconfig_bitrate = avc_param->rc.i_bitrate;
+    encoder->reconfig_vbv_max_bitrate = avc_param->rc.i_vbv_max_bitrate;
+    encoder->reconfig_vbv_buffer_size = vbv_buffer_size;
+    encoder->reconfig_keyint_max = avc_param->i_keyint_max;
+    encoder->reconfig = 1;
+    pthread_mutex_unlock( &encoder->queue.mutex );
+
+    cur_stream->avc_param.rc.i_bitrate = avc_param->rc.i_bitrate;
+    cur_stream->avc_param.rc.i_vbv_max_bitrate = avc_param->rc.i_vbv_max_bitrate;
+    cur_stream->avc_param.rc.i_vbv_buffer_size = vbv_buffer_size;
+    cur_stream->avc_param.i_keyint_max = avc_param->i_keyint_max;
+
+    return 0;
+}
+
+int obe_get_latency( obe_t *h, int stage, obe_latency_stats_t *latency )
+{
+    obe_latency_hist_t *hist;
+    int64_t *percentiles[] = { &latency->p50, &latency->p99, &latency->p999 };
+    const int64_t per_mille[] = { 500, 990, 999 };
+    int64_t total = 0;
+    int j = 0;
+
+    if( stage < 0 || stage >= OBE_LATENCY_STAGES )
+    {
+        fprintf( stderr, "Invalid latency stage\n" );
+        return -1;
+    }
+
+    hist = &h->latency[stage];
+    memset( latency, 0, sizeof(*latency) );
+    latency->max = OBE_STAT_GET( hist->max );
+
+    for( int i = 0; i < OBE_LATENCY_BUCKETS; i++ )
+        latency->count += OBE_STAT_GET( hist->buckets[i] );
+
+    if( !latency->count )
+        return 0;
+
+    for( int i = 0; i < OBE_LATENCY_BUCKETS && j < 3; i++ )
+    {
+        total += OBE_STAT_GET( hist->buckets[i] );
+        while( j < 3 && total * 1000 >= latency->count * per_mille[j] )
+            *percentiles[j++] = MIN( latency_bucket_value( i ), latency->max );
+    }
+
+    return 0;
+}
+
+static void get_queue_stats( obe_queue_t *queue, obe_queue_stats_t *stats )
+{
+    stats->depth = obe_queue_depth( queue );
+    stats->high_water = OBE_STAT_GET( queue->high_water );
+}
+
+int obe_get_stats( obe_t *h, obe_stats_t *stats )
+{
+    if( !h->is_active )
+    {
+        fprintf( stderr, "Encoder is not running\n" );
+        return -1;
+    }
+
+    memset( stats, 0, sizeof(*stats) );
+
+    stats->input_frames = OBE_STAT_GET( h->input_frames );
+    stats->input_drops = OBE_STAT_GET( h->input_drops );
+    stats->input_allocs = OBE_STAT_GET( h->input_allocs );
+
+    stats->num_filters = MIN( h->num_filters, OBE_MAX_STATS_STREAMS );
+    for( int i = 0; i < stats->num_filters; i++ )
+    {
+        get_queue_stats( &h->filters[i]->queue, &stats->filters[i].queue );
+        stats->filters[i].frames_in = OBE_STAT_GET( h->filters[i]->frames_in );
+        stats->filters[i].frames_out = OBE_STAT_GET( h->filters[i]->frames_out );
+        stats->filters[i].image_allocs = OBE_STAT_GET( h->filters[i]->image_allocs );
+    }
+
+    stats->num_encoders = MIN( h->num_encoders, OBE_MAX_STATS_STREAMS );
+    for( int i = 0; i < stats->num_encoders; i++ )
+    {
+        obe_encoder_t *encoder = h->encoders[i];
+        stats->encoders[i].output_stream_id = encoder->output_stream_id;
+        get_queue_stats( &encoder->queue, &stats->encoders[i].queue );
+        stats->encoders[i].frames_in = OBE_STAT_GET( encoder->frames_in );
+        stats->encoders[i].frames_out = OBE_STAT_GET( encoder->frames_out );
+        stats->encoders[i].drops = OBE_STAT_GET( encoder->drops );
+        stats->encoders[i].last_encode_time = OBE_STAT_GET( encoder->last_encode_time );
+        stats->encoders[i].max_encode_time = OBE_STAT_GET( encoder->max_encode_time );
+        stats->encoders[i].total_encode_time = OBE_STAT_GET( encoder->total_encode_time );
+    }
+
+    get_queue_stats( &h->enc_smoothing_queue, &stats->enc_smoothing_queue );
+    stats->enc_smoothing_frames = OBE_STAT_GET( h->enc_smoothing_frames );
+
+    get_queue_stats( &h->mux_queue, &stats->mux_queue );
+    stats->mux_frames = OBE_STAT_GET( h->mux_frames );
+    stats->mux_bursts = OBE_STAT_GET( h->mux_bursts );
+    stats->mux_bytes = OBE_STAT_GET( h->mux_bytes );
+    stats->mux_last_burst_size = OBE_STAT_GET( h->mux_last_burst_size );
+    stats->mux_max_burst_size = OBE_STAT_GET( h->mux_max_burst_size );
+
+    get_queue_stats( &h->mux_smoothing_queue, &stats->mux_smoothing_queue );
+    stats->mux_drops = OBE_STAT_GET( h->mux_drops );
+
+    stats->num_outputs = MIN( h->num_outputs, OBE_MAX_STATS_STREAMS );
+    for( int i = 0; i < stats->num_outputs; i++ )
+    {
+        get_queue_stats( &h->outputs[i]->queue, &stats->outputs[i].queue );
+        stats->outputs[i].packets_sent = OBE_STAT_GET( h->outputs[i]->packets_sent );
+        stats->outputs[i].packets_failed = OBE_STAT_GET( h->outputs[i]->packets_failed );
+    }
+
+    return 0;
+}
+
 void obe_close( obe_t *h )
 {
     void *ret_ptr;
 
     fprintf( stderr, "closing obe \n" );
 
+    /* A thread waiting to add to a full queue would not see its cancel flag */
+    for( int i = 0; i < h->num_filters; i++ )
+        obe_close_queue( &h->filters[i]->queue );
+    for( int i = 0; i < h->num_encoders; i++ )
+        obe_close_queue( &h->encoders[i]->queue );
+    obe_close_queue( &h->enc_smoothing_queue );
+    obe_close_queue( &h->mux_queue );
+    obe_close_queue( &h->mux_smoothing_queue );
+    for( int i = 0; i < h->num_outputs; i++ )
+        obe_close_queue( &h->outputs[i]->queue );
+
     /* Cancel input thread */
     for( int i = 0; i < h->num_devices; i++ )
     {
@@ -1358,6 +2517,14 @@ void obe_close( obe_t *h )
     free( h->output_streams );
     /* TODO: free other things */
 
+    syslog( LOG_INFO, "Frame pools: raw high-water %i misses %"PRIi64", coded high-water %i misses %"PRIi64", muxed high-water %i misses %"PRIi64"\n",
+            h->raw_frame_pool.high_water, h->raw_frame_pool.misses, h->coded_frame_pool.high_water, h->coded_frame_pool.misses,
+            h->muxed_data_pool.high_water, h->muxed_data_pool.misses );
+
+    destroy_pool( &h->raw_frame_pool, free_raw_frame );
+    destroy_pool( &h->coded_frame_pool, free_coded_frame );
+    destroy_pool( &h->muxed_data_pool, free_muxed_data );
+
     /* Destroy lock manager */
     av_lockmgr_register( NULL );
 
@@ -47,6 +47,11 @@ enum obe_system_type_e
 
 int obe_set_config( obe_t *h, int system_type );
 
+/* Offline mode replaces the SDI clock with a virtual clock that only advances with the input timestamps.
+ * Nothing waits for real time, so a file input can be encoded as fast as the CPU allows.
+ * Must be set before obe_start() and is only valid with INPUT_DEVICE_FILE */
+int obe_set_offline( obe_t *h, int offline );
+
 enum input_video_connection_e
 {
     INPUT_VIDEO_CONNECTION_SDI,
@@ -95,6 +100,7 @@ enum input_type_e
     INPUT_URL,
     INPUT_DEVICE_DECKLINK,
     INPUT_DEVICE_LINSYS_SDI,
+    INPUT_DEVICE_FILE,
 //    INPUT_DEVICE_V4L2,
 //    INPUT_DEVICE_ASI,
 };
@@ -106,6 +112,12 @@ enum tc_source_e
     TC_SOURCE_VITC,
 };
 
+enum input_pacing_e
+{
+    INPUT_PACING_REALTIME,
+    INPUT_PACING_NONE,
+};
+
 typedef struct
 {
     int input_type;
@@ -117,6 +129,15 @@ typedef struct
     int video_connection;
     int audio_connection;
     int tc_source;
+
+    /* Threads used by the filter of each video stream including its own. 0 chooses automatically */
+    int filter_threads;
+
+    /* File input */
+    char *audio_location;
+    int vanc;
+    int pacing;
+    int loop;
 } obe_input_t;
 
 /**** Stream Formats ****/
@@ -402,11 +423,25 @@ typedef struct
  * Encode Options: (ignored in passthrough mode)
  * stream_format - stream_format
  *
+ * Video Options:
+ * Several video streams can be encoded from one video input stream, e.g. 1920x1080, 1280x720 and 960x540 renditions
+ * of a progressive input. Renditions of an interlaced input must be the height of the input as deinterlacing is not
+ * supported. All renditions must have the same VBV buffer duration
+ * first_cpu, num_cpus - cores the encoder of the stream runs on. num_cpus of 0 leaves it unpinned
+ *
  * Audio Options:
  * sdi_channel_pair - channel pair to use for encoding stereo (starts from channel pair 1)
  *
  * */
 
+/* Scaler used when the output is narrower than the input. The polyphase scaler's path also downsamples
+ * progressive 4:2:0 chroma by averaging line pairs rather than with swscale's Lanczos filter */
+enum obe_scaler_e
+{
+    OBE_SCALER_SWSCALE,
+    OBE_SCALER_POLYPHASE, /* Horizontal only, for 10-bit input */
+};
+
 typedef struct
 {
     int input_stream_id;
@@ -419,6 +454,9 @@ typedef struct
     /* Video */
     int is_wide;
     obe_frame_anc_opts_t video_anc;
+    int scaler;
+    int first_cpu;
+    int num_cpus;
 
     /* AVC */
     x264_param_t avc_param;
@@ -503,6 +541,7 @@ enum output_e
 {
     OUTPUT_UDP, /* MPEG-TS in UDP */
     OUTPUT_RTP, /* MPEG-TS in RTP in UDP */
+    OUTPUT_FILE, /* MPEG-TS file */
 //    OUTPUT_LINSYS_ASI,
 //    OUTPUT_LINSYS_SMPTE_310M,
 };
@@ -530,6 +569,117 @@ int obe_setup_output( obe_t *h, obe_output_opts_t *output_opts );
 int obe_start( obe_t *h );
 int obe_stop( obe_t *h );
 
+/* Blocks until the end of the input has been written by every output, which only happens with a
+ * file input which is not looped. Call obe_close() afterwards */
+int obe_wait_finished( obe_t *h );
+
+/* Changes the rate control of a running AVC stream without restarting. Only avc_param.rc.i_bitrate,
+ * rc.i_vbv_max_bitrate, rc.i_vbv_buffer_size and i_keyint_max are used; the VBV buffer size is ignored
+ * in lowest-latency mode. The VBV buffer duration (size / maxrate) must stay the same and all the streams
+ * together must fit in the mux rate. The encoder applies the change from the next frame it is given */
+int obe_update_stream( obe_t *h, obe_output_stream_t *output_stream );
+
+/**** Statistics ****/
+#define OBE_MAX_STATS_STREAMS 40
+
+typedef struct
+{
+    int depth;
+    int high_water;
+} obe_queue_stats_t;
+
+typedef struct
+{
+    obe_queue_stats_t queue;
+    int64_t frames_in;
+    int64_t frames_out; /* Input frames which have been filtered and passed on to the encoders */
+    int64_t image_allocs; /* Output images allocated by the video filter rather than taken from its pool */
+} obe_filter_stats_t;
+
+typedef struct
+{
+    int output_stream_id;
+    obe_queue_stats_t queue;
+    int64_t frames_in;
+    int64_t frames_out;
+    int64_t drops; /* Number of times the encoder was resynced after an input drop */
+
+    /* Time spent in the encode call in microseconds */
+    int64_t last_encode_time;
+    int64_t max_encode_time;
+    int64_t total_encode_time;
+} obe_encoder_stats_t;
+
+typedef struct
+{
+    obe_queue_stats_t queue;
+    int64_t packets_sent;
+    int64_t packets_failed;
+} obe_output_stats_t;
+
+typedef struct
+{
+    /* Input */
+    int64_t input_frames;
+    int64_t input_drops;
+    /* Buffer allocations made while capturing. Stays at zero once the scratch buffers have been sized */
+    int64_t input_allocs;
+
+    /* Filters */
+    int num_filters;
+    obe_filter_stats_t filters[OBE_MAX_STATS_STREAMS];
+
+    /* Encoders */
+    int num_encoders;
+    obe_encoder_stats_t encoders[OBE_MAX_STATS_STREAMS];
+
+    /* Encoder smoothing */
+    obe_queue_stats_t enc_smoothing_queue;
+    int64_t enc_smoothing_frames;
+
+    /* Mux. Burst sizes are in bytes */
+    obe_queue_stats_t mux_queue;
+    int64_t mux_frames;
+    int64_t mux_bursts;
+    int64_t mux_bytes;
+    int     mux_last_burst_size;
+    int     mux_max_burst_size;
+
+    /* Mux smoothing */
+    obe_queue_stats_t mux_smoothing_queue;
+    int64_t mux_drops;
+
+    /* Outputs */
+    int num_outputs;
+    obe_output_stats_t outputs[OBE_MAX_STATS_STREAMS];
+} obe_stats_t;
+
+/* Video latency from capture to the exit of each stage in microseconds */
+enum obe_latency_stage_e
+{
+    OBE_LATENCY_FILTER,
+    OBE_LATENCY_ENCODER_IN,
+    OBE_LATENCY_ENCODER_OUT,
+    OBE_LATENCY_SMOOTHING,   /* Encoder smoothing, OBE_SYSTEM_TYPE_GENERIC only */
+    OBE_LATENCY_MUX,
+    OBE_LATENCY_OUTPUT,      /* First packet of the frame handed to the outputs */
+    OBE_LATENCY_STAGES,
+};
+
+typedef struct
+{
+    int64_t count;
+    int64_t p50;
+    int64_t p99;
+    int64_t p999;
+    int64_t max;
+} obe_latency_stats_t;
+
+/* Can be called from any thread once obe_start has returned. Counters are read without locking
+ * so related values may be from slightly different instants */
+int obe_get_stats( obe_t *h, obe_stats_t *stats );
+int obe_get_latency( obe_t *h, int stage, obe_latency_stats_t *latency );
+
 void obe_close( obe_t *h );
 
 #endif
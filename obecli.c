@@ -63,7 +63,7 @@ static int running = 0;
 static int system_type_value = OBE_SYSTEM_TYPE_GENERIC;
 
 static const char * const system_types[]             = { "generic", "lowestlatency", "lowlatency", 0 };
-static const char * const input_types[]              = { "url", "decklink", "linsys-sdi", 0 };
+static const char * const input_types[]              = { "url", "decklink", "linsys-sdi", "file", 0 };
 static const char * const input_video_formats[]      = { "pal", "ntsc", "720p50", "720p59.94", "720p60", "1080i50", "1080i59.94", "1080i60",
                                                          "1080p23.98", "1080p24", "1080p25", "1080p29.97", "1080p30", "1080p50", "1080p59.94",
                                                          "1080p60", 0 };
@@ -80,12 +80,18 @@ static const char * const aac_encapsulations[]       = { "adts", "latm", 0 };
 static const char * const mp2_modes[]                = { "auto", "stereo", "joint-stereo", "dual-channel", 0 };
 static const char * const channel_maps[]             = { "", "mono", "stereo", "5.0", "5.1", 0 };
 static const char * const mono_channels[]            = { "left", "right", 0 };
-static const char * const output_modules[]           = { "udp", "rtp", "linsys-asi", 0 };
-static const char * const addable_streams[]          = { "audio", "ttx", 0 };
+static const char * const output_modules[]           = { "udp", "rtp", "file", "linsys-asi", 0 };
+static const char * const addable_streams[]          = { "audio", "ttx", "video", 0 };
 static const char * const tc_sources[]               = { "none", "rp188", "vitc", 0};
-
-static const char * system_opts[] = { "system-type", NULL };
-static const char * input_opts[]  = { "location", "card-idx", "video-format", "video-connection", "audio-connection", "tc-source", NULL };
+static const char * const input_pacings[]            = { "realtime", "none", 0 };
+static const char * const scalers[]                  = { "swscale", "polyphase", 0 };
+
+static const char * system_opts[] = { "system-type", "offline", NULL };
+static const char * input_opts[]  = { "location", "card-idx", "video-format", "video-connection", "audio-connection", "tc-source",
+                                      /* File input options */
+                                      "audio-location", "vanc", "pacing", "loop",
+                                      /* Video filter options */
+                                      "filter-threads", NULL };
 static const char * add_opts[] =    { "type" };
 /* TODO: split the stream options into general options, video options, ts options */
 static const char * stream_opts[] = { "action", "format",
@@ -105,13 +111,18 @@ static const char * stream_opts[] = { "action", "format",
                                       "pid", "lang", "audio-type", "num-ttx", "ttx-lang", "ttx-type", "ttx-mag", "ttx-page",
                                       /* VBI options */
                                       "vbi-ttx", "vbi-inv-ttx", "vbi-vps", "vbi-wss",
+                                      /* Video filter options */
+                                      "scaler", "height",
+                                      /* Encoder thread options */
+                                      "cpus",
                                       NULL };
+static const char * update_stream_opts[] = { "vbv-maxrate", "vbv-bufsize", "bitrate", "keyint", NULL };
 static const char * muxer_opts[]  = { "ts-type", "cbr", "ts-muxrate", "passthrough", "ts-id", "program-num", "pmt-pid", "pcr-pid",
                                       "pcr-period", "pat-period", "service-name", "provider-name", NULL };
 static const char * ts_types[]    = { "generic", "dvb", "cablelabs", "atsc", "isdb", NULL };
 static const char * output_opts[] = { "type", "target", NULL };
 
-const static int allowed_resolutions[17][2] =
+const static int allowed_resolutions[19][2] =
 {
     /* NTSC */
     { 720, 480 },
@@ -132,6 +143,9 @@ const static int allowed_resolutions[17][2] =
     { 1280,  720 },
     {  960,  720 },
     {  640,  720 },
+    /* Vertically scaled progressive HD */
+    {  960,  540 },
+    {  640,  360 },
     { 0, 0 }
 };
 
@@ -423,6 +437,21 @@ static int add_stream( char *command, obecli_command_t *child )
         cli.output_streams[output_stream_id].input_stream_id = -1;
         cli.output_streams[output_stream_id].stream_format = stream_format;
     }
+    else if( !strcasecmp( type, addable_streams[2] ) ) /* Video rendition */
+    {
+        obe_output_stream_t *video_stream = &cli.output_streams[0];
+        x264_param_t *avc_param = &cli.output_streams[output_stream_id].avc_param;
+
+        /* Start from the first video stream but make the rates be chosen again */
+        cli.output_streams[output_stream_id].input_stream_id = video_stream->input_stream_id;
+        cli.output_streams[output_stream_id].is_wide = video_stream->is_wide;
+        cli.output_streams[output_stream_id].video_anc = video_stream->video_anc;
+        cli.output_streams[output_stream_id].scaler = video_stream->scaler;
+        memcpy( avc_param, &video_stream->avc_param, sizeof(*avc_param) );
+        avc_param->rc.i_vbv_max_bitrate = 0;
+        avc_param->rc.i_vbv_buffer_size = 0;
+        avc_param->rc.i_bitrate = 0;
+    }
     cli.output_streams[output_stream_id].output_stream_id = output_stream_id;
 
     printf( "NOTE: output-stream-ids have CHANGED! \n" );
@@ -480,6 +509,7 @@ static int set_obe( char *command, obecli_command_t *child )
             return -1;
 
         char *system_type     = obe_get_option( system_opts[0], opts );
+        char *offline         = obe_get_option( system_opts[1], opts );
 
         FAIL_IF_ERROR( system_type && ( check_enum_value( system_type, system_types ) < 0 ),
                        "Invalid system type\n" );
@@ -492,6 +522,9 @@ static int set_obe( char *command, obecli_command_t *child )
             obe_set_config( cli.h, system_type_value );
         }
 
+        if( offline )
+            obe_set_offline( cli.h, obe_otoi( offline, 0 ) );
+
         obe_free_string_array( opts );
     }
 
@@ -520,6 +553,11 @@ static int set_input( char *command, obecli_command_t *child )
         char *video_connection = obe_get_option( input_opts[3], opts );
         char *audio_connection = obe_get_option( input_opts[4], opts );
         char *tc_source        = obe_get_option( input_opts[5], opts );
+        char *audio_location   = obe_get_option( input_opts[6], opts );
+        char *vanc             = obe_get_option( input_opts[7], opts );
+        char *pacing           = obe_get_option( input_opts[8], opts );
+        char *loop             = obe_get_option( input_opts[9], opts );
+        char *filter_threads   = obe_get_option( input_opts[10], opts );
 
         FAIL_IF_ERROR( video_format && ( check_enum_value( video_format, input_video_formats ) < 0 ),
                        "Invalid video format\n" );
@@ -533,6 +571,9 @@ static int set_input( char *command, obecli_command_t *child )
         FAIL_IF_ERROR( tc_source && ( check_enum_value( tc_source, tc_sources ) < 0 ),
                        "Invalid timecode source \n" );
 
+        FAIL_IF_ERROR( pacing && ( check_enum_value( pacing, input_pacings ) < 0 ),
+                       "Invalid input pacing \n" );
+
         if( location )
         {
              if( cli.input.location )
@@ -543,6 +584,16 @@ static int set_input( char *command, obecli_command_t *child )
              strcpy( cli.input.location, location );
         }
 
+        if( audio_location )
+        {
+             if( cli.input.audio_location )
+                 free( cli.input.audio_location );
+
+             cli.input.audio_location = malloc( strlen( audio_location ) + 1 );
+             FAIL_IF_ERROR( !cli.input.audio_location, "malloc failed\n" );
+             strcpy( cli.input.audio_location, audio_location );
+        }
+
         cli.input.card_idx = obe_otoi( card_idx, cli.input.card_idx );
         if( video_format )
             parse_enum_value( video_format, input_video_formats, &cli.input.video_format );
@@ -552,6 +603,11 @@ static int set_input( char *command, obecli_command_t *child )
             parse_enum_value( audio_connection, input_audio_connections, &cli.input.audio_connection );
         if( tc_source )
             parse_enum_value( tc_source, tc_sources, &cli.input.tc_source );
+        cli.input.vanc = obe_otoi( vanc, cli.input.vanc );
+        if( pacing )
+            parse_enum_value( pacing, input_pacings, &cli.input.pacing );
+        cli.input.loop = obe_otoi( loop, cli.input.loop );
+        cli.input.filter_threads = obe_otoi( filter_threads, cli.input.filter_threads );
 
         obe_free_string_array( opts );
     }
@@ -641,6 +697,13 @@ static int set_stream( char *command, obecli_command_t *child )
             char *lang        = obe_get_option( stream_opts[30], opts );
             char *audio_type  = obe_get_option( stream_opts[31], opts );
 
+            /* Video filter options */
+            char *scaler         = obe_get_option( stream_opts[41], opts );
+            char *height         = obe_get_option( stream_opts[42], opts );
+
+            /* Encoder thread options */
+            char *cpus           = obe_get_option( stream_opts[43], opts );
+
             if( input_stream->stream_type == STREAM_TYPE_VIDEO )
             {
                 x264_param_t *avc_param = &cli.output_streams[output_stream_id].avc_param;
@@ -654,6 +717,9 @@ static int set_stream( char *command, obecli_command_t *child )
                 FAIL_IF_ERROR( frame_packing && ( check_enum_value( frame_packing, frame_packing_modes ) < 0 ),
                                "Invalid frame packing mode\n" )
 
+                FAIL_IF_ERROR( scaler && ( check_enum_value( scaler, scalers ) < 0 ),
+                               "Invalid scaler\n" )
+
                 if( aspect_ratio )
                 {
                     int ar_num, ar_den;
@@ -669,15 +735,17 @@ static int set_stream( char *command, obecli_command_t *child )
                     }
                 }
 
-                if( width )
+                if( width || height )
                 {
                     int i_width = obe_otoi( width, avc_param->i_width );
-                    while( allowed_resolutions[i][0] && ( allowed_resolutions[i][1] != avc_param->i_height ||
+                    int i_height = obe_otoi( height, avc_param->i_height );
+                    while( allowed_resolutions[i][0] && ( allowed_resolutions[i][1] != i_height ||
                            allowed_resolutions[i][0] != i_width ) )
                        i++;
 
                     FAIL_IF_ERROR( !allowed_resolutions[i][0], "Invalid resolution. \n" );
                     avc_param->i_width = i_width;
+                    avc_param->i_height = i_height;
                 }
 
                 /* Set it to encode by default */
@@ -697,6 +765,22 @@ static int set_stream( char *command, obecli_command_t *child )
                 avc_param->b_intra_refresh     = obe_otob( intra_refresh, avc_param->b_intra_refresh );
                 avc_param->i_frame_reference   = obe_otoi( max_refs, avc_param->i_frame_reference );
 
+                /* A single core or a range such as 0-7 */
+                if( cpus )
+                {
+                    int first_cpu, last_cpu;
+                    int ret = sscanf( cpus, "%d-%d", &first_cpu, &last_cpu );
+                    if( ret == 1 )
+                        last_cpu = first_cpu;
+
+                    FAIL_IF_ERROR( ret < 1 || first_cpu < 0 || last_cpu < first_cpu, "Invalid cpus\n" );
+                    cli.output_streams[output_stream_id].first_cpu = first_cpu;
+                    cli.output_streams[output_stream_id].num_cpus = last_cpu - first_cpu + 1;
+                }
+
+                if( scaler )
+                    parse_enum_value( scaler, scalers, &cli.output_streams[output_stream_id].scaler );
+
                 if( profile )
                     parse_enum_value( profile, x264_profile_names, &cli.avc_profile );
 
@@ -873,6 +957,73 @@ static int set_stream( char *command, obecli_command_t *child )
     return 0;
 }
 
+static int update_stream( char *command, obecli_command_t *child )
+{
+    obe_output_stream_t output_stream;
+
+    FAIL_IF_ERROR( !running, "Encoder not running\n" );
+
+    int tok_len = strcspn( command, " " );
+    int str_len = strlen( command );
+    command[tok_len] = 0;
+
+    FAIL_IF_ERROR( strcasecmp( command, "opts" ) || str_len <= tok_len, "Usage: update stream opts streamid:[opts]\n" );
+
+    command += tok_len+1;
+    int tok_len2 = strcspn( command, ":" );
+    int str_len2 = strlen( command );
+    command[tok_len2] = 0;
+
+    int output_stream_id = obe_otoi( command, -1 );
+    FAIL_IF_ERROR( output_stream_id < 0 || output_stream_id > cli.num_output_streams-1,
+                   "Invalid stream id\n" );
+    FAIL_IF_ERROR( cli.output_streams[output_stream_id].stream_format != VIDEO_AVC,
+                   "Only AVC streams can be updated\n" );
+    FAIL_IF_ERROR( str_len2 <= tok_len2, "No options given\n" );
+
+    char *params = command + tok_len2 + 1;
+    char **opts = obe_split_options( params, update_stream_opts );
+    if( !opts && params )
+        return -1;
+
+    char *vbv_maxrate = obe_get_option( update_stream_opts[0], opts );
+    char *vbv_bufsize = obe_get_option( update_stream_opts[1], opts );
+    char *bitrate     = obe_get_option( update_stream_opts[2], opts );
+    char *keyint      = obe_get_option( update_stream_opts[3], opts );
+
+    if( vbv_bufsize && system_type_value == OBE_SYSTEM_TYPE_LOWEST_LATENCY )
+    {
+        obe_free_string_array( opts );
+        fprintf( stderr, "VBV buffer size is not user-settable in lowest-latency mode\n" );
+        return -1;
+    }
+
+    memcpy( &output_stream, &cli.output_streams[output_stream_id], sizeof(output_stream) );
+    x264_param_t *avc_param = &output_stream.avc_param;
+
+    /* A CBR stream stays CBR if only the bitrate is given */
+    if( bitrate && !vbv_maxrate && avc_param->rc.i_vbv_max_bitrate == avc_param->rc.i_bitrate )
+        vbv_maxrate = bitrate;
+
+    /* The VBV buffer duration cannot change while running so scale the buffer with the maxrate */
+    int cur_vbv_maxrate = avc_param->rc.i_vbv_max_bitrate;
+    avc_param->rc.i_vbv_max_bitrate = obe_otoi( vbv_maxrate, avc_param->rc.i_vbv_max_bitrate );
+    if( vbv_bufsize )
+        avc_param->rc.i_vbv_buffer_size = obe_otoi( vbv_bufsize, avc_param->rc.i_vbv_buffer_size );
+    else if( cur_vbv_maxrate > 0 )
+        avc_param->rc.i_vbv_buffer_size = (int64_t)avc_param->rc.i_vbv_buffer_size * avc_param->rc.i_vbv_max_bitrate / cur_vbv_maxrate;
+    avc_param->rc.i_bitrate         = obe_otoi( bitrate, avc_param->rc.i_bitrate );
+    avc_param->i_keyint_max         = obe_otoi( keyint, avc_param->i_keyint_max );
+    obe_free_string_array( opts );
+
+    FAIL_IF_ERROR( obe_update_stream( cli.h, &output_stream ) < 0, "Could not update stream\n" );
+
+    memcpy( &cli.output_streams[output_stream_id], &output_stream, sizeof(output_stream) );
+    printf( "Stream %i will be updated from the next frame\n", output_stream_id );
+
+    return 0;
+}
+
 static int set_muxer( char *command, obecli_command_t *child )
 {
     if( !strlen( command ) )
@@ -1076,9 +1227,16 @@ static int show_help( char *command, obecli_command_t *child )
 
     H0( "\n" );
 
+    H0( "update - Change a running encode\n" );
+    for( int i = 0; update_commands[i].name != 0; i++ )
+        H0( "       %-*s %-*s  - %s \n", 8, update_commands[i].name, 21, update_commands[i].child_opts, update_commands[i].description );
+
+    H0( "\n" );
+
     H0( "Starting/Stopping OBE:\n" );
     H0( "start - Start encoding\n" );
     H0( "stop  - Stop encoding\n" );
+    H0( "wait  - Wait for a file input which is not looped to finish encoding, then stop\n" );
 
     H0( "\n" );
 
@@ -1158,6 +1316,81 @@ static int show_outputs( char *command, obecli_command_t *child )
     return 0;
 }
 
+static int show_latency( char *command, obecli_command_t *child )
+{
+    obe_latency_stats_t latency;
+    const char *stage_names[] = { "Filter", "Encoder input", "Encoder output", "Smoothing", "Mux", "Output" };
+    FAIL_IF_ERROR( !running, "Encoder not running\n" );
+
+    printf( "\nVideo latency since capture (us): \n" );
+
+    for( int i = 0; i < OBE_LATENCY_STAGES; i++ )
+    {
+        if( obe_get_latency( cli.h, i, &latency ) < 0 )
+            return -1;
+
+        if( !latency.count )
+            continue;
+
+        printf( "       %-*s - frames: %"PRIi64" - p50: %"PRIi64" - p99: %"PRIi64" - p99.9: %"PRIi64" - max: %"PRIi64" \n", 14, stage_names[i],
+                latency.count, latency.p50, latency.p99, latency.p999, latency.max );
+    }
+
+    printf( "\n" );
+
+    return 0;
+}
+
+static void print_queue_stats( const char *name, obe_queue_stats_t *queue )
+{
+    printf( "       %-*s - depth: %d - high-water: %d \n", 16, name, queue->depth, queue->high_water );
+}
+
+static int show_stats( char *command, obecli_command_t *child )
+{
+    obe_stats_t stats;
+    FAIL_IF_ERROR( !running, "Encoder not running\n" );
+
+    if( obe_get_stats( cli.h, &stats ) < 0 )
+        return -1;
+
+    printf( "\nInput: frames: %"PRIi64" - drops: %"PRIi64" - allocations: %"PRIi64" \n", stats.input_frames, stats.input_drops,
+            stats.input_allocs );
+
+    printf( "Filters: \n" );
+    for( int i = 0; i < stats.num_filters; i++ )
+        printf( "       Filter %d - frames in: %"PRIi64" - frames out: %"PRIi64" - depth: %d - high-water: %d - allocations: %"PRIi64" \n", i,
+                stats.filters[i].frames_in, stats.filters[i].frames_out, stats.filters[i].queue.depth, stats.filters[i].queue.high_water,
+                stats.filters[i].image_allocs );
+
+    printf( "Encoders: \n" );
+    for( int i = 0; i < stats.num_encoders; i++ )
+    {
+        obe_encoder_stats_t *encoder = &stats.encoders[i];
+        printf( "       Output-stream-id: %d - frames in: %"PRIi64" - frames out: %"PRIi64" - drops: %"PRIi64" - depth: %d - high-water: %d \n",
+                encoder->output_stream_id, encoder->frames_in, encoder->frames_out, encoder->drops, encoder->queue.depth, encoder->queue.high_water );
+        printf( "       Encode time (us) - last: %"PRIi64" - average: %"PRIi64" - max: %"PRIi64" \n", encoder->last_encode_time,
+                encoder->frames_in ? encoder->total_encode_time / encoder->frames_in : 0, encoder->max_encode_time );
+    }
+
+    printf( "Queues: \n" );
+    print_queue_stats( "Encoder smoothing", &stats.enc_smoothing_queue );
+    print_queue_stats( "Mux", &stats.mux_queue );
+    print_queue_stats( "Mux smoothing", &stats.mux_smoothing_queue );
+
+    printf( "Mux: frames: %"PRIi64" - bursts: %"PRIi64" - bytes: %"PRIi64" - last burst: %d - max burst: %d - drops: %"PRIi64" \n",
+            stats.mux_frames, stats.mux_bursts, stats.mux_bytes, stats.mux_last_burst_size, stats.mux_max_burst_size, stats.mux_drops );
+
+    printf( "Outputs: \n" );
+    for( int i = 0; i < stats.num_outputs; i++ )
+        printf( "       Output %d - packets sent: %"PRIi64" - packets failed: %"PRIi64" - depth: %d - high-water: %d \n", i,
+                stats.outputs[i].packets_sent, stats.outputs[i].packets_failed, stats.outputs[i].queue.depth, stats.outputs[i].queue.high_water );
+
+    printf( "\n" );
+
+    return 0;
+}
+
 static int show_input_streams( char *command, obecli_command_t *child )
 {
     obe_input_stream_t *stream;
@@ -1250,7 +1483,7 @@ static int show_output_streams( char *command, obecli_command_t *child )
             printf( "DVB-VBI\n" );
         else if( input_stream->stream_type == STREAM_TYPE_VIDEO )
         {
-            printf( "Video: AVC \n" );
+            printf( "Video: AVC - %dx%d \n", output_stream->avc_param.i_width, output_stream->avc_param.i_height );
         }
         else if( input_stream->stream_type == STREAM_TYPE_AUDIO )
         {
@@ -1341,8 +1574,8 @@ static int start_encode( char *command, obecli_command_t *child )
     FAIL_IF_ERROR( !cli.output.num_outputs, "No outputs selected\n" );
     for( int i = 0; i < cli.output.num_outputs; i++ )
     {
-        if( ( cli.output.outputs[i].type == OUTPUT_UDP || cli.output.outputs[i].type == OUTPUT_RTP ) &&
-             !cli.output.outputs[i].target )
+        if( ( cli.output.outputs[i].type == OUTPUT_UDP || cli.output.outputs[i].type == OUTPUT_RTP ||
+              cli.output.outputs[i].type == OUTPUT_FILE ) && !cli.output.outputs[i].target )
         {
             fprintf( stderr, "No output target chosen. Output-ID %d\n", i );
             return -1;
@@ -1372,6 +1605,12 @@ static int stop_encode( char *command, obecli_command_t *child )
         cli.input.location = NULL;
     }
 
+    if( cli.input.audio_location )
+    {
+        free( cli.input.audio_location );
+        cli.input.audio_location = NULL;
+    }
+
     if( cli.mux_opts.service_name )
     {
         free( cli.mux_opts.service_name );
@@ -1403,6 +1642,20 @@ static int stop_encode( char *command, obecli_command_t *child )
     return 0;
 }
 
+static int wait_encode( char *command, obecli_command_t *child )
+{
+    FAIL_IF_ERROR( !running, "Encoder not running\n" );
+    FAIL_IF_ERROR( cli.input.input_type != INPUT_DEVICE_FILE || cli.input.loop,
+                   "Only a file input which is not looped finishes\n" );
+
+    if( obe_wait_finished( cli.h ) < 0 )
+        return -1;
+
+    printf( "Encoding finished\n" );
+
+    return stop_encode( NULL, NULL );
+}
+
 static int probe_device( char *command, obecli_command_t *child )
 {
     if( !strlen( command ) )
@@ -50,21 +50,26 @@ static int set_muxer( char *command, obecli_command_t *child );
 static int set_output( char *command, obecli_command_t *child );
 static int set_outputs( char *command, obecli_command_t *child );
 
+static int update_stream( char *command, obecli_command_t *child );
+
 static int show_bitdepth( char *command, obecli_command_t *child );
 static int show_decoders( char *command, obecli_command_t *child );
 static int show_encoders( char *command, obecli_command_t *child );
 static int show_help( char *command, obecli_command_t *child );
 static int show_input( char *command, obecli_command_t *child );
 static int show_inputs( char *command, obecli_command_t *child );
+static int show_latency( char *command, obecli_command_t *child );
 static int show_muxers( char *command, obecli_command_t *child );
 static int show_output( char *command, obecli_command_t *child );
 static int show_outputs( char *command, obecli_command_t *child );
+static int show_stats( char *command, obecli_command_t *child );
 
 static int show_input_streams( char *command, obecli_command_t *child );
 static int show_output_streams( char *command, obecli_command_t *child );
 
 static int start_encode( char *command, obecli_command_t *child );
 static int stop_encode( char *command, obecli_command_t *child );
+static int wait_encode( char *command, obecli_command_t *child );
 
 struct obecli_command_t
 {
@@ -129,9 +134,11 @@ static obecli_command_t show_commands[] =
     //{ "filters",  "",  "Show supported filters",   show_filters, NULL },
     { "input",    "streams",  "Show input streams",  show_input,   NULL },
     { "inputs",   "",  "Show supported inputs",      show_inputs,   NULL },
+    { "latency",  "",  "Show video latency",         show_latency,  NULL },
     { "muxers",   "",  "Show supported muxers",      show_muxers,   NULL },
     { "output",   "streams",  "Show output streams", show_output,   NULL },
     { "outputs",  "",  "Show supported outputs",     show_outputs,  NULL },
+    { "stats",    "",  "Show encoder statistics",    show_stats,    NULL },
     { 0 }
 };
 
@@ -147,6 +154,12 @@ static obecli_command_t set_commands[] =
     { 0 }
 };
 
+static obecli_command_t update_commands[] =
+{
+    { "stream", "opts streamid:[opts]",   "Change the bitrate, VBV or keyint of a running stream", update_stream, NULL },
+    { 0 }
+};
+
 static obecli_command_t main_commands[] =
 {
     { "add",   "[item] ...", "Add stream",               parse_command, add_commands },
@@ -157,6 +170,8 @@ static obecli_command_t main_commands[] =
     { "show",  "[item] ...", "Show item",                parse_command, show_commands },
     { "start", "",           "Start encoding",           start_encode,  NULL },
     { "stop",  "",           "Stop encoding",            stop_encode,   NULL },
+    { "update","[item] ...", "Update running item",      parse_command, update_commands },
+    { "wait",  "",           "Wait for a file to finish encoding", wait_encode, NULL },
     { 0 }
 };
 
@@ -167,6 +182,7 @@ static const obecli_input_name_t input_names[] =
     { INPUT_URL,             "URL",      "URL (includes UDP and RTP)",             "libavformat" },
     { INPUT_DEVICE_DECKLINK, "Decklink", "Blackmagic Design Decklink input",       "internal" },
     { INPUT_DEVICE_DECKLINK, "Linsys SDI", "Linear Systems (DVEO) SDI card input", "internal" },
+    { INPUT_DEVICE_FILE,     "File",     "Raw v210 and PCM capture file input",    "internal" },
     { 0, 0, 0 },
 };
 
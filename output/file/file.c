@@ -0,0 +1,139 @@
+/*****************************************************************************
+ * file.c : File output functions
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+#include "common/common.h"
+#include "output/output.h"
+
+struct file_status
+{
+    obe_output_t *output;
+    FILE **fp;
+    AVBufferRef ***muxed_data;
+};
+
+static void close_output( void *handle )
+{
+    struct file_status *status = handle;
+
+    if( *status->fp )
+        fclose( *status->fp );
+
+    if( status->output->output_dest.target  )
+        free( status->output->output_dest.target );
+
+    if( *status->muxed_data )
+        free( *status->muxed_data );
+
+    pthread_mutex_unlock( &status->output->queue.mutex );
+}
+
+static void *open_output( void *ptr )
+{
+    obe_output_t *output = ptr;
+    obe_output_dest_t *output_dest = &output->output_dest;
+    struct file_status status;
+    FILE *fp = NULL;
+    int num_muxed_data = 0, muxed_data_size = 0, eos = 0;
+    AVBufferRef **muxed_data = NULL, **tmp;
+
+    status.output = output;
+    status.fp = &fp;
+    status.muxed_data = &muxed_data;
+    pthread_cleanup_push( close_output, (void*)&status );
+
+    fp = fopen( output_dest->target, "wb" );
+    if( !fp )
+    {
+        fprintf( stderr, "[file] Could not open output file %s: %s\n", output_dest->target, strerror( errno ) );
+        return NULL;
+    }
+
+    while( 1 )
+    {
+        obe_queue_lock( &output->queue );
+        while( !obe_queue_size( &output->queue ) && !output->cancel_thread )
+            pthread_cond_wait( &output->queue.in_cv, &output->queue.mutex );
+
+        if( output->cancel_thread )
+        {
+            obe_queue_unlock( &output->queue );
+            break;
+        }
+        obe_queue_unlock( &output->queue );
+
+        num_muxed_data = obe_queue_size( &output->queue );
+
+        if( num_muxed_data > muxed_data_size )
+        {
+            tmp = realloc( muxed_data, num_muxed_data * sizeof(*muxed_data) );
+            if( !tmp )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return NULL;
+            }
+            muxed_data = tmp;
+            muxed_data_size = num_muxed_data;
+        }
+
+        for( int i = 0; i < num_muxed_data; i++ )
+            muxed_data[i] = obe_queue_item( &output->queue, i );
+
+        for( int i = 0; i < num_muxed_data; i++ )
+        {
+            if( !muxed_data[i] )
+            {
+                remove_from_queue( &output->queue );
+                eos = 1;
+                break;
+            }
+
+            /* Skip the PCRs in front of the transport stream packets */
+            if( fwrite( &muxed_data[i]->data[7*sizeof(int64_t)], TS_PACKETS_SIZE, 1, fp ) != 1 )
+            {
+                syslog( LOG_ERR, "[file] Failed to write packet\n" );
+                OBE_STAT_ADD( output->packets_failed, 1 );
+            }
+            else
+                OBE_STAT_ADD( output->packets_sent, 1 );
+
+            remove_from_queue( &output->queue );
+            av_buffer_unref( &muxed_data[i] );
+        }
+
+        /* The file is complete once it has been closed */
+        if( eos )
+        {
+            if( fclose( fp ) )
+                syslog( LOG_ERR, "[file] Failed to close output file: %s\n", strerror( errno ) );
+            fp = NULL;
+            obe_output_finished( output );
+            break;
+        }
+    }
+
+    pthread_cleanup_pop( 1 );
+
+    return NULL;
+}
+
+const obe_output_func_t file_output = { open_output };
@@ -57,6 +57,7 @@ struct ip_status
 {
     obe_output_t *output;
     hnd_t *ip_handle;
+    AVBufferRef ***muxed_data;
 };
 
 static int rtp_open( hnd_t *p_handle, obe_udp_opts_t *udp_opts )
@@ -174,6 +175,9 @@ static void close_output( void *handle )
     if( status->output->output_dest.target  )
         free( status->output->output_dest.target );
 
+    if( *status->muxed_data )
+        free( *status->muxed_data );
+
     pthread_mutex_unlock( &status->output->queue.mutex );
 }
 
@@ -183,8 +187,8 @@ static void *open_output( void *ptr )
     obe_output_dest_t *output_dest = &output->output_dest;
     struct ip_status status;
     hnd_t ip_handle = NULL;
-    int num_muxed_data = 0;
-    AVBufferRef **muxed_data;
+    int num_muxed_data = 0, muxed_data_size = 0, ret, eos = 0;
+    AVBufferRef **muxed_data = NULL, **tmp;
     obe_udp_opts_t udp_opts;
 
     struct sched_param param = {0};
@@ -193,6 +197,7 @@ static void *open_output( void *ptr )
 
     status.output = output;
     status.ip_handle = &ip_handle;
+    status.muxed_data = &muxed_data;
     pthread_cleanup_push( close_output, (void*)&status );
 
     udp_populate_opts( &udp_opts, output_dest->target );
@@ -213,8 +218,8 @@ static void *open_output( void *ptr )
 
     while( 1 )
     {
-        pthread_mutex_lock( &output->queue.mutex );
-        while( !output->queue.size && !output->cancel_thread )
+        obe_queue_lock( &output->queue );
+        while( !obe_queue_size( &output->queue ) && !output->cancel_thread )
         {
             /* Often this cond_wait is not because of an underflow */
             pthread_cond_wait( &output->queue.in_cv, &output->queue.mutex );
@@ -222,43 +227,66 @@ static void *open_output( void *ptr )
 
         if( output->cancel_thread )
         {
-            pthread_mutex_unlock( &output->queue.mutex );
+            obe_queue_unlock( &output->queue );
             break;
         }
+        obe_queue_unlock( &output->queue );
 
-        num_muxed_data = output->queue.size;
+        num_muxed_data = obe_queue_size( &output->queue );
 
-        muxed_data = malloc( num_muxed_data * sizeof(*muxed_data) );
-        if( !muxed_data )
+        if( num_muxed_data > muxed_data_size )
         {
-            pthread_mutex_unlock( &output->queue.mutex );
-            syslog( LOG_ERR, "Malloc failed\n" );
-            return NULL;
+            tmp = realloc( muxed_data, num_muxed_data * sizeof(*muxed_data) );
+            if( !tmp )
+            {
+                syslog( LOG_ERR, "Malloc failed\n" );
+                return NULL;
+            }
+            muxed_data = tmp;
+            muxed_data_size = num_muxed_data;
         }
-        memcpy( muxed_data, output->queue.queue, num_muxed_data * sizeof(*muxed_data) );
-        pthread_mutex_unlock( &output->queue.mutex );
+
+        for( int i = 0; i < num_muxed_data; i++ )
+            muxed_data[i] = obe_queue_item( &output->queue, i );
 
 //        printf("\n START %i \n", num_muxed_data );
 
         for( int i = 0; i < num_muxed_data; i++ )
         {
+            if( !muxed_data[i] )
+            {
+                remove_from_queue( &output->queue );
+                eos = 1;
+                break;
+            }
+
             if( output_dest->type == OUTPUT_RTP )
             {
-                if( write_rtp_pkt( ip_handle, &muxed_data[i]->data[7*sizeof(int64_t)], TS_PACKETS_SIZE, AV_RN64( muxed_data[i]->data ) ) < 0 )
+                ret = write_rtp_pkt( ip_handle, &muxed_data[i]->data[7*sizeof(int64_t)], TS_PACKETS_SIZE, AV_RN64( muxed_data[i]->data ) );
+                if( ret < 0 )
                     syslog( LOG_ERR, "[rtp] Failed to write RTP packet\n" );
             }
             else
             {
-                if( udp_write( ip_handle, &muxed_data[i]->data[7*sizeof(int64_t)], TS_PACKETS_SIZE ) < 0 )
+                ret = udp_write( ip_handle, &muxed_data[i]->data[7*sizeof(int64_t)], TS_PACKETS_SIZE );
+                if( ret < 0 )
                     syslog( LOG_ERR, "[udp] Failed to write UDP packet\n" );
             }
 
+            if( ret < 0 )
+                OBE_STAT_ADD( output->packets_failed, 1 );
+            else
+                OBE_STAT_ADD( output->packets_sent, 1 );
+
             remove_from_queue( &output->queue );
             av_buffer_unref( &muxed_data[i] );
         }
 
-        free( muxed_data );
-        muxed_data = NULL;
+        if( eos )
+        {
+            obe_output_finished( output );
+            break;
+        }
     }
 
     pthread_cleanup_pop( 1 );
@@ -0,0 +1,835 @@
+/*****************************************************************************
+ * checkasm.c: Checks the SIMD functions against the C versions and times them
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+/* Usage: checkasm [--nobench] [seed]
+ * Every function is run on random data at random widths and, where it allows it, random alignments.
+ * The output must match the C version and nothing may be written more than SLACK elements past the end */
+
+#include <libavutil/cpu.h>
+#include <x86intrin.h>
+#include "common/common.h"
+#include "input/sdi/sdi.h"
+#include "input/sdi/ancillary.h"
+#include "input/sdi/x86/sdi.h"
+#include "filters/video/video.h"
+#include "filters/video/scale.h"
+#include "filters/video/x86/vfilter.h"
+
+#define MAX_WIDTH  4096
+/* Elements the SIMD versions are allowed to write past the end of the output */
+#define SLACK      64
+#define ITERATIONS 200
+#define BENCH_WIDTH 1920
+#define BENCH_RUNS 1000
+#define CANARY     0xa5
+
+/* AVX-512 has no libavutil flags */
+#define CPU_AVX512VBMI -1
+#define CPU_AVX512BW   -2
+
+typedef struct
+{
+    const char *name;
+    void *func;
+    int cpu_flag;
+    int align; /* Required alignment of the input in bytes */
+} asm_func_t;
+
+static int bench = 1;
+static int failed;
+static uint32_t rand_state;
+
+static uint32_t rnd( void )
+{
+    /* xorshift32 so runs can be repeated with the same seed on any libc */
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static int cpu_supported( int cpu_flag )
+{
+#if HAVE_AVX512
+    if( cpu_flag == CPU_AVX512VBMI )
+        return obe_cpu_has_avx512vbmi();
+    if( cpu_flag == CPU_AVX512BW )
+        return obe_cpu_has_avx512bw();
+#endif
+    if( cpu_flag < 0 )
+        return 0;
+
+    return (av_get_cpu_flags() & cpu_flag) == cpu_flag;
+}
+
+/* Nothing may be written between SLACK elements past the end and the end of the buffer */
+static int check_canary( const void *buf, int start, int size )
+{
+    const uint8_t *p = buf;
+
+    for( int i = start; i < size; i++ )
+    {
+        if( p[i] != CANARY )
+            return -1;
+    }
+
+    return 0;
+}
+
+static void report( const char *name, int ok, uint64_t cycles, int pixels )
+{
+    if( !ok )
+    {
+        printf( "    %-20s FAILED\n", name );
+        failed = 1;
+    }
+    else if( bench )
+        printf( "    %-20s OK   %7.3f cycles/pixel\n", name, (double)cycles / pixels );
+    else
+        printf( "    %-20s OK\n", name );
+}
+
+#define BENCH( cycles, call ) \
+    do { \
+        uint64_t start = __rdtsc(); \
+        for( int run = 0; run < BENCH_RUNS; run++ ) \
+            call; \
+        cycles = (__rdtsc() - start) / BENCH_RUNS; \
+    } while( 0 )
+
+/** v210 unpack **/
+static const asm_func_t v210_funcs[] =
+{
+#if HAVE_MMX
+    { "unaligned_ssse3",   obe_v210_planar_unpack_unaligned_ssse3,  AV_CPU_FLAG_SSSE3,  4 },
+    { "aligned_ssse3",     obe_v210_planar_unpack_aligned_ssse3,    AV_CPU_FLAG_SSSE3,  16 },
+    { "unaligned_avx",     obe_v210_planar_unpack_unaligned_avx,    AV_CPU_FLAG_AVX,    4 },
+    { "aligned_avx",       obe_v210_planar_unpack_aligned_avx,      AV_CPU_FLAG_AVX,    16 },
+#ifdef AV_CPU_FLAG_AVX2
+    { "unaligned_avx2",    obe_v210_planar_unpack_unaligned_avx2,   AV_CPU_FLAG_AVX2,   4 },
+    { "aligned_avx2",      obe_v210_planar_unpack_aligned_avx2,     AV_CPU_FLAG_AVX2,   32 },
+#endif
+#if HAVE_AVX512
+    { "avx512vbmi",        obe_v210_planar_unpack_avx512vbmi,       CPU_AVX512VBMI,     4 },
+#endif
+#endif
+    { 0 }
+};
+
+static int check_v210_unpack( void )
+{
+    /* Room for the input offsets and for reading past the end */
+    int src_size = MAX_WIDTH * 8 / 3 + 512;
+    int sizes[3] = { MAX_WIDTH + SLACK + 64, MAX_WIDTH/2 + SLACK + 64, MAX_WIDTH/2 + SLACK + 64 };
+    uint8_t *src_alloc = av_malloc( src_size + 64 );
+    uint32_t *src_buf = (uint32_t*)FFALIGN( (uintptr_t)src_alloc, 64 );
+    uint16_t *ref[3], *dst[3];
+    uint64_t cycles = 0;
+
+    for( int i = 0; i < 3; i++ )
+    {
+        ref[i] = av_malloc( sizes[i] * sizeof(uint16_t) );
+        dst[i] = av_malloc( sizes[i] * sizeof(uint16_t) );
+        if( !ref[i] || !dst[i] )
+            return -1;
+    }
+    if( !src_alloc )
+        return -1;
+
+    printf( "v210_planar_unpack:\n" );
+
+    for( int i = 0; i < src_size / 4; i++ )
+        src_buf[i] = rnd() & 0x3fffffff;
+
+    if( bench )
+        BENCH( cycles, obe_v210_planar_unpack_c( src_buf, dst[0], dst[1], dst[2], BENCH_WIDTH ) );
+    report( "c", 1, cycles, BENCH_WIDTH );
+
+    for( const asm_func_t *f = v210_funcs; f->name; f++ )
+    {
+        obe_v210_planar_unpack_t unpack = f->func;
+        int ok = 1;
+
+        if( !cpu_supported( f->cpu_flag ) )
+            continue;
+
+        for( int it = 0; it < ITERATIONS && ok; it++ )
+        {
+            int width = 6 * (1 + rnd() % (MAX_WIDTH / 6));
+            /* Offsets are in 32-bit words for the input and 16-bit samples for the output */
+            int src_off = (rnd() % 64) & ~(f->align / 4 - 1);
+            int dst_off = rnd() % 16;
+            const uint32_t *src = src_buf + src_off;
+
+            for( int i = 0; i < src_size / 4; i++ )
+                src_buf[i] = rnd() & 0x3fffffff;
+
+            for( int i = 0; i < 3; i++ )
+            {
+                memset( ref[i], CANARY, sizes[i] * sizeof(uint16_t) );
+                memset( dst[i], CANARY, sizes[i] * sizeof(uint16_t) );
+            }
+
+            obe_v210_planar_unpack_c( src, ref[0] + dst_off, ref[1] + dst_off, ref[2] + dst_off, width );
+            unpack( src, dst[0] + dst_off, dst[1] + dst_off, dst[2] + dst_off, width );
+
+            if( memcmp( ref[0], dst[0], (dst_off + width) * sizeof(uint16_t) ) ||
+                memcmp( ref[1], dst[1], (dst_off + width/2) * sizeof(uint16_t) ) ||
+                memcmp( ref[2], dst[2], (dst_off + width/2) * sizeof(uint16_t) ) ||
+                check_canary( dst[0], (dst_off + width + SLACK) * sizeof(uint16_t), sizes[0] * sizeof(uint16_t) ) ||
+                check_canary( dst[1], (dst_off + width/2 + SLACK) * sizeof(uint16_t), sizes[1] * sizeof(uint16_t) ) ||
+                check_canary( dst[2], (dst_off + width/2 + SLACK) * sizeof(uint16_t), sizes[2] * sizeof(uint16_t) ) )
+            {
+                printf( "    %s: mismatch at width %i, input offset %i, output offset %i\n", f->name, width, src_off*4, dst_off );
+                ok = 0;
+            }
+        }
+
+        if( bench )
+            BENCH( cycles, unpack( src_buf, dst[0], dst[1], dst[2], BENCH_WIDTH ) );
+
+        report( f->name, ok, cycles, BENCH_WIDTH );
+    }
+
+    av_free( src_alloc );
+    for( int i = 0; i < 3; i++ )
+    {
+        av_free( ref[i] );
+        av_free( dst[i] );
+    }
+
+    return 0;
+}
+
+/** Downscale VBI lines to 8-bit **/
+static const asm_func_t downscale_funcs[] =
+{
+#if HAVE_MMX
+    { "mmx",  obe_downscale_line_mmx,  AV_CPU_FLAG_MMX,  16 },
+    { "sse2", obe_downscale_line_sse2, AV_CPU_FLAG_SSE2, 16 },
+#endif
+    { 0 }
+};
+
+#define DOWNSCALE_MAX_LINES 8
+
+static int check_downscale_line( void )
+{
+    int src_size = 720 * 2 * DOWNSCALE_MAX_LINES;
+    int dst_size = 720 * 2 * DOWNSCALE_MAX_LINES + SLACK;
+    uint16_t *src = av_malloc( src_size * sizeof(uint16_t) );
+    uint8_t *ref = av_malloc( dst_size );
+    uint8_t *dst = av_malloc( dst_size );
+    uint64_t cycles = 0;
+
+    if( !src || !ref || !dst )
+        return -1;
+
+    printf( "downscale_line:\n" );
+
+    for( int i = 0; i < src_size; i++ )
+        src[i] = rnd() & 0x3ff;
+
+    if( bench )
+        BENCH( cycles, obe_downscale_line_c( src, dst, 1 ) );
+    report( "c", 1, cycles, 720 );
+
+    for( const asm_func_t *f = downscale_funcs; f->name; f++ )
+    {
+        void (*downscale)( uint16_t *src, uint8_t *dst, int lines ) = f->func;
+        int ok = 1;
+
+        if( !cpu_supported( f->cpu_flag ) )
+            continue;
+
+        for( int it = 0; it < ITERATIONS && ok; it++ )
+        {
+            int lines = 1 + rnd() % DOWNSCALE_MAX_LINES;
+
+            for( int i = 0; i < src_size; i++ )
+                src[i] = rnd() & 0x3ff;
+            memset( ref, CANARY, dst_size );
+            memset( dst, CANARY, dst_size );
+
+            obe_downscale_line_c( src, ref, lines );
+            downscale( src, dst, lines );
+            _mm_empty();
+
+            /* Always a whole number of lines so there is no overwrite */
+            if( memcmp( ref, dst, 720 * 2 * lines ) || check_canary( dst, 720 * 2 * lines, dst_size ) )
+            {
+                printf( "    %s: mismatch at %i lines\n", f->name, lines );
+                ok = 0;
+            }
+        }
+
+        if( bench )
+        {
+            BENCH( cycles, downscale( src, dst, 1 ) );
+            _mm_empty();
+        }
+
+        report( f->name, ok, cycles, 720 );
+    }
+
+    av_free( src );
+    av_free( ref );
+    av_free( dst );
+
+    return 0;
+}
+
+/** Video filter **/
+typedef void (*downsample_func_t)( uint16_t *src, uint16_t *dst, int width, int stride );
+typedef void (*dither_func_t)( uint16_t *src, uint8_t *dst, const uint16_t *dithers, int width, int stride );
+typedef void (*scale_8_to_10_func_t)( const uint8_t *src, const uint8_t *srcn, uint16_t *dst, int width, int weight );
+
+static const asm_func_t downsample_top_funcs[] =
+{
+#if HAVE_MMX
+    { "sse2", obe_downsample_chroma_row_top_sse2, AV_CPU_FLAG_SSE2, 16 },
+    { "avx",  obe_downsample_chroma_row_top_avx,  AV_CPU_FLAG_AVX,  16 },
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2", obe_downsample_chroma_row_top_avx2, AV_CPU_FLAG_AVX2, 2 },
+#endif
+#if HAVE_AVX512
+    { "avx512bw", obe_downsample_chroma_row_top_avx512bw, CPU_AVX512BW, 2 },
+#endif
+#endif
+    { 0 }
+};
+
+static const asm_func_t downsample_bottom_funcs[] =
+{
+#if HAVE_MMX
+    { "sse2", obe_downsample_chroma_row_bottom_sse2, AV_CPU_FLAG_SSE2, 16 },
+    { "avx",  obe_downsample_chroma_row_bottom_avx,  AV_CPU_FLAG_AVX,  16 },
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2", obe_downsample_chroma_row_bottom_avx2, AV_CPU_FLAG_AVX2, 2 },
+#endif
+#if HAVE_AVX512
+    { "avx512bw", obe_downsample_chroma_row_bottom_avx512bw, CPU_AVX512BW, 2 },
+#endif
+#endif
+    { 0 }
+};
+
+static const asm_func_t downsample_avg_funcs[] =
+{
+#if HAVE_MMX
+    { "sse2", obe_downsample_chroma_row_avg_sse2, AV_CPU_FLAG_SSE2, 16 },
+    { "avx",  obe_downsample_chroma_row_avg_avx,  AV_CPU_FLAG_AVX,  16 },
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2", obe_downsample_chroma_row_avg_avx2, AV_CPU_FLAG_AVX2, 2 },
+#endif
+#if HAVE_AVX512
+    { "avx512bw", obe_downsample_chroma_row_avg_avx512bw, CPU_AVX512BW, 2 },
+#endif
+#endif
+    { 0 }
+};
+
+static const asm_func_t dither_funcs[] =
+{
+#if HAVE_MMX
+    { "sse4", obe_dither_row_10_to_8_sse4, AV_CPU_FLAG_SSE4, 16 },
+    { "avx",  obe_dither_row_10_to_8_avx,  AV_CPU_FLAG_AVX,  16 },
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2", obe_dither_row_10_to_8_avx2, AV_CPU_FLAG_AVX2, 2 },
+#endif
+#if HAVE_AVX512
+    { "avx512bw", obe_dither_row_10_to_8_avx512bw, CPU_AVX512BW, 2 },
+#endif
+#endif
+    { 0 }
+};
+
+static const asm_func_t scale_8_to_10_funcs[] =
+{
+#if HAVE_MMX
+    { "sse2", obe_scale_row_8_to_10_sse2, AV_CPU_FLAG_SSE2, 1 },
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2", obe_scale_row_8_to_10_avx2, AV_CPU_FLAG_AVX2, 1 },
+#endif
+#endif
+    { 0 }
+};
+
+/* The rows are aligned so only the width and the distance between the two input rows vary */
+static int check_downsample( const char *kernel, downsample_func_t ref_func, const asm_func_t *funcs )
+{
+    int max_stride = FFALIGN( MAX_WIDTH / 2, 16 ) + 64;
+    int dst_size = MAX_WIDTH / 2 + SLACK + 64;
+    uint16_t *src = av_malloc( 2 * max_stride * sizeof(uint16_t) );
+    uint16_t *ref = av_malloc( dst_size * sizeof(uint16_t) );
+    uint16_t *dst = av_malloc( dst_size * sizeof(uint16_t) );
+    uint64_t cycles = 0;
+
+    if( !src || !ref || !dst )
+        return -1;
+
+    printf( "%s:\n", kernel );
+
+    for( int i = 0; i < 2 * max_stride; i++ )
+        src[i] = rnd() & 0x3ff;
+
+    if( bench )
+        BENCH( cycles, ref_func( src, dst, BENCH_WIDTH, FFALIGN( BENCH_WIDTH / 2, 16 ) ) );
+    report( "c", 1, cycles, BENCH_WIDTH / 2 );
+
+    for( const asm_func_t *f = funcs; f->name; f++ )
+    {
+        downsample_func_t downsample = f->func;
+        int ok = 1;
+
+        if( !cpu_supported( f->cpu_flag ) )
+            continue;
+
+        for( int it = 0; it < ITERATIONS && ok; it++ )
+        {
+            /* The functions take the output width in bytes */
+            int out_width = 1 + rnd() % (MAX_WIDTH / 2);
+            int stride = FFALIGN( out_width, 16 ) + 16 * (rnd() % 4);
+
+            for( int i = 0; i < 2 * max_stride; i++ )
+                src[i] = rnd() & 0x3ff;
+            memset( ref, CANARY, dst_size * sizeof(uint16_t) );
+            memset( dst, CANARY, dst_size * sizeof(uint16_t) );
+
+            ref_func( src, ref, out_width * 2, stride );
+            downsample( src, dst, out_width * 2, stride );
+
+            if( memcmp( ref, dst, out_width * sizeof(uint16_t) ) ||
+                check_canary( dst, (out_width + SLACK) * sizeof(uint16_t), dst_size * sizeof(uint16_t) ) )
+            {
+                printf( "    %s: mismatch at width %i, stride %i\n", f->name, out_width, stride );
+                ok = 0;
+            }
+        }
+
+        if( bench )
+            BENCH( cycles, downsample( src, dst, BENCH_WIDTH, FFALIGN( BENCH_WIDTH / 2, 16 ) ) );
+
+        report( f->name, ok, cycles, BENCH_WIDTH / 2 );
+    }
+
+    av_free( src );
+    av_free( ref );
+    av_free( dst );
+
+    return 0;
+}
+
+static int check_dither( dither_func_t ref_func )
+{
+    int dst_size = MAX_WIDTH + SLACK + 64;
+    uint16_t *src = av_malloc( (MAX_WIDTH + SLACK) * sizeof(uint16_t) );
+    uint8_t *ref = av_malloc( dst_size );
+    uint8_t *dst = av_malloc( dst_size );
+    DECLARE_ALIGNED( 16, uint16_t, dithers )[8] = { 1, 2, 1, 2, 1, 2, 1, 2 };
+    uint64_t cycles = 0;
+
+    if( !src || !ref || !dst )
+        return -1;
+
+    printf( "dither_row_10_to_8:\n" );
+
+    for( int i = 0; i < MAX_WIDTH + SLACK; i++ )
+        src[i] = rnd() & 0x3ff;
+
+    if( bench )
+        BENCH( cycles, ref_func( src, dst, dithers, BENCH_WIDTH, 0 ) );
+    report( "c", 1, cycles, BENCH_WIDTH );
+
+    for( const asm_func_t *f = dither_funcs; f->name; f++ )
+    {
+        dither_func_t dither = f->func;
+        int ok = 1;
+
+        if( !cpu_supported( f->cpu_flag ) )
+            continue;
+
+        for( int it = 0; it < ITERATIONS && ok; it++ )
+        {
+            int width = 1 + rnd() % MAX_WIDTH;
+
+            for( int i = 0; i < MAX_WIDTH + SLACK; i++ )
+                src[i] = rnd() & 0x3ff;
+            /* The real dither values are 0-3. Larger ones can overflow 8 bits, where the C version wraps */
+            for( int i = 0; i < 8; i++ )
+                dithers[i] = rnd() & 3;
+            memset( ref, CANARY, dst_size );
+            memset( dst, CANARY, dst_size );
+
+            ref_func( src, ref, dithers, width, 0 );
+            dither( src, dst, dithers, width, 0 );
+
+            if( memcmp( ref, dst, width ) || check_canary( dst, width + SLACK, dst_size ) )
+            {
+                printf( "    %s: mismatch at width %i\n", f->name, width );
+                ok = 0;
+            }
+        }
+
+        if( bench )
+            BENCH( cycles, dither( src, dst, dithers, BENCH_WIDTH, 0 ) );
+
+        report( f->name, ok, cycles, BENCH_WIDTH );
+    }
+
+    av_free( src );
+    av_free( ref );
+    av_free( dst );
+
+    return 0;
+}
+
+/* Every weight the upconversion uses, including 8 for lines which are not interpolated */
+static int check_scale_8_to_10( scale_8_to_10_func_t ref_func )
+{
+    static const int weights[] = { 5, 6, 7, 8 };
+    int dst_size = MAX_WIDTH + SLACK + 64;
+    uint8_t *src = av_malloc( 2 * (MAX_WIDTH + SLACK) );
+    uint16_t *ref = av_malloc( dst_size * sizeof(uint16_t) );
+    uint16_t *dst = av_malloc( dst_size * sizeof(uint16_t) );
+    uint64_t cycles = 0;
+
+    if( !src || !ref || !dst )
+        return -1;
+
+    printf( "scale_row_8_to_10:\n" );
+
+    for( int i = 0; i < 2 * (MAX_WIDTH + SLACK); i++ )
+        src[i] = rnd();
+
+    if( bench )
+        BENCH( cycles, ref_func( src, src + MAX_WIDTH + SLACK, dst, BENCH_WIDTH, 6 ) );
+    report( "c", 1, cycles, BENCH_WIDTH );
+
+    for( const asm_func_t *f = scale_8_to_10_funcs; f->name; f++ )
+    {
+        scale_8_to_10_func_t scale = f->func;
+        int ok = 1;
+
+        if( !cpu_supported( f->cpu_flag ) )
+            continue;
+
+        for( int it = 0; it < ITERATIONS && ok; it++ )
+        {
+            /* The SIMD versions only take whole blocks of 16 pixels and must not touch anything past them */
+            int width = 16 * (1 + rnd() % (MAX_WIDTH / 16));
+            int weight = weights[rnd() % 4];
+            /* The 8-bit input need not be aligned */
+            int src_off = rnd() % 32;
+
+            for( int i = 0; i < 2 * (MAX_WIDTH + SLACK); i++ )
+                src[i] = rnd();
+            /* Include the extremes */
+            src[src_off] = 255;
+            src[src_off + MAX_WIDTH + SLACK - 32] = 255;
+            memset( ref, CANARY, dst_size * sizeof(uint16_t) );
+            memset( dst, CANARY, dst_size * sizeof(uint16_t) );
+
+            ref_func( src + src_off, src + src_off + MAX_WIDTH + SLACK - 32, ref, width, weight );
+            scale( src + src_off, src + src_off + MAX_WIDTH + SLACK - 32, dst, width, weight );
+
+            if( memcmp( ref, dst, width * sizeof(uint16_t) ) ||
+                check_canary( dst, width * sizeof(uint16_t), dst_size * sizeof(uint16_t) ) )
+            {
+                printf( "    %s: mismatch at width %i, weight %i\n", f->name, width, weight );
+                ok = 0;
+            }
+        }
+
+        if( bench )
+            BENCH( cycles, scale( src, src + MAX_WIDTH + SLACK, dst, BENCH_WIDTH, 6 ) );
+
+        report( f->name, ok, cycles, BENCH_WIDTH );
+    }
+
+    av_free( src );
+    av_free( ref );
+    av_free( dst );
+
+    return 0;
+}
+
+static int check_vfilter( void )
+{
+    obe_vid_filter_dsp_t c;
+
+    obe_init_vid_filter_dsp( &c, 0 );
+
+    if( check_downsample( "downsample_chroma_row_top", c.downsample_chroma_row_top, downsample_top_funcs ) < 0 ||
+        check_downsample( "downsample_chroma_row_bottom", c.downsample_chroma_row_bottom, downsample_bottom_funcs ) < 0 ||
+        check_downsample( "downsample_chroma_row_avg", c.downsample_chroma_row_avg, downsample_avg_funcs ) < 0 ||
+        check_dither( c.dither_row_10_to_8 ) < 0 ||
+        check_scale_8_to_10( c.scale_row_8_to_10 ) < 0 )
+        return -1;
+
+    return 0;
+}
+
+/** Horizontal scaler **/
+static const asm_func_t hscale_funcs[] =
+{
+#if HAVE_MMX
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2",              obe_hscale_row_avx2,                     AV_CPU_FLAG_AVX2,   2 },
+#endif
+#endif
+    { 0 }
+};
+
+/* The output widths offered by obecli, from SD and HD inputs */
+static const int hscale_widths[][2] =
+{
+    { 720, 544 }, { 720, 528 }, { 720, 480 }, { 720, 352 },
+    { 1920, 1440 }, { 1920, 1280 }, { 1920, 960 }, { 1280, 960 }, { 1280, 640 },
+};
+
+static int check_hscale( void )
+{
+    int num_widths = sizeof(hscale_widths) / sizeof(hscale_widths[0]);
+    int size = MAX_WIDTH + SLACK + 64;
+    uint16_t *src = av_malloc( size * sizeof(uint16_t) );
+    uint16_t *ref = av_malloc( size * sizeof(uint16_t) );
+    uint16_t *dst = av_malloc( size * sizeof(uint16_t) );
+    obe_hscale_t *s = calloc( 2 * num_widths, sizeof(*s) );
+    uint64_t cycles = 0;
+
+    if( !src || !ref || !dst || !s )
+        return -1;
+
+    for( int i = 0; i < 2 * num_widths; i++ )
+    {
+        int chroma = i & 1;
+        if( obe_hscale_init( &s[i], hscale_widths[i/2][0] >> chroma, hscale_widths[i/2][1] >> chroma, chroma, 0 ) < 0 )
+            return -1;
+    }
+
+    printf( "hscale_row:\n" );
+
+    for( int i = 0; i < size; i++ )
+        src[i] = rnd() & 0x3ff;
+
+    /* 1920 to 1440 luma */
+    if( bench )
+        BENCH( cycles, obe_hscale_row_c( src, dst, s[8].dst_width, s[8].pos, s[8].coefs, s[8].filter_size ) );
+    report( "c", 1, cycles, s[8].dst_width );
+
+    for( const asm_func_t *f = hscale_funcs; f->name; f++ )
+    {
+        obe_hscale_row_t scale_row = f->func;
+        int ok = 1;
+
+        if( !cpu_supported( f->cpu_flag ) )
+            continue;
+
+        for( int it = 0; it < ITERATIONS && ok; it++ )
+        {
+            obe_hscale_t *t = &s[rnd() % (2 * num_widths)];
+            int src_off = rnd() % 16;
+            int dst_off = rnd() % 16;
+
+            for( int i = 0; i < size; i++ )
+                src[i] = rnd() & 0x3ff;
+
+            /* Full scale edges so the clipping is exercised */
+            for( int n = rnd() % 64; n > 0; n-- )
+            {
+                int i = rnd() % (size - 8);
+                int v = rnd() & 1 ? 0x3ff : 0;
+                for( int j = 0; j < 8; j++ )
+                    src[i+j] = v;
+            }
+
+            memset( ref, CANARY, size * sizeof(uint16_t) );
+            memset( dst, CANARY, size * sizeof(uint16_t) );
+
+            obe_hscale_row_c( src + src_off, ref + dst_off, t->dst_width, t->pos, t->coefs, t->filter_size );
+            scale_row( src + src_off, dst + dst_off, t->dst_width, t->pos, t->coefs, t->filter_size );
+
+            if( memcmp( ref, dst, (dst_off + t->dst_width) * sizeof(uint16_t) ) ||
+                check_canary( dst, (dst_off + t->dst_width + SLACK) * sizeof(uint16_t), size * sizeof(uint16_t) ) )
+            {
+                printf( "    %s: mismatch at %i to %i, input offset %i, output offset %i\n", f->name,
+                        t->src_width, t->dst_width, src_off, dst_off );
+                ok = 0;
+            }
+        }
+
+        if( bench )
+            BENCH( cycles, scale_row( src, dst, s[8].dst_width, s[8].pos, s[8].coefs, s[8].filter_size ) );
+
+        report( f->name, ok, cycles, s[8].dst_width );
+    }
+
+    for( int i = 0; i < 2 * num_widths; i++ )
+        obe_hscale_close( &s[i] );
+    free( s );
+    av_free( src );
+    av_free( ref );
+    av_free( dst );
+
+    return 0;
+}
+
+/** VANC **/
+static const asm_func_t vanc_levels[] =
+{
+#if HAVE_MMX
+    { "sse2", NULL, AV_CPU_FLAG_SSE2, 1 },
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2", NULL, AV_CPU_FLAG_AVX2 | AV_CPU_FLAG_SSE2, 1 },
+#endif
+#endif
+    { 0 }
+};
+
+#define VANC_LEN (MAX_WIDTH * 2)
+
+/* Mostly blanking with some ADFs and near misses so every branch of the search is taken */
+static void fill_vanc_line( uint16_t *line, int len )
+{
+    for( int i = 0; i < len; i++ )
+        line[i] = rnd() & 1 ? 0x40 : 0x200;
+
+    for( int n = rnd() % 8; n > 0; n-- )
+    {
+        int i = rnd() % (len - 3);
+        line[i]   = rnd() % 8;
+        line[i+1] = 0x3f8 | (rnd() & 7);
+        line[i+2] = 0x3f8 | (rnd() & 7);
+    }
+
+    for( int n = rnd() % 64; n > 0; n-- )
+        line[rnd() % len] = rnd() & 0x3ff;
+}
+
+static int check_vanc( void )
+{
+    uint16_t *line = av_malloc( (VANC_LEN + SLACK) * sizeof(uint16_t) );
+    uint64_t cycles_adf = 0, cycles_cs = 0;
+    obe_vanc_dsp_t c, simd;
+
+    if( !line )
+        return -1;
+
+    obe_init_vanc_dsp( &c, 0 );
+
+    printf( "vanc_find_adf, vanc_checksum:\n" );
+
+    /* Blanking, which has to be searched to the end */
+    for( int i = 0; i < VANC_LEN; i++ )
+        line[i] = i & 1 ? 0x40 : 0x200;
+
+    if( bench )
+    {
+        BENCH( cycles_adf, obe_vanc_find_adf( &c, line, 0, BENCH_WIDTH * 2 ) );
+        BENCH( cycles_cs, obe_vanc_checksum( &c, line, BENCH_WIDTH * 2 ) );
+    }
+    report( "c find_adf", 1, cycles_adf, BENCH_WIDTH * 2 );
+    report( "c checksum", 1, cycles_cs, BENCH_WIDTH * 2 );
+
+    for( const asm_func_t *f = vanc_levels; f->name; f++ )
+    {
+        char name[32];
+        int ok = 1;
+
+        if( !cpu_supported( f->cpu_flag ) )
+            continue;
+
+        obe_init_vanc_dsp( &simd, f->cpu_flag );
+
+        for( int it = 0; it < ITERATIONS * 10 && ok; it++ )
+        {
+            int len = 8 + rnd() % (VANC_LEN - 8);
+            int start = rnd() % len;
+            int end = start + rnd() % (len - start + 1);
+            int i_c, i_simd, cs_c, cs_simd;
+
+            /* Whatever follows the line must not change the result */
+            for( int i = 0; i < VANC_LEN + SLACK; i++ )
+                line[i] = rnd() & 0x3ff;
+            fill_vanc_line( line, len );
+
+            i_c = obe_vanc_find_adf( &c, line, start, end );
+            i_simd = obe_vanc_find_adf( &simd, line, start, end );
+            cs_c = obe_vanc_checksum( &c, line + start, end - start );
+            cs_simd = obe_vanc_checksum( &simd, line + start, end - start );
+
+            if( i_c != i_simd || cs_c != cs_simd )
+            {
+                printf( "    %s: mismatch searching %i to %i: found %i, expected %i, checksum %i, expected %i\n",
+                        f->name, start, end, i_simd, i_c, cs_simd, cs_c );
+                ok = 0;
+            }
+        }
+
+        if( bench )
+        {
+            for( int i = 0; i < VANC_LEN; i++ )
+                line[i] = i & 1 ? 0x40 : 0x200;
+            BENCH( cycles_adf, obe_vanc_find_adf( &simd, line, 0, BENCH_WIDTH * 2 ) );
+            BENCH( cycles_cs, obe_vanc_checksum( &simd, line, BENCH_WIDTH * 2 ) );
+        }
+
+        snprintf( name, sizeof(name), "%s find_adf", f->name );
+        report( name, ok, cycles_adf, BENCH_WIDTH * 2 );
+        snprintf( name, sizeof(name), "%s checksum", f->name );
+        report( name, ok, cycles_cs, BENCH_WIDTH * 2 );
+    }
+
+    av_free( line );
+
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    rand_state = obe_mdate();
+
+    for( int i = 1; i < argc; i++ )
+    {
+        if( !strcmp( argv[i], "--nobench" ) )
+            bench = 0;
+        else
+            rand_state = strtoul( argv[i], NULL, 0 );
+    }
+
+    if( !rand_state )
+        rand_state = 1;
+
+    printf( "checkasm: seed %u\n", rand_state );
+
+    if( check_v210_unpack() < 0 || check_downscale_line() < 0 || check_vfilter() < 0 || check_hscale() < 0 || check_vanc() < 0 )
+    {
+        fprintf( stderr, "Malloc failed\n" );
+        return -1;
+    }
+
+    printf( failed ? "checkasm: FAILED\n" : "checkasm: all tests passed\n" );
+
+    return failed;
+}
@@ -0,0 +1,200 @@
+/*****************************************************************************
+ * queuebench.c: Benchmark of the inter-thread queue
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+#include "common/common.h"
+
+/* Pushes and pops one item per 1316-byte output packet, which is the busiest queue in the system */
+#define NUM_ITEMS 2000000
+#define RING_CAPACITY OBE_QUEUE_MUXED_DATA
+
+/* The realloc/memmove queue which obe_queue_t replaced */
+typedef struct
+{
+    void **queue;
+    int  size;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  in_cv;
+    pthread_cond_t  out_cv;
+} legacy_queue_t;
+
+static int legacy_add_to_queue( legacy_queue_t *queue, void *item )
+{
+    void **tmp;
+
+    pthread_mutex_lock( &queue->mutex );
+    tmp = realloc( queue->queue, sizeof(*queue->queue) * (queue->size+1) );
+    if( !tmp )
+    {
+        pthread_mutex_unlock( &queue->mutex );
+        return -1;
+    }
+    queue->queue = tmp;
+    queue->queue[queue->size++] = item;
+
+    pthread_cond_signal( &queue->in_cv );
+    pthread_mutex_unlock( &queue->mutex );
+
+    return 0;
+}
+
+static int legacy_remove_from_queue( legacy_queue_t *queue )
+{
+    void **tmp;
+
+    pthread_mutex_lock( &queue->mutex );
+    if( queue->size > 1 )
+        memmove( &queue->queue[0], &queue->queue[1], sizeof(*queue->queue) * (queue->size-1) );
+    tmp = realloc( queue->queue, sizeof(*queue->queue) * (queue->size-1) );
+    queue->size--;
+    if( tmp || !queue->size )
+        queue->queue = tmp;
+
+    pthread_cond_signal( &queue->out_cv );
+    pthread_mutex_unlock( &queue->mutex );
+
+    return 0;
+}
+
+static void *legacy_producer( void *ptr )
+{
+    legacy_queue_t *queue = ptr;
+
+    for( intptr_t i = 1; i <= NUM_ITEMS; i++ )
+        legacy_add_to_queue( queue, (void*)i );
+
+    return NULL;
+}
+
+static void *ring_producer( void *ptr )
+{
+    obe_queue_t *queue = ptr;
+
+    for( intptr_t i = 1; i <= NUM_ITEMS; i++ )
+        add_to_queue( queue, (void*)i );
+
+    return NULL;
+}
+
+static int64_t get_time_us( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bench_legacy( void )
+{
+    legacy_queue_t queue = {0};
+    pthread_t thread;
+    intptr_t item, expected = 1;
+    int64_t start;
+
+    pthread_mutex_init( &queue.mutex, NULL );
+    pthread_cond_init( &queue.in_cv, NULL );
+    pthread_cond_init( &queue.out_cv, NULL );
+
+    start = get_time_us();
+    if( pthread_create( &thread, NULL, legacy_producer, &queue ) < 0 )
+        return -1;
+
+    /* Same consumer pattern as the pipeline threads */
+    while( expected <= NUM_ITEMS )
+    {
+        pthread_mutex_lock( &queue.mutex );
+        while( !queue.size )
+            pthread_cond_wait( &queue.in_cv, &queue.mutex );
+        item = (intptr_t)queue.queue[0];
+        pthread_mutex_unlock( &queue.mutex );
+
+        if( item != expected++ )
+        {
+            fprintf( stderr, "legacy: out of order item\n" );
+            return -1;
+        }
+        legacy_remove_from_queue( &queue );
+    }
+
+    pthread_join( thread, NULL );
+    printf( "legacy queue: %8.1f ns/item\n", (get_time_us() - start) * 1000.0 / NUM_ITEMS );
+
+    free( queue.queue );
+    pthread_mutex_destroy( &queue.mutex );
+    pthread_cond_destroy( &queue.in_cv );
+    pthread_cond_destroy( &queue.out_cv );
+
+    return 0;
+}
+
+static int bench_ring( void )
+{
+    obe_queue_t queue = {0};
+    pthread_t thread;
+    intptr_t item, expected = 1;
+    int64_t start;
+
+    if( obe_init_queue( &queue, RING_CAPACITY ) < 0 )
+        return -1;
+
+    start = get_time_us();
+    if( pthread_create( &thread, NULL, ring_producer, &queue ) < 0 )
+        return -1;
+
+    while( expected <= NUM_ITEMS )
+    {
+        if( !obe_queue_size( &queue ) )
+        {
+            obe_queue_lock( &queue );
+            while( !obe_queue_size( &queue ) )
+                pthread_cond_wait( &queue.in_cv, &queue.mutex );
+            obe_queue_unlock( &queue );
+        }
+        item = (intptr_t)obe_queue_item( &queue, 0 );
+
+        if( item != expected++ )
+        {
+            fprintf( stderr, "ring: out of order item\n" );
+            return -1;
+        }
+        remove_from_queue( &queue );
+    }
+
+    pthread_join( thread, NULL );
+    printf( "ring queue:   %8.1f ns/item (capacity %i)\n", (get_time_us() - start) * 1000.0 / NUM_ITEMS, queue.mask + 1 );
+
+    pthread_mutex_lock( &queue.mutex );
+    obe_destroy_queue( &queue );
+
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    printf( "%i items, one producer, one consumer\n", NUM_ITEMS );
+
+    if( bench_legacy() < 0 || bench_ring() < 0 )
+        return 1;
+
+    return 0;
+}
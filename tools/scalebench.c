@@ -0,0 +1,200 @@
+/*****************************************************************************
+ * scalebench.c: Benchmark of the polyphase scaler against swscale
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+/* Scales a synthetic 10-bit 4:2:2 frame to each output width with swscale, configured as the video
+ * filter does, and with the polyphase scaler. Reports the time per frame and the luma PSNR after scaling
+ * back up to the input width with the same scaler, which penalises both blurring and aliasing */
+
+#include <math.h>
+#include <libavutil/cpu.h>
+#include <libswscale/swscale.h>
+#include "common/common.h"
+#include "filters/video/scale.h"
+
+#define RUNS 20
+
+typedef struct
+{
+    int src_width;
+    int dst_width;
+    int height;
+} scale_size_t;
+
+static const scale_size_t sizes[] =
+{
+    {  720,  544,  576 },
+    {  720,  528,  576 },
+    {  720,  480,  576 },
+    {  720,  352,  576 },
+    { 1920, 1440, 1080 },
+    { 1920, 1280, 1080 },
+    { 0 }
+};
+
+/* Horizontal chirp up to half the input Nyquist frequency plus some noise */
+static void fill_image( obe_image_t *img )
+{
+    for( int i = 0; i < img->planes; i++ )
+    {
+        int width = i ? img->width / 2 : img->width;
+
+        for( int y = 0; y < img->height; y++ )
+        {
+            uint16_t *line = (uint16_t*)(img->plane[i] + y * img->stride[i]);
+            for( int x = 0; x < width; x++ )
+            {
+                double phase = M_PI * x * x / (4.0 * width) + y * 0.05;
+                line[x] = av_clip( 512 + 300 * sin( phase ) + (rand() % 33) - 16, 0, 1023 );
+            }
+        }
+    }
+}
+
+static double psnr( obe_image_t *a, obe_image_t *b )
+{
+    double sse = 0.0;
+
+    for( int y = 0; y < a->height; y++ )
+    {
+        uint16_t *la = (uint16_t*)(a->plane[0] + y * a->stride[0]);
+        uint16_t *lb = (uint16_t*)(b->plane[0] + y * b->stride[0]);
+        for( int x = 0; x < a->width; x++ )
+            sse += (la[x] - lb[x]) * (la[x] - lb[x]);
+    }
+
+    if( sse == 0.0 )
+        return INFINITY;
+
+    return 10.0 * log10( 1023.0 * 1023.0 * a->width * a->height / sse );
+}
+
+static int alloc_image( obe_image_t *img, int width, int height )
+{
+    img->csp = PIX_FMT_YUV422P10;
+    img->planes = 3;
+    img->width = width;
+    img->height = height;
+
+    return av_image_alloc( img->plane, img->stride, width, height + 1, img->csp, 16 );
+}
+
+static void polyphase_scale( obe_hscale_t s[2], obe_image_t *src, obe_image_t *dst )
+{
+    for( int i = 0; i < src->planes; i++ )
+    {
+        obe_hscale_t *t = &s[!!i];
+        for( int y = 0; y < src->height; y++ )
+            t->scale_row( (uint16_t*)(src->plane[i] + y * src->stride[i]), (uint16_t*)(dst->plane[i] + y * dst->stride[i]),
+                          t->dst_width, t->pos, t->coefs, t->filter_size );
+    }
+}
+
+static void sws_scale_image( struct SwsContext *sws_ctx, obe_image_t *src, obe_image_t *dst )
+{
+    sws_scale( sws_ctx, (const uint8_t* const*)src->plane, src->stride, 0, src->height, dst->plane, dst->stride );
+}
+
+static struct SwsContext *get_sws_ctx( int src_width, int dst_width, int height )
+{
+    /* The flags used by the video filter */
+    return sws_getContext( src_width, height, PIX_FMT_YUV422P10, dst_width, height, PIX_FMT_YUV422P10,
+                           SWS_FULL_CHR_H_INP | SWS_ACCURATE_RND | SWS_LANCZOS, NULL, NULL, NULL );
+}
+
+static int init_polyphase( obe_hscale_t s[2], int src_width, int dst_width )
+{
+    int cpu_flags = av_get_cpu_flags();
+
+    if( obe_hscale_init( &s[0], src_width, dst_width, 0, cpu_flags ) < 0 ||
+        obe_hscale_init( &s[1], src_width / 2, dst_width / 2, 1, cpu_flags ) < 0 )
+        return -1;
+
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    srand( 1234 );
+
+    printf( "%-12s %-10s %10s %10s\n", "size", "scaler", "ms/frame", "PSNR (dB)" );
+
+    for( const scale_size_t *size = sizes; size->src_width; size++ )
+    {
+        obe_image_t src = {0}, dst = {0}, back = {0};
+        struct SwsContext *sws_down, *sws_up;
+        obe_hscale_t down[2], up[2];
+        int64_t start, sws_time, polyphase_time;
+        double sws_psnr, polyphase_psnr;
+        char name[16];
+
+        if( alloc_image( &src, size->src_width, size->height ) < 0 ||
+            alloc_image( &dst, size->dst_width, size->height ) < 0 ||
+            alloc_image( &back, size->src_width, size->height ) < 0 )
+        {
+            fprintf( stderr, "Malloc failed\n" );
+            return -1;
+        }
+
+        sws_down = get_sws_ctx( size->src_width, size->dst_width, size->height );
+        sws_up = get_sws_ctx( size->dst_width, size->src_width, size->height );
+        if( !sws_down || !sws_up || init_polyphase( down, size->src_width, size->dst_width ) < 0 ||
+            init_polyphase( up, size->dst_width, size->src_width ) < 0 )
+        {
+            fprintf( stderr, "Could not initialise the scalers\n" );
+            return -1;
+        }
+
+        fill_image( &src );
+
+        start = obe_mdate();
+        for( int i = 0; i < RUNS; i++ )
+            sws_scale_image( sws_down, &src, &dst );
+        sws_time = obe_mdate() - start;
+        sws_scale_image( sws_up, &dst, &back );
+        sws_psnr = psnr( &src, &back );
+
+        start = obe_mdate();
+        for( int i = 0; i < RUNS; i++ )
+            polyphase_scale( down, &src, &dst );
+        polyphase_time = obe_mdate() - start;
+        polyphase_scale( up, &dst, &back );
+        polyphase_psnr = psnr( &src, &back );
+
+        snprintf( name, sizeof(name), "%ix%i", size->dst_width, size->height );
+        printf( "%-12s %-10s %10.3f %10.2f\n", name, "swscale", sws_time / 1000.0 / RUNS, sws_psnr );
+        printf( "%-12s %-10s %10.3f %10.2f\n", name, "polyphase", polyphase_time / 1000.0 / RUNS, polyphase_psnr );
+
+        sws_freeContext( sws_down );
+        sws_freeContext( sws_up );
+        for( int i = 0; i < 2; i++ )
+        {
+            obe_hscale_close( &down[i] );
+            obe_hscale_close( &up[i] );
+        }
+        av_free( src.plane[0] );
+        av_free( dst.plane[0] );
+        av_free( back.plane[0] );
+    }
+
+    return 0;
+}
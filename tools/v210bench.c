@@ -0,0 +1,139 @@
+/*****************************************************************************
+ * v210bench.c: Benchmark of the v210 unpack functions
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+#include <libavutil/cpu.h>
+#include <x86intrin.h>
+#include "common/common.h"
+#include "input/sdi/sdi.h"
+#include "input/sdi/x86/sdi.h"
+
+/* One 1080-line frame worth of 1920 pixel lines per run */
+#define WIDTH    1920
+#define LINES    1080
+#define RUNS     50
+/* Room for the SIMD versions to write past the end of the line */
+#define PADDING  64
+
+typedef struct
+{
+    const char *name;
+    obe_v210_planar_unpack_t unpack;
+    int cpu_flag;
+} v210_func_t;
+
+static const v210_func_t funcs[] =
+{
+    { "c",             obe_v210_planar_unpack_c,              0 },
+    { "ssse3",         obe_v210_planar_unpack_aligned_ssse3,  AV_CPU_FLAG_SSSE3 },
+    { "avx",           obe_v210_planar_unpack_aligned_avx,    AV_CPU_FLAG_AVX },
+#ifdef AV_CPU_FLAG_AVX2
+    { "avx2",          obe_v210_planar_unpack_aligned_avx2,   AV_CPU_FLAG_AVX2 },
+#endif
+#if HAVE_AVX512
+    { "avx512vbmi",    obe_v210_planar_unpack_avx512vbmi,     -1 },
+#endif
+    { 0 }
+};
+
+static int cpu_supported( const v210_func_t *func )
+{
+#if HAVE_AVX512
+    if( func->cpu_flag == -1 )
+        return obe_cpu_has_avx512vbmi();
+#endif
+    return (av_get_cpu_flags() & func->cpu_flag) == func->cpu_flag;
+}
+
+int main( int argc, char **argv )
+{
+    int stride = ((WIDTH + 47) / 48) * 48 * 8 / 3;
+    uint32_t *src = av_malloc( stride );
+    uint16_t *ref[3], *dst[3];
+    int sizes[3] = { WIDTH + PADDING, WIDTH/2 + PADDING, WIDTH/2 + PADDING };
+    int ret = 0;
+
+    if( !src )
+    {
+        fprintf( stderr, "Malloc failed\n" );
+        return -1;
+    }
+
+    for( int i = 0; i < 3; i++ )
+    {
+        ref[i] = av_mallocz( sizes[i] * sizeof(uint16_t) );
+        dst[i] = av_mallocz( sizes[i] * sizeof(uint16_t) );
+        if( !ref[i] || !dst[i] )
+        {
+            fprintf( stderr, "Malloc failed\n" );
+            return -1;
+        }
+    }
+
+    srand( 1234 );
+    for( int i = 0; i < stride / 4; i++ )
+        src[i] = ((rand() & 0x3ff) << 20) | ((rand() & 0x3ff) << 10) | (rand() & 0x3ff);
+
+    obe_v210_planar_unpack_c( src, ref[0], ref[1], ref[2], WIDTH );
+
+    printf( "%i pixel lines, %i lines x %i runs\n", WIDTH, LINES, RUNS );
+
+    for( const v210_func_t *func = funcs; func->name; func++ )
+    {
+        uint64_t start, cycles;
+
+        if( !cpu_supported( func ) )
+        {
+            printf( "%-12s not supported\n", func->name );
+            continue;
+        }
+
+        for( int i = 0; i < 3; i++ )
+            memset( dst[i], 0, sizes[i] * sizeof(uint16_t) );
+
+        func->unpack( src, dst[0], dst[1], dst[2], WIDTH );
+        if( memcmp( ref[0], dst[0], WIDTH * sizeof(uint16_t) ) ||
+            memcmp( ref[1], dst[1], WIDTH/2 * sizeof(uint16_t) ) ||
+            memcmp( ref[2], dst[2], WIDTH/2 * sizeof(uint16_t) ) )
+        {
+            printf( "%-12s MISMATCH\n", func->name );
+            ret = -1;
+            continue;
+        }
+
+        start = __rdtsc();
+        for( int i = 0; i < RUNS * LINES; i++ )
+            func->unpack( src, dst[0], dst[1], dst[2], WIDTH );
+        cycles = __rdtsc() - start;
+
+        printf( "%-12s %6.2f pixels/cycle\n", func->name, (double)WIDTH * LINES * RUNS / cycles );
+    }
+
+    av_free( src );
+    for( int i = 0; i < 3; i++ )
+    {
+        av_free( ref[i] );
+        av_free( dst[i] );
+    }
+
+    return ret;
+}
@@ -0,0 +1,203 @@
+/*****************************************************************************
+ * vancbench.c: Benchmark of the VANC packet scanner
+ *****************************************************************************
+ * Copyright (C) 2026 Open Broadcast Systems Ltd.
+ *
+ * Authors: Kieran Kunhya <kieran@kunhya.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ *****************************************************************************/
+
+#include <libavutil/cpu.h>
+#include "common/common.h"
+#include "input/sdi/ancillary.h"
+
+/* Lines are NV20 as passed to parse_vanc_line, two words per pixel */
+#define WIDTH     1920
+#define NUM_LINES 2000
+#define RUNS      200
+#define MAX_PKTS  256
+
+typedef struct
+{
+    int offset;
+    int did;
+    int sdid;
+    int checksum_ok;
+} vanc_pkt_t;
+
+static int64_t get_time_us( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Same walk over the line as parse_vanc_line */
+static int scan_line( const obe_vanc_dsp_t *dsp, const uint16_t *line, int width, vanc_pkt_t *pkts )
+{
+    int i = 0, num_pkts = 0, len;
+    uint16_t checksum;
+
+    width <<= 1;
+
+    while( num_pkts < MAX_PKTS )
+    {
+        i = obe_vanc_find_adf( dsp, line, i, width - 7 );
+        if( i >= width - 7 )
+            break;
+
+        i += 3;
+        len = line[i+2] & 0xff;
+        if( (len+2) > (width - i - 1) )
+            break;
+
+        checksum = obe_vanc_checksum( dsp, &line[i], len+3 );
+        checksum |= (~checksum & 0x100) << 1;
+
+        pkts[num_pkts].offset = i;
+        pkts[num_pkts].did = line[i] & 0xff;
+        pkts[num_pkts].sdid = line[i+1] & 0xff;
+        pkts[num_pkts++].checksum_ok = line[i+len+3] == checksum;
+
+        i += 2 + len + 1;
+    }
+
+    return num_pkts;
+}
+
+static uint16_t parity( uint8_t val )
+{
+    return val | (!__builtin_parity( val ) << 8) | (__builtin_parity( val ) << 9);
+}
+
+static int write_packet( uint16_t *dst, int did, int sdid, int len )
+{
+    uint16_t checksum = 0;
+
+    dst[0] = 0x000;
+    dst[1] = dst[2] = 0x3ff;
+    dst[3] = parity( did );
+    dst[4] = parity( sdid );
+    dst[5] = parity( len );
+    for( int i = 0; i < len; i++ )
+        dst[6+i] = parity( rand() );
+
+    for( int i = 3; i < 6 + len; i++ )
+        checksum = (checksum + (dst[i] & 0x1ff)) & 0x1ff;
+    dst[6+len] = checksum | ((~checksum & 0x100) << 1);
+
+    /* Corrupt some checksums */
+    if( !(rand() & 15) )
+        dst[6+len] ^= 1;
+
+    return 7 + len;
+}
+
+/* Mostly blank lines, some with AFD and caption packets and some with noise which can look like an ADF */
+static void synthesise_lines( uint16_t *lines )
+{
+    for( int i = 0; i < NUM_LINES; i++ )
+    {
+        uint16_t *line = &lines[i * WIDTH * 2];
+        int pos = rand() % 64;
+
+        for( int j = 0; j < WIDTH * 2; j++ )
+            line[j] = j & 1 ? 0x040 : 0x200;
+
+        switch( i % 4 )
+        {
+            case 1:
+                pos += write_packet( &line[pos], 0x41, 0x05, 8 );
+                pos += write_packet( &line[pos], 0x61, 0x01, 73 );
+                break;
+            case 2:
+                for( int j = 0; j < WIDTH * 2; j++ )
+                    line[j] = rand() & 3 ? rand() & 0x3ff : 0x3fc | (rand() & 3);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+int main( int argc, char **argv )
+{
+    obe_vanc_dsp_t ref, simd;
+    uint16_t *lines;
+    vanc_pkt_t ref_pkts[MAX_PKTS], simd_pkts[MAX_PKTS];
+    int num_lines = NUM_LINES, total_pkts = 0, ret = 0;
+    int64_t start;
+
+    lines = calloc( NUM_LINES, WIDTH * 2 * sizeof(*lines) );
+    if( !lines )
+    {
+        fprintf( stderr, "Malloc failed\n" );
+        return -1;
+    }
+
+    /* Recorded lines are native endian NV20 words of WIDTH pixels */
+    if( argc > 1 )
+    {
+        FILE *fp = fopen( argv[1], "rb" );
+        if( !fp )
+        {
+            fprintf( stderr, "Could not open %s\n", argv[1] );
+            return -1;
+        }
+        num_lines = fread( lines, WIDTH * 2 * sizeof(*lines), NUM_LINES, fp );
+        fclose( fp );
+    }
+    else
+        synthesise_lines( lines );
+
+    obe_init_vanc_dsp( &ref, 0 );
+    obe_init_vanc_dsp( &simd, av_get_cpu_flags() );
+
+    for( int i = 0; i < num_lines; i++ )
+    {
+        const uint16_t *line = &lines[i * WIDTH * 2];
+        int num_ref = scan_line( &ref, line, WIDTH, ref_pkts );
+        int num_simd = scan_line( &simd, line, WIDTH, simd_pkts );
+
+        if( num_ref != num_simd || memcmp( ref_pkts, simd_pkts, num_ref * sizeof(*ref_pkts) ) )
+        {
+            fprintf( stderr, "Mismatch on line %i\n", i );
+            ret = -1;
+        }
+        total_pkts += num_ref;
+    }
+
+    printf( "%i lines, %i packets\n", num_lines, total_pkts );
+
+    start = get_time_us();
+    for( int j = 0; j < RUNS; j++ )
+        for( int i = 0; i < num_lines; i++ )
+            scan_line( &ref, &lines[i * WIDTH * 2], WIDTH, ref_pkts );
+    printf( "c:    %8.1f ns/line\n", (get_time_us() - start) * 1000.0 / (RUNS * num_lines) );
+
+    start = get_time_us();
+    for( int j = 0; j < RUNS; j++ )
+        for( int i = 0; i < num_lines; i++ )
+            scan_line( &simd, &lines[i * WIDTH * 2], WIDTH, simd_pkts );
+    printf( "simd: %8.1f ns/line (%i words per block)\n", (get_time_us() - start) * 1000.0 / (RUNS * num_lines),
+            simd.block_size );
+
+    free( lines );
+
+    return ret;
+}